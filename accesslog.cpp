@@ -0,0 +1,277 @@
+#include "accesslog.h"
+#include "log.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <chrono>
+
+AccessLog* AccessLog::Instance() {
+    static AccessLog accessLog;
+    return &accessLog;
+}
+
+AccessLog::~AccessLog() {
+    Stop();
+    for(Ring_* ring : rings_) {
+        delete ring;
+    }
+}
+
+bool AccessLog::Start(const Options& options) {
+    if(running_ || options.path.empty()) {
+        return running_;
+    }
+    fd_ = open(options.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd_ < 0) {
+        LOG_ERROR("AccessLog: cannot open %s: %s", options.path.c_str(), strerror(errno));
+        return false;
+    }
+    opt_ = options;
+    opt_.sampleEvery = std::max(opt_.sampleEvery, 1);
+    opt_.flushMs = std::max(opt_.flushMs, 1);
+    size_t size = 64;
+    while(size < opt_.ringSize) { size <<= 1; }
+    opt_.ringSize = size;
+    stampSec_ = -1;     // 格式可能换了
+    stop_ = false;
+    running_ = true;
+    thread_ = std::thread([this]() { Loop_(); });
+    return true;
+}
+
+void AccessLog::Stop() {
+    if(!running_) {
+        return;
+    }
+    running_ = false;
+    {
+        std::lock_guard<std::mutex> locker(waitMtx_);
+        stop_ = true;
+    }
+    cond_.notify_one();
+    thread_.join();
+    close(fd_);
+    fd_ = -1;
+}
+
+uint64_t AccessLog::Dropped() const {
+    std::lock_guard<std::mutex> locker(ringMtx_);
+    uint64_t dropped = 0;
+    for(const Ring_* ring : rings_) {
+        dropped += ring->dropped.load(std::memory_order_relaxed);
+    }
+    return dropped;
+}
+
+// 和Watchdog的槽位一样，线程退出后环留给新线程用，里面没取走的记录照样会被取走
+AccessLog::Ring_* AccessLog::Local_() {
+    static thread_local RingHolder_ holder;
+    if(holder.ring) {
+        return holder.ring;
+    }
+    AccessLog* self = Instance();
+    std::lock_guard<std::mutex> locker(self->ringMtx_);
+    for(Ring_* ring : self->rings_) {
+        bool idle = false;
+        if(ring->inUse.compare_exchange_strong(idle, true, std::memory_order_acquire)) {
+            holder.ring = ring;
+            return ring;
+        }
+    }
+    holder.ring = new Ring_(self->opt_.ringSize);
+    holder.ring->inUse.store(true, std::memory_order_relaxed);
+    self->rings_.push_back(holder.ring);
+    return holder.ring;
+}
+
+static uint8_t CopyField(char* dst, size_t cap, std::string_view src) {
+    size_t len = std::min(src.size(), cap);
+    memcpy(dst, src.data(), len);
+    return static_cast<uint8_t>(len);
+}
+
+void AccessLog::Record(const Entry& entry) {
+    if(!running_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    bool important = entry.code >= 400 || entry.durationNs >= opt_.slowMs * 1000000LL;
+    Ring_* ring = Local_();
+    if(!important && (opt_.slowOrErrorOnly || ring->seen++ % opt_.sampleEvery != 0)) {
+        return;
+    }
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    uint64_t used = head - ring->tail.load(std::memory_order_acquire);
+    if(used > ring->mask) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Record_& rec = ring->records[head & ring->mask];
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    rec.time = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    rec.durationNs = entry.durationNs;
+    rec.bytes = entry.bytes;
+    rec.ip = entry.ip;
+    rec.unixPeer = entry.unixPeer;
+    rec.code = static_cast<int16_t>(entry.code);
+    CopyField(rec.version, sizeof(rec.version) - 1, entry.version);
+    rec.version[std::min(entry.version.size(), sizeof(rec.version) - 1)] = '\0';
+    rec.methodLen = CopyField(rec.method, METHOD_LEN, entry.method);
+    rec.pathLen = CopyField(rec.path, PATH_LEN, entry.path);
+    rec.refererLen = CopyField(rec.referer, REFERER_LEN, entry.referer);
+    rec.agentLen = CopyField(rec.userAgent, AGENT_LEN, entry.userAgent);
+    ring->head.store(head + 1, std::memory_order_release);
+    if(used + 1 == (ring->mask + 1) / 2) {    // 刚好过半时叫醒刷盘线程，不等到下一轮
+        cond_.notify_one();
+    }
+}
+
+void AccessLog::Loop_() {
+    std::string out;
+    for(bool stopping = false; !stopping; ) {
+        {
+            std::unique_lock<std::mutex> locker(waitMtx_);
+            cond_.wait_for(locker, std::chrono::milliseconds(opt_.flushMs));
+            stopping = stop_;
+        }
+        Drain_(out);
+        size_t done = 0;
+        while(done < out.size()) {
+            ssize_t n = ::write(fd_, out.data() + done, out.size() - done);
+            if(n < 0) {
+                if(errno == EINTR) { continue; }
+                LOG_WARN("AccessLog: write failed: %s", strerror(errno));
+                break;
+            }
+            done += n;
+        }
+        out.clear();
+        if(out.capacity() > (1 << 20)) {    // 突发过后别一直占着
+            std::string().swap(out);
+        }
+    }
+}
+
+void AccessLog::Drain_(std::string& out) {
+    std::vector<Ring_*> rings;
+    {
+        std::lock_guard<std::mutex> locker(ringMtx_);
+        rings = rings_;
+    }
+    uint64_t count = 0;
+    for(Ring_* ring : rings) {
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        for(uint64_t i = tail; i != head; i++) {
+            Format_(ring->records[i & ring->mask], out);
+        }
+        count += head - tail;
+        ring->tail.store(head, std::memory_order_release);     // 格式化完才还槽位
+    }
+    written_ += count;
+}
+
+// CLF里的引号串：引号、反斜杠和不可打印的字节写成\xHH
+static void AppendQuoted(std::string& out, const char* data, size_t len) {
+    static const char HEX[] = "0123456789abcdef";
+    for(size_t i = 0; i < len; i++) {
+        unsigned char c = data[i];
+        if(c == '"' || c == '\\' || c < 0x20 || c >= 0x7f) {
+            out += "\\x";
+            out += HEX[c >> 4];
+            out += HEX[c & 0xf];
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+}
+
+// JSON字符串：非ASCII的字节也写成\u00XX，路径里不一定是合法的UTF-8
+static void AppendJson(std::string& out, const char* data, size_t len) {
+    static const char HEX[] = "0123456789abcdef";
+    for(size_t i = 0; i < len; i++) {
+        unsigned char c = data[i];
+        if(c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if(c < 0x20 || c >= 0x7f) {
+            out += "\\u00";
+            out += HEX[c >> 4];
+            out += HEX[c & 0xf];
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+}
+
+void AccessLog::Format_(const Record_& rec, std::string& out) {
+    int64_t sec = rec.time / 1000000000LL;
+    if(sec != stampSec_) {
+        time_t t = static_cast<time_t>(sec);
+        struct tm tm;
+        localtime_r(&t, &tm);
+        strftime(stamp_, sizeof(stamp_), opt_.format == JSON ? "%Y-%m-%dT%H:%M:%S%z" : "%d/%b/%Y:%H:%M:%S %z", &tm);
+        stampSec_ = sec;
+    }
+    char ip[INET_ADDRSTRLEN] = "unix:";    // 和nginx一样
+    if(!rec.unixPeer) {
+        struct in_addr addr;
+        addr.s_addr = rec.ip;
+        inet_ntop(AF_INET, &addr, ip, sizeof(ip));
+    }
+    long long us = rec.durationNs / 1000;
+    char num[96];
+
+    if(opt_.format == JSON) {
+        out += "{\"time\":\"";
+        out += stamp_;
+        out += "\",\"ip\":\"";
+        out += ip;
+        out += "\",\"method\":\"";
+        AppendJson(out, rec.method, rec.methodLen);
+        out += "\",\"path\":\"";
+        AppendJson(out, rec.path, rec.pathLen);
+        out += "\",\"version\":\"HTTP/";
+        out += rec.version;
+        snprintf(num, sizeof(num), "\",\"status\":%d,\"bytes\":%llu,\"duration_us\":%lld,\"referer\":\"",
+                 rec.code, (unsigned long long)rec.bytes, us);
+        out += num;
+        AppendJson(out, rec.referer, rec.refererLen);
+        out += "\",\"user_agent\":\"";
+        AppendJson(out, rec.userAgent, rec.agentLen);
+        out += "\"}\n";
+        return;
+    }
+    out += ip;
+    out += " - - [";
+    out += stamp_;
+    out += "] \"";
+    if(rec.methodLen) {
+        AppendQuoted(out, rec.method, rec.methodLen);
+        out += ' ';
+        AppendQuoted(out, rec.path, rec.pathLen);
+        out += " HTTP/";
+        out += rec.version;
+    } else {
+        out += '-';     // 请求行没解析出来
+    }
+    if(rec.bytes) {
+        snprintf(num, sizeof(num), "\" %d %llu", rec.code, (unsigned long long)rec.bytes);
+    } else {
+        snprintf(num, sizeof(num), "\" %d -", rec.code);
+    }
+    out += num;
+    if(opt_.format == COMBINED) {
+        out += " \"";
+        if(rec.refererLen) { AppendQuoted(out, rec.referer, rec.refererLen); } else { out += '-'; }
+        out += "\" \"";
+        if(rec.agentLen) { AppendQuoted(out, rec.userAgent, rec.agentLen); } else { out += '-'; }
+        out += '"';
+    }
+    snprintf(num, sizeof(num), " %lld\n", us);
+    out += num;
+}
@@ -0,0 +1,127 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <stdint.h>
+#include <netinet/in.h>
+
+/*
+访问日志：请求结束时在当前线程自己的环形缓冲区里写一条定长的二进制记录，不格式化、不加锁、不碰文件；
+刷盘线程定期把各线程攒下的记录取出来，拼成CLF/Combined或者JSON行，一次write写进文件
+正常请求可以按1/N采样，也可以只记慢请求和错误；状态码>=400和慢请求不参与采样，总是记
+环满了丢掉新记录并计数，不让工作线程等刷盘线程
+*/
+class AccessLog {
+public:
+    enum FORMAT {
+        CLF,            // host - - [time] "request" status bytes，后面跟着耗时（微秒）
+        COMBINED,       // CLF再加上"Referer" "User-Agent"，然后是耗时
+        JSON,
+    };
+
+    struct Options {
+        std::string path;               // 为空时不开访问日志
+        FORMAT format = COMBINED;
+        int sampleEvery = 1;            // 正常请求每N个记一个
+        bool slowOrErrorOnly = false;   // 只记状态码>=400或者耗时超过slowMs的
+        int slowMs = 1000;
+        int flushMs = 100;              // 刷盘线程多久取一次，某个线程的环过半时会提前叫醒它
+        size_t ringSize = 1024;         // 每个线程的记录数，取整到2的幂
+    };
+
+    // 一个请求，string_view只在Record返回之前用
+    struct Entry {
+        in_addr_t ip = 0;               // 网络字节序
+        bool unixPeer = false;          // 从UNIX套接字进来的，没有IP，记成unix:
+        std::string_view method;
+        std::string_view path;
+        std::string_view version;       // "1.1"、"2.0"……
+        std::string_view referer;
+        std::string_view userAgent;
+        int code = 0;
+        size_t bytes = 0;               // 写出去的字节数，和飞行记录仪里的一样：HTTP/1含响应头，HTTP/2只算DATA
+        int64_t durationNs = 0;
+    };
+
+    static AccessLog* Instance();
+
+    bool Start(const Options& options);     // 打开文件并启动刷盘线程，打不开时返回false
+    void Stop();                            // 把剩下的记录写完再停
+    bool Enabled() const { return running_.load(std::memory_order_relaxed); }
+
+    void Record(const Entry& entry);        // 工作线程调，没开时直接返回
+
+    uint64_t Written() const { return written_; }
+    uint64_t Dropped() const;
+
+private:
+    static const size_t METHOD_LEN = 8;
+    static const size_t PATH_LEN = 96;
+    static const size_t REFERER_LEN = 64;
+    static const size_t AGENT_LEN = 96;
+
+    // 定长记录，字符串截断存放
+    struct Record_ {
+        int64_t time;           // CLOCK_REALTIME，纳秒
+        int64_t durationNs;
+        uint64_t bytes;
+        in_addr_t ip;
+        int16_t code;
+        uint8_t methodLen, pathLen, refererLen, agentLen;
+        bool unixPeer;
+        char version[4];
+        char method[METHOD_LEN];
+        char path[PATH_LEN];
+        char referer[REFERER_LEN];
+        char userAgent[AGENT_LEN];
+    };
+
+    // 单生产者（所属线程）单消费者（刷盘线程）
+    struct Ring_ {
+        explicit Ring_(size_t size) : records(size), mask(size - 1) {}
+        std::vector<Record_> records;
+        size_t mask;
+        alignas(64) std::atomic<uint64_t> head{0};      // 生产者写
+        uint64_t seen = 0;                              // 生产者自己用：采样计数
+        alignas(64) std::atomic<uint64_t> tail{0};      // 消费者写
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<bool> inUse{false};
+    };
+
+    struct RingHolder_ {
+        Ring_* ring = nullptr;
+        ~RingHolder_() { if(ring) { ring->inUse.store(false, std::memory_order_release); } }
+    };
+
+    AccessLog() = default;
+    ~AccessLog();
+    Ring_* Local_();
+    void Loop_();
+    void Drain_(std::string& out);
+    void Format_(const Record_& rec, std::string& out);
+
+    Options opt_;
+    int fd_ = -1;
+    std::atomic<bool> running_{false};
+    std::atomic<uint64_t> written_{0};
+
+    mutable std::mutex ringMtx_;
+    std::vector<Ring_*> rings_;     // 线程退出后的环留着给新线程用
+
+    std::mutex waitMtx_;
+    std::condition_variable cond_;
+    bool stop_ = false;
+    std::thread thread_;
+
+    // 刷盘线程自己用：同一秒内的时间戳只格式化一次
+    int64_t stampSec_ = -1;
+    char stamp_[48] = {};
+};
+
+#endif //ACCESS_LOG_H
@@ -0,0 +1,71 @@
+#include "arena.h"
+#include <string.h>
+#include <algorithm>
+
+Arena::Arena(size_t blockSize, size_t retainBlocks)
+    : cur_(0), pos_(0), blockSize_(blockSize), retain_(retainBlocks) {
+    assert(blockSize > 0 && retainBlocks > 0);
+}
+
+Arena::~Arena() {
+    for(Block_& block : blocks_) {
+        delete[] block.data;
+    }
+}
+
+char* Arena::Allocate(size_t len) {
+    // 先在已有的块里找，复位后这些块会被依次复用
+    while(cur_ < blocks_.size()) {
+        Block_& block = blocks_[cur_];
+        if(block.size - pos_ >= len) {
+            char* ptr = block.data + pos_;
+            pos_ += len;
+            return ptr;
+        }
+        cur_++;
+        pos_ = 0;
+    }
+    size_t size = std::max(blockSize_, len);
+    blocks_.push_back({new char[size], size});
+    cur_ = blocks_.size() - 1;
+    pos_ = len;
+    return blocks_.back().data;
+}
+
+char* Arena::Dup(const char* data, size_t len) {
+    char* ptr = Allocate(len + 1);
+    if(len) { memcpy(ptr, data, len); }
+    ptr[len] = '\0';
+    return ptr;
+}
+
+std::string_view Arena::Concat(std::string_view a, std::string_view b) {
+    char* ptr = Allocate(a.size() + b.size() + 1);
+    if(!a.empty()) { memcpy(ptr, a.data(), a.size()); }
+    if(!b.empty()) { memcpy(ptr + a.size(), b.data(), b.size()); }
+    ptr[a.size() + b.size()] = '\0';
+    return std::string_view(ptr, a.size() + b.size());
+}
+
+// 游标归零；超过默认大小的块（一般是异常大的请求或者/trace这类大响应留下的）和超出保留数量的块还给系统
+void Arena::Reset() {
+    size_t kept = 0;
+    for(size_t i = 0; i < blocks_.size(); i++) {
+        if(blocks_[i].size > blockSize_ || kept >= retain_) {
+            delete[] blocks_[i].data;
+        } else {
+            blocks_[kept++] = blocks_[i];
+        }
+    }
+    blocks_.resize(kept);
+    cur_ = 0;
+    pos_ = 0;
+}
+
+size_t Arena::Used() const {
+    size_t used = 0;
+    for(size_t i = 0; i < cur_ && i < blocks_.size(); i++) {
+        used += blocks_[i].size;
+    }
+    return used + pos_;
+}
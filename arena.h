@@ -0,0 +1,42 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <string_view>
+#include <vector>
+#include <stddef.h>
+#include <assert.h>
+
+/*
+按请求复位的线性分配器：请求里的字符串（方法、路径、请求头、查询串等）都从这里分配，
+请求结束后Reset一次性回收；块在复位后保留，稳定状态下长连接的每个请求不再调用malloc
+*/
+class Arena {
+public:
+    explicit Arena(size_t blockSize = 4096, size_t retainBlocks = 4);
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    char* Allocate(size_t len);
+    char* Dup(const char* data, size_t len);    // 复制一份并以'\0'结尾
+    std::string_view Copy(std::string_view str) { return std::string_view(Dup(str.data(), str.size()), str.size()); }
+    std::string_view Concat(std::string_view a, std::string_view b);    // 以'\0'结尾
+    void Reset();
+
+    size_t Used() const;
+    size_t BlockCount() const { return blocks_.size(); }
+
+private:
+    struct Block_ {
+        char* data;
+        size_t size;
+    };
+
+    std::vector<Block_> blocks_;
+    size_t cur_;            // 当前分配的块
+    size_t pos_;            // 当前块已用的字节
+    size_t blockSize_;
+    size_t retain_;         // 复位时最多保留的块数
+};
+
+#endif //ARENA_H
@@ -0,0 +1,566 @@
+/*
+端到端压测：在本机回环地址上启动WebServer，用多线程epoll客户端打压，
+结果以JSON输出，方便和上一次的结果对比找回退
+用法：bench [--port=9916] [--threads=2] [--server-threads=4] [--server-max-threads=0] [--coroutines=0] [--conns=64] [--duration=5]
+            [--max-conns=N --max-queued=N --max-db=N --codel-target-us=N]
+            [--scenarios=small_keepalive,small_close,large_keepalive,pipeline,login]
+            [--out=result.json] [--sql-user=root --sql-pwd=root --sql-db=webserver --sql-port=3306]
+            [--trace-sample=0.01 --trace-out=trace.json]
+            [--access-log=clf|combined|json --access-sample=N --access-slow-only=1]
+            [--unix=1] [--accept4=0|1 --nodelay=1 --cork=1 --defer-accept=S --fastopen=N --sndbuf=N --rcvbuf=N]
+            [--slow-verify-ms=N]
+--unix：服务器另外听一个UNIX套接字，压测客户端都从它连进去，和回环TCP比延迟
+--accept4等：服务器的套接字参数（WebServer::SocketOptions），一次改一个，和默认值的结果比；--fastopen时客户端也用TFO连
+--slow-verify-ms：请求头超时设成N毫秒，压完之后再发一个查库要等3N的登录，它应该照样拿到响应，拿不到时退出码为1
+*/
+#include "webserver.h"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <ftw.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+struct Scenario {
+    const char* name;
+    const char* method;
+    const char* path;
+    const char* body;       // POST的表单，GET为nullptr
+    bool keepAlive;
+    int pipeline;           // 每个连接同时在途的请求数
+};
+
+static const Scenario SCENARIOS[] = {
+    { "small_keepalive", "GET", "/small.html", nullptr, true, 1 },
+    { "small_close", "GET", "/small.html", nullptr, false, 1 },
+    { "large_keepalive", "GET", "/large.bin", nullptr, true, 1 },
+    { "large_close", "GET", "/large.bin", nullptr, false, 1 },
+    { "pipeline", "GET", "/small.html", nullptr, true, 8 },
+    { "login", "POST", "/login", "username=bench&password=bench", true, 1 },
+};
+
+struct Options {
+    int port = 9916;
+    int threads = 2;            // 压测线程数
+    int serverThreads = 4;      // 服务器线程池大小
+    int serverMaxThreads = 0;   // 大于serverThreads时线程池自动伸缩
+    bool coroutines = false;    // 服务器用协程处理连接
+    WebServer::OverloadOptions overload;    // 服务器的过载保护参数
+    int conns = 64;             // 总连接数
+    int duration = 5;           // 每个场景的秒数
+    std::string scenarios = "small_keepalive,small_close,large_keepalive,pipeline,login";
+    std::string out;
+    int sqlPort = 3306;
+    std::string sqlUser = "root", sqlPwd = "root", sqlDb = "webserver";
+    double traceSample = 0;     // 服务器端请求跟踪的采样比例
+    std::string traceOut;
+    std::string accessLog;      // 不为空时服务器开访问日志，写在临时目录里，看开着它掉多少吞吐
+    int accessSample = 1;
+    bool accessSlowOnly = false;
+    bool unixSocket = false;
+    WebServer::SocketOptions socket;    // 服务器的套接字参数
+    std::string unixPath;       // main里按临时目录填上
+    int slowVerifyMs = 0;
+};
+
+struct Stats {
+    uint64_t requests = 0;
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+    std::vector<uint32_t> latencyUs;
+};
+
+struct Conn {
+    int fd = -1;
+    std::string out;
+    size_t outPos = 0;
+    std::string in;
+    std::deque<int64_t> starts;     // 已发出还没收到响应的请求的开始时间
+    bool inBody = false;
+    size_t bodyLeft = 0;
+    int status = 0;
+    bool closeAfter = false;
+};
+
+static int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void WriteFile(const std::string& path, size_t size, char fill) {
+    FILE* fp = fopen(path.c_str(), "w");
+    assert(fp);
+    std::string data(size, fill);
+    if(path.size() > 5 && path.compare(path.size() - 5, 5, ".html") == 0) {
+        data = "<html><body>" + std::string(size > 32 ? size - 32 : 0, fill) + "</body></html>\n";
+    }
+    fwrite(data.data(), 1, data.size(), fp);
+    fclose(fp);
+}
+
+// 生成压测用的resources目录，WebServer以当前目录下的resources/作为根目录
+static std::string MakeResources() {
+    char dir[] = "/tmp/tinybench-XXXXXX";
+    if(!mkdtemp(dir)) {
+        perror("mkdtemp");
+        exit(1);
+    }
+    std::string root = std::string(dir) + "/resources/";
+    mkdir(root.c_str(), 0755);
+    WriteFile(root + "index.html", 512, 'i');
+    WriteFile(root + "small.html", 1024, 's');
+    WriteFile(root + "large.bin", 1024 * 1024, 'l');
+    WriteFile(root + "welcome.html", 256, 'w');
+    WriteFile(root + "error.html", 256, 'e');
+    WriteFile(root + "login.html", 256, 'g');
+    WriteFile(root + "400.html", 64, '4');
+    WriteFile(root + "403.html", 64, '3');
+    WriteFile(root + "404.html", 64, '0');
+    if(chdir(dir) != 0) {
+        perror("chdir");
+        exit(1);
+    }
+    return dir;
+}
+
+static int RemoveEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
+
+static std::string BuildRequest(const Scenario& sc) {
+    std::string req = std::string(sc.method) + " " + sc.path + " HTTP/1.1\r\nHost: 127.0.0.1\r\n";
+    req += sc.keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    if(sc.body) {
+        req += "Content-Type: application/x-www-form-urlencoded\r\n";
+        req += "Content-Length: " + std::to_string(strlen(sc.body)) + "\r\n\r\n";
+        req += sc.body;
+    } else {
+        req += "\r\n";
+    }
+    return req;
+}
+
+class LoadWorker {
+public:
+    LoadWorker(const Scenario& sc, int port, const std::string& unixPath, bool fastOpen, int conns)
+        : sc_(sc), port_(port), unixPath_(unixPath), fastOpen_(fastOpen), conns_(conns), request_(BuildRequest(sc)), epfd_(epoll_create1(0)) {
+        assert(epfd_ >= 0);
+    }
+
+    ~LoadWorker() {
+        for(Conn& c : conns_) { Close_(c); }
+        close(epfd_);
+    }
+
+    void Run(int64_t deadline, Stats* stats) {
+        stats_ = stats;
+        for(size_t i = 0; i < conns_.size(); i++) {
+            Open_(i);
+        }
+        epoll_event events[256];
+        while(NowNs() < deadline) {
+            int n = epoll_wait(epfd_, events, 256, 50);
+            for(int i = 0; i < n; i++) {
+                if(events[i].events & EPOLLOUT) { Flush_(events[i].data.u32); }
+                if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) { OnReadable_(events[i].data.u32); }
+            }
+        }
+    }
+
+private:
+    void Open_(size_t idx) {
+        Conn& c = conns_[idx];
+        Close_(c);
+        c = Conn();
+        int fd = socket(unixPath_.empty() ? AF_INET : AF_UNIX, SOCK_STREAM, 0);
+        assert(fd >= 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port_);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(fastOpen_) {     // 请求跟着SYN一起发，拿到过cookie之后省一个来回
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &one, sizeof(one));
+        }
+        sockaddr_un unixAddr = {};
+        unixAddr.sun_family = AF_UNIX;
+        strncpy(unixAddr.sun_path, unixPath_.c_str(), sizeof(unixAddr.sun_path) - 1);
+        int ret = unixPath_.empty() ? connect(fd, (sockaddr*)&addr, sizeof(addr)) :
+                                      connect(fd, (sockaddr*)&unixAddr, sizeof(unixAddr));
+        if(ret < 0) {
+            stats_->errors++;
+            close(fd);
+            return;
+        }
+        if(unixPath_.empty()) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        c.fd = fd;
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u32 = idx;
+        epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev);
+        for(int i = 0; i < sc_.pipeline; i++) {
+            Send_(idx);
+        }
+    }
+
+    void Close_(Conn& c) {
+        if(c.fd >= 0) {
+            epoll_ctl(epfd_, EPOLL_CTL_DEL, c.fd, nullptr);
+            close(c.fd);
+            c.fd = -1;
+        }
+    }
+
+    void Send_(size_t idx) {
+        Conn& c = conns_[idx];
+        c.starts.push_back(NowNs());
+        c.out.append(request_);
+        Flush_(idx);
+    }
+
+    void Flush_(size_t idx) {
+        Conn& c = conns_[idx];
+        while(c.outPos < c.out.size()) {
+            ssize_t n = send(c.fd, c.out.data() + c.outPos, c.out.size() - c.outPos, MSG_NOSIGNAL);
+            if(n < 0) {
+                if(errno == EAGAIN) { break; }
+                return;
+            }
+            c.outPos += n;
+        }
+        epoll_event ev = {};
+        ev.data.u32 = idx;
+        if(c.outPos == c.out.size()) {
+            c.out.clear();
+            c.outPos = 0;
+            ev.events = EPOLLIN;
+        } else {
+            ev.events = EPOLLIN | EPOLLOUT;
+        }
+        epoll_ctl(epfd_, EPOLL_CTL_MOD, c.fd, &ev);
+    }
+
+    void OnReadable_(size_t idx) {
+        Conn& c = conns_[idx];
+        char buf[65536];
+        bool eof = false;
+        while(true) {
+            ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+            if(n > 0) {
+                if(c.inBody && c.in.empty() && static_cast<size_t>(n) <= c.bodyLeft) {
+                    c.bodyLeft -= n;    // 大文件的正文只计数，不拷贝
+                    stats_->bytes += n;
+                    if(c.bodyLeft == 0 && !Complete_(idx)) { return; }
+                    continue;
+                }
+                c.in.append(buf, n);
+                if(!Parse_(idx)) { return; }
+                continue;
+            }
+            if(n == 0) { eof = true; }
+            else if(errno != EAGAIN) { eof = true; }
+            break;
+        }
+        if(eof) {
+            if(!c.starts.empty()) { stats_->errors++; }
+            Open_(idx);
+        }
+    }
+
+    // 解析收到的响应，返回false表示连接已经被替换
+    bool Parse_(size_t idx) {
+        Conn& c = conns_[idx];
+        while(true) {
+            if(!c.inBody) {
+                size_t end = c.in.find("\r\n\r\n");
+                if(end == std::string::npos) { return true; }
+                c.status = c.in.size() > 12 ? atoi(c.in.c_str() + 9) : 0;
+                c.bodyLeft = 0;
+                c.closeAfter = false;
+                size_t pos = 0;
+                while(pos < end) {
+                    size_t eol = c.in.find("\r\n", pos);
+                    const char* line = c.in.c_str() + pos;
+                    if(strncasecmp(line, "Content-length:", 15) == 0) {
+                        c.bodyLeft = strtoull(line + 15, nullptr, 10);
+                    } else if(strncasecmp(line, "Connection: close", 17) == 0) {
+                        c.closeAfter = true;
+                    }
+                    pos = eol + 2;
+                }
+                stats_->bytes += end + 4;
+                c.in.erase(0, end + 4);
+                c.inBody = true;
+            }
+            size_t take = std::min(c.bodyLeft, c.in.size());
+            c.bodyLeft -= take;
+            stats_->bytes += take;
+            c.in.erase(0, take);
+            if(c.bodyLeft > 0) { return true; }
+            if(!Complete_(idx)) { return false; }
+        }
+    }
+
+    // 一个响应收完
+    bool Complete_(size_t idx) {
+        Conn& c = conns_[idx];
+        c.inBody = false;
+        if(!c.starts.empty()) {
+            stats_->latencyUs.push_back((NowNs() - c.starts.front()) / 1000);
+            c.starts.pop_front();
+        }
+        stats_->requests++;
+        if(c.status < 200 || c.status >= 300) { stats_->errors++; }
+        if(c.closeAfter || !sc_.keepAlive) {
+            Open_(idx);
+            return false;
+        }
+        Send_(idx);
+        return true;
+    }
+
+    const Scenario& sc_;
+    int port_;
+    std::string unixPath_;      // 不为空时从UNIX套接字连
+    bool fastOpen_;
+    std::vector<Conn> conns_;
+    std::string request_;
+    int epfd_;
+    Stats* stats_ = nullptr;
+};
+
+static uint32_t Percentile(const std::vector<uint32_t>& sorted, double p) {
+    if(sorted.empty()) { return 0; }
+    size_t idx = std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()));
+    return sorted[idx];
+}
+
+static std::string RunScenario(const Scenario& sc, const Options& opt) {
+    std::vector<Stats> stats(opt.threads);
+    std::vector<std::thread> threads;
+    int64_t start = NowNs();
+    int64_t deadline = start + static_cast<int64_t>(opt.duration) * 1000000000LL;
+    for(int t = 0; t < opt.threads; t++) {
+        int conns = opt.conns / opt.threads + (t < opt.conns % opt.threads ? 1 : 0);
+        threads.emplace_back([&, t, conns]() {
+            LoadWorker worker(sc, opt.port, opt.unixPath, opt.socket.fastOpenQueue > 0, std::max(conns, 1));
+            worker.Run(deadline, &stats[t]);
+        });
+    }
+    for(auto& th : threads) { th.join(); }
+    double secs = (NowNs() - start) / 1e9;
+
+    Stats total;
+    for(Stats& s : stats) {
+        total.requests += s.requests;
+        total.bytes += s.bytes;
+        total.errors += s.errors;
+        total.latencyUs.insert(total.latencyUs.end(), s.latencyUs.begin(), s.latencyUs.end());
+    }
+    std::sort(total.latencyUs.begin(), total.latencyUs.end());
+    char json[1024];
+    snprintf(json, sizeof(json),
+        "{\"name\":\"%s\",\"requests\":%llu,\"errors\":%llu,\"req_per_s\":%.1f,\"mb_per_s\":%.2f,"
+        "\"latency_us\":{\"p50\":%u,\"p90\":%u,\"p99\":%u,\"p999\":%u,\"max\":%u}}",
+        sc.name, (unsigned long long)total.requests, (unsigned long long)total.errors,
+        total.requests / secs, total.bytes / secs / (1024.0 * 1024.0),
+        Percentile(total.latencyUs, 0.50), Percentile(total.latencyUs, 0.90),
+        Percentile(total.latencyUs, 0.99), Percentile(total.latencyUs, 0.999),
+        total.latencyUs.empty() ? 0 : total.latencyUs.back());
+    return json;
+}
+
+static std::string SocketJson(const WebServer::SocketOptions& so) {
+    char json[256];
+    snprintf(json, sizeof(json), ",\"socket\":{\"accept4\":%s,\"nodelay\":%s,\"cork\":%s,\"defer_accept_s\":%d,"
+             "\"fastopen\":%d,\"sndbuf\":%d,\"rcvbuf\":%d}",
+             so.accept4 ? "true" : "false", so.noDelay ? "true" : "false", so.cork ? "true" : "false",
+             so.deferAcceptS, so.fastOpenQueue, so.sndBuf, so.rcvBuf);
+    return json;
+}
+
+// 查库慢的登录不能被请求头的超时关掉：从池里借一个连接锁住user表，登录的查询就会一直等着，
+// 过了好几个请求头超时再解锁，客户端应该照样收到响应。数据库连不上时跳过
+static std::string CheckSlowVerify(const Options& opt, bool* ok) {
+    *ok = true;
+    MYSQL* sql = SqlConnPool::Instance()->GetConn();
+    if(!sql || mysql_query(sql, "LOCK TABLES user WRITE") != 0) {
+        if(sql) { SqlConnPool::Instance()->FreeConn(sql); }
+        return "\"skipped\"";
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(fd >= 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opt.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    timeval wait = { 10, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+    char status[16] = {};
+    if(connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0) {
+        static const Scenario LOGIN = { "slow_verify", "POST", "/login", "username=bench&password=bench", false, 1 };
+        std::string req = BuildRequest(LOGIN);
+        send(fd, req.data(), req.size(), MSG_NOSIGNAL);
+        std::this_thread::sleep_for(std::chrono::milliseconds(opt.slowVerifyMs * 3));
+    }
+    mysql_query(sql, "UNLOCK TABLES");
+    SqlConnPool::Instance()->FreeConn(sql);
+    recv(fd, status, 9, MSG_WAITALL);
+    close(fd);
+    *ok = strncmp(status, "HTTP/1.1 ", 9) == 0;
+    return *ok ? "\"ok\"" : "\"closed\"";
+}
+
+static void ParseArgs(int argc, char** argv, Options* opt) {
+    for(int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* eq = strchr(arg, '=');
+        if(strncmp(arg, "--", 2) != 0 || !eq) {
+            fprintf(stderr, "bad argument: %s\n", arg);
+            exit(1);
+        }
+        std::string key(arg + 2, eq - arg - 2);
+        const char* val = eq + 1;
+        if(key == "port") opt->port = atoi(val);
+        else if(key == "threads") opt->threads = std::max(1, atoi(val));
+        else if(key == "server-threads") opt->serverThreads = std::max(1, atoi(val));
+        else if(key == "server-max-threads") opt->serverMaxThreads = atoi(val);
+        else if(key == "coroutines") opt->coroutines = atoi(val) != 0;
+        else if(key == "max-conns") opt->overload.maxConns = atoi(val);
+        else if(key == "max-queued") opt->overload.maxQueued = atoi(val);
+        else if(key == "max-db") opt->overload.maxDbInFlight = atoi(val);
+        else if(key == "codel-target-us") opt->overload.codelTargetUs = atoi(val);
+        else if(key == "conns") opt->conns = std::max(1, atoi(val));
+        else if(key == "duration") opt->duration = std::max(1, atoi(val));
+        else if(key == "scenarios") opt->scenarios = val;
+        else if(key == "out") opt->out = val;
+        else if(key == "sql-port") opt->sqlPort = atoi(val);
+        else if(key == "sql-user") opt->sqlUser = val;
+        else if(key == "sql-pwd") opt->sqlPwd = val;
+        else if(key == "sql-db") opt->sqlDb = val;
+        else if(key == "trace-sample") opt->traceSample = atof(val);
+        else if(key == "trace-out") opt->traceOut = val;
+        else if(key == "access-log") opt->accessLog = val;
+        else if(key == "access-sample") opt->accessSample = std::max(1, atoi(val));
+        else if(key == "access-slow-only") opt->accessSlowOnly = atoi(val) != 0;
+        else if(key == "unix") opt->unixSocket = atoi(val) != 0;
+        else if(key == "accept4") opt->socket.accept4 = atoi(val) != 0;
+        else if(key == "nodelay") opt->socket.noDelay = atoi(val) != 0;
+        else if(key == "cork") opt->socket.cork = atoi(val) != 0;
+        else if(key == "defer-accept") opt->socket.deferAcceptS = atoi(val);
+        else if(key == "fastopen") opt->socket.fastOpenQueue = atoi(val);
+        else if(key == "sndbuf") opt->socket.sndBuf = atoi(val);
+        else if(key == "rcvbuf") opt->socket.rcvBuf = atoi(val);
+        else if(key == "slow-verify-ms") opt->slowVerifyMs = std::max(0, atoi(val));
+        else {
+            fprintf(stderr, "unknown option: %s\n", arg);
+            exit(1);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    ParseArgs(argc, argv, &opt);
+    // 之后会切换到临时目录，相对路径先按启动时的目录补全
+    char* cwd = getcwd(nullptr, 0);
+    for(std::string* path : { &opt.out, &opt.traceOut }) {
+        if(!path->empty() && (*path)[0] != '/') { *path = std::string(cwd) + "/" + *path; }
+    }
+    free(cwd);
+    std::string dir = MakeResources();
+
+    Tracer::sampleRate = opt.traceSample;
+    WebServer::poolOptions.maxThreads = opt.serverMaxThreads;
+    WebServer::useCoroutines = opt.coroutines;
+    WebServer::overload = opt.overload;
+    WebServer::socketOptions = opt.socket;
+    if(!opt.accessLog.empty()) {
+        WebServer::accessLog.path = dir + "/access.log";
+        WebServer::accessLog.format = opt.accessLog == "json" ? AccessLog::JSON :
+                                      opt.accessLog == "clf" ? AccessLog::CLF : AccessLog::COMBINED;
+        WebServer::accessLog.sampleEvery = opt.accessSample;
+        WebServer::accessLog.slowOrErrorOnly = opt.accessSlowOnly;
+    }
+    if(opt.unixSocket) {
+        opt.unixPath = dir + "/bench.sock";
+        WebServer::unixListen.path = opt.unixPath;
+    }
+    if(opt.slowVerifyMs > 0) {
+        WebServer::timeouts.headerMs = opt.slowVerifyMs;
+    }
+    // 日志关闭，避免压测的是日志系统；数据库连不上时登录请求会走error.html
+    WebServer* server = new WebServer(opt.port, 3, 60000, false,
+        opt.sqlPort, opt.sqlUser.c_str(), opt.sqlPwd.c_str(), opt.sqlDb.c_str(), 4,
+        opt.serverThreads, false, 1, 1024);
+    std::thread serverThread([server]() { server->Start(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    std::string result = "{\"bench\":\"tinywebserver\",\"server_threads\":" + std::to_string(opt.serverThreads) +
+        ",\"server_max_threads\":" + std::to_string(std::max(opt.serverMaxThreads, opt.serverThreads)) +
+        ",\"coroutines\":" + std::string(opt.coroutines ? "true" : "false") +
+        ",\"transport\":\"" + std::string(opt.unixSocket ? "unix" : "tcp") + "\"" + SocketJson(opt.socket) +
+        ",\"client_threads\":" + std::to_string(opt.threads) + ",\"connections\":" + std::to_string(opt.conns) +
+        ",\"duration_s\":" + std::to_string(opt.duration) + ",\"trace_sample\":" + std::to_string(opt.traceSample) +
+        ",\"scenarios\":[";
+    bool first = true;
+    std::string names = opt.scenarios + ",";
+    for(size_t pos = 0, next; (next = names.find(',', pos)) != std::string::npos; pos = next + 1) {
+        std::string name = names.substr(pos, next - pos);
+        const Scenario* sc = nullptr;
+        for(const Scenario& s : SCENARIOS) {
+            if(name == s.name) { sc = &s; }
+        }
+        if(!sc) {
+            if(!name.empty()) { fprintf(stderr, "unknown scenario: %s\n", name.c_str()); }
+            continue;
+        }
+        result += (first ? "" : ",") + RunScenario(*sc, opt);
+        first = false;
+    }
+    result += "]";
+    bool slowVerifyOk = true;
+    if(opt.slowVerifyMs > 0) {
+        result += ",\"slow_verify\":{\"header_ms\":" + std::to_string(opt.slowVerifyMs) +
+            ",\"result\":" + CheckSlowVerify(opt, &slowVerifyOk) + "}";
+    }
+    if(!opt.accessLog.empty()) {
+        result += ",\"access_log\":{\"format\":\"" + opt.accessLog + "\",\"records\":" +
+            std::to_string(AccessLog::Instance()->Written()) + ",\"dropped\":" + std::to_string(AccessLog::Instance()->Dropped()) + "}";
+    }
+    result += "}\n";
+
+    if(opt.out.empty()) {
+        fputs(result.c_str(), stdout);
+    } else {
+        FILE* fp = fopen(opt.out.c_str(), "w");
+        assert(fp);
+        fputs(result.c_str(), fp);
+        fclose(fp);
+    }
+    if(!opt.traceOut.empty() && !Tracer::Instance()->Dump(opt.traceOut.c_str())) {
+        fprintf(stderr, "cannot write trace: %s\n", opt.traceOut.c_str());
+    }
+    // 和线上一样用SIGTERM让服务器排空退出：构造函数里已经把这个信号挡住交给signalfd，由Start()所在的线程处理
+    kill(getpid(), SIGTERM);
+    serverThread.join();
+    delete server;
+    nftw(dir.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+    return slowVerifyOk ? 0 : 1;
+}
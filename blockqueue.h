@@ -4,9 +4,17 @@
 #include <deque>
 #include <condition_variable>
 #include <mutex>
+#include <chrono>
+#include <utility>
 #include <sys/time.h>
 using namespace std;
 
+/*
+有界阻塞队列，一把锁加两个条件变量
+入队可以移动或者原地构造，try_push_back满了直接返回false，不阻塞；
+pop_batch一次加锁取走最多N个，队列里的不超过N个时直接和调用方的deque交换，日志写线程这样一批批地取
+关闭之后入队的直接丢掉；Close()不清空，出队的把关闭前剩下的取完才返回false，带超时的等待也会被Close()叫醒
+*/
 template<typename T>
 class BlockQueue {
 public:
@@ -15,9 +23,19 @@ public:
     bool empty();
     bool full();
     void push_back(const T& item);
+    void push_back(T&& item);
+    template<typename... Args>
+    void emplace_back(Args&&... args);
+    bool try_push_back(T&& item);   // 满了或者关了返回false，item不动
     void push_front(const T& item); 
     bool pop(T& item);  // 弹出的任务放入item
-    bool pop(T& item, int timeout);  // 等待时间
+    bool pop(T& item, int timeout);  // 等待时间，秒
+    template<typename Rep, typename Period>
+    bool pop(T& item, const std::chrono::duration<Rep, Period>& timeout);
+    // 等到有数据，一次取走最多maxItems个追加到out后面（out为空时直接交换），返回取到的个数；关闭且取完了返回0
+    size_t pop_batch(deque<T>& out, size_t maxItems);
+    template<typename Rep, typename Period>
+    size_t pop_batch(deque<T>& out, size_t maxItems, const std::chrono::duration<Rep, Period>& timeout);
     void clear();
     T front();
     T back();
@@ -28,6 +46,10 @@ public:
     void Close();
 
 private:
+    template<typename U>
+    void Push_(U&& item);
+    size_t Take_(deque<T>& out, size_t maxItems);   // 拿着锁调用
+
     deque<T> deq_;                      // 底层数据结构
     mutex mtx_;                         // 锁
     bool isClose_;                      // 关闭标志
@@ -49,10 +71,11 @@ BlockQueue<T>::~BlockQueue() {
 
 template<typename T>
 void BlockQueue<T>::Close() {
-    // lock_guard<mutex> locker(mtx_); // 操控队列之前，都需要上锁
-    // deq_.clear();                   // 清空队列
-    clear();
-    isClose_ = true;
+    // 不清空队列：已经入队的留给消费者取完，日志写线程退出前能把最后几行写掉
+    {
+        lock_guard<mutex> locker(mtx_);     // 标志也要在锁里改，否则消费者可能刚检查完就睡下，错过唤醒
+        isClose_ = true;
+    }
     condConsumer_.notify_all();
     condProducer_.notify_all();
 }
@@ -76,22 +99,66 @@ bool BlockQueue<T>::full() {
 }
 
 template<typename T>
-void BlockQueue<T>::push_back(const T& item) {
+template<typename U>
+void BlockQueue<T>::Push_(U&& item) {
     // 注意，条件变量需要搭配unique_lock
     unique_lock<mutex> locker(mtx_);    
-    while(deq_.size() >= capacity_) {   // 队列满了，需要等待，你拿到锁也改变不了什么，阻塞然后要等到消费者取出一点东西先，然后还锁。
+    while(deq_.size() >= capacity_ && !isClose_) {   // 队列满了，需要等待，你拿到锁也改变不了什么，阻塞然后要等到消费者取出一点东西先，然后还锁。
         condProducer_.wait(locker);     // 暂停生产，等待消费者唤醒生产条件变量
     }
-    deq_.push_back(item);
+    if(isClose_) {
+        return;
+    }
+    deq_.push_back(std::forward<U>(item));
     condConsumer_.notify_one();         // 唤醒消费者//就是有可能消费者之前就在这里阻塞了，那么你就需要在插入东西之后去叫醒之前因为条件变量而阻塞的消费者。
 }
 
+template<typename T>
+void BlockQueue<T>::push_back(const T& item) {
+    Push_(item);
+}
+
+template<typename T>
+void BlockQueue<T>::push_back(T&& item) {
+    Push_(std::move(item));
+}
+
+template<typename T>
+template<typename... Args>
+void BlockQueue<T>::emplace_back(Args&&... args) {
+    unique_lock<mutex> locker(mtx_);
+    while(deq_.size() >= capacity_ && !isClose_) {
+        condProducer_.wait(locker);
+    }
+    if(isClose_) {
+        return;
+    }
+    deq_.emplace_back(std::forward<Args>(args)...);
+    condConsumer_.notify_one();
+}
+
+template<typename T>
+bool BlockQueue<T>::try_push_back(T&& item) {
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(deq_.size() >= capacity_ || isClose_) {
+            return false;
+        }
+        deq_.push_back(std::move(item));
+    }
+    condConsumer_.notify_one();         // 放了锁再叫，醒来的消费者不用马上又睡在锁上
+    return true;
+}
+
 template<typename T>
 void BlockQueue<T>::push_front(const T& item) {
     unique_lock<mutex> locker(mtx_);
-    while(deq_.size() >= capacity_) {   // 队列满了，需要等待
+    while(deq_.size() >= capacity_ && !isClose_) {   // 队列满了，需要等待
         condProducer_.wait(locker);     // 暂停生产，等待消费者唤醒生产条件变量，如果阻塞了，下次被唤醒也是在这里被唤醒。
     }
+    if(isClose_) {
+        return;
+    }
     deq_.push_front(item);
     condConsumer_.notify_one();         // 唤醒消费者
 }
@@ -100,9 +167,12 @@ template<typename T>
 bool BlockQueue<T>::pop(T& item) {
     unique_lock<mutex> locker(mtx_);
     while(deq_.empty()) {
+        if(isClose_) {
+            return false;               // 关闭之后不再等，日志的写线程才能退出
+        }
         condConsumer_.wait(locker);     // 队列空了，需要等待
     }
-    item = deq_.front();
+    item = std::move(deq_.front());
     deq_.pop_front();
     condProducer_.notify_one();         // 唤醒生产者
     return true;
@@ -110,21 +180,56 @@ bool BlockQueue<T>::pop(T& item) {
 
 template<typename T>
 bool BlockQueue<T>::pop(T &item, int timeout) {
-    unique_lock<std::mutex> locker(mtx_);
-    while(deq_.empty()){
-        if(condConsumer_.wait_for(locker, std::chrono::seconds(timeout)) //这是在阻塞，就是在清空的时候，如果已经为空，那么久阻塞一段时间，一段时间后如果还是空就返回
-                == std::cv_status::timeout){
-            return false;
-        }
-        if(isClose_){
-            return false;
-        }
+    return pop(item, std::chrono::seconds(timeout));
+}
+
+// 按截止时间等，中途被无关的唤醒也不会把等待时间重新算一遍；关闭了就不再等
+template<typename T>
+template<typename Rep, typename Period>
+bool BlockQueue<T>::pop(T& item, const std::chrono::duration<Rep, Period>& timeout) {
+    unique_lock<mutex> locker(mtx_);
+    if(!condConsumer_.wait_for(locker, timeout, [this]() { return !deq_.empty() || isClose_; }) || deq_.empty()) {
+        return false;
     }
-    item = deq_.front();//你pop还要传item的意义是啥？
-    deq_.pop_front();//从前面将对应的值给pop了
-    condProducer_.notify_one();//pop了要看看有没有因条件变量阻塞的生产者，唤醒
+    item = std::move(deq_.front());
+    deq_.pop_front();
+    condProducer_.notify_one();
     return true;
 }
+
+template<typename T>
+size_t BlockQueue<T>::Take_(deque<T>& out, size_t maxItems) {
+    size_t n = 0;
+    if(out.empty() && deq_.size() <= maxItems) {
+        out.swap(deq_);     // 不搬元素，只换两个deque的内部指针
+        n = out.size();
+    } else {
+        for(; n < maxItems && !deq_.empty(); n++) {
+            out.push_back(std::move(deq_.front()));
+            deq_.pop_front();
+        }
+    }
+    if(n > 0) {
+        condProducer_.notify_all();     // 一次空出好几个位置
+    }
+    return n;
+}
+
+template<typename T>
+size_t BlockQueue<T>::pop_batch(deque<T>& out, size_t maxItems) {
+    unique_lock<mutex> locker(mtx_);
+    condConsumer_.wait(locker, [this]() { return !deq_.empty() || isClose_; });
+    return Take_(out, maxItems);
+}
+
+template<typename T>
+template<typename Rep, typename Period>
+size_t BlockQueue<T>::pop_batch(deque<T>& out, size_t maxItems, const std::chrono::duration<Rep, Period>& timeout) {
+    unique_lock<mutex> locker(mtx_);
+    condConsumer_.wait_for(locker, timeout, [this]() { return !deq_.empty() || isClose_; });
+    return Take_(out, maxItems);
+}
+
 //感觉读和写都需要分别建立一个线程来实现。
 template<typename T>
 T BlockQueue<T>::front() {
@@ -150,9 +255,9 @@ size_t BlockQueue<T>::size() {
     return deq_.size();
 }
 
-// 唤醒消费者
+// 唤醒所有消费者
 template<typename T>
 void BlockQueue<T>::flush() {
-    condConsumer_.notify_one();//更新一下看看有没有新东西？
+    condConsumer_.notify_all();//更新一下看看有没有新东西？
 }
 # endif
@@ -0,0 +1,86 @@
+#include "bodysink.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "log.h"
+
+const char* BodySink::tmpDir = "/tmp";
+
+BodySink::BodySink() {
+    fd_ = -1;
+    size_ = 0;
+    threshold_ = 0;
+}
+
+BodySink::~BodySink() {
+    Reset();
+}
+
+void BodySink::Init(size_t spillThreshold) {
+    Reset();
+    threshold_ = spillThreshold;
+}
+
+void BodySink::Reset() {
+    if(fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    // 内存部分超过阈值说明曾经被撑大过，释放掉，保证空闲连接占用的内存有上限
+    if(mem_.capacity() > threshold_) {
+        std::string().swap(mem_);
+    } else {
+        mem_.clear();
+    }
+    size_ = 0;
+}
+
+bool BodySink::Append(const char* data, size_t len) {
+    assert(data || len == 0);
+    if(fd_ < 0 && threshold_ > 0 && size_ + len > threshold_) {
+        if(!Spill_()) { return false; }
+    }
+    if(fd_ >= 0) {
+        if(!WriteAll_(data, len)) { return false; }
+    } else {
+        mem_.append(data, len);
+    }
+    size_ += len;
+    return true;
+}
+
+// 把已经收到的内容转存到一个匿名临时文件，之后的内容都直接写文件
+bool BodySink::Spill_() {
+    int fd = -1;
+#ifdef O_TMPFILE
+    fd = open(tmpDir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+#endif
+    if(fd < 0) {    // 文件系统不支持O_TMPFILE，退回到mkstemp + unlink
+        char name[256] = {0};
+        snprintf(name, sizeof(name) - 1, "%s/body-XXXXXX", tmpDir);
+        fd = mkstemp(name);
+        if(fd >= 0) { unlink(name); }
+    }
+    if(fd < 0) {
+        LOG_ERROR("Body spill open error: %d", errno);
+        return false;
+    }
+    fd_ = fd;
+    if(!WriteAll_(mem_.data(), mem_.size())) { return false; }
+    std::string().swap(mem_);
+    LOG_DEBUG("Body spilled to disk, size:%d", (int)size_);
+    return true;
+}
+
+bool BodySink::WriteAll_(const char* data, size_t len) {
+    while(len > 0) {
+        ssize_t n = ::write(fd_, data, len);
+        if(n < 0) {
+            if(errno == EINTR) { continue; }
+            LOG_ERROR("Body spill write error: %d", errno);
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
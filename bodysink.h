@@ -0,0 +1,41 @@
+#ifndef BODY_SINK_H
+#define BODY_SINK_H
+
+#include <string>
+#include <fcntl.h>       // open
+#include <unistd.h>      // write, close
+#include <errno.h>
+#include <assert.h>
+
+/*
+请求体的接收器：小的请求体放在内存里，超过阈值后整体转存到临时文件，
+这样大上传不会把连接的内存撑大
+*/
+class BodySink {
+public:
+    BodySink();
+    ~BodySink();
+
+    void Init(size_t spillThreshold);
+    bool Append(const char* data, size_t len);  // 写临时文件失败时返回false
+    void Reset();
+
+    size_t Size() const { return size_; }
+    bool IsSpilled() const { return fd_ >= 0; }
+    int Fd() const { return fd_; }              // 落盘后的临时文件，文件偏移在末尾
+    std::string& Memory() { return mem_; }      // 未落盘时的内容
+    const std::string& Memory() const { return mem_; }
+
+    static const char* tmpDir;  // 临时文件目录
+
+private:
+    bool Spill_();
+    bool WriteAll_(const char* data, size_t len);
+
+    std::string mem_;
+    int fd_;
+    size_t size_;
+    size_t threshold_;
+};
+
+#endif //BODY_SINK_H
@@ -82,16 +82,17 @@ void Buffer::Append(const char* str, size_t len) {
     HasWritten(len);    // 移动写下标
 }
 
-void Buffer::Append(const std::string& str) {//除了传入字符数组也可以传字符串
-    Append(str.c_str(), str.size());
+void Buffer::Append(std::string_view str) {//除了传入字符数组也可以传字符串
+    if(str.empty()) { return; }
+    Append(str.data(), str.size());
 }
 
-void Append(const void* data, size_t len) {
+void Buffer::Append(const void* data, size_t len) {
     Append(static_cast<const char*>(data), len);
 }
 
 // 将buffer中的读下标的地方放到该buffer中的写下标位置
-void Append(const Buffer& buff) {
+void Buffer::Append(const Buffer& buff) {
     Append(buff.Peek(), buff.ReadableBytes());
 }
 
@@ -6,6 +6,8 @@
 #include <unistd.h>  // write
 #include <sys/uio.h> //readv
 #include <vector> //readv
+#include <string>
+#include <string_view>
 #include <atomic>
 #include <assert.h>
 class Buffer {
@@ -30,7 +32,7 @@ public:
     const char* BeginWriteConst() const;
     char* BeginWrite();
 
-    void Append(const std::string& str);
+    void Append(std::string_view str);
     void Append(const char* str, size_t len);
     void Append(const void* data, size_t len);
     void Append(const Buffer& buff);
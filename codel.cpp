@@ -0,0 +1,43 @@
+#include "codel.h"
+#include <math.h>
+#include <assert.h>
+
+CoDel::CoDel(int64_t targetNs, int64_t intervalNs)
+    : target_(targetNs), interval_(intervalNs), firstAbove_(0), dropNext_(0), count_(0), dropping_(false) {
+    assert(targetNs > 0 && intervalNs > 0);
+}
+
+// 和RFC 8289的dodequeue/控制律一致，只是丢弃由调用方去做
+bool CoDel::ShouldDrop(int64_t sojournNs, int64_t nowNs) {
+    std::lock_guard<std::mutex> locker(mtx_);
+    if(sojournNs < target_) {
+        firstAbove_ = 0;
+        dropping_ = false;
+        return false;
+    }
+    if(firstAbove_ == 0) {
+        firstAbove_ = nowNs + interval_;
+        return false;
+    }
+    if(!dropping_) {
+        if(nowNs < firstAbove_) {
+            return false;
+        }
+        dropping_ = true;
+        // 刚退出过载不久又进来，从上一轮的丢弃速度接着丢
+        count_ = (count_ > 2 && nowNs - dropNext_ < 16 * interval_) ? count_ - 2 : 1;
+        dropNext_ = nowNs + static_cast<int64_t>(interval_ / sqrt(count_));
+        return true;
+    }
+    if(nowNs >= dropNext_) {
+        count_++;
+        dropNext_ += static_cast<int64_t>(interval_ / sqrt(count_));
+        return true;
+    }
+    return false;
+}
+
+bool CoDel::Dropping() {
+    std::lock_guard<std::mutex> locker(mtx_);
+    return dropping_;
+}
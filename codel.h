@@ -0,0 +1,31 @@
+#ifndef CODEL_H
+#define CODEL_H
+
+#include <mutex>
+#include <stdint.h>
+
+/*
+CoDel（Controlled Delay）按排队延迟丢请求：
+任务出队时报告自己等了多久，延迟连续interval都高于target才算过载，开始丢；
+过载期间第n次丢弃之后隔interval/sqrt(n)再丢下一个，延迟一直降不下来就丢得越来越密，
+延迟回到target以下立刻停。只看延迟不看队列长度，短时间的突发排一会儿队不会被误丢
+*/
+class CoDel {
+public:
+    CoDel(int64_t targetNs, int64_t intervalNs);
+
+    bool ShouldDrop(int64_t sojournNs, int64_t nowNs);     // 多个工作线程可以同时调用
+    bool Dropping();
+
+private:
+    const int64_t target_;
+    const int64_t interval_;
+
+    std::mutex mtx_;
+    int64_t firstAbove_;    // 延迟第一次超过target的时刻加上interval，0表示现在没超
+    int64_t dropNext_;      // 过载期间下一次丢弃的时刻
+    uint32_t count_;        // 这一轮过载里丢了几个
+    bool dropping_;
+};
+
+#endif //CODEL_H
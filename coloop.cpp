@@ -0,0 +1,112 @@
+#include "coloop.h"
+#include <new>
+
+static const size_t FRAME_ALIGN = 64;
+static const size_t FRAME_CLASSES = FramePool::MAX_POOLED / FRAME_ALIGN;
+
+struct FreeFrame_ {
+    FreeFrame_* next;
+};
+
+// 线程退出时把缓存的帧还给系统
+struct FrameCache_ {
+    FreeFrame_* heads[FRAME_CLASSES] = { nullptr };
+    size_t counts[FRAME_CLASSES] = { 0 };
+    ~FrameCache_() {
+        for(size_t i = 0; i < FRAME_CLASSES; i++) {
+            while(heads[i]) {
+                FreeFrame_* frame = heads[i];
+                heads[i] = frame->next;
+                ::operator delete(frame);
+            }
+        }
+    }
+};
+
+static thread_local FrameCache_ frameCache;
+
+void* FramePool::Alloc(size_t size) {
+    if(size == 0 || size > MAX_POOLED) {
+        return ::operator new(size);
+    }
+    size_t cls = (size - 1) / FRAME_ALIGN;
+    FreeFrame_*& head = frameCache.heads[cls];
+    if(head) {
+        FreeFrame_* frame = head;
+        head = frame->next;
+        frameCache.counts[cls]--;
+        return frame;
+    }
+    return ::operator new((cls + 1) * FRAME_ALIGN);
+}
+
+void FramePool::Free(void* ptr, size_t size) {
+    if(size == 0 || size > MAX_POOLED) {
+        ::operator delete(ptr);
+        return;
+    }
+    size_t cls = (size - 1) / FRAME_ALIGN;
+    if(frameCache.counts[cls] >= MAX_FREE) {
+        ::operator delete(ptr);
+        return;
+    }
+    FreeFrame_* frame = static_cast<FreeFrame_*>(ptr);
+    frame->next = frameCache.heads[cls];
+    frameCache.heads[cls] = frame;
+    frameCache.counts[cls]++;
+}
+
+CoLoop::CoLoop(Epoller* epoller, ThreadPool* pool, int maxFd)
+    : epoller_(epoller), pool_(pool), maxFd_(maxFd), waiters_(new Waiter_[maxFd]) {
+    assert(epoller && pool && maxFd > 0);
+}
+
+void CoLoop::Spawn(int fd, CoTask task, int cls) {
+    assert(fd >= 0 && fd < maxFd_);
+    Waiter_& waiter = waiters_[fd];
+    waiter.handle.store(nullptr, std::memory_order_relaxed);
+    waiter.cancelled.store(false, std::memory_order_relaxed);
+    std::coroutine_handle<> handle = task.Release();
+    pool_->AddTask([handle] { handle.resume(); }, cls);
+}
+
+// 返回true表示协程挂起，false表示不挂起直接返回（已经取消了）
+bool CoLoop::Park_(int fd, std::coroutine_handle<> handle, uint32_t events) {
+    Waiter_& waiter = waiters_[fd];
+    waiter.handle.store(handle.address());
+    // 先放句柄再看取消标志，和Cancel的顺序相反，两边至少有一边能看到对方
+    if(waiter.cancelled.load() || !epoller_->ModFd(fd, events)) {
+        if(waiter.handle.exchange(nullptr)) {
+            waiter.ok = false;
+            return false;
+        }
+        return true;    // 主线程已经取走句柄，会由它恢复
+    }
+    return true;
+}
+
+void CoLoop::Resume_(Waiter_& waiter, void* handle, bool ok, int cls) {
+    waiter.ok = ok;     // 投递任务时要拿线程池的锁，恢复的线程一定能看到
+    pool_->AddTask([handle] { std::coroutine_handle<>::from_address(handle).resume(); }, cls);
+}
+
+bool CoLoop::Dispatch(int fd, int cls) {
+    assert(fd >= 0 && fd < maxFd_);
+    Waiter_& waiter = waiters_[fd];
+    void* handle = waiter.handle.exchange(nullptr);
+    if(!handle) {
+        return false;
+    }
+    Resume_(waiter, handle, true, cls);
+    return true;
+}
+
+void CoLoop::Cancel(int fd, int cls) {
+    assert(fd >= 0 && fd < maxFd_);
+    Waiter_& waiter = waiters_[fd];
+    waiter.cancelled.store(true);
+    void* handle = waiter.handle.exchange(nullptr);
+    if(handle) {
+        Resume_(waiter, handle, false, cls);
+    }
+}
@@ -0,0 +1,126 @@
+#ifndef COLOOP_H
+#define COLOOP_H
+
+#include <coroutine>
+#include <atomic>
+#include <memory>
+#include <exception>
+#include <stdint.h>
+#include "epoller.h"
+#include "threadpool.h"
+
+/*
+协程层：一个连接的处理流程写成一个协程，
+co_await loop->Wait(fd, events) 挂起直到fd就绪，被超时或对端关闭取消时返回false；
+co_await CoSwitch(pool, cls) 换到另一个线程池接着执行（例如查库）
+epoll仍然只在主线程里等，主线程拿到事件后把挂起的协程投给线程池恢复；
+协程帧从FramePool分配，投给线程池的只是一个句柄，放得进std::function的内部缓冲区，恢复一次不分配内存
+*/
+
+// 协程帧的内存池：按64字节向上取整分档，每个线程一份空闲链表，不加锁
+// 协程可能在别的线程上结束，帧就归还到那个线程的链表里
+class FramePool {
+public:
+    static void* Alloc(size_t size);
+    static void Free(void* ptr, size_t size);
+
+    static const size_t MAX_POOLED = 4096;  // 更大的帧直接用operator new
+    static const size_t MAX_FREE = 256;     // 每档每个线程最多留这么多空闲帧
+};
+
+// 不需要结果的顶层协程：创建后先挂起，由Start()或CoLoop::Spawn开始执行，执行完自己释放帧
+class CoTask {
+public:
+    struct promise_type {
+        CoTask get_return_object() { return CoTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+        static void* operator new(size_t size) { return FramePool::Alloc(size); }
+        static void operator delete(void* ptr, size_t size) { FramePool::Free(ptr, size); }
+    };
+
+    CoTask(CoTask&& other) noexcept : handle_(other.handle_) { other.handle_ = nullptr; }
+    CoTask(const CoTask&) = delete;
+    ~CoTask() { if(handle_) { handle_.destroy(); } }  // 没有开始执行就被丢掉的协程
+
+    std::coroutine_handle<> Release() {
+        std::coroutine_handle<> handle = handle_;
+        handle_ = nullptr;
+        return handle;
+    }
+    void Start() { Release().resume(); }    // 在当前线程上执行到第一个挂起点
+
+private:
+    explicit CoTask(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+    std::coroutine_handle<promise_type> handle_;
+};
+
+// 换到pool里接着执行
+class CoSwitch {
+public:
+    explicit CoSwitch(ThreadPool* pool, int cls = 0) : pool_(pool), cls_(cls) { assert(pool); }
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) const {
+        pool_->AddTask([handle] { handle.resume(); }, cls_);    // 投出去之后协程可能已经在别的线程上跑了，不能再碰帧
+    }
+    void await_resume() const noexcept {}
+
+private:
+    ThreadPool* pool_;
+    int cls_;
+};
+
+/*
+每个fd一个等待槽，协程挂起时把句柄放进去再用EPOLLONESHOT打开事件；
+主线程收到事件（Dispatch）或者要取消（Cancel）时从槽里取走句柄投给线程池，谁取到谁负责恢复，
+所以事件、取消和协程自己撤回三方同时发生时协程也只会被恢复一次
+取消是粘滞的：协程正在运行时被取消，下一次Wait直接返回false，直到这个fd上Spawn新的协程
+*/
+class CoLoop {
+public:
+    class Awaiter {
+    public:
+        Awaiter(CoLoop* loop, int fd, uint32_t events) : loop_(loop), fd_(fd), events_(events) {}
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> handle) { return loop_->Park_(fd_, handle, events_); }
+        bool await_resume() const { return loop_->waiters_[fd_].ok; }
+
+    private:
+        CoLoop* loop_;
+        int fd_;
+        uint32_t events_;
+    };
+
+    CoLoop(Epoller* epoller, ThreadPool* pool, int maxFd = 65536);
+
+    // 在工作线程里调用：events是完整的epoll事件（含EPOLLONESHOT），fd必须已经加进epoller
+    Awaiter Wait(int fd, uint32_t events) {
+        assert(fd >= 0 && fd < maxFd_);
+        return Awaiter(this, fd, events);
+    }
+
+    // 下面三个只在主线程调用，cls是恢复时用的线程池任务类别
+    void Spawn(int fd, CoTask task, int cls = 0);   // 清掉fd上次的取消标志，投给线程池开始执行
+    bool Dispatch(int fd, int cls = 0);             // fd就绪；没有协程在等返回false
+    void Cancel(int fd, int cls = 0);
+
+private:
+    struct Waiter_ {
+        std::atomic<void*> handle{nullptr};     // 挂起的协程，没有为nullptr
+        std::atomic<bool> cancelled{false};
+        bool ok = false;                        // 恢复时Wait的返回值，由取到句柄的一方写
+    };
+
+    bool Park_(int fd, std::coroutine_handle<> handle, uint32_t events);
+    void Resume_(Waiter_& waiter, void* handle, bool ok, int cls);
+
+    Epoller* epoller_;
+    ThreadPool* pool_;
+    int maxFd_;
+    std::unique_ptr<Waiter_[]> waiters_;
+};
+
+#endif //COLOOP_H
@@ -10,12 +10,11 @@ void HeapTimer::SwapNode_(size_t i, size_t j) {
 
 void HeapTimer::siftup_(size_t i) {//插入了一个时间定时器之后就会将其往上浮，直至整个定时器类仍然满足小堆顶性质
     assert(i >= 0 && i < heap_.size());
-    size_t parent = (i-1) / 2;
-    while(parent >= 0) {
+    while(i > 0) {      // 下标是无符号数，到堆顶就要停下，不能再算(0-1)/2
+        size_t parent = (i-1) / 2;
         if(heap_[parent] > heap_[i]) {
             SwapNode_(i, parent);
             i = parent;
-            parent = (i-1)/2;
         } else {
             break;
         }
@@ -63,8 +62,11 @@ void HeapTimer::del_(size_t index) {
 // 调整指定id的结点
 void HeapTimer::adjust(int id, int newExpires) {//这里是想要基于事件id找到他们再堆顶的位置，然后对定时器进行一定的修改。
     assert(!heap_.empty() && ref_.count(id));
-    heap_[ref_[id]].expires = Clock::now() + MS(newExpires);
-    siftdown_(ref_[id], heap_.size());
+    size_t i = ref_[id];
+    heap_[i].expires = Clock::now() + MS(newExpires);
+    if(!siftdown_(i, heap_.size())) {
+        siftup_(i);
+    }
 }
 
 void HeapTimer::add(int id, int timeOut, const TimeoutCallBack& cb) {
@@ -103,12 +105,13 @@ void HeapTimer::tick() {
         return;
     }
     while(!heap_.empty()) {
-        TimerNode node = heap_.front();
-        if(std::chrono::duration_cast<MS>(node.expires - Clock::now()).count() > 0) { 
+        if(std::chrono::duration_cast<MS>(heap_.front().expires - Clock::now()).count() > 0) { 
             break; 
         }
-        node.cb();
+        // 先出堆再回调，回调里可以用同一个id重新add（截止时间被推后了的连接就是这样重新挂回去的）
+        TimerNode node = std::move(heap_.front());
         pop();
+        node.cb();
     }
 }
 
@@ -10,6 +10,7 @@
 #include <assert.h> 
 #include <chrono>
 #include "log.h"
+#include "metrics.h"
 
 typedef std::function<void()> TimeoutCallBack;
 typedef std::chrono::high_resolution_clock Clock;
@@ -32,8 +33,9 @@ public:
     HeapTimer() { heap_.reserve(64); }  // 保留（扩充）容量
     ~HeapTimer() { clear(); }
     
-    void adjust(int id, int newExpires);
+    void adjust(int id, int newExpires);    // 可以推后也可以提前
     void add(int id, int timeOut, const TimeoutCallBack& cb);
+    bool contains(int id) const { return ref_.count(id) > 0; }
     void doWork(int id);
     void clear();
     void tick();
@@ -0,0 +1,426 @@
+#include "hpack.h"
+#include <assert.h>
+#include <algorithm>
+
+static const struct { const char* name; const char* value; } STATIC_TABLE[HpackTable::STATIC_COUNT] = {
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" },
+};
+
+static const struct { uint32_t code; uint8_t bits; } HUFFMAN_CODES[257] = {
+    { 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 },
+    { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+    { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+    { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+    { 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 },
+    { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+    { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+    { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+    { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+    { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+    { 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 },
+    { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+    { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 },
+    { 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+    { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+    { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+    { 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 },
+    { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+    { 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 },
+    { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+    { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+    { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+    { 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 },
+    { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+    { 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 },
+    { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+    { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+    { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+    { 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 },
+    { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+    { 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 },
+    { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+    { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+    { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+    { 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 },
+    { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+    { 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 },
+    { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+    { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+    { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+    { 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 },
+    { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+    { 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 },
+    { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+    { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+    { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+    { 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 },
+    { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+    { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 },
+    { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+    { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+    { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+    { 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 },
+    { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+    { 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 },
+    { 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+    { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+    { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+    { 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 },
+    { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+    { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 },
+    { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+    { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+    { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+    { 0x3fffffff, 30 },     // EOS
+};
+
+static const size_t ENTRY_OVERHEAD = 32;
+static const uint64_t MAX_INT = 1ULL << 32;     // 整数编码最多接受到这么大，再大就当作攻击
+
+HpackTable::HpackTable(size_t maxSize) : size_(0), maxSize_(maxSize) {}
+
+void HpackTable::Evict_(size_t size) {
+    while(!entries_.empty() && size_ + size > maxSize_) {
+        size_ -= entries_.back().first.size() + entries_.back().second.size() + ENTRY_OVERHEAD;
+        entries_.pop_back();
+    }
+}
+
+void HpackTable::SetMaxSize(size_t size) {
+    maxSize_ = size;
+    Evict_(0);
+}
+
+void HpackTable::Add(std::string_view name, std::string_view value) {
+    size_t size = name.size() + value.size() + ENTRY_OVERHEAD;
+    Evict_(size);
+    if(size > maxSize_) {   // 比整张表还大，按规定效果是清空表
+        return;
+    }
+    entries_.emplace_front(std::string(name), std::string(value));
+    size_ += size;
+}
+
+bool HpackTable::Get(uint64_t index, std::string_view* name, std::string_view* value) const {
+    if(index == 0) {
+        return false;
+    }
+    if(index <= STATIC_COUNT) {
+        *name = STATIC_TABLE[index - 1].name;
+        *value = STATIC_TABLE[index - 1].value;
+        return true;
+    }
+    index -= STATIC_COUNT + 1;
+    if(index >= entries_.size()) {
+        return false;
+    }
+    *name = entries_[index].first;
+    *value = entries_[index].second;
+    return true;
+}
+
+uint64_t HpackTable::Find(std::string_view name, std::string_view value, bool* exact) const {
+    uint64_t nameIndex = 0;
+    *exact = false;
+    for(size_t i = 0; i < STATIC_COUNT; i++) {
+        if(name == STATIC_TABLE[i].name) {
+            if(value == STATIC_TABLE[i].value) {
+                *exact = true;
+                return i + 1;
+            }
+            if(!nameIndex) { nameIndex = i + 1; }
+        }
+    }
+    for(size_t i = 0; i < entries_.size(); i++) {
+        if(name == entries_[i].first) {
+            if(value == entries_[i].second) {
+                *exact = true;
+                return STATIC_COUNT + 1 + i;
+            }
+            if(!nameIndex) { nameIndex = STATIC_COUNT + 1 + i; }
+        }
+    }
+    return nameIndex;
+}
+
+// Huffman解码树，第一次用时建好；叶子的sym是字节值，256是EOS
+namespace {
+struct HuffmanTree {
+    int16_t child[513][2];
+    int16_t sym[513];
+    int count;
+
+    HuffmanTree() : count(1) {
+        for(int i = 0; i < 513; i++) { child[i][0] = child[i][1] = -1; sym[i] = -1; }
+        for(int s = 0; s < 257; s++) {
+            int node = 0;
+            for(int b = HUFFMAN_CODES[s].bits - 1; b >= 0; b--) {
+                int bit = (HUFFMAN_CODES[s].code >> b) & 1;
+                if(child[node][bit] < 0) { child[node][bit] = count++; }
+                node = child[node][bit];
+            }
+            sym[node] = s;
+        }
+        assert(count == 513);
+    }
+};
+}
+
+bool Huffman::Decode(const uint8_t* data, size_t len, std::string* out) {
+    static const HuffmanTree tree;
+    int node = 0;
+    int depth = 0;          // 从上一个符号结束到现在走了几位
+    bool allOnes = true;    // 这几位是不是全是1，结尾的填充必须是EOS的前缀
+    for(size_t i = 0; i < len; i++) {
+        for(int b = 7; b >= 0; b--) {
+            int bit = (data[i] >> b) & 1;
+            node = tree.child[node][bit];
+            depth++;
+            allOnes = allOnes && bit;
+            if(tree.sym[node] >= 0) {
+                if(tree.sym[node] == 256) {
+                    return false;
+                }
+                out->push_back(static_cast<char>(tree.sym[node]));
+                node = 0;
+                depth = 0;
+                allOnes = true;
+            }
+        }
+    }
+    return depth < 8 && allOnes;
+}
+
+size_t Huffman::EncodedLen(std::string_view str) {
+    size_t bits = 0;
+    for(unsigned char ch : str) { bits += HUFFMAN_CODES[ch].bits; }
+    return (bits + 7) / 8;
+}
+
+void Huffman::Encode(std::string_view str, std::string* out) {
+    uint64_t acc = 0;
+    int bits = 0;
+    for(unsigned char ch : str) {
+        acc = (acc << HUFFMAN_CODES[ch].bits) | HUFFMAN_CODES[ch].code;
+        bits += HUFFMAN_CODES[ch].bits;
+        while(bits >= 8) {
+            bits -= 8;
+            out->push_back(static_cast<char>(acc >> bits));
+        }
+    }
+    if(bits > 0) {  // 不足一个字节的部分用EOS的高位（全1）补齐
+        out->push_back(static_cast<char>((acc << (8 - bits)) | (0xff >> bits)));
+    }
+}
+
+// 前缀整数：prefix位放得下就直接放，放不下先填满，剩下的每7位一个字节，最高位表示后面还有
+static bool ReadInt(const uint8_t** p, const uint8_t* end, int prefix, uint64_t* value) {
+    if(*p >= end) { return false; }
+    uint64_t max = (1u << prefix) - 1;
+    uint64_t v = **p & max;
+    (*p)++;
+    if(v < max) {
+        *value = v;
+        return true;
+    }
+    for(int shift = 0; *p < end; shift += 7) {
+        if(shift > 28) { return false; }    // 0x80续字节不增大v，光看v挡不住，移位超过64位就是未定义行为
+        uint8_t byte = **p;
+        (*p)++;
+        v += static_cast<uint64_t>(byte & 0x7f) << shift;
+        if(v > MAX_INT) { return false; }
+        if(!(byte & 0x80)) {
+            *value = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void WriteInt(std::string* out, uint8_t flags, int prefix, uint64_t value) {
+    uint64_t max = (1u << prefix) - 1;
+    if(value < max) {
+        out->push_back(static_cast<char>(flags | value));
+        return;
+    }
+    out->push_back(static_cast<char>(flags | max));
+    value -= max;
+    while(value >= 0x80) {
+        out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out->push_back(static_cast<char>(value));
+}
+
+static bool ReadString(const uint8_t** p, const uint8_t* end, std::string* out) {
+    if(*p >= end) { return false; }
+    bool huffman = **p & 0x80;
+    uint64_t len;
+    if(!ReadInt(p, end, 7, &len) || len > static_cast<uint64_t>(end - *p)) {
+        return false;
+    }
+    out->clear();
+    bool ok = true;
+    if(huffman) {
+        ok = Huffman::Decode(*p, len, out);
+    } else {
+        out->assign(reinterpret_cast<const char*>(*p), len);
+    }
+    *p += len;
+    return ok;
+}
+
+static void WriteString(std::string* out, std::string_view str) {
+    size_t huffLen = Huffman::EncodedLen(str);
+    if(huffLen < str.size()) {
+        WriteInt(out, 0x80, 7, huffLen);
+        Huffman::Encode(str, out);
+    } else {
+        WriteInt(out, 0, 7, str.size());
+        out->append(str.data(), str.size());
+    }
+}
+
+HpackDecoder::HpackDecoder(size_t maxTableSize) : table_(maxTableSize), limit_(maxTableSize) {}
+
+bool HpackDecoder::Decode(const uint8_t* data, size_t len, std::vector<Header>* out, size_t maxListSize, bool* truncated) {
+    const uint8_t* p = data;
+    const uint8_t* end = data + len;
+    size_t listSize = 0;
+    bool first = true;      // 表大小更新只能出现在头部块开头
+    std::string name, value;
+    *truncated = false;
+    while(p < end) {
+        uint8_t byte = *p;
+        uint64_t index;
+        std::string_view n, v;
+        if(byte & 0x80) {   // 索引
+            if(!ReadInt(&p, end, 7, &index) || !table_.Get(index, &n, &v)) { return false; }
+            name.assign(n);
+            value.assign(v);
+        }
+        else if((byte & 0xe0) == 0x20) {    // 动态表大小更新
+            if(!first || !ReadInt(&p, end, 5, &index) || index > limit_) { return false; }
+            table_.SetMaxSize(index);
+            continue;
+        }
+        else {      // 带字面值：01增量索引，0000不索引，0001永不索引
+            int prefix = (byte & 0x40) ? 6 : 4;
+            if(!ReadInt(&p, end, prefix, &index)) { return false; }
+            if(index) {
+                if(!table_.Get(index, &n, &v)) { return false; }
+                name.assign(n);
+            } else if(!ReadString(&p, end, &name)) {
+                return false;
+            }
+            if(!ReadString(&p, end, &value)) { return false; }
+            if(byte & 0x40) {
+                table_.Add(name, value);
+            }
+        }
+        first = false;
+        listSize += name.size() + value.size() + ENTRY_OVERHEAD;
+        if(listSize > maxListSize) {
+            *truncated = true;
+            continue;
+        }
+        out->emplace_back(name, value);
+    }
+    return true;
+}
+
+HpackEncoder::HpackEncoder() : table_(4096), pendingSize_(0), pendingUpdate_(false) {}
+
+void HpackEncoder::SetMaxTableSize(size_t size) {
+    size = std::min<size_t>(size, 4096);    // 编码这边的表不用比默认的大
+    if(size != table_.MaxSize()) {
+        pendingSize_ = pendingUpdate_ ? std::min(pendingSize_, size) : size;
+        pendingUpdate_ = true;
+        table_.SetMaxSize(size);
+    }
+}
+
+void HpackEncoder::Encode(std::string_view name, std::string_view value, std::string* out, bool index) {
+    if(pendingUpdate_) {
+        // 表缩小过又变大时，按规定先报最小值再报最终值
+        if(pendingSize_ != table_.MaxSize()) { WriteInt(out, 0x20, 5, pendingSize_); }
+        WriteInt(out, 0x20, 5, table_.MaxSize());
+        pendingUpdate_ = false;
+    }
+    bool exact;
+    uint64_t found = table_.Find(name, value, &exact);
+    if(exact) {
+        WriteInt(out, 0x80, 7, found);
+        return;
+    }
+    if(index) {
+        WriteInt(out, 0x40, 6, found);
+        table_.Add(name, value);
+    } else {
+        WriteInt(out, 0x00, 4, found);
+    }
+    if(!found) {
+        WriteString(out, name);
+    }
+    WriteString(out, value);
+}
@@ -0,0 +1,75 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+HPACK（RFC 7541）：HTTP/2的头部压缩
+索引从1开始，1~61是固定的静态表，62以后是动态表，最新加入的编号最小；
+动态表按 名字长度+值长度+32 计大小，超过上限从最老的一项开始淘汰
+*/
+class HpackTable {
+public:
+    explicit HpackTable(size_t maxSize = 4096);
+
+    void SetMaxSize(size_t size);
+    size_t MaxSize() const { return maxSize_; }
+    void Add(std::string_view name, std::string_view value);
+    bool Get(uint64_t index, std::string_view* name, std::string_view* value) const;
+    // 找完全相同的一项，没有就找同名的；返回0表示名字也没有
+    uint64_t Find(std::string_view name, std::string_view value, bool* exact) const;
+
+    static const size_t STATIC_COUNT = 61;
+
+private:
+    void Evict_(size_t size);
+
+    std::deque<std::pair<std::string, std::string>> entries_;   // 最新的在前
+    size_t size_;
+    size_t maxSize_;
+};
+
+// 静态Huffman码（RFC 7541附录B）
+class Huffman {
+public:
+    static bool Decode(const uint8_t* data, size_t len, std::string* out);   // 填充不对或者出现EOS返回false
+    static size_t EncodedLen(std::string_view str);
+    static void Encode(std::string_view str, std::string* out);
+};
+
+class HpackDecoder {
+public:
+    typedef std::pair<std::string, std::string> Header;
+
+    explicit HpackDecoder(size_t maxTableSize = 4096);
+
+    // 解一个完整的头部块，格式错误返回false（连接级的COMPRESSION_ERROR）；
+    // 解出来的头部超过maxListSize字节后不再输出，但动态表照常更新，*truncated置true
+    bool Decode(const uint8_t* data, size_t len, std::vector<Header>* out, size_t maxListSize, bool* truncated);
+
+private:
+    HpackTable table_;
+    size_t limit_;      // 我方SETTINGS_HEADER_TABLE_SIZE，对端的表大小更新不能超过它
+};
+
+class HpackEncoder {
+public:
+    HpackEncoder();
+
+    // index为false时不进动态表，值每次都不一样的头部（content-length之类）用
+    void Encode(std::string_view name, std::string_view value, std::string* out, bool index = true);
+    void SetMaxTableSize(size_t size);      // 对端SETTINGS_HEADER_TABLE_SIZE，下一个头部块开头带上表大小更新
+
+private:
+    HpackTable table_;
+    size_t pendingSize_;
+    bool pendingUpdate_;
+};
+
+#endif //HPACK_H
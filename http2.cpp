@@ -0,0 +1,780 @@
+#include "http2.h"
+#include "metrics.h"
+#include "watchdog.h"
+#include "accesslog.h"
+#include "log.h"
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+
+bool Http2Session::enabled = true;
+int Http2Session::maxConcurrentStreams = 100;
+
+static const char PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const size_t PREFACE_LEN = sizeof(PREFACE) - 1;
+static const int64_t DEFAULT_WINDOW = 65535;
+static const int64_t MAX_WINDOW = 0x7fffffff;
+static const int64_t LOCAL_WINDOW = 1 << 20;        // 我方的接收窗口，连接和每个流都是
+static const uint32_t LOCAL_MAX_FRAME = 16384;      // 没有通告SETTINGS_MAX_FRAME_SIZE，用默认值
+static const uint32_t MAX_SEND_FRAME = 64 * 1024;   // 对端允许得再大，DATA帧也不超过这个
+static const size_t MAX_HEADER_BLOCK = 64 * 1024;   // 压缩后的头部块上限
+static const size_t HIGH_WATER = 64 * 1024;         // 输出缓冲区攒到这么多就先发出去
+static const size_t FREE_STREAMS = 8;
+
+enum {
+    FLAG_END_STREAM = 0x1,
+    FLAG_ACK = 0x1,
+    FLAG_END_HEADERS = 0x4,
+    FLAG_PADDED = 0x8,
+    FLAG_PRIORITY = 0x20,
+};
+
+enum {
+    SETTINGS_HEADER_TABLE_SIZE = 1,
+    SETTINGS_ENABLE_PUSH = 2,
+    SETTINGS_MAX_CONCURRENT_STREAMS = 3,
+    SETTINGS_INITIAL_WINDOW_SIZE = 4,
+    SETTINGS_MAX_FRAME_SIZE = 5,
+};
+
+static uint32_t Read32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void Put32(char* p, uint32_t value) {
+    p[0] = static_cast<char>(value >> 24);
+    p[1] = static_cast<char>(value >> 16);
+    p[2] = static_cast<char>(value >> 8);
+    p[3] = static_cast<char>(value);
+}
+
+// 要拼进HTTP/1.1文本里的值不能带换行，否则就能注入别的请求头
+static bool SafeValue(const std::string& value) {
+    return value.find_first_of("\r\n", 0, 3) == std::string::npos;
+}
+
+// 普通头部名只能是小写的token字符（RFC 9110 §5.6.2），CR/LF/NUL、冒号、空格、大写字母都不行，
+// 否则"x\r\ncontent-length"这样的名字拼进HTTP/1.1文本后就绕过了下面连接相关头部的过滤
+static bool SafeName(const std::string& name) {
+    return std::all_of(name.begin(), name.end(), [](char ch) {
+        return (ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9') || (ch != '\0' && strchr("!#$%&'*+-.^_`|~", ch));
+    });
+}
+
+Http2Session::Http2Session(const char* srcDir, int fd, bool peerLocal, const sockaddr_in& peer, bool unixPeer)
+    : srcDir_(srcDir), fd_(fd), peerLocal_(peerLocal), peer_(peer), unixPeer_(unixPeer), prefaceDone_(false), goawaySent_(false),
+      peerGoaway_(false), fatal_(false), blockStream_(0), blockEndStream_(false), lastStreamId_(0),
+      vclock_(0), connSendWindow_(DEFAULT_WINDOW), connRecvWindow_(DEFAULT_WINDOW),
+      peerInitialWindow_(DEFAULT_WINDOW), peerMaxFrame_(LOCAL_MAX_FRAME) {}
+
+Http2Session::~Http2Session() {
+    for(auto& entry : streams_) { delete entry.second; }
+    for(Stream_* stream : free_) { delete stream; }
+}
+
+int Http2Session::MatchPreface(const Buffer& buff) {
+    size_t len = std::min(buff.ReadableBytes(), PREFACE_LEN);
+    if(memcmp(buff.Peek(), PREFACE, len) != 0) {
+        return -1;
+    }
+    return len == PREFACE_LEN ? 1 : 0;
+}
+
+bool Http2Session::Closing() const {
+    return fatal_ || (peerGoaway_ && streams_.empty());
+}
+
+void Http2Session::WriteFrameHeader_(Buffer& out, uint32_t len, uint8_t type, uint8_t flags, uint32_t id) {
+    char header[9];
+    header[0] = static_cast<char>(len >> 16);
+    header[1] = static_cast<char>(len >> 8);
+    header[2] = static_cast<char>(len);
+    header[3] = static_cast<char>(type);
+    header[4] = static_cast<char>(flags);
+    Put32(header + 5, id);
+    out.Append(header, sizeof(header));
+}
+
+void Http2Session::WriteWindowUpdate_(Buffer& out, uint32_t id, uint32_t increment) {
+    WriteFrameHeader_(out, 4, WINDOW_UPDATE, 0, id);
+    char payload[4];
+    Put32(payload, increment);
+    out.Append(payload, sizeof(payload));
+}
+
+bool Http2Session::ConnError_(ERROR_CODE code, Buffer& out) {
+    if(!goawaySent_) {
+        WriteFrameHeader_(out, 8, GOAWAY, 0, 0);
+        char payload[8];
+        Put32(payload, lastStreamId_);
+        Put32(payload + 4, code);
+        out.Append(payload, sizeof(payload));
+        goawaySent_ = true;
+    }
+    fatal_ = true;
+    verify_.clear();
+    LOG_WARN("HTTP/2 connection error %d on fd %d", code, fd_);
+    return false;
+}
+
+void Http2Session::StreamError_(uint32_t id, ERROR_CODE code, Buffer& out) {
+    WriteFrameHeader_(out, 4, RST_STREAM, 0, id);
+    char payload[4];
+    Put32(payload, code);
+    out.Append(payload, sizeof(payload));
+    auto it = streams_.find(id);
+    if(it != streams_.end()) {
+        Reset_(it->second);
+    }
+}
+
+bool Http2Session::OnRead(Buffer& in, Buffer& out) {
+    if(fatal_) {
+        in.RetrieveAll();
+        return false;
+    }
+    if(!prefaceDone_) {
+        if(in.ReadableBytes() < PREFACE_LEN) {
+            return true;
+        }
+        if(MatchPreface(in) != 1) {
+            return ConnError_(PROTOCOL_ERROR, out);
+        }
+        in.Retrieve(PREFACE_LEN);
+        prefaceDone_ = true;
+        // 服务端的连接前言是一个SETTINGS帧，顺便把连接的接收窗口开大
+        char settings[12];
+        settings[0] = 0;
+        settings[1] = SETTINGS_MAX_CONCURRENT_STREAMS;
+        Put32(settings + 2, maxConcurrentStreams);
+        settings[6] = 0;
+        settings[7] = SETTINGS_INITIAL_WINDOW_SIZE;
+        Put32(settings + 8, LOCAL_WINDOW);
+        WriteFrameHeader_(out, sizeof(settings), SETTINGS, 0, 0);
+        out.Append(settings, sizeof(settings));
+        WriteWindowUpdate_(out, 0, LOCAL_WINDOW - DEFAULT_WINDOW);
+        connRecvWindow_ = LOCAL_WINDOW;
+    }
+    while(in.ReadableBytes() >= 9) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(in.Peek());
+        uint32_t len = (p[0] << 16) | (p[1] << 8) | p[2];
+        if(len > LOCAL_MAX_FRAME) {
+            return ConnError_(FRAME_SIZE_ERROR, out);
+        }
+        if(in.ReadableBytes() < 9 + len) {
+            break;
+        }
+        bool ok = OnFrame_(p[3], p[4], Read32(p + 5) & 0x7fffffff, p + 9, len, out);
+        in.Retrieve(9 + len);
+        if(!ok) {
+            in.RetrieveAll();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Http2Session::OnFrame_(uint8_t type, uint8_t flags, uint32_t id, const uint8_t* payload, uint32_t len, Buffer& out) {
+    if(blockStream_ && (type != CONTINUATION || id != blockStream_)) {    // 头部块中间不能插别的帧
+        return ConnError_(PROTOCOL_ERROR, out);
+    }
+    switch(type) {
+    case DATA:
+        return OnData_(flags, id, payload, len, out);
+    case HEADERS:
+        return OnHeaders_(flags, id, payload, len, out);
+    case CONTINUATION:
+        if(!blockStream_) {
+            return ConnError_(PROTOCOL_ERROR, out);
+        }
+        if(block_.size() + len > MAX_HEADER_BLOCK) {
+            return ConnError_(ENHANCE_YOUR_CALM, out);
+        }
+        block_.append(reinterpret_cast<const char*>(payload), len);
+        return (flags & FLAG_END_HEADERS) ? OnHeaderBlock_(out) : true;
+    case PRIORITY: {
+        if(id == 0) {
+            return ConnError_(PROTOCOL_ERROR, out);
+        }
+        if(len != 5) {
+            StreamError_(id, FRAME_SIZE_ERROR, out);
+            return true;
+        }
+        auto it = streams_.find(id);
+        uint32_t dependency = Read32(payload);
+        if(it != streams_.end() && !SetPriority_(it->second, dependency & 0x7fffffff, dependency >> 31, payload[4] + 1)) {
+            StreamError_(id, PROTOCOL_ERROR, out);
+        }
+        return true;
+    }
+    case RST_STREAM: {
+        if(id == 0 || id > lastStreamId_) {
+            return ConnError_(PROTOCOL_ERROR, out);
+        }
+        if(len != 4) {
+            return ConnError_(FRAME_SIZE_ERROR, out);
+        }
+        auto it = streams_.find(id);
+        if(it != streams_.end()) {
+            Reset_(it->second);
+        }
+        return true;
+    }
+    case SETTINGS:
+        if(id != 0) {
+            return ConnError_(PROTOCOL_ERROR, out);
+        }
+        return OnSettings_(flags, payload, len, out);
+    case PUSH_PROMISE:      // 客户端不能推送
+        return ConnError_(PROTOCOL_ERROR, out);
+    case PING:
+        if(id != 0) {
+            return ConnError_(PROTOCOL_ERROR, out);
+        }
+        if(len != 8) {
+            return ConnError_(FRAME_SIZE_ERROR, out);
+        }
+        if(!(flags & FLAG_ACK)) {
+            WriteFrameHeader_(out, 8, PING, FLAG_ACK, 0);
+            out.Append(payload, 8);
+        }
+        return true;
+    case GOAWAY:
+        if(id != 0) {
+            return ConnError_(PROTOCOL_ERROR, out);
+        }
+        if(len < 8) {
+            return ConnError_(FRAME_SIZE_ERROR, out);
+        }
+        peerGoaway_ = true;     // 已经开了的流照常做完
+        return true;
+    case WINDOW_UPDATE:
+        return OnWindowUpdate_(id, payload, len, out);
+    default:    // 不认识的帧类型按规定忽略
+        return true;
+    }
+}
+
+bool Http2Session::OnData_(uint8_t flags, uint32_t id, const uint8_t* payload, uint32_t len, Buffer& out) {
+    if(id == 0) {
+        return ConnError_(PROTOCOL_ERROR, out);
+    }
+    // 整帧（包括填充）都算进流量控制；连接窗口用掉一半就补满
+    uint32_t frameLen = len;
+    connRecvWindow_ -= frameLen;
+    if(connRecvWindow_ < 0) {
+        return ConnError_(FLOW_CONTROL_ERROR, out);
+    }
+    if(connRecvWindow_ < LOCAL_WINDOW / 2) {
+        WriteWindowUpdate_(out, 0, LOCAL_WINDOW - connRecvWindow_);
+        connRecvWindow_ = LOCAL_WINDOW;
+    }
+    if(flags & FLAG_PADDED) {
+        if(len < 1 || payload[0] >= len) {
+            return ConnError_(PROTOCOL_ERROR, out);
+        }
+        len -= payload[0] + 1;
+        payload++;
+    }
+    auto it = streams_.find(id);
+    if(it == streams_.end() || it->second->remoteClosed) {
+        if(id > lastStreamId_) {
+            return ConnError_(PROTOCOL_ERROR, out);
+        }
+        StreamError_(id, STREAM_CLOSED, out);
+        return true;
+    }
+    Stream_* stream = it->second;
+    stream->recvWindow -= frameLen;
+    if(stream->recvWindow < 0) {
+        StreamError_(id, FLOW_CONTROL_ERROR, out);
+        return true;
+    }
+    if(stream->errorCode == 0) {
+        if(stream->body.size() + len > HttpRequest::maxBodySize) {
+            stream->errorCode = 413;
+            std::string().swap(stream->body);
+        } else {
+            stream->body.append(reinterpret_cast<const char*>(payload), len);
+        }
+    }
+    if(flags & FLAG_END_STREAM) {
+        stream->remoteClosed = true;
+        Dispatch_(stream, out);
+    } else if(stream->recvWindow < LOCAL_WINDOW / 2) {
+        WriteWindowUpdate_(out, id, LOCAL_WINDOW - stream->recvWindow);
+        stream->recvWindow = LOCAL_WINDOW;
+    }
+    return true;
+}
+
+bool Http2Session::OnHeaders_(uint8_t flags, uint32_t id, const uint8_t* payload, uint32_t len, Buffer& out) {
+    if(id == 0 || id % 2 == 0) {    // 客户端发起的流是奇数
+        return ConnError_(PROTOCOL_ERROR, out);
+    }
+    uint32_t pos = 0, pad = 0;
+    if(flags & FLAG_PADDED) {
+        if(len < 1) {
+            return ConnError_(FRAME_SIZE_ERROR, out);
+        }
+        pad = payload[0];
+        pos = 1;
+    }
+    uint32_t dependency = 0;
+    int weight = 16;
+    if(flags & FLAG_PRIORITY) {
+        if(len < pos + 5) {
+            return ConnError_(FRAME_SIZE_ERROR, out);
+        }
+        dependency = Read32(payload + pos);
+        weight = payload[pos + 4] + 1;
+        pos += 5;
+    }
+    if(pos + pad > len) {
+        return ConnError_(PROTOCOL_ERROR, out);
+    }
+    auto it = streams_.find(id);
+    if(it != streams_.end()) {
+        // 对端已经半关的流不能再收HEADERS，只重置这个流（RFC 7540 5.1），头部块照样要解
+        if(it->second->remoteClosed) {
+            StreamError_(id, STREAM_CLOSED, out);
+        } else if(!(flags & FLAG_END_STREAM)) {     // 开着的流又来HEADERS只能是请求体后面的trailer，必须带END_STREAM
+            return ConnError_(PROTOCOL_ERROR, out);
+        }
+    } else {
+        if(id <= lastStreamId_) {
+            return ConnError_(STREAM_CLOSED, out);
+        }
+        lastStreamId_ = id;
+        if(streams_.size() >= static_cast<size_t>(maxConcurrentStreams)) {
+            StreamError_(id, REFUSED_STREAM, out);      // 头部块还是要解，动态表才能跟对端保持一致
+        } else {
+            Stream_* stream = NewStream_(id);
+            if((flags & FLAG_PRIORITY) && !SetPriority_(stream, dependency & 0x7fffffff, dependency >> 31, weight)) {
+                StreamError_(id, PROTOCOL_ERROR, out);
+            }
+        }
+    }
+    if(len - pos - pad > MAX_HEADER_BLOCK) {
+        return ConnError_(ENHANCE_YOUR_CALM, out);
+    }
+    block_.assign(reinterpret_cast<const char*>(payload + pos), len - pos - pad);
+    blockStream_ = id;
+    blockEndStream_ = flags & FLAG_END_STREAM;
+    return (flags & FLAG_END_HEADERS) ? OnHeaderBlock_(out) : true;
+}
+
+bool Http2Session::OnHeaderBlock_(Buffer& out) {
+    uint32_t id = blockStream_;
+    blockStream_ = 0;
+    headers_.clear();
+    bool truncated = false;
+    if(!decoder_.Decode(reinterpret_cast<const uint8_t*>(block_.data()), block_.size(), &headers_,
+                        HttpRequest::maxHeaderSize, &truncated)) {
+        return ConnError_(COMPRESSION_ERROR, out);
+    }
+    auto it = streams_.find(id);
+    if(it == streams_.end()) {      // 被拒绝或者已经重置的流
+        return true;
+    }
+    Stream_* stream = it->second;
+    if(!stream->head.empty()) {     // trailer，内容不用
+        stream->remoteClosed = true;
+        Dispatch_(stream, out);
+        return true;
+    }
+
+    // 伪头部必须在普通头部前面；头部名必须小写；连接相关的头部在HTTP/2里没有意义
+    const std::string* method = nullptr;
+    const std::string* path = nullptr;
+    const std::string* scheme = nullptr;
+    const std::string* authority = nullptr;
+    bool regular = false;
+    std::string& head = stream->head;
+    for(const auto& header : headers_) {
+        const std::string& name = header.first;
+        if(name.empty() || !SafeValue(header.second)) {
+            StreamError_(id, PROTOCOL_ERROR, out);
+            return true;
+        }
+        if(name[0] == ':') {
+            const std::string** slot = name == ":method" ? &method : name == ":path" ? &path :
+                                       name == ":scheme" ? &scheme : name == ":authority" ? &authority : nullptr;
+            if(regular || !slot || *slot) {
+                StreamError_(id, PROTOCOL_ERROR, out);
+                return true;
+            }
+            *slot = &header.second;
+            continue;
+        }
+        regular = true;
+        if(!SafeName(name)) {
+            StreamError_(id, PROTOCOL_ERROR, out);
+            return true;
+        }
+        if(name == "connection" || name == "keep-alive" || name == "proxy-connection" || name == "transfer-encoding" ||
+           name == "upgrade" || name == "te" || name == "content-length" || name == "host") {
+            continue;   // content-length按收到的DATA重新算
+        }
+        head += name;       // HttpRequest查请求头不区分大小写，小写的名字原样交给它
+        head += ": ";
+        head += header.second;
+        head += "\r\n";
+    }
+    if(!method || !path || !scheme || path->find(' ') != std::string::npos || method->find(' ') != std::string::npos) {
+        StreamError_(id, PROTOCOL_ERROR, out);
+        return true;
+    }
+    std::string requestLine = *method + " " + *path + " HTTP/1.1\r\n";
+    if(authority) {
+        requestLine += "Host: " + *authority + "\r\n";
+    }
+    head.insert(0, requestLine);
+    if(truncated) {
+        stream->errorCode = 431;
+    }
+    if(blockEndStream_) {
+        stream->remoteClosed = true;
+        Dispatch_(stream, out);
+    }
+    return true;
+}
+
+bool Http2Session::OnSettings_(uint8_t flags, const uint8_t* payload, uint32_t len, Buffer& out) {
+    if(flags & FLAG_ACK) {
+        return len == 0 ? true : ConnError_(FRAME_SIZE_ERROR, out);
+    }
+    if(len % 6) {
+        return ConnError_(FRAME_SIZE_ERROR, out);
+    }
+    for(const uint8_t* p = payload; p < payload + len; p += 6) {
+        uint16_t key = (p[0] << 8) | p[1];
+        uint32_t value = Read32(p + 2);
+        switch(key) {
+        case SETTINGS_HEADER_TABLE_SIZE:
+            encoder_.SetMaxTableSize(value);
+            break;
+        case SETTINGS_ENABLE_PUSH:
+            if(value > 1) {
+                return ConnError_(PROTOCOL_ERROR, out);
+            }
+            break;
+        case SETTINGS_INITIAL_WINDOW_SIZE: {
+            if(value > MAX_WINDOW) {
+                return ConnError_(FLOW_CONTROL_ERROR, out);
+            }
+            // 已经开着的流的发送窗口按差值调整，可能变成负的
+            int64_t delta = static_cast<int64_t>(value) - peerInitialWindow_;
+            for(auto& entry : streams_) {
+                entry.second->sendWindow += delta;
+                if(entry.second->sendWindow > MAX_WINDOW) {
+                    return ConnError_(FLOW_CONTROL_ERROR, out);
+                }
+            }
+            peerInitialWindow_ = value;
+            break;
+        }
+        case SETTINGS_MAX_FRAME_SIZE:
+            if(value < LOCAL_MAX_FRAME || value > 0xffffff) {
+                return ConnError_(PROTOCOL_ERROR, out);
+            }
+            peerMaxFrame_ = value;
+            break;
+        default:
+            break;
+        }
+    }
+    WriteFrameHeader_(out, 0, SETTINGS, FLAG_ACK, 0);
+    return true;
+}
+
+bool Http2Session::OnWindowUpdate_(uint32_t id, const uint8_t* payload, uint32_t len, Buffer& out) {
+    if(len != 4) {
+        return ConnError_(FRAME_SIZE_ERROR, out);
+    }
+    uint32_t increment = Read32(payload) & 0x7fffffff;
+    if(id == 0) {
+        if(increment == 0) {
+            return ConnError_(PROTOCOL_ERROR, out);
+        }
+        connSendWindow_ += increment;
+        return connSendWindow_ <= MAX_WINDOW ? true : ConnError_(FLOW_CONTROL_ERROR, out);
+    }
+    auto it = streams_.find(id);
+    if(it == streams_.end()) {
+        return id > lastStreamId_ ? ConnError_(PROTOCOL_ERROR, out) : true;
+    }
+    if(increment == 0) {
+        StreamError_(id, PROTOCOL_ERROR, out);
+        return true;
+    }
+    it->second->sendWindow += increment;
+    if(it->second->sendWindow > MAX_WINDOW) {
+        StreamError_(id, FLOW_CONTROL_ERROR, out);
+    }
+    return true;
+}
+
+// RFC 7540 5.3：依赖自己是错误；新的父节点原来在自己下面时，先把它挂到自己原来的位置；
+// 独占依赖时父节点原来的子节点都改挂到自己下面
+bool Http2Session::SetPriority_(Stream_* stream, uint32_t dependency, bool exclusive, int weight) {
+    if(dependency == stream->id) {
+        return false;
+    }
+    auto it = streams_.find(dependency);
+    if(it != streams_.end()) {
+        uint32_t ancestor = it->second->parent;
+        for(int depth = 0; ancestor && depth < maxConcurrentStreams; depth++) {
+            if(ancestor == stream->id) {
+                it->second->parent = stream->parent;
+                break;
+            }
+            auto up = streams_.find(ancestor);
+            if(up == streams_.end()) { break; }
+            ancestor = up->second->parent;
+        }
+    }
+    if(exclusive) {
+        for(auto& entry : streams_) {
+            if(entry.second != stream && entry.second->parent == dependency) {
+                entry.second->parent = stream->id;
+            }
+        }
+    }
+    stream->parent = dependency;
+    stream->weight = weight;
+    return true;
+}
+
+Http2Session::Stream_* Http2Session::NewStream_(uint32_t id) {
+    Stream_* stream;
+    if(!free_.empty()) {
+        stream = free_.back();
+        free_.pop_back();
+    } else {
+        stream = new Stream_();
+    }
+    stream->id = id;
+    stream->remoteClosed = false;
+    stream->responded = false;
+    stream->errorCode = 0;
+    stream->head.clear();
+    stream->body.clear();
+    stream->out.RetrieveAll();
+    stream->file = nullptr;
+    stream->fileLen = stream->fileSent = stream->sent = 0;
+    stream->sendWindow = peerInitialWindow_;
+    stream->recvWindow = LOCAL_WINDOW;
+    stream->parent = 0;
+    stream->weight = 16;
+    stream->vtime = vclock_;    // 新流从当前进度开始排，不会因为来得晚反而插到最前面
+    stream->start = Metrics::NowNs();
+    streams_[id] = stream;
+    return stream;
+}
+
+void Http2Session::Reset_(Stream_* stream) {
+    streams_.erase(stream->id);
+    stream->response.UnmapFile();
+    if(stream->body.capacity() > HIGH_WATER) {
+        std::string().swap(stream->body);
+    }
+    if(free_.size() < FREE_STREAMS) {
+        free_.push_back(stream);
+    } else {
+        delete stream;
+    }
+}
+
+void Http2Session::Finish_(Stream_* stream) {
+    int64_t now = Metrics::NowNs();
+    Watchdog::Instance()->RecordRequest(fd_, stream->request.method(), stream->request.target(), stream->response.Code(),
+                                        stream->sent, stream->start, now);
+    if(AccessLog::Instance()->Enabled()) {
+        AccessLog::Entry entry;
+        entry.ip = peer_.sin_addr.s_addr;
+        entry.unixPeer = unixPeer_;
+        entry.method = stream->request.method();
+        entry.path = stream->request.target();
+        entry.version = "2.0";
+        entry.referer = stream->request.GetHeader(HttpRequest::HDR_REFERER);
+        entry.userAgent = stream->request.GetHeader(HttpRequest::HDR_USER_AGENT);
+        entry.code = stream->response.Code();
+        entry.bytes = stream->sent;
+        entry.durationNs = now - stream->start;
+        AccessLog::Instance()->Record(entry);
+    }
+    Reset_(stream);
+}
+
+void Http2Session::Dispatch_(Stream_* stream, Buffer& out) {
+    Watchdog::SetPhase("h2");
+    HttpRequest& request = stream->request;
+    request.Init();
+    request.SetPeerLocal(peerLocal_);
+    bool ok = false;
+    if(stream->errorCode == 0) {
+        scratch_.RetrieveAll();
+        scratch_.Append(stream->head);
+        if(!stream->body.empty()) {
+            char line[48];
+            int n = snprintf(line, sizeof(line), "Content-Length: %zu\r\n", stream->body.size());
+            scratch_.Append(line, n);
+        }
+        scratch_.Append("\r\n", 2);
+        scratch_.Append(stream->body);
+        ok = request.parse(scratch_) && request.IsFinish();
+        if(ok && request.NeedsVerify()) {   // 查库会阻塞，不在I/O线程里做，见Verify()
+            verify_.push_back(stream->id);
+            return;
+        }
+        if(!ok) {
+            stream->errorCode = request.ErrorCode();
+        }
+    }
+    Respond_(stream, ok, out);
+}
+
+void Http2Session::Verify(Buffer& out, bool query) {
+    for(uint32_t id : verify_) {
+        auto it = streams_.find(id);
+        if(it == streams_.end()) { continue; }
+        Stream_* stream = it->second;
+        if(query) {
+            stream->request.Verify();
+        } else {
+            stream->errorCode = 503;
+        }
+        Respond_(stream, query, out);
+    }
+    verify_.clear();
+}
+
+void Http2Session::Respond_(Stream_* stream, bool ok, Buffer& out) {
+    HttpRequest& request = stream->request;
+    if(ok) {
+        const char* root = request.root() ? request.root() : srcDir_;
+        stream->response.Init(root, request.path(), request.arena(), true, 200);
+        if(request.HasContent()) {
+            stream->response.SetContent(request.Content(), request.ContentType());
+        }
+    } else {
+        stream->response.Init(srcDir_, request.path(), request.arena(), false, stream->errorCode);
+    }
+    Watchdog::SetPath(request.target());
+    stream->out.RetrieveAll();
+    stream->response.MakeResponse(stream->out);
+    Metrics::Instance()->AddRequest(stream->response.Code());
+    stream->file = stream->response.File();
+    stream->fileLen = stream->file ? stream->response.FileLen() : 0;
+    SendHeaders_(stream, out);
+}
+
+// HttpResponse生成的是HTTP/1.1的状态行和响应头，转成HPACK编码的HEADERS帧，剩下的响应体留在stream->out里
+void Http2Session::SendHeaders_(Stream_* stream, Buffer& out) {
+    std::string_view text(stream->out.Peek(), stream->out.ReadableBytes());
+    size_t headEnd = text.find("\r\n\r\n");
+    assert(headEnd != std::string_view::npos && text.size() > 12);
+    encoded_.clear();
+    encoder_.Encode(":status", text.substr(9, 3), &encoded_);
+    size_t pos = text.find("\r\n") + 2;
+    std::string name;
+    while(pos < headEnd) {
+        size_t lineEnd = text.find("\r\n", pos);
+        std::string_view line = text.substr(pos, lineEnd - pos);
+        pos = lineEnd + 2;
+        size_t colon = line.find(':');
+        if(colon == std::string_view::npos) { continue; }
+        name.assign(line.substr(0, colon));
+        std::transform(name.begin(), name.end(), name.begin(), [](char ch) { return ch >= 'A' && ch <= 'Z' ? ch - 'A' + 'a' : ch; });
+        if(name == "connection" || name == "keep-alive") { continue; }
+        std::string_view value = line.substr(colon + 1);
+        while(!value.empty() && value[0] == ' ') { value.remove_prefix(1); }
+        encoder_.Encode(name, value, &encoded_, name != "content-length");
+    }
+    stream->out.Retrieve(headEnd + 4);
+    stream->sent = encoded_.size();
+
+    // 头部块超过一帧的部分用CONTINUATION接着发；没有响应体时HEADERS就带上END_STREAM
+    bool endStream = stream->out.ReadableBytes() == 0 && stream->fileLen == 0;
+    uint32_t maxFrame = std::min(peerMaxFrame_, MAX_SEND_FRAME);
+    size_t sent = 0;
+    do {
+        size_t chunk = std::min<size_t>(maxFrame, encoded_.size() - sent);
+        uint8_t flags = (sent + chunk == encoded_.size() ? FLAG_END_HEADERS : 0) | (sent == 0 && endStream ? FLAG_END_STREAM : 0);
+        WriteFrameHeader_(out, chunk, sent == 0 ? HEADERS : CONTINUATION, flags, stream->id);
+        out.Append(encoded_.data() + sent, chunk);
+        sent += chunk;
+    } while(sent < encoded_.size());
+    stream->responded = true;
+    if(endStream) {
+        Finish_(stream);
+    }
+}
+
+/*
+优先级：依赖树上祖先还有数据能发的流先等着，能发的流里选vtime最小的；
+每发n字节vtime加 n*256/weight，权重大的流vtime涨得慢，按权重比例分到带宽
+祖先被流量控制卡住（窗口用完）时不挡后代
+*/
+Http2Session::Stream_* Http2Session::Next_() {
+    auto sendable = [](const Stream_* stream) {
+        return stream->responded && stream->sendWindow > 0 &&
+               (stream->out.ReadableBytes() > 0 || stream->fileSent < stream->fileLen);
+    };
+    Stream_* best = nullptr;
+    for(auto& entry : streams_) {
+        Stream_* stream = entry.second;
+        if(!sendable(stream)) { continue; }
+        bool blocked = false;
+        uint32_t ancestor = stream->parent;
+        for(int depth = 0; ancestor && depth < maxConcurrentStreams; depth++) {
+            auto it = streams_.find(ancestor);
+            if(it == streams_.end()) { break; }     // 父节点已经结束，当作挂在根上
+            if(sendable(it->second)) {
+                blocked = true;
+                break;
+            }
+            ancestor = it->second->parent;
+        }
+        if(!blocked && (!best || stream->vtime < best->vtime)) {
+            best = stream;
+        }
+    }
+    return best;
+}
+
+bool Http2Session::Produce(Buffer& out) {
+    if(fatal_) {
+        return false;
+    }
+    bool wrote = false;
+    uint32_t maxFrame = std::min(peerMaxFrame_, MAX_SEND_FRAME);
+    while(out.ReadableBytes() < HIGH_WATER && connSendWindow_ > 0) {
+        Stream_* stream = Next_();
+        if(!stream) { break; }
+        size_t inMemory = stream->out.ReadableBytes();
+        size_t left = inMemory + (stream->fileLen - stream->fileSent);
+        size_t len = std::min({ left, static_cast<size_t>(maxFrame), static_cast<size_t>(stream->sendWindow),
+                                static_cast<size_t>(connSendWindow_) });
+        bool end = len == left;
+        WriteFrameHeader_(out, len, DATA, end ? FLAG_END_STREAM : 0, stream->id);
+        size_t fromMemory = std::min(len, inMemory);
+        out.Append(stream->out.Peek(), fromMemory);
+        stream->out.Retrieve(fromMemory);
+        if(len > fromMemory) {
+            out.Append(stream->file + stream->fileSent, len - fromMemory);
+            stream->fileSent += len - fromMemory;
+        }
+        stream->sendWindow -= len;
+        connSendWindow_ -= len;
+        stream->sent += len;
+        vclock_ = stream->vtime;
+        stream->vtime += len * 256 / stream->weight;
+        wrote = true;
+        if(end) {
+            Finish_(stream);
+        }
+    }
+    return wrote;
+}
@@ -0,0 +1,146 @@
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include <map>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "buffer.h"
+#include "hpack.h"
+#include "httprequest.h"
+#include "httpresponse.h"
+
+/*
+HTTP/2（RFC 7540）的一条连接：分帧、多路复用、HPACK、流量控制和优先级
+只管字节进出，不碰套接字：HttpConn读到的数据交给OnRead，要发的帧写进输出缓冲区，
+所以明文的h2c（客户端直接发连接前言）和以后TLS上ALPN协商出来的h2用的是同一套代码
+每个流收齐请求之后拼成HTTP/1.1的请求交给HttpRequest解析，路由、静态文件、登录都和HTTP/1走同一条路，
+HttpResponse生成的响应头转成HEADERS帧，响应体（内存里的内容或mmap的文件）切成DATA帧
+*/
+class Http2Session {
+public:
+    // peer和unixPeer只用来记访问日志
+    Http2Session(const char* srcDir, int fd, bool peerLocal, const sockaddr_in& peer, bool unixPeer);
+    ~Http2Session();
+    Http2Session(const Http2Session&) = delete;
+    Http2Session& operator=(const Http2Session&) = delete;
+
+    // 读缓冲区开头是不是连接前言：1是，0数据还不够判断，-1不是
+    static int MatchPreface(const Buffer& buff);
+
+    bool OnRead(Buffer& in, Buffer& out);   // 处理读到的完整帧；返回false表示连接出错，GOAWAY已经写进out
+    bool Produce(Buffer& out);              // 按优先级和发送窗口继续往out里填DATA帧，填了东西返回true
+    bool Closing() const;                   // 出错了，或者GOAWAY之后流都处理完了，写完就关
+    // 登录/注册的流收齐之后先不回，等调用方在数据库线程里Verify(out, true)查完再生成响应；
+    // 数据库线程池满了时Verify(out, false)，这些流回503，连接上别的流不受影响
+    bool NeedsVerify() const { return !verify_.empty(); }
+    void Verify(Buffer& out, bool query);
+    size_t Streams() const { return streams_.size(); }
+
+    static bool enabled;                // 关掉之后连接前言当作普通的HTTP/1请求，返回400
+    static int maxConcurrentStreams;    // 通告给对端的并发流上限，超过的流回REFUSED_STREAM
+
+private:
+    enum FRAME_TYPE {
+        DATA = 0,
+        HEADERS = 1,
+        PRIORITY = 2,
+        RST_STREAM = 3,
+        SETTINGS = 4,
+        PUSH_PROMISE = 5,
+        PING = 6,
+        GOAWAY = 7,
+        WINDOW_UPDATE = 8,
+        CONTINUATION = 9,
+    };
+
+    enum ERROR_CODE {
+        NO_ERROR = 0,
+        PROTOCOL_ERROR = 1,
+        INTERNAL_ERROR = 2,
+        FLOW_CONTROL_ERROR = 3,
+        STREAM_CLOSED = 5,
+        FRAME_SIZE_ERROR = 6,
+        REFUSED_STREAM = 7,
+        CANCEL = 8,
+        COMPRESSION_ERROR = 9,
+        ENHANCE_YOUR_CALM = 11,
+    };
+
+    struct Stream_ {
+        uint32_t id;
+        bool remoteClosed;      // 对端已经发了END_STREAM
+        bool responded;         // 响应头已经发出去
+        int errorCode;          // 不为0时不解析请求，直接回这个状态码
+        std::string head;       // 拼出来的HTTP/1.1请求行和请求头
+        std::string body;
+        HttpRequest request;
+        HttpResponse response;
+        Buffer out;             // 响应体里在内存中的部分
+        const char* file;       // mmap的文件，跟在out后面发
+        size_t fileLen;
+        size_t fileSent;
+        size_t sent;
+        int64_t sendWindow;
+        int64_t recvWindow;
+        uint32_t parent;        // 依赖的流，0表示根
+        int weight;             // 1~256
+        uint64_t vtime;         // 按权重折算的已发送量，小的先发
+        int64_t start;
+    };
+
+    bool OnFrame_(uint8_t type, uint8_t flags, uint32_t id, const uint8_t* payload, uint32_t len, Buffer& out);
+    bool OnData_(uint8_t flags, uint32_t id, const uint8_t* payload, uint32_t len, Buffer& out);
+    bool OnHeaders_(uint8_t flags, uint32_t id, const uint8_t* payload, uint32_t len, Buffer& out);
+    bool OnHeaderBlock_(Buffer& out);
+    bool OnSettings_(uint8_t flags, const uint8_t* payload, uint32_t len, Buffer& out);
+    bool OnWindowUpdate_(uint32_t id, const uint8_t* payload, uint32_t len, Buffer& out);
+    bool SetPriority_(Stream_* stream, uint32_t dependency, bool exclusive, int weight);
+    void Dispatch_(Stream_* stream, Buffer& out);       // 请求收齐了，生成响应
+    void Respond_(Stream_* stream, bool ok, Buffer& out);
+    void SendHeaders_(Stream_* stream, Buffer& out);
+    Stream_* Next_();                                   // 下一个该发DATA的流
+    Stream_* NewStream_(uint32_t id);
+    void Finish_(Stream_* stream);                      // 流结束，记飞行记录仪并回收
+    void Reset_(Stream_* stream);
+
+    bool ConnError_(ERROR_CODE code, Buffer& out);      // 写GOAWAY，返回false
+    void StreamError_(uint32_t id, ERROR_CODE code, Buffer& out);
+    static void WriteFrameHeader_(Buffer& out, uint32_t len, uint8_t type, uint8_t flags, uint32_t id);
+    void WriteWindowUpdate_(Buffer& out, uint32_t id, uint32_t increment);
+
+    const char* srcDir_;
+    int fd_;
+    bool peerLocal_;
+    sockaddr_in peer_;
+    bool unixPeer_;
+    bool prefaceDone_;
+    bool goawaySent_;
+    bool peerGoaway_;
+    bool fatal_;
+
+    HpackDecoder decoder_;
+    HpackEncoder encoder_;
+    std::vector<HpackDecoder::Header> headers_;
+    std::string block_;             // 正在收的头部块（HEADERS+CONTINUATION）
+    uint32_t blockStream_;          // 不为0时下一帧必须是这个流的CONTINUATION
+    bool blockEndStream_;
+    std::string encoded_;
+    Buffer scratch_;                // 拼HTTP/1.1请求和生成响应头用
+
+    std::map<uint32_t, Stream_*> streams_;  // 按id排序，优先级相同时先开的流先发
+    std::vector<Stream_*> free_;
+    std::vector<uint32_t> verify_;  // 等着查库的流；存id，中途被重置的流到时候找不到就跳过
+    uint32_t lastStreamId_;
+    uint64_t vclock_;
+
+    int64_t connSendWindow_;
+    int64_t connRecvWindow_;
+    int64_t peerInitialWindow_;
+    uint32_t peerMaxFrame_;
+};
+
+#endif //HTTP2_H
@@ -4,38 +4,178 @@ using namespace std;
 const char* HttpConn::srcDir;
 std::atomic<int> HttpConn::userCount;
 bool HttpConn::isET;
+bool HttpConn::cork = false;
+size_t HttpConn::maxPooledStates = 1024;
+size_t HttpConn::maxPooledBuffer = 256 * 1024;
+std::atomic<int> HttpConn::statesActive_;
+std::atomic<int> HttpConn::statesPooled_;
+std::mutex HttpConn::poolMtx_;
+std::vector<HttpConn::State_*> HttpConn::pool_;
+#ifdef TINYWEB_TLS
+TlsContext* HttpConn::tls = nullptr;
+#endif
 
 HttpConn::HttpConn() { 
     fd_ = -1;
     addr_ = { 0 };
+    peer_ = PEER_INET;
     isClose_ = true;
+    corked_ = false;
+    owners_ = 0;
+    state_ = nullptr;
+    ext_ = nullptr;
+    requestStart_ = 0;
+    traceId_ = 0;
+    queuedAt_ = 0;
 };
 
 HttpConn::~HttpConn() { 
     Close(); 
 };
 
-void HttpConn::init(int fd, const sockaddr_in& addr) {//初始化fd就是通信的那个文件，文件描述符，靠这个和别人进行通讯
+HttpConn::Ext_::~Ext_() {
+    delete h2;
+#ifdef TINYWEB_TLS
+    delete tls;
+#endif
+}
+
+HttpConn::State_* HttpConn::AcquireState_() {
+    State_* state = nullptr;
+    {
+        std::lock_guard<std::mutex> locker(poolMtx_);
+        if(!pool_.empty()) {
+            state = pool_.back();
+            pool_.pop_back();
+            statesPooled_--;
+        }
+    }
+    if(!state) {
+        state = new State_();
+    }
+    statesActive_++;
+    return state;
+}
+
+void HttpConn::ReleaseState_(State_* state) {
+    assert(state);
+    statesActive_--;
+    state->response.UnmapFile();
+    // 上传大请求时缓冲区会涨得很大，这种不留着
+    size_t buffered = state->readBuff.PrependableBytes() + state->readBuff.ReadableBytes() + state->readBuff.WritableBytes()
+                    + state->writeBuff.PrependableBytes() + state->writeBuff.ReadableBytes() + state->writeBuff.WritableBytes();
+    if(buffered <= maxPooledBuffer) {
+        state->readBuff.RetrieveAll();
+        state->writeBuff.RetrieveAll();
+        state->iov[0].iov_len = state->iov[1].iov_len = 0;
+        state->iovCnt = 0;
+        std::lock_guard<std::mutex> locker(poolMtx_);
+        if(pool_.size() < maxPooledStates) {
+            pool_.push_back(state);
+            statesPooled_++;
+            return;
+        }
+    }
+    delete state;
+}
+
+HttpConn::State_* HttpConn::Materialize_() {
+    if(!state_) {
+        state_ = AcquireState_();
+        state_->request.Init();
+        state_->request.SetPeerLocal(PeerLocal_());
+    }
+    return state_;
+}
+
+void HttpConn::init(int fd, const sockaddr_in& addr, PEER peer) {//初始化fd就是通信的那个文件，文件描述符，靠这个和别人进行通讯
     assert(fd > 0);
     userCount++;
     addr_ = addr;
+    peer_ = peer;
     fd_ = fd;
-    writeBuff_.RetrieveAll();
-    readBuff_.RetrieveAll();
+    if(state_) {    // fd会被复用，上一个连接没还的状态先还掉
+        ReleaseState_(state_);
+        state_ = nullptr;
+    }
+    delete ext_;
+    ext_ = nullptr;
+#ifdef TINYWEB_TLS
+    if(tls) {
+        ext_ = new Ext_();
+        ext_->tls = new TlsConn(tls, fd);
+    }
+#endif
+    requestStart_ = 0;
+    corked_ = false;
+    owners_.fetch_and(static_cast<uint8_t>(~TIMED_OUT), std::memory_order_relaxed);   // 计数不清：上一个连接的任务可能还差一次Unhold
+    traceId_ = 0;
     isClose_ = false;
-    LOG_INFO("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
+    Metrics::Instance()->Add(Metrics::CONN_OPENED);
+    LOG_DEBUG("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
 }
 
 void HttpConn::Close() {//不想聊了
-    response_.UnmapFile();
+    if(state_) {
+        ReleaseState_(state_);
+        state_ = nullptr;
+    }
+    delete ext_;    // TLS要在close之前发close_notify
+    ext_ = nullptr;
     if(isClose_ == false){
         isClose_ = true; 
         userCount--;
         close(fd_);
-        LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
+        Metrics::Instance()->Add(Metrics::CONN_CLOSED);
+        LOG_DEBUG("Client[%d](%s:%d) quit, UserCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
     }
 }
 
+// 响应写完、没有攒着的流水线请求、也没有解析到一半的请求时才算空闲
+bool HttpConn::Compact() {
+    if(!state_) {
+        return true;
+    }
+    if(state_->readBuff.ReadableBytes() > 0 || ToWriteBytes() > 0
+       || state_->request.InProgress() || NeedsVerify()) {
+        return false;
+    }
+    ReleaseState_(state_);
+    state_ = nullptr;
+    return true;
+}
+
+HttpConn::READ_PHASE HttpConn::ReadPhase() const {
+    if(ext_ && ext_->h2) {
+        return READ_H2;
+    }
+#ifdef TINYWEB_TLS
+    if(ext_ && ext_->tls && !ext_->tls->Established()) {
+        return READ_HEADER;
+    }
+#endif
+    if(!state_) {
+        return READ_IDLE;
+    }
+    const HttpRequest& request = state_->request;
+    if(request.InBody()) {
+        return READ_BODY;
+    }
+    // 上一个请求已经完整时，读缓冲区里剩下的是下一个请求的开头
+    if(request.InProgress() || state_->readBuff.ReadableBytes() > 0) {
+        return READ_HEADER;
+    }
+    return READ_IDLE;
+}
+
+bool HttpConn::HandshakeWantsWrite() const {
+#ifdef TINYWEB_TLS
+    return ext_ && ext_->tls && !ext_->tls->Established() && ext_->tls->WantsWrite();
+#else
+    return false;
+#endif
+}
+
 int HttpConn::GetFd() const {
     return fd_;
 };
@@ -45,6 +185,9 @@ struct sockaddr_in HttpConn::GetAddr() const {
 }
 
 const char* HttpConn::GetIP() const {
+    if(peer_ != PEER_INET) {
+        return "unix";
+    }
     return inet_ntoa(addr_.sin_addr);
 }
 
@@ -53,12 +196,27 @@ int HttpConn::GetPort() const {
 }
 
 ssize_t HttpConn::read(int* saveErrno) {
+    Buffer& readBuff = Materialize_()->readBuff;
+#ifdef TINYWEB_TLS
+    if(ext_ && ext_->tls && !ext_->tls->Established()) {   // 握手没完成之前读到的都是握手消息
+        int ret = ext_->tls->Handshake();
+        if(ret <= 0) {
+            *saveErrno = ret == 0 ? EAGAIN : EPROTO;
+            return -1;
+        }
+    }
+#endif
     ssize_t len = -1;
     do {
-        len = readBuff_.ReadFd(fd_, saveErrno);
+        len = ReadOnce_(readBuff, saveErrno);
         if (len <= 0) {
             break;
         }
+        Metrics::Instance()->Add(Metrics::BYTES_IN, len);
+        // 读缓冲区攒够一批就先交给解析，剩下的留在内核里，重新注册EPOLLIN后还会触发
+        if(readBuff.ReadableBytes() >= READ_BATCH) {
+            break;
+        }
     } while (isET); // ET:边沿触发要一次性全部读出
     return len;
 }
@@ -66,58 +224,255 @@ ssize_t HttpConn::read(int* saveErrno) {
 // 主要采用writev连续写函数，将响应头部和响应文件的内容信息从buff写到fd里面
 //监听到写缓冲区为空了就准备写东西了
 ssize_t HttpConn::write(int* saveErrno) {
+    assert(state_);
+    struct iovec* iov = state_->iov;
+    Buffer& writeBuff = state_->writeBuff;
     ssize_t len = -1;
+    if(cork && !corked_ && ToWriteBytes() > 0) {
+        SetCork_(true);
+    }
     do {
-        len = writev(fd_, iov_, iovCnt_);   // 将iov的内容写到fd中
+        {
+            WatchCall watch(Watchdog::WRITEV);
+            len = Writev_();   // 将iov的内容写到fd中
+        }
         if(len <= 0) {
             *saveErrno = errno;
             break;
         }
+        Metrics::Instance()->Add(Metrics::BYTES_OUT, len);
         //iov是一个结构体包装了我们要发送的数据头部和数据块。分别存储了两个指针指向了要传输的头部和数据。
 
-        if(iov_[0].iov_len + iov_[1].iov_len  == 0) { break; } /* 传输结束 */
-        else if(static_cast<size_t>(len) > iov_[0].iov_len) {//调节传输的大小
-            iov_[1].iov_base = (uint8_t*) iov_[1].iov_base + (len - iov_[0].iov_len);
-            iov_[1].iov_len -= (len - iov_[0].iov_len);
-            if(iov_[0].iov_len) {
-                writeBuff_.RetrieveAll();
-                iov_[0].iov_len = 0;
+        if(iov[0].iov_len + iov[1].iov_len  == 0) { break; } /* 传输结束 */
+        else if(static_cast<size_t>(len) > iov[0].iov_len) {//调节传输的大小
+            iov[1].iov_base = (uint8_t*) iov[1].iov_base + (len - iov[0].iov_len);
+            iov[1].iov_len -= (len - iov[0].iov_len);
+            if(iov[0].iov_len) {
+                writeBuff.RetrieveAll();
+                iov[0].iov_len = 0;
             }
         }
         else {
-            iov_[0].iov_base = (uint8_t*)iov_[0].iov_base + len; 
-            iov_[0].iov_len -= len; 
-            writeBuff_.Retrieve(len);
+            iov[0].iov_base = (uint8_t*)iov[0].iov_base + len; 
+            iov[0].iov_len -= len; 
+            writeBuff.Retrieve(len);
+        }
+        if(ext_ && ext_->h2 && ToWriteBytes() == 0) {    // 这一批帧发完了，接着要下一批
+            FillHttp2_();
         }
     } while(isET || ToWriteBytes() > 10240);
+    if(corked_ && ToWriteBytes() == 0) {    // 拔掉时内核把最后不满一段的也发出去
+        SetCork_(false);
+    }
     return len;
 }
+
+// UNIX套接字没有这个选项
+void HttpConn::SetCork_(bool on) {
+    if(peer_ != PEER_INET) {
+        return;
+    }
+    int val = on ? 1 : 0;
+    setsockopt(fd_, IPPROTO_TCP, TCP_CORK, &val, sizeof(val));
+    corked_ = on;
+}
+ssize_t HttpConn::ReadOnce_(Buffer& readBuff, int* saveErrno) {
+#ifdef TINYWEB_TLS
+    if(ext_ && ext_->tls) {
+        return ext_->tls->Read(readBuff, saveErrno);
+    }
+#endif
+    return readBuff.ReadFd(fd_, saveErrno);
+}
+
+bool HttpConn::SendNow(std::string_view data) {
+    if(ext_ && ext_->h2) {
+        return false;
+    }
+#ifdef TINYWEB_TLS
+    if(ext_ && ext_->tls) {
+        struct iovec iov = { const_cast<char*>(data.data()), data.size() };
+        return ext_->tls->Established() && ext_->tls->Writev(&iov, 1) > 0;
+    }
+#endif
+    return send(fd_, data.data(), data.size(), MSG_NOSIGNAL | MSG_DONTWAIT) > 0;
+}
+
+// 出错时和writev一样设置errno
+ssize_t HttpConn::Writev_() {
+#ifdef TINYWEB_TLS
+    if(ext_ && ext_->tls) {
+        return ext_->tls->Writev(state_->iov, state_->iovCnt);
+    }
+#endif
+    return writev(fd_, state_->iov, state_->iovCnt);
+}
+
 //等系统监听到缓冲区有东西了就调用process
 bool HttpConn::process() {//真正的处理
-    request_.Init();
-    if(readBuff_.ReadableBytes() <= 0) {
+    if(!state_) {
         return false;
     }
-    else if(request_.parse(readBuff_)) {    // 解析成功，解析完成后立马生成响应报文
-        LOG_DEBUG("%s", request_.path().c_str());
-        response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
-    } else {//解析失败了就里面回复报错
-        response_.Init(srcDir, request_.path(), false, 400);
+    if(ext_ && ext_->h2) {
+        return ProcessHttp2_();
+    }
+    HttpRequest& request = state_->request;
+    if(request.IsFinish()) {   // 上一个请求已经处理完，开始新的请求；否则接着解析没收完的请求
+        request.Init();
     }
+    if(state_->readBuff.ReadableBytes() <= 0) {
+        return false;
+    }
+    if(Http2Session::enabled && !request.InProgress()) {    // 不是以"PRI"开头的第一个字节就比对失败
+        int preface = Http2Session::MatchPreface(state_->readBuff);
+        if(preface == 0) {
+            return false;
+        }
+        if(preface == 1) {
+            if(!ext_) { ext_ = new Ext_(); }
+            ext_->h2 = new Http2Session(srcDir, fd_, PeerLocal_(), addr_, peer_ != PEER_INET);
+            LOG_DEBUG("Client[%d] speaks HTTP/2", fd_);
+            return ProcessHttp2_();
+        }
+    }
+    Watchdog::SetPhase("parse");
+    Tracer::SetCurrent(traceId_);   // 让UserVerify等下层代码也能记到这个请求上
+    int64_t start = Metrics::NowNs();
+    bool ok = request.parse(state_->readBuff);
+    int64_t end = Metrics::NowNs();
+    Tracer::SetCurrent(0);
+    Metrics::Instance()->Record(Metrics::PARSE_NS, end - start);
+    if(traceId_) { Tracer::Instance()->Record(traceId_, Tracer::PARSE, start, end, fd_); }
+    if(ok && !request.IsFinish()) {        // 请求还没收完，继续监听读事件
+        return false;
+    }
+    if(ok && request.NeedsVerify()) {      // 要查库，等调用方在数据库线程里调Verify()
+        return false;
+    }
+    MakeResponse_(ok);
+    return true;
+}
 
-    response_.MakeResponse(writeBuff_); // 生成响应报文放入writeBuff_中
+void HttpConn::Verify() {
+    assert(state_);
+    Watchdog::SetPhase("verify");
+    Tracer::SetCurrent(traceId_);
+    if(ext_ && ext_->h2) {
+        ext_->h2->Verify(state_->writeBuff, true);
+        Tracer::SetCurrent(0);
+        FillHttp2_();
+        return;
+    }
+    state_->request.Verify();
+    Tracer::SetCurrent(0);
+    MakeResponse_(true);
+}
+
+bool HttpConn::RefuseVerify() {
+    assert(state_);
+    if(!ext_ || !ext_->h2) {
+        return false;
+    }
+    ext_->h2->Verify(state_->writeBuff, false);
+    FillHttp2_();
+    return true;
+}
+
+void HttpConn::MakeResponse_(bool ok) {
+    HttpRequest& request = state_->request;
+    HttpResponse& response = state_->response;
+    Buffer& writeBuff = state_->writeBuff;
+    struct iovec* iov = state_->iov;
+    if(ok) {    // 解析成功，解析完成后立马生成响应报文
+        LOG_DEBUG("%s", request.path().data());
+        const char* root = request.root() ? request.root() : srcDir;   // 静态挂载使用挂载目录
+        response.Init(root, request.path(), request.arena(), request.IsKeepAlive(), 200);
+        if(request.HasContent()) {
+            response.SetContent(request.Content(), request.ContentType());
+        }
+    } else {//解析失败了就里面回复报错，并在发送完之后关闭连接
+        response.Init(srcDir, request.path(), request.arena(), false, request.ErrorCode());
+    }
+
+    Watchdog::SetPath(request.target());
+    Watchdog::SetPhase("response");
+    int64_t start = traceId_ ? Metrics::NowNs() : 0;
+    response.MakeResponse(writeBuff); // 生成响应报文放入writeBuff中
+    if(traceId_) { Tracer::Instance()->Record(traceId_, Tracer::RESPONSE, start, Metrics::NowNs(), fd_, response.Code()); }
+    Metrics::Instance()->AddRequest(response.Code());
     // 响应头
-    iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());//将响应的报文用一个指针存起来，之后好发
-    iov_[0].iov_len = writeBuff_.ReadableBytes();
-    iovCnt_ = 1;
+    iov[0].iov_base = const_cast<char*>(writeBuff.Peek());//将响应的报文用一个指针存起来，之后好发
+    iov[0].iov_len = writeBuff.ReadableBytes();
+    state_->iovCnt = 1;
+    iov[1].iov_len = 0;
 
     // 文件
-    if(response_.FileLen() > 0  && response_.File()) {
-        iov_[1].iov_base = response_.File();
-        iov_[1].iov_len = response_.FileLen();
-        iovCnt_ = 2;
+    if(response.FileLen() > 0  && response.File()) {
+        iov[1].iov_base = response.File();
+        iov[1].iov_len = response.FileLen();
+        state_->iovCnt = 2;
     }
-    LOG_DEBUG("filesize:%d, %d  to %d", response_.FileLen() , iovCnt_, ToWriteBytes());
-    return true;
+    state_->responseBytes = ToWriteBytes();
+    LOG_DEBUG("filesize:%zu, %d  to %d", response.FileLen(), state_->iovCnt, ToWriteBytes());
+}
+
+// HTTP/2的请求都在会话里处理，一次读事件可能完成零个或多个流，返回true表示有帧要发；
+// 有流要查库时返回false，和HTTP/1一样由调用方转到数据库线程里Verify()，已经生成的帧到时候一起发
+bool HttpConn::ProcessHttp2_() {
+    Watchdog::SetPhase("h2");
+    Tracer::SetCurrent(traceId_);
+    bool ok = ext_->h2->OnRead(state_->readBuff, state_->writeBuff);
+    Tracer::SetCurrent(0);
+    if(ok && ext_->h2->NeedsVerify()) {
+        return false;
+    }
+    if(ok) {
+        FillHttp2_();
+    } else {    // 出错时只把GOAWAY发出去，之后IsKeepAlive()为false
+        state_->iov[0].iov_base = const_cast<char*>(state_->writeBuff.Peek());
+        state_->iov[0].iov_len = state_->writeBuff.ReadableBytes();
+        state_->iov[1].iov_len = 0;
+        state_->iovCnt = 1;
+    }
+    return ToWriteBytes() > 0;
+}
+
+void HttpConn::FillHttp2_() {
+    Buffer& writeBuff = state_->writeBuff;
+    ext_->h2->Produce(writeBuff);
+    state_->iov[0].iov_base = const_cast<char*>(writeBuff.Peek());
+    state_->iov[0].iov_len = writeBuff.ReadableBytes();
+    state_->iov[1].iov_len = 0;
+    state_->iovCnt = 1;
+    state_->responseBytes = writeBuff.ReadableBytes();
+}
+
+void HttpConn::RequestEnd() {
+    assert(state_);
+    if(ext_ && ext_->h2) {   // 每个流结束时会话自己记飞行记录仪
+        requestStart_ = 0;
+        traceId_ = 0;
+        return;
+    }
+    int64_t now = Metrics::NowNs();
+    Watchdog::Instance()->RecordRequest(fd_, state_->request.method(), state_->request.target(), state_->response.Code(),
+                                        state_->responseBytes, requestStart_, now);
+    if(AccessLog::Instance()->Enabled()) {
+        const HttpRequest& request = state_->request;
+        AccessLog::Entry entry;
+        entry.ip = addr_.sin_addr.s_addr;
+        entry.unixPeer = peer_ != PEER_INET;
+        entry.method = request.method();
+        entry.path = request.target();
+        entry.version = request.version();
+        entry.referer = request.GetHeader(HttpRequest::HDR_REFERER);
+        entry.userAgent = request.GetHeader(HttpRequest::HDR_USER_AGENT);
+        entry.code = state_->response.Code();
+        entry.bytes = state_->responseBytes;
+        entry.durationNs = now - requestStart_;
+        AccessLog::Instance()->Record(entry);
+    }
+    requestStart_ = 0;
+    traceId_ = 0;
 }
 
@@ -4,59 +4,178 @@
 #include <sys/types.h>
 #include <sys/uio.h>     // readv/writev
 #include <arpa/inet.h>   // sockaddr_in
+#include <netinet/tcp.h> // TCP_CORK
 #include <stdlib.h>      // atoi()
 #include <errno.h>      
+#include <atomic>
+#include <mutex>
+#include <vector>
 
 #include "log.h"
 #include "buffer.h"
 #include "httprequest.h"
 #include "httpresponse.h"
+#include "metrics.h"
+#include "tracer.h"
+#include "watchdog.h"
+#include "http2.h"
+#include "tls.h"
+#include "accesslog.h"
 /*
 进行读写数据并调用httprequest 来解析数据以及httpresponse来生成响应
+空闲的长连接只留fd、地址和跟踪用的几个字段，缓冲区、请求和响应放在State_里，
+有数据可读时才从池里取一份，响应写完、缓冲区清空后Compact()还回池里
+连接一开始收到的是HTTP/2连接前言时改由Http2Session处理，读写缓冲区照旧用State_里的
+配置了TLS时连接先握手，之后的读写经过TlsConn，内核接管了加密时写还是直接writev
 */
 class HttpConn {
 public:
     HttpConn();
     ~HttpConn();
+    HttpConn(const HttpConn&) = delete;
+    HttpConn& operator=(const HttpConn&) = delete;
     
-    void init(int sockFd, const sockaddr_in& addr);
+    // 对端从哪来：UNIX套接字上没有地址，addr全是0；算不算本机看WebServer::unixListen.trustPeers
+    enum PEER : uint8_t {
+        PEER_INET,
+        PEER_UNIX,
+        PEER_UNIX_TRUSTED,
+    };
+    void init(int sockFd, const sockaddr_in& addr, PEER peer = PEER_INET);
     ssize_t read(int* saveErrno);
     ssize_t write(int* saveErrno);
     void Close();
+    bool IsClosed() const { return isClose_; }
+    bool Compact();     // 连接空闲时把状态还回池里，返回true表示已经还了
+    bool IsCompact() const { return state_ == nullptr; }
     int GetFd() const;
     int GetPort() const;
     const char* GetIP() const;
     sockaddr_in GetAddr() const;
-    bool process();
+    bool process();     // 返回true表示响应已经生成；返回false且NeedsVerify()时要再调Verify()
+    bool NeedsVerify() const { return state_ && (state_->request.NeedsVerify() || (ext_ && ext_->h2 && ext_->h2->NeedsVerify())); }
+    void Verify();      // 查库完成登录/注册并生成响应，会阻塞
+    bool RefuseVerify();    // 数据库线程池满了：HTTP/2给等着查库的流回503并返回true，HTTP/1返回false由调用方关连接
+    enum READ_PHASE {
+        READ_IDLE,      // 没有收到一半的请求
+        READ_HEADER,    // TLS握手、请求行或者请求头收到一半
+        READ_BODY,
+        READ_H2,        // HTTP/2连接上好几个流交错着，不分阶段
+    };
+    // 只能在连接不归任何工作线程时调用，也就是EPOLLONESHOT之后主线程收到这个连接的事件时
+    READ_PHASE ReadPhase() const;
+    bool HandshakeWantsWrite() const;   // TLS握手要等套接字可写：交还时注册EPOLLOUT，可写了还是从read()接着握手
+    size_t BodyReceived() const { return state_ ? state_->request.body().Size() : 0; }
+
+    // 不经过缓冲区直接回一段HTTP/1报文（过载时的503），写不完不管；HTTP/2和还没握完手的TLS连接上不发，返回false
+    bool SendNow(std::string_view data);
 
     // 写的总长度
     int ToWriteBytes() { 
-        return iov_[0].iov_len + iov_[1].iov_len; 
+        return state_ ? state_->iov[0].iov_len + state_->iov[1].iov_len : 0; 
     }
 
     bool IsKeepAlive() const {
-        return request_.IsKeepAlive();
+        if(ext_ && ext_->h2) { return !ext_->h2->Closing(); }
+        return state_ && state_->request.IsKeepAlive();
+    }
+
+    // 读缓冲区里还没处理的字节（流水线请求）
+    size_t PendingBytes() const {
+        return state_ ? state_->readBuff.ReadableBytes() : 0;
+    }
+
+    // 新请求的第一次读事件时记下开始时间并决定是否采样跟踪，响应写完后结束
+    void RequestBegin() {
+        if(!requestStart_) {
+            requestStart_ = Metrics::NowNs();
+            traceId_ = Tracer::Instance()->Sample();
+        }
     }
+    void RequestEnd();      // 记入飞行记录仪
+    int64_t RequestStart() const { return requestStart_; }
+    // 当前请求原样的请求目标（带查询串），响应写完之前有效
+    std::string_view Path() const { return state_ ? state_->request.target() : std::string_view(); }
+    uint64_t TraceId() const { return traceId_; }
+    void SetQueuedAt(int64_t ns) { queuedAt_ = ns; }    // 任务入队时间，算排队阶段
+    int64_t QueuedAt() const { return queuedAt_; }
+
+    // 工作线程（读写线程池、数据库线程池）手上有这个连接的计数，外加一位“已超时”：
+    // 主线程投任务之前Hold，任务对连接的最后一次访问之后Unhold；计数为0时定时器才能直接关（见WebServer::OnDeadline_）
+    void Hold() { owners_.fetch_add(1, std::memory_order_relaxed); }
+    void Unhold() { owners_.fetch_sub(1, std::memory_order_release); }
+    bool Held() const { return (owners_.load(std::memory_order_acquire) & ~TIMED_OUT) != 0; }
+    void MarkTimedOut() { owners_.fetch_or(TIMED_OUT, std::memory_order_relaxed); }
+    bool TimedOut() const { return (owners_.load(std::memory_order_relaxed) & TIMED_OUT) != 0; }
+
+    static int ActiveStates() { return statesActive_; }     // 连接正在用的状态数
+    static int PooledStates() { return statesPooled_; }     // 池里空着的状态数
 
     static bool isET;
+    static bool cork;                   // 写响应期间TCP_CORK（见WebServer::SocketOptions）
     static const char* srcDir;
     static std::atomic<int> userCount;  // 原子，支持锁
+    static size_t maxPooledStates;      // 池里最多留多少份空闲状态，多出来的直接释放
+    static size_t maxPooledBuffer;      // 缓冲区涨到超过这个大小的状态不回池
+#ifdef TINYWEB_TLS
+    static TlsContext* tls;             // 不为空时所有连接都走TLS
+#endif
     
 private:
+    static const size_t READ_BATCH = 64 * 1024;   // 一次读事件最多读入的字节数
+    static const uint8_t TIMED_OUT = 0x80;
+
+    // 处理请求时才需要的状态，几KB，按连接数算是大头
+    struct State_ {
+        Buffer readBuff; // 读缓冲区
+        Buffer writeBuff; // 写缓冲区
+        HttpRequest request;
+        HttpResponse response;
+        int iovCnt = 0;
+        struct iovec iov[2] = {};
+        size_t responseBytes = 0;
+    };
+
+    // 不是每个连接都用得上的部分，用到时才分配，明文HTTP/1的空闲连接不为它多占地方
+    struct Ext_ {
+        Http2Session* h2 = nullptr;
+#ifdef TINYWEB_TLS
+        TlsConn* tls = nullptr;
+#endif
+        ~Ext_();
+    };
+
+    static State_* AcquireState_();
+    static void ReleaseState_(State_* state);
+
+    State_* Materialize_();     // 没有状态就先从池里取一份
+    void MakeResponse_(bool ok);
+    bool PeerLocal_() const {
+        return peer_ == PEER_UNIX_TRUSTED || (peer_ == PEER_INET && (ntohl(addr_.sin_addr.s_addr) >> 24) == 127);
+    }
+    ssize_t ReadOnce_(Buffer& readBuff, int* saveErrno);
+    ssize_t Writev_();
+    void SetCork_(bool on);
+    bool ProcessHttp2_();
+    void FillHttp2_();          // 把HTTP/2会话接下来要发的帧放进写缓冲区
    
     int fd_;
-    struct  sockaddr_in addr_;
-
     bool isClose_;
-    
-    int iovCnt_;
-    struct iovec iov_[2];
-    
-    Buffer readBuff_; // 读缓冲区
-    Buffer writeBuff_; // 写缓冲区
+    PEER peer_;         // 和corked_、owners_一起塞在fd_后面对齐空出来的地方，HttpConn保持64字节
+    bool corked_;
+    std::atomic<uint8_t> owners_;   // 见Hold()，占的是原来对齐空出来的一个字节
+    struct  sockaddr_in addr_;
+    State_* state_;
+    Ext_* ext_;
+    int64_t requestStart_;      // 0表示还没有请求开始
+    uint64_t traceId_;
+    int64_t queuedAt_;
 
-    HttpRequest request_;
-    HttpResponse response_;
+    // 状态在哪个工作线程取、在哪个线程还都不一定，用一把锁的全局空闲链，一个请求最多取还各一次
+    static std::mutex poolMtx_;
+    static std::vector<State_*> pool_;
+    static std::atomic<int> statesActive_;
+    static std::atomic<int> statesPooled_;
 };
 
 #endif
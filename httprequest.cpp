@@ -1,28 +1,114 @@
 #include "httprequest.h"
 using namespace std;
 
-const unordered_set<string> HttpRequest::DEFAULT_HTML{
-            "/index", "/register", "/login",
-             "/welcome", "/video", "/picture", };
+size_t HttpRequest::maxHeaderSize = 8 * 1024;
+size_t HttpRequest::maxBodySize = 8 * 1024 * 1024;
+size_t HttpRequest::bodySpillSize = 64 * 1024;
 
-const unordered_map<string, int> HttpRequest::DEFAULT_HTML_TAG {
-            {"/register.html", 0}, {"/login.html", 1},  };
+// 注册默认页面：/ 和几个不带后缀的页面改写为对应的html，登录/注册页面带上标签
+void HttpRequest::RegisterRoutes(Router* router) {
+    assert(router);
+    router->AddExact("/", RouteIndex_);
+    router->AddExact("/index", RouteHtml_);
+    router->AddExact("/welcome", RouteHtml_);
+    router->AddExact("/video", RouteHtml_);
+    router->AddExact("/picture", RouteHtml_);
+    router->AddExact("/register", RouteHtml_, TAG_REGISTER);
+    router->AddExact("/login", RouteHtml_, TAG_LOGIN);
+    router->AddExact("/register.html", nullptr, TAG_REGISTER);
+    router->AddExact("/login.html", nullptr, TAG_LOGIN);
+}
+
+void HttpRequest::RouteIndex_(HttpRequest& req, const RouteMatch&) {
+    req.path_ = "/index.html";
+}
+
+void HttpRequest::RouteHtml_(HttpRequest& req, const RouteMatch&) {
+    req.path_ = req.arena_.Concat(req.path_, ".html");
+}
 
 void HttpRequest::Init() {
-    method_ = path_ = version_ = body_ = "";
+    arena_.Reset();
+    method_ = path_ = version_ = target_ = "";
+    body_.Reset();
+    contentLength_ = 0;
+    headerBytes_ = 0;
+    code_ = 400;
     state_ = REQUEST_LINE;
+    tag_ = -1;
+    verifyPending_ = false;
+    root_ = nullptr;
+    content_ = contentType_ = std::string_view();
+    std::fill(std::begin(known_), std::end(known_), std::string_view());
     header_.clear();
     post_.clear();
+    queryArgs_.clear();
 }
 
-bool HttpRequest::IsKeepAlive() const {
-    if(header_.count("Connection") == 1) {
-        return header_.find("Connection")->second == "keep-alive" && version_ == "1.1";
+// 只比较ASCII字母的大小写，HTTP的头部名和这些取值都是ASCII
+static bool EqualsNoCase(std::string_view a, std::string_view b) {
+    if(a.size() != b.size()) {
+        return false;
     }
-    return false;
+    for(size_t i = 0; i < a.size(); i++) {
+        char x = a[i], y = b[i];
+        if(x == y) {    // 绝大多数客户端发的就是同样的大小写
+            continue;
+        }
+        if(x >= 'A' && x <= 'Z') { x += 'a' - 'A'; }
+        if(y >= 'A' && y <= 'Z') { y += 'a' - 'A'; }
+        if(x != y) {
+            return false;
+        }
+    }
+    return true;
 }
 
-// 解析处理
+// 和HEADER的顺序一致，全小写
+static const std::string_view HEADER_NAMES[HttpRequest::HDR_COUNT] = {
+    "host", "connection", "content-length", "content-type", "transfer-encoding", "accept", "accept-encoding",
+    "if-none-match", "if-modified-since", "range", "cookie", "user-agent", "expect", "upgrade", "referer",
+};
+
+// 先按长度和首字母分流，不认识的头大多一次比较都不用做
+HttpRequest::HEADER HttpRequest::LookupHeader(std::string_view name) {
+    if(name.empty()) {
+        return HDR_COUNT;
+    }
+    HEADER id = HDR_COUNT;
+    char first = name[0] | 0x20;
+    switch(name.size()) {
+    case 4:  id = HDR_HOST; break;
+    case 5:  id = HDR_RANGE; break;
+    case 6:  id = first == 'a' ? HDR_ACCEPT : first == 'c' ? HDR_COOKIE : HDR_EXPECT; break;
+    case 7:  id = first == 'u' ? HDR_UPGRADE : HDR_REFERER; break;
+    case 10: id = first == 'c' ? HDR_CONNECTION : HDR_USER_AGENT; break;
+    case 12: id = HDR_CONTENT_TYPE; break;
+    case 13: id = HDR_IF_NONE_MATCH; break;
+    case 14: id = HDR_CONTENT_LENGTH; break;
+    case 15: id = HDR_ACCEPT_ENCODING; break;
+    case 17: id = first == 't' ? HDR_TRANSFER_ENCODING : HDR_IF_MODIFIED_SINCE; break;
+    default: return HDR_COUNT;
+    }
+    // 表里全是小写字母和'-'，字母位或上0x20就是小写，'-'要原样相等
+    const std::string_view& lower = HEADER_NAMES[id];
+    if(lower.size() != name.size()) {
+        return HDR_COUNT;
+    }
+    for(size_t i = 0; i < name.size(); i++) {
+        char c = lower[i] == '-' ? name[i] : static_cast<char>(name[i] | 0x20);
+        if(c != lower[i]) {
+            return HDR_COUNT;
+        }
+    }
+    return id;
+}
+
+bool HttpRequest::IsKeepAlive() const {
+    return version_ == "1.1" && EqualsNoCase(known_[HDR_CONNECTION], "keep-alive");
+}
+
+// 解析处理，可以多次调用：数据不完整时保留状态，等下一批数据到来后继续
 bool HttpRequest::parse(Buffer& buff) {
     const char CRLF[] = "\r\n";      // 行结束符标志(回车换行)
     if(buff.ReadableBytes() <= 0) { // 没有可读的字节
@@ -30,12 +116,32 @@ bool HttpRequest::parse(Buffer& buff) {
     }
     // 读取数据
     while(buff.ReadableBytes() && state_ != FINISH) {
+        if(state_ == BODY) {    // 请求体不按行处理，有多少收多少
+            if(!ParseBody_(buff)) {
+                return false;
+            }
+            continue;
+        }
         // 从buff中的读指针开始到读指针结束，这块区域是未读取得数据并去处"\r\n"，返回有效数据得行末指针
         //从目前可读的到可读的尽头中，找到CRLF的位置，返回CRLF位置的指针
         //会一行一行的读，第一行读了肯定是请求行，然后请求行处理完了就处理请求头部
         const char* lineEnd = search(buff.Peek(), buff.BeginWriteConst(), CRLF, CRLF + 2);
-        // 转化为string类型
-        std::string line(buff.Peek(), lineEnd);//每一行都是要单独处理的吗？
+        if(lineEnd == buff.BeginWriteConst()) {     // 还没有收到完整的一行，等待更多数据
+            if(headerBytes_ + buff.ReadableBytes() > maxHeaderSize) {
+                LOG_WARN("Request header too large");
+                code_ = 431;
+                return false;
+            }
+            break;
+        }
+        headerBytes_ += lineEnd + 2 - buff.Peek();
+        if(headerBytes_ > maxHeaderSize) {      // 不等请求头收完，超过上限就拒绝
+            LOG_WARN("Request header too large");
+            code_ = 431;
+            return false;
+        }
+        // 行直接指向读缓冲区，需要保留的部分再复制到arena里
+        string_view line(buff.Peek(), lineEnd - buff.Peek());//每一行都是要单独处理的吗？
         switch(state_)
         {
         /*
@@ -45,55 +151,68 @@ bool HttpRequest::parse(Buffer& buff) {
             if(!ParseRequestLine_(line)) {
                 return false;
             }
-            ParsePath_();   // 解析路径
+            if(!ParsePath_()) {     // 解析路径
+                return false;
+            }
             break;    
         case HEADERS:
-            ParseHeader_(line);
-            if(buff.ReadableBytes() <= 2) { 
-                state_ = FINISH;
+            if(!ParseHeader_(line)) {
+                return false;
             }
             break;
-        case BODY:
-            ParseBody_(line);
-            break;
         default:
             break;
         }
-        if(lineEnd == buff.BeginWrite()) { break; } // 读完了
         buff.RetrieveUntil(lineEnd + 2);        // 跳过回车换行
     }
-    LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(), version_.c_str());
+    if(state_ == FINISH) {
+        LOG_DEBUG("[%s], [%s], [%s]", method_.data(), path_.data(), version_.data());
+    }
     return true;
 }
 
-// 解析路径
-void HttpRequest::ParsePath_() {
-    if(path_ == "/") {
-        path_ = "/index.html"; //如果用户输入的是/那么就是要访问/index.html
+// 解析路径：查一次路由表，由命中的路由决定如何改写；带".."段的路径直接拒绝
+bool HttpRequest::ParsePath_() {
+    size_t query = path_.find('?');
+    if(query != string::npos) {     // 把查询串从路径上拿下来单独解码，路径在'?'处截断
+        char* raw = const_cast<char*>(path_.data());    // path_是arena里的副本，可以原地修改
+        UrlCodec::ParseForm(raw + query + 1, path_.size() - query - 1, &queryArgs_);
+        raw[query] = '\0';
+        path_ = path_.substr(0, query);
     }
-    else {
-        for(auto &item: DEFAULT_HTML) {
-            if(item == path_) {
-                path_ += ".html";//或者有其他几项可能列在了HTML状态表里了
-                break;
-            }
-        }
+    if(Router::HasDotDot(path_)) {
+        LOG_WARN("Path escapes the document root: %s", path_.data());
+        code_ = 400;
+        return false;
+    }
+    RouteMatch match;
+    if(!Router::Instance()->Match(path_, &match)) {
+        return true;
+    }
+    tag_ = match.tag;
+    if(match.root) {    // 静态挂载：去掉挂载前缀，从挂载目录取文件
+        root_ = match.root;
+        path_ = match.rest;     // rest是路径的后缀，仍然以'\0'结尾
     }
+    if(match.handler) {
+        match.handler(*this, match);
+    }
+    return true;
 }
 
 //解析请求行
-bool HttpRequest::ParseRequestLine_(const string& line) {
-    regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$"); 
+bool HttpRequest::ParseRequestLine_(string_view line) {
     //请求行一般是这样的：GET / HTTP/1.1
-    //反正就是通过正则表达式来将buffer里面收到的请求数据包进行匹配
-    //匹配处需要的method字段，path字段和version字段。
+    //按空格切成method、path、version三段，三段内部都不能再有空格
     //解析完成后就将状态改为HEADERS准备继续解析后面的请求头部
-    smatch subMatch;
-    // 在匹配规则中，以括号()的方式来划分组别 一共三个括号 [0]表示整体
-    if(regex_match(line, subMatch, patten)) {      // 匹配指定字符串整体是否符合
-        method_ = subMatch[1];
-        path_ = subMatch[2];
-        version_ = subMatch[3];
+    size_t sp1 = line.find(' ');
+    size_t sp2 = sp1 == string_view::npos ? sp1 : line.find(' ', sp1 + 1);
+    if(sp2 != string_view::npos && line.compare(sp2 + 1, 5, "HTTP/") == 0 &&
+            line.find(' ', sp2 + 1) == string_view::npos) {
+        method_ = arena_.Copy(line.substr(0, sp1));
+        target_ = arena_.Copy(line.substr(sp1 + 1, sp2 - sp1 - 1));
+        path_ = arena_.Copy(target_);   // ParsePath_会在path_上原地截断查询串，target_留着原样
+        version_ = arena_.Copy(line.substr(sp2 + 6));
         state_ = HEADERS;   // 状态转换为下一个状态
         return true;
     }
@@ -101,124 +220,167 @@ bool HttpRequest::ParseRequestLine_(const string& line) {
     return false;
 }
 
-void HttpRequest::ParseHeader_(const string& line) {
-    regex patten("^([^:]*): ?(.*)$");//用正则表达式来获得需要的字段
-    smatch subMatch;
-    if(regex_match(line, subMatch, patten)) {//如果能匹配到，如果匹配不到了就处理body的部分
-        header_[subMatch[1]] = subMatch[2];
+bool HttpRequest::ParseHeader_(string_view line) {
+    if(line.empty()) {  // 空行，请求头结束，根据Content-Length决定是否有请求体
+        string_view len = known_[HDR_CONTENT_LENGTH];
+        // 不支持分块传输：当成没有请求体的话，分块的数据会被当成下一个流水线请求，前面有代理时就能夹带请求
+        if(!known_[HDR_TRANSFER_ENCODING].empty()) {
+            LOG_WARN("Transfer-Encoding not supported: %s", known_[HDR_TRANSFER_ENCODING].data());
+            code_ = len.empty() ? 501 : 400;    // 两个都有时前后端可能各信一个
+            return false;
+        }
+        if(!len.empty()) {
+            char* end = nullptr;
+            errno = 0;
+            unsigned long long n = strtoull(len.data(), &end, 10);  // arena里的值以'\0'结尾
+            if(*end != '\0' || errno == ERANGE || len[0] == '-') {
+                LOG_WARN("Bad Content-Length: %s", len.data());
+                code_ = 400;
+                return false;
+            }
+            if(n > maxBodySize) {   // 请求体还没开始读，直接拒绝
+                LOG_WARN("Request body too large: %llu", n);
+                code_ = 413;
+                return false;
+            }
+            contentLength_ = n;
+        }
+        if(contentLength_ > 0) {
+            body_.Init(bodySpillSize);
+            state_ = BODY;  // 状态转换为下一个状态
+        } else {
+            state_ = FINISH;
+        }
+        return true;
+    }
+    // 形如 "Name: value"，冒号后面最多跳过一个空格
+    size_t colon = line.find(':');
+    if(colon != string_view::npos) {
+        string_view value = line.substr(colon + 1);
+        if(!value.empty() && value[0] == ' ') {
+            value.remove_prefix(1);
+        }
+        string_view name = line.substr(0, colon);
+        HEADER id = LookupHeader(name);
+        if(id == HDR_CONTENT_LENGTH && !known_[id].empty() && known_[id] != value) {
+            LOG_WARN("Conflicting Content-Length");    // 两个不一样的长度，前后端理解不一致会被用来夹带请求
+            code_ = 400;
+            return false;
+        }
+        if(id != HDR_COUNT && known_[id].empty()) {
+            known_[id] = arena_.Copy(value);
+        } else {
+            header_.emplace_back(arena_.Copy(name), arena_.Copy(value));
+        }
     }
     else {
-        state_ = BODY;  // 状态转换为下一个状态
+        LOG_DEBUG("Bad header line: %.*s", (int)line.size(), line.data());
     }
+    return true;
 }
 
-void HttpRequest::ParseBody_(const string& line) {//这个时候line一行包含了所有信息了
-    body_ = line;
-    ParsePost_();
+bool HttpRequest::ParseBody_(Buffer& buff) {
+    size_t len = min(buff.ReadableBytes(), contentLength_ - body_.Size());
+    if(!body_.Append(buff.Peek(), len)) {
+        code_ = 500;
+        return false;
+    }
+    buff.Retrieve(len);
+    if(body_.Size() < contentLength_) {     // 还没收完，等下一批数据
+        return true;
+    }
+    if(!body_.IsSpilled()) {    // 落盘的请求体不做表单解析，留给处理函数自己读
+        ParsePost_();
+    }
     state_ = FINISH;    // 状态转换为下一个状态
-    LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
-}
-
-// 16进制转化为10进制
-int HttpRequest::ConverHex(char ch) {
-    if(ch >= 'A' && ch <= 'F') return ch -'A' + 10;
-    if(ch >= 'a' && ch <= 'f') return ch -'a' + 10;
-    return ch;
+    LOG_DEBUG("Body len:%d%s", (int)body_.Size(), body_.IsSpilled() ? " (spilled)" : "");
+    return true;
 }
 
 // 处理post请求
 // 就是用户要把自己想说的话写在了这个数据包里面，我们需要将其提取出来。
 
 void HttpRequest::ParsePost_() {//只有POST才会有body部分的信息
-    if(method_ == "POST" && header_["Content-Type"] == "application/x-www-form-urlencoded") {
-        //header_["Content-Type"]这个是一个头部字段，他描述请求或者响应中的数据格式
+    // 只看媒体类型，后面可能跟着"; charset=UTF-8"
+    string_view type = known_[HDR_CONTENT_TYPE].substr(0, known_[HDR_CONTENT_TYPE].find(';'));
+    while(!type.empty() && type.back() == ' ') { type.remove_suffix(1); }
+    if(method_ == "POST" && EqualsNoCase(type, "application/x-www-form-urlencoded")) {
+        //Content-Type这个是一个头部字段，他描述请求或者响应中的数据格式
         //如果是"application/x-www-form-urlencoded"，就以位置请求的数据是URL编码格式
         ParseFromUrlencoded_();     // POST请求体示例
         //基于上面这个函数将body里面的字段进行进一步的分解，判断这个数据包到底想干嘛哦
         //用body来填充post_表信息。填完之后再判断是不是要登录或者注册
 
-        if(DEFAULT_HTML_TAG.count(path_)) { // 如果是登录/注册的path，常用.count+哈希表的方式判断有无出现
-            int tag = DEFAULT_HTML_TAG.find(path_)->second; 
-            LOG_DEBUG("Tag:%d", tag);
-            if(tag == 0 || tag == 1) {
-                bool isLogin = (tag == 1);  // 为1则是登录
-                if(UserVerify(post_["username"], post_["password"], isLogin)) {
-                    path_ = "/welcome.html";//这个改path是什么意思？
-                } 
-                else {
-                    path_ = "/error.html";
-                }
-            }
+        if(tag_ == TAG_REGISTER || tag_ == TAG_LOGIN) { // 解析路径时已经由路由表打好了标签
+            LOG_DEBUG("Tag:%d", tag_);
+            verifyPending_ = true;      // 查库会阻塞，不在解析里做，由调用方交给数据库线程调用Verify()
         }
     }   
 }
 
-// 从url中解析编码
-void HttpRequest::ParseFromUrlencoded_() {
-    if(body_.size() == 0) { return; }
-
-    string key, value;
-    int num = 0;
-    int n = body_.size();
-    int i = 0, j = 0;
-
-    for(; i < n; i++) {
-        char ch = body_[i];
-        switch (ch) {
-        // key
-        case '=':
-            key = body_.substr(j, i - j);
-            j = i + 1;
-            break;
-        // 键值对中的空格换为+或者%20
-        case '+':
-            body_[i] = ' ';
-            break;
-        case '%':
-            num = ConverHex(body_[i + 1]) * 16 + ConverHex(body_[i + 2]);
-            body_[i + 2] = num % 10 + '0';
-            body_[i + 1] = num / 10 + '0';
-            i += 2;
-            break;
-        // 键值对连接符
-        case '&':
-            value = body_.substr(j, i - j);
-            j = i + 1;
-            post_[key] = value;
-            LOG_DEBUG("%s = %s", key.c_str(), value.c_str());
-            break;
-        default:
-            break;
-        }
+void HttpRequest::Verify() {
+    assert(verifyPending_);
+    verifyPending_ = false;
+    bool isLogin = (tag_ == TAG_LOGIN);  // 为1则是登录
+    if(UserVerify(post_.Get("username"), post_.Get("password"), isLogin)) {
+        path_ = "/welcome.html";//这个改path是什么意思？
+    } 
+    else {
+        path_ = "/error.html";
     }
-    assert(j <= i);//最后一次的value提取：
-    if(post_.count(key) == 0 && j < i) {
-        value = body_.substr(j, i - j);
-        post_[key] = value;
+}
+
+// 从url中解析编码：在请求体上原地解码，post_里存的是指向请求体的视图
+void HttpRequest::ParseFromUrlencoded_() {
+    string& body = body_.Memory();
+    if(body.size() == 0) { return; }
+    UrlCodec::ParseForm(&body[0], body.size(), &post_);
+    for(size_t i = 0; i < post_.size(); i++) {
+        LOG_DEBUG("%.*s = %.*s", (int)post_[i].first.size(), post_[i].first.data(),
+                  (int)post_[i].second.size(), post_[i].second.data());
     }
 }
 
-bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin) {
-    if(name == "" || pwd == "") { return false; }
-    LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
+// 查询可能被数据库卡住，交给看门狗计时
+static int Query_(MYSQL* sql, const char* order) {
+    WatchCall watch(Watchdog::SQL_QUERY);
+    return mysql_query(sql, order);
+}
+
+bool HttpRequest::UserVerify(string_view name, string_view pwd, bool isLogin) {
+    if(name.empty() || pwd.empty()) { return false; }
+    TraceScope trace(Tracer::VERIFY);
+    LOG_INFO("Verify name:%.*s pwd:%.*s", (int)name.size(), name.data(), (int)pwd.size(), pwd.data());
     MYSQL* sql;//获得一个指向某个具体的数据库的指针在下面这个函数中，但需要时mysql*的格式
     //conn会返回一个同样类型的数据给sql
-    SqlConnRAII(&sql,  SqlConnPool::Instance());//在连接池中为对应的指针赋值。
-    assert(sql);
+    SqlConnRAII sqlRAII(&sql,  SqlConnPool::Instance());//在连接池中为对应的指针赋值，函数返回时归还
+    if(!sql) {      // 连接池没有可用的连接（数据库连不上或者都在用）
+        LOG_ERROR("No sql connection for verify!");
+        return false;
+    }
     
+    // 表单已经按%xx解码，用户名密码里可能有引号、反斜杠、\0，拼进SQL之前先转义；太长的直接不认
+    if(name.size() > MAX_CREDENTIAL || pwd.size() > MAX_CREDENTIAL) {
+        LOG_WARN("Credential too long");
+        return false;
+    }
+    char escName[MAX_CREDENTIAL * 2 + 1], escPwd[MAX_CREDENTIAL * 2 + 1];
+    mysql_real_escape_string(sql, escName, name.data(), name.size());
+    mysql_real_escape_string(sql, escPwd, pwd.data(), pwd.size());
+
     bool flag = false;
     unsigned int j = 0;
-    char order[256] = { 0 };//查询的命令
+    char order[512] = { 0 };//查询的命令
     MYSQL_FIELD *fields = nullptr;
     MYSQL_RES *res = nullptr;//查询的结果集
     
     if(!isLogin) { flag = true; }
     /* 查询用户及密码 */
-    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%s' LIMIT 1", name.c_str());
+    snprintf(order, sizeof(order), "SELECT username, password FROM user WHERE username='%s' LIMIT 1", escName);
     //将指定用户名和密码存到order里面去
     LOG_DEBUG("%s", order);
 
-    if(mysql_query(sql, order)) { //在数据库中根据order命令查询到了对应的用户名和密码就返回0
+    if(Query_(sql, order)) { //在数据库中根据order命令查询到了对应的用户名和密码就返回0
         mysql_free_result(res);
         return false; 
     }
@@ -228,7 +390,7 @@ bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin
 
     while(MYSQL_ROW row = mysql_fetch_row(res)) {
         LOG_DEBUG("MYSQL ROW: %s %s", row[0], row[1]);
-        string password(row[1]);
+        string_view password(row[1]);
         /* 登录行为 且 用户名未被使用*/
         if(isLogin) {
             if(pwd == password) { flag = true; }
@@ -247,10 +409,10 @@ bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin
     /* 注册行为 且 用户名未被使用*/
     if(!isLogin && flag == true) {
         LOG_DEBUG("regirster!");
-        bzero(order, 256);
-        snprintf(order, 256,"INSERT INTO user(username, password) VALUES('%s','%s')", name.c_str(), pwd.c_str());
+        bzero(order, sizeof(order));
+        snprintf(order, sizeof(order), "INSERT INTO user(username, password) VALUES('%s','%s')", escName, escPwd);
         LOG_DEBUG( "%s", order);
-        if(mysql_query(sql, order)) { //将新的用户名和密码存到数据库里面去
+        if(Query_(sql, order)) { //将新的用户名和密码存到数据库里面去
             LOG_DEBUG( "Insert error!");
             flag = false; 
         }
@@ -261,33 +423,38 @@ bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin
     return flag;
 }
 
-std::string HttpRequest::path() const{
+std::string_view HttpRequest::path() const{
     return path_;
 }
 
-std::string& HttpRequest::path(){
-    return path_;
-}
-std::string HttpRequest::method() const {
+std::string_view HttpRequest::method() const {
     return method_;
 }
 
-std::string HttpRequest::version() const {
+std::string_view HttpRequest::version() const {
     return version_;
 }
-//根据给定的key返回body字段中对应的value
-std::string HttpRequest::GetPost(const std::string& key) const {
-    assert(key != "");
-    if(post_.count(key) == 1) {
-        return post_.find(key)->second;
+
+std::string_view HttpRequest::GetHeader(std::string_view key) const {
+    HEADER id = LookupHeader(key);
+    if(id != HDR_COUNT) {
+        return known_[id];
     }
-    return "";
+    for(const auto& header : header_) {
+        if(EqualsNoCase(header.first, key)) {
+            return header.second;
+        }
+    }
+    return std::string_view();
 }
 
-std::string HttpRequest::GetPost(const char* key) const {
-    assert(key != nullptr);
-    if(post_.count(key) == 1) {
-        return post_.find(key)->second;
-    }
-    return "";
+//根据给定的key返回body字段中对应的value
+std::string_view HttpRequest::GetPost(std::string_view key) const {
+    assert(!key.empty());
+    return post_.Get(key);
+}
+
+std::string_view HttpRequest::GetQuery(std::string_view key) const {
+    assert(!key.empty());
+    return queryArgs_.Get(key);
 }
@@ -1,16 +1,23 @@
 #ifndef HTTP_REQUEST_H
 #define HTTP_REQUEST_H
 
-#include <unordered_map>
-#include <unordered_set>
 #include <string>
-#include <regex>    // 正则表达式
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <algorithm>     // search
 #include <errno.h>     
 #include <mysql/mysql.h>  //mysql
 
 #include "buffer.h"
 #include "log.h"
 #include "sqlconnpool.h"
+#include "router.h"
+#include "bodysink.h"
+#include "urlcodec.h"
+#include "arena.h"
+#include "tracer.h"
+#include "watchdog.h"
 
 class HttpRequest {
 public:
@@ -20,41 +27,108 @@ public:
         BODY,
         FINISH,        
     };
+
+    enum ROUTE_TAG {    // 注册路由时附带的标签，解析请求体时使用
+        TAG_REGISTER = 0,
+        TAG_LOGIN = 1,
+    };
+
+    // 常用的请求头，解析时按名字（不区分大小写）直接放进对应的槽，查找是一次数组下标
+    enum HEADER {
+        HDR_HOST,
+        HDR_CONNECTION,
+        HDR_CONTENT_LENGTH,
+        HDR_CONTENT_TYPE,
+        HDR_TRANSFER_ENCODING,
+        HDR_ACCEPT,
+        HDR_ACCEPT_ENCODING,
+        HDR_IF_NONE_MATCH,
+        HDR_IF_MODIFIED_SINCE,
+        HDR_RANGE,
+        HDR_COOKIE,
+        HDR_USER_AGENT,
+        HDR_EXPECT,
+        HDR_UPGRADE,
+        HDR_REFERER,
+        HDR_COUNT,      // 不认识的请求头
+    };
+    static HEADER LookupHeader(std::string_view name);
     
-    HttpRequest() { Init(); }
+    HttpRequest() { header_.reserve(16); Init(); }
     ~HttpRequest() = default;
 
-    void Init();
-    bool parse(Buffer& buff);   
+    void Init();    // 开始新的请求，同时复位arena，上一个请求的所有视图随之失效
+    bool parse(Buffer& buff);   // 出错返回false，错误码见ErrorCode()；请求可能还没收完，见IsFinish()
+    bool IsFinish() const { return state_ == FINISH; }
+    bool InProgress() const { return state_ == HEADERS || state_ == BODY; }    // 请求行之后的部分已经开始解析
+    bool InBody() const { return state_ == BODY; }
+    // 登录/注册请求解析完之后还要查库，Verify()会阻塞，根据结果改写path
+    bool NeedsVerify() const { return verifyPending_; }
+    void Verify();
+    int ErrorCode() const { return code_; }
+
+    // 下面的视图都指向本连接的arena，以'\0'结尾，在下一次Init之前有效
+    std::string_view path() const;
+    std::string_view target() const { return target_; }  // 请求行里原样的请求目标（带查询串），path()是路由改写之后的，记日志用这个
+    std::string_view method() const;//const的意思是常量成员函数，不能修改任何成员变量的值
+    std::string_view version() const;
+    std::string_view GetHeader(std::string_view key) const;   // 名字不区分大小写，找不到返回空串
+    std::string_view GetHeader(HEADER id) const { return known_[id]; }
+    const char* root() const { return root_; }    // 命中静态挂载时的目录，否则为nullptr
+    std::string_view GetPost(std::string_view key) const;     // 表单字段，指向请求体内部，请求结束前有效
+    std::string_view GetQuery(std::string_view key) const;    // 查询串字段
+    const BodySink& body() const { return body_; }
+    Arena* arena() { return &arena_; }    // 每个连接一个请求对象，也就是每个连接一个arena，响应也从这里分配
 
-    std::string path() const;
-    std::string& path();//返回一个字符串的引用。//这个path是什么的path？这几个返回是什么东西，是解出来的字段吗？
-    std::string method() const;//const的意思是常量成员函数，不能修改任何成员变量的值
-    std::string version() const;
-    std::string GetPost(const std::string& key) const;
-    std::string GetPost(const char* key) const;
+    // 路由回调直接生成的响应体（例如/metrics），有内容时不再去找文件
+    void SetContent(std::string_view content, std::string_view type) { content_ = content; contentType_ = type; }
+    bool HasContent() const { return content_.data() != nullptr; }
+    std::string_view Content() const { return content_; }
+    std::string_view ContentType() const { return contentType_; }
+
+    // 对端是不是本机回环地址，由连接在建立时设置，Init不清除
+    void SetPeerLocal(bool local) { peerLocal_ = local; }
+    bool IsPeerLocal() const { return peerLocal_; }
 
     bool IsKeepAlive() const; 
 
+    static void RegisterRoutes(Router* router);     // 注册默认页面的路由
+
+    static size_t maxHeaderSize;    // 请求行+请求头的上限，超过返回431
+    static size_t maxBodySize;      // 请求体的上限，超过返回413
+    static size_t bodySpillSize;    // 请求体超过该大小后转存到临时文件
+
 private:
-    bool ParseRequestLine_(const std::string& line);    // 处理请求行
-    void ParseHeader_(const std::string& line);         // 处理请求头
-    void ParseBody_(const std::string& line);           // 处理请求体
+    bool ParseRequestLine_(std::string_view line);      // 处理请求行
+    bool ParseHeader_(std::string_view line);           // 处理请求头
+    bool ParseBody_(Buffer& buff);                      // 处理请求体，按Content-Length流式接收
 
-    void ParsePath_();                                  // 处理请求路径
+    bool ParsePath_();                                  // 处理请求路径
     void ParsePost_();                                  // 处理Post事件
     void ParseFromUrlencoded_();                        // 从url种解析编码
 
-    static bool UserVerify(const std::string& name, const std::string& pwd, bool isLogin);  // 用户验证
+    static void RouteIndex_(HttpRequest& req, const RouteMatch& match);
+    static void RouteHtml_(HttpRequest& req, const RouteMatch& match);
 
-    PARSE_STATE state_;//枚举类
-    std::string method_, path_, version_, body_;
-    std::unordered_map<std::string, std::string> header_;
-    std::unordered_map<std::string, std::string> post_;
+    static const size_t MAX_CREDENTIAL = 64;    // 用户名、密码的长度上限
+    static bool UserVerify(std::string_view name, std::string_view pwd, bool isLogin);  // 用户验证
 
-    static const std::unordered_set<std::string> DEFAULT_HTML;
-    static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG;
-    static int ConverHex(char ch);  // 16进制转换为10进制
+    PARSE_STATE state_;//枚举类
+    Arena arena_;
+    std::string_view method_, path_, version_, target_;
+    BodySink body_;
+    size_t contentLength_;
+    size_t headerBytes_;    // 已经解析过的请求头字节数
+    int code_;              // 解析出错时的状态码
+    std::string_view known_[HDR_COUNT];     // 同名的请求头出现多次时只有第一个进槽，后面的放进header_
+    std::vector<std::pair<std::string_view, std::string_view>> header_;    // 其它请求头很少，扁平数组线性查找
+    FormMap post_;
+    FormMap queryArgs_;
+    int tag_;               // 命中路由的标签，-1表示没有
+    bool verifyPending_;
+    const char* root_;
+    std::string_view content_, contentType_;
+    bool peerLocal_ = false;
 };
 
 #endif
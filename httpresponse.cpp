@@ -29,6 +29,11 @@ const unordered_map<int, string> HttpResponse::CODE_STATUS = {//常用状态码
     { 400, "Bad Request" },
     { 403, "Forbidden" },
     { 404, "Not Found" },
+    { 413, "Payload Too Large" },
+    { 431, "Request Header Fields Too Large" },
+    { 500, "Internal Server Error" },
+    { 501, "Not Implemented" },
+    { 503, "Service Unavailable" },
 };
 
 const unordered_map<int, string> HttpResponse::CODE_PATH = {
@@ -39,7 +44,9 @@ const unordered_map<int, string> HttpResponse::CODE_PATH = {
 
 HttpResponse::HttpResponse() {///初始化
     code_ = -1;
-    path_ = srcDir_ = "";
+    path_ = file_ = "";
+    srcDir_ = "";
+    arena_ = nullptr;
     isKeepAlive_ = false;
     mmFile_ = nullptr; 
     mmFileStat_ = { 0 };
@@ -50,20 +57,41 @@ HttpResponse::~HttpResponse() {
 }
 
 //根据请求的内容解析出对应资源的位置，就可以将参数传递到这里来形成响应报文
-void HttpResponse::Init(const string& srcDir, string& path, bool isKeepAlive, int code){
-    assert(srcDir != "");
+void HttpResponse::Init(const char* srcDir, string_view path, Arena* arena, bool isKeepAlive, int code){
+    assert(srcDir && *srcDir && arena);
     if(mmFile_) { UnmapFile(); }
     code_ = code;
     isKeepAlive_ = isKeepAlive;
     path_ = path;//这个path跟昨天request的那个path有啥区别呢？
     srcDir_ = srcDir;//这个好像是要访问资源的地址
+    arena_ = arena;
+    file_ = arena_->Concat(srcDir_, path_);
     mmFile_ = nullptr; //将要访问的文件映射到内存中，然后用指针指向这个文件。
     mmFileStat_ = { 0 };
+    content_ = contentType_ = std::string_view();
+}
+
+void HttpResponse::SetContent(string_view content, string_view type) {
+    content_ = content;
+    contentType_ = type;
 }
 
 void HttpResponse::MakeResponse(Buffer& buff) {//将资源填满buff
     /* 判断请求的资源文件 */
-    if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
+    if(code_ >= 400) {
+        // 解析阶段已经确定的错误（400/413/431...），不再去找请求的文件
+    }
+    else if(content_.data()) {      // 路由直接给出的内容，不是文件
+        code_ = 200;
+        AddStateLine_(buff);
+        AddHeader_(buff);
+        char header[64];
+        int len = snprintf(header, sizeof(header), "Content-length: %zu\r\n\r\n", content_.size());
+        buff.Append(header, len);
+        buff.Append(content_);
+        return;
+    }
+    else if(stat(file_.data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
         code_ = 404;
     }
     else if(!(mmFileStat_.st_mode & S_IROTH)) {
@@ -89,20 +117,27 @@ size_t HttpResponse::FileLen() const {
 void HttpResponse::ErrorHtml_() {
     if(CODE_PATH.count(code_) == 1) {
         path_ = CODE_PATH.find(code_)->second;//path还是放对应资源的位置，如果有错误的请求出现，那么响应也会按照规定的403，402给
-        stat((srcDir_ + path_).data(), &mmFileStat_);
+        file_ = arena_->Concat(srcDir_, path_);
+        stat(file_.data(), &mmFileStat_);
+    }
+    else if(code_ >= 400) {     // 没有对应的错误页面，由ErrorContent生成
+        path_ = file_ = "";
+        mmFileStat_ = { 0 };
     }
 }
 
 void HttpResponse::AddStateLine_(Buffer& buff) {//首先先根据request请求的东西将响应状态行填到buff
-    string status;
+    const char* status;
     if(CODE_STATUS.count(code_) == 1) {
-        status = CODE_STATUS.find(code_)->second;
+        status = CODE_STATUS.find(code_)->second.c_str();
     }
     else {
         code_ = 400;
-        status = CODE_STATUS.find(400)->second;
+        status = CODE_STATUS.find(400)->second.c_str();
     }
-    buff.Append("HTTP/1.1 " + to_string(code_) + " " + status + "\r\n");
+    char line[128];
+    int len = snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n", code_, status);
+    buff.Append(line, len);
 }
 
 //再将响应头部填到buff
@@ -114,26 +149,39 @@ void HttpResponse::AddHeader_(Buffer& buff) {
     } else{
         buff.Append("close\r\n");
     }
-    buff.Append("Content-type: " + GetFileType_() + "\r\n");
+    buff.Append("Content-type: ");
+    buff.Append(contentType_.empty() ? GetFileType_() : contentType_);
+    buff.Append("\r\n");
 }
 //再将请求的资源填到buff里面去
 void HttpResponse::AddContent_(Buffer& buff) {
-    int srcFd = open((srcDir_ + path_).data(), O_RDONLY);//依据之前解析request的资源地址来打开对应的文件
+    if(path_.empty()) {
+        ErrorContent(buff, CODE_STATUS.find(code_)->second);
+        return;
+    }
+    int srcFd = open(file_.data(), O_RDONLY);//依据之前解析request的资源地址来打开对应的文件
     if(srcFd < 0) { 
         ErrorContent(buff, "File NotFound!");
         return; 
     }
 
     //将文件映射到内存提高文件的访问速度  MAP_PRIVATE 建立一个写入时拷贝的私有映射
-    LOG_DEBUG("file path %s", (srcDir_ + path_).data());
-    int* mmRet = (int*)mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);//映射到内存中，并用一个指针指向它
-    if(*mmRet == -1) {
+    LOG_DEBUG("file path %s", file_.data());
+    int* mmRet;
+    {
+        WatchCall watch(Watchdog::MMAP);
+        mmRet = (int*)mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);//映射到内存中，并用一个指针指向它
+    }
+    if(mmRet == MAP_FAILED) {
+        close(srcFd);
         ErrorContent(buff, "File NotFound!");
         return; 
     }
     mmFile_ = (char*)mmRet;
     close(srcFd);
-    buff.Append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n\r\n");//将指针存到buff中去
+    char header[64];
+    int len = snprintf(header, sizeof(header), "Content-length: %lld\r\n\r\n", (long long)mmFileStat_.st_size);
+    buff.Append(header, len);//将指针存到buff中去
 }
 
 void HttpResponse::UnmapFile() {
@@ -144,34 +192,34 @@ void HttpResponse::UnmapFile() {
 }
 
 // 判断文件类型 
-string HttpResponse::GetFileType_() {
-    string::size_type idx = path_.find_last_of('.');
-    if(idx == string::npos) {   // 最大值 find函数在找不到指定值得情况下会返回string::npos
+string_view HttpResponse::GetFileType_() {
+    string_view::size_type idx = path_.find_last_of('.');
+    if(idx == string_view::npos || path_.size() - idx > 8) {   // 找不到后缀，或者后缀长得不像已知类型
         return "text/plain";
     }
-    string suffix = path_.substr(idx);
+    string suffix(path_.substr(idx));   // 后缀很短，走小字符串优化，不分配内存
     if(SUFFIX_TYPE.count(suffix) == 1) {
         return SUFFIX_TYPE.find(suffix)->second;
     }
     return "text/plain";
 }
 
-void HttpResponse::ErrorContent(Buffer& buff, string message) //资源打不开，资源找不到都要将错误返回到body里面，然后写到buff
+void HttpResponse::ErrorContent(Buffer& buff, string_view message) //资源打不开，资源找不到都要将错误返回到body里面，然后写到buff
 {
-    string body;
-    string status;
-    body += "<html><title>Error</title>";
-    body += "<body bgcolor=\"ffffff\">";
+    const char* status;
     if(CODE_STATUS.count(code_) == 1) {
-        status = CODE_STATUS.find(code_)->second;
+        status = CODE_STATUS.find(code_)->second.c_str();
     } else {
         status = "Bad Request";
     }
-    body += to_string(code_) + " : " + status  + "\n";
-    body += "<p>" + message + "</p>";
-    body += "<hr><em>TinyWebServer</em></body></html>";
-
-    buff.Append("Content-length: " + to_string(body.size()) + "\r\n\r\n");
-    buff.Append(body);
+    char body[512];
+    int len = snprintf(body, sizeof(body),
+            "<html><title>Error</title><body bgcolor=\"ffffff\">%d : %s\n<p>%.*s</p><hr><em>TinyWebServer</em></body></html>",
+            code_, status, (int)message.size(), message.data());
+    len = std::min<int>(len, sizeof(body) - 1);
+
+    char header[64];
+    int n = snprintf(header, sizeof(header), "Content-length: %d\r\n\r\n", len);
+    buff.Append(header, n);
+    buff.Append(body, len);
 }
-
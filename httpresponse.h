@@ -2,6 +2,8 @@
 #define HTTP_RESPONSE_H
 
 #include <unordered_map>
+#include <string>
+#include <string_view>
 #include <fcntl.h>       // open
 #include <unistd.h>      // close
 #include <sys/stat.h>    // stat
@@ -9,19 +11,23 @@
 
 #include "buffer.h"
 #include "log.h"
+#include "arena.h"
+#include "watchdog.h"
 
 class HttpResponse {
 public:
     HttpResponse();
     ~HttpResponse();
 
-    void Init(const std::string& srcDir, std::string& path, bool isKeepAlive = false, int code = -1);
+    // path和拼出来的文件路径都放在请求所在连接的arena里，不再复制字符串
+    void Init(const char* srcDir, std::string_view path, Arena* arena, bool isKeepAlive = false, int code = -1);
     void MakeResponse(Buffer& buff);
     void UnmapFile();
     char* File();
     size_t FileLen() const;
-    void ErrorContent(Buffer& buff, std::string message);
+    void ErrorContent(Buffer& buff, std::string_view message);
     int Code() const { return code_; }
+    void SetContent(std::string_view content, std::string_view type);  // 内存中的响应体，在Init之后调用
 
 private:
     void AddStateLine_(Buffer &buff);
@@ -29,13 +35,16 @@ private:
     void AddContent_(Buffer &buff);
 
     void ErrorHtml_();
-    std::string GetFileType_();
+    std::string_view GetFileType_();
 
     int code_;
     bool isKeepAlive_;
 
-    std::string path_;
-    std::string srcDir_;
+    std::string_view path_;
+    const char* srcDir_;
+    std::string_view file_;     // srcDir_ + path_，以'\0'结尾
+    Arena* arena_;
+    std::string_view content_, contentType_;
     
     char* mmFile_; 
     struct stat mmFileStat_;
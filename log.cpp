@@ -1,34 +1,57 @@
 #include "log.h"
 
+#include <fcntl.h>
+#include <stdint.h>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#ifdef TINYWEB_ZLIB
+#include <zlib.h>
+#endif
+
+Log::Options Log::options;
+
 // 构造函数
 Log::Log() {
-    fp_ = nullptr;
+    fd_ = -1;
+    fileBytes_ = 0;
+    segment_ = 0;
+    nextDay_ = 0;
     deque_ = nullptr;
     writeThread_ = nullptr;
-    lineCount_ = 0;
-    toDay_ = 0;
     isAsync_ = false;
+    isOpen_ = false;
+    level_ = 1;
+    dropped_ = 0;
+    droppedTotal_ = 0;
 }
 
 Log::~Log() {
-    while(!deque_->empty()) {
-        deque_->flush();    // 唤醒消费者，处理掉剩下的任务
+    if(writeThread_) {
+        while(!deque_->empty()) {
+            deque_->flush();    // 唤醒消费者，处理掉剩下的任务
+        }
+        deque_->Close();    // 关闭队列
+        writeThread_->join();   // 等待当前线程完成手中的任务
     }
-    deque_->Close();    // 关闭队列
-    writeThread_->join();   // 等待当前线程完成手中的任务
-    if(fp_) {       // 冲洗文件缓冲区，关闭文件描述符
-        lock_guard<mutex> locker(mtx_);
-        flush();        // 清空缓冲区中的数据
-        fclose(fp_);    // 关闭日志文件
+    if(compressThread_) {   // 写线程换段时还会往这里放，所以等它先退出
+        while(!compressQueue_->empty()) {
+            compressQueue_->flush();
+        }
+        compressQueue_->Close();
+        compressThread_->join();
     }
+    lock_guard<mutex> locker(mtx_);
+    WriteBlocks_(true);
+    CloseSegment_(false);
 }
 
-// 唤醒阻塞队列消费者，开始写日志
+// 唤醒阻塞队列消费者，开始写日志；同步模式下每行已经直接写进文件了
 void Log::flush() {
     if(isAsync_) {  // 只有异步日志才会用到deque
         deque_->flush();
     }
-    fflush(fp_);    // 清空输入缓冲区
 }
 
 // 懒汉模式 局部静态变量法（这种方法不需要加锁和解锁操作）
@@ -42,13 +65,70 @@ void Log::FlushLogThread() {
     Log::Instance()->AsyncWrite_();//线程的工作函数，写的时候才创建一个变量
 }
 
-// 写线程真正的执行函数
+// 写线程真正的执行函数：一次把队列里有的都取出来（一次加锁，不搬字符串），攒够整块就写，这一批完了把剩下的也写掉
 void Log::AsyncWrite_() {
-    string str = "";
-    while(deque_->pop(str)) {//实现从deque->log文件，str以引用的形式传入到函数中，返回时会给其赋值
+    std::deque<std::string> batch;
+    while(deque_->pop_batch(batch, SIZE_MAX) > 0) {
         lock_guard<mutex> locker(mtx_);
-        fputs(str.c_str(), fp_);//将组赛队列中弹出的str写到文件中
-    }//终于明白了，这个pop函数返回值一直是true，然后会一直使得写线程在工作函数中工作。
+        RotateIfNeeded_();      // 在写这一批之前换，换天之后的第一行不会落进前一天的文件
+        for(const std::string& str : batch) {
+            buff_.Append(str);
+            WriteBlocks_(false);
+        }
+        batch.clear();
+        uint64_t dropped = dropped_.exchange(0);
+        if(dropped) {
+            time_t now = time(nullptr);
+            struct tm t;
+            localtime_r(&now, &t);
+            char note[128];
+            int n = snprintf(note, sizeof(note), "%d-%02d-%02d %02d:%02d:%02d.000000 [warn] : log queue full, %llu lines dropped\n",
+                             t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, (unsigned long long)dropped);
+            buff_.Append(note, n);
+        }
+        WriteBlocks_(true);
+    }
+}
+
+// 压缩线程：调低优先级，和工作线程抢CPU时让着它们
+void Log::CompressLoop_() {
+    setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 10);
+    string fileName;
+    while(compressQueue_->pop(fileName)) {
+        Compress_(fileName);
+    }
+}
+
+// 压成 文件名.gz，先写临时文件再改名，中途失败留着原文件
+bool Log::Compress_(const std::string& fileName) {
+#ifdef TINYWEB_ZLIB
+    std::string tmpName = fileName + ".gz.tmp";
+    int src = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+    if(src < 0) {
+        return false;
+    }
+    gzFile dst = gzopen(tmpName.c_str(), "wb6");
+    bool ok = dst != nullptr;
+    char chunk[BLOCK_SIZE];
+    ssize_t len = 0;
+    while(ok && (len = ::read(src, chunk, sizeof(chunk))) > 0) {
+        ok = gzwrite(dst, chunk, static_cast<unsigned>(len)) == len;
+    }
+    ok = ok && len == 0;
+    if(dst && gzclose(dst) != Z_OK) {
+        ok = false;
+    }
+    close(src);
+    if(ok && rename(tmpName.c_str(), (fileName + ".gz").c_str()) == 0) {
+        unlink(fileName.c_str());
+        return true;
+    }
+    unlink(tmpName.c_str());
+    return false;
+#else
+    (void)fileName;
+    return false;
+#endif
 }
 
 // 初始化日志实例
@@ -56,139 +136,170 @@ void Log::init(int level, const char* path, const char* suffix, int maxQueCapaci
     //主要确定日志记录方式，分配好写日志的资源，扩张好线程，准备好文件准备好缓冲区buffer，记录好时间
     isOpen_ = true;
     level_ = level;
-    path_ = path;
-    suffix_ = suffix;
+    {
+        // 重新初始化时先把旧文件里该写的写完，再换目录
+        lock_guard<mutex> locker(mtx_);
+        WriteBlocks_(true);
+        CloseSegment_(false);
+        path_ = path;
+        suffix_ = suffix;
+        segment_ = 0;
+        OpenSegment_(time(nullptr));
+        assert(fd_ >= 0);//初始化结束之后要确保有打开一个真正的文件
+    }
+
+#ifdef TINYWEB_ZLIB
+    if(options.compress && !compressQueue_) {
+        compressQueue_.reset(new BlockQueue<std::string>(64));
+        compressThread_.reset(new thread([this]() { CompressLoop_(); }));
+    }
+#endif
     if(maxQueCapacity) {    // 异步方式
         isAsync_ = true;
         if(!deque_) {   // 为空则创建一个
-            unique_ptr<BlockQueue<std::string>> newQue(new BlockQueue<std::string>);//使用只能指针更加高效，不用自己手动回收
+            unique_ptr<BlockQueue<std::string>> newQue(new BlockQueue<std::string>(maxQueCapacity));
             // 阻塞队列，因为unique_ptr不支持普通的拷贝或赋值操作,所以采用move
-            // 将动态申请的内存权给deque，newDeque被释放
             deque_ = move(newQue);  // 左值变右值,掏空newDeque
-            //不懂为什么不直接deque：可能是因为不一定要用异步写日志，但是需要将异步的情况都用一个变量来先写，这里如果一个if就实现不了
             unique_ptr<thread> newThread(new thread(FlushLogThread));//建立新线程
             writeThread_ = move(newThread);
         }
     } else {
         isAsync_ = false;
     }
+}
 
-    lineCount_ = 0;
-    time_t timer = time(nullptr);
-    struct tm* systime = localtime(&timer);
-    char fileName[LOG_NAME_LEN] = {0};
-    snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s", 
-            path_, systime->tm_year + 1900, systime->tm_mon + 1, systime->tm_mday, suffix_);
-    toDay_ = systime->tm_mday;//记录好时间
-
-    {
-        lock_guard<mutex> locker(mtx_);
-        buff_.RetrieveAll();//清空buff
-        if(fp_) {   // 重新打开？打开啥？初始化的时候log也可能并不是刚刚被实例化，所以如果此时log打开了另外一个文件的话，就要将目前缓冲区的东西全部清空
-            flush();
-            fclose(fp_);
-        }
-        fp_ = fopen(fileName, "a"); // 打开文件读取并附加写入
-        if(fp_ == nullptr) {
-            mkdir(fileName, 0777);///0777咩意思
-            fp_ = fopen(fileName, "a"); // 生成目录文件（最大权限）
+void Log::WriteBlocks_(bool all) {
+    size_t len = buff_.ReadableBytes();
+    if(!all) {
+        len -= len % BLOCK_SIZE;
+    }
+    const char* data = buff_.Peek();
+    size_t done = 0;
+    while(fd_ >= 0 && done < len) {
+        ssize_t n = ::write(fd_, data + done, len - done);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            break;      // 磁盘满之类的写不进去，这一批就丢了，不能让日志卡住
         }
-        assert(fp_ != nullptr);//初始化结束之后要确保fp_有打开一个真正的文件
+        done += n;
     }
+    fileBytes_ += done;
+    buff_.Retrieve(len);
 }
 
-void Log::write(int level, const char *format, ...) {//写一条就是将一条记录写到log里面/异步写到deque里面
-    struct timeval now = {0, 0};
-    gettimeofday(&now, nullptr);
-    time_t tSec = now.tv_sec;
-    struct tm *sysTime = localtime(&tSec);
-    struct tm t = *sysTime;
-    va_list vaList;
+void Log::RotateIfNeeded_() {
+    time_t now = time(nullptr);
+    bool newDay = now >= nextDay_;
+    if(!newDay && fileBytes_ < options.maxFileBytes) {
+        return;
+    }
+    WriteBlocks_(true);
+    CloseSegment_(true);
+    segment_ = newDay ? 0 : segment_ + 1;
+    OpenSegment_(now);
+}
 
-    // 日志日期 日志行数  如果不是今天或行数超了
-    if (toDay_ != t.tm_mday || (lineCount_ && (lineCount_  %  MAX_LINES == 0)))
-    {
-        unique_lock<mutex> locker(mtx_);//看看拿不拿得到锁，拿得到锁说明没有人在处理这个日志，
-        locker.unlock();//这是在？可能是拿到锁了就不管了。就还锁了
-        
-        char newFile[LOG_NAME_LEN];
-        char tail[36] = {0};
-        snprintf(tail, 36, "%04d_%02d_%02d", t.tm_year + 1900, t.tm_mon + 1, t.tm_mday);
-
-        if (toDay_ != t.tm_mday)    // 时间不匹配，则替换为最新的日志文件名
-        {
-            snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s%s", path_, tail, suffix_);
-            toDay_ = t.tm_mday;
-            lineCount_ = 0;
+// 文件名 目录/2024_01_31.log，同一天超过大小上限后是 目录/2024_01_31-1.log、-2.log……
+void Log::OpenSegment_(time_t now) {
+    struct tm t;
+    localtime_r(&now, &t);
+    struct tm midnight = t;
+    midnight.tm_hour = midnight.tm_min = midnight.tm_sec = 0;
+    midnight.tm_mday++;
+    midnight.tm_isdst = -1;
+    nextDay_ = mktime(&midnight);
+
+    for(bool madeDir = false; ; ) {
+        char name[512];
+        if(segment_ == 0) {
+            snprintf(name, sizeof(name), "%s/%04d_%02d_%02d%s", path_, t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, suffix_);
+        } else {
+            snprintf(name, sizeof(name), "%s/%04d_%02d_%02d-%d%s", path_, t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, segment_, suffix_);
         }
-        else {
-            snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s-%d%s", path_, tail, (lineCount_  / MAX_LINES), suffix_);
+        fileName_ = name;
+        if(access((fileName_ + ".gz").c_str(), F_OK) == 0) {     // 上次运行已经换下来压掉的段，不覆盖
+            segment_++;
+            continue;
         }
-        //如果到了第二天，那么日志要换时间了，还有就是如果现在写的时候超出了行数，就需要重新打开一个文件。
-
-        locker.lock();//之前处理完了跟buffer，后面要处理跟fp和buffer有关的共享资源，所以需要加锁。
-
-        flush();//将buffe中的东西写到log文件中
-        fclose(fp_);
-        fp_ = fopen(newFile, "a");
-        assert(fp_ != nullptr);
-    }
-
-    // 在buffer内生成一条对应的日志信息
-    {
-        unique_lock<mutex> locker(mtx_);
-        lineCount_++;
-        int n = snprintf(buff_.BeginWrite(), 128, "%d-%02d-%02d %02d:%02d:%02d.%06ld ",
-                    t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
-                    t.tm_hour, t.tm_min, t.tm_sec, now.tv_usec);
-                    
-        buff_.HasWritten(n);
-        AppendLogLevelTitle_(level);    
-
-        va_start(vaList, format);
-        int m = vsnprintf(buff_.BeginWrite(), buff_.WritableBytes(), format, vaList);
-        va_end(vaList);
-
-        buff_.HasWritten(m);
-        buff_.Append("\n\0", 2);
-
-        if(isAsync_ && deque_ && !deque_->full()) { // 异步方式（加入阻塞队列中，等待写线程读取日志信息）
-            deque_->push_back(buff_.RetrieveAllToStr());//buff->deque->fp第二步是用开了一个线程来实现的。开了一个线程然后更加
-            //？？？？这个将东西写到deque里面了，线程也已经在init的时候开启了，但是什么时候才会将duque的 东西读入log文件呢？循环操作
-        } else {    // 同步方式（直接向文件中写入日志信息）
-            fputs(buff_.Peek(), fp_);   // 同步就直接写入文件buff->fp
+        fd_ = open(name, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if(fd_ < 0 && errno == ENOENT && !madeDir) {
+            mkdir(path_, 0777);     // 目录不存在时建目录，不是建一个和日志文件同名的目录
+            madeDir = true;
+            continue;
         }
-        buff_.RetrieveAll();    // 清空buff
+        if(fd_ < 0) {
+            fileBytes_ = 0;
+            return;
+        }
+        struct stat st;
+        fileBytes_ = fstat(fd_, &st) == 0 ? st.st_size : 0;
+        if(fileBytes_ >= options.maxFileBytes) {    // 重启之前这一段已经写满了
+            close(fd_);
+            segment_++;
+            continue;
+        }
+        break;
+    }
+    if(options.preallocate) {
+        // KEEP_SIZE只预留块，文件长度照旧，追加写时不用再为分配块改元数据；文件系统不支持就算了
+        fallocate(fd_, FALLOC_FL_KEEP_SIZE, fileBytes_, options.maxFileBytes - fileBytes_);
     }
 }
 
-// 添加日志等级
-void Log::AppendLogLevelTitle_(int level) {
-    switch(level) {
-    case 0:
-        buff_.Append("[debug]: ", 9);
-        break;
-    case 1:
-        buff_.Append("[info] : ", 9);
-        break;
-    case 2:
-        buff_.Append("[warn] : ", 9);
-        break;
-    case 3:
-        buff_.Append("[error]: ", 9);
-        break;
-    default:
-        buff_.Append("[info] : ", 9);
-        break;
+void Log::CloseSegment_(bool compress) {
+    if(fd_ < 0) {
+        return;
+    }
+    if(options.preallocate) {
+        ftruncate(fd_, fileBytes_);     // 还掉没用完的预留空间
+    }
+    close(fd_);
+    fd_ = -1;
+    if(compress && compressQueue_) {
+        compressQueue_->try_push_back(std::string(fileName_));     // 压缩跟不上时这一段就不压了
     }
 }
 
-int Log::GetLevel() {
-    lock_guard<mutex> locker(mtx_);
-    return level_;
-}
+// 在调用线程的缓冲区里拼好一行；秒数没变时复用上次格式化好的日期时间
+void Log::write(int level, const char *format, ...) {
+    static const char* const TITLES[] = { "[debug]: ", "[info] : ", "[warn] : ", "[error]: " };
+    thread_local char line[LINE_LEN];
+    thread_local char stamp[64];
+    thread_local time_t stampSec = -1;
 
-void Log::SetLevel(int level) {
-    lock_guard<mutex> locker(mtx_);
-    level_ = level;
+    struct timeval now = {0, 0};
+    gettimeofday(&now, nullptr);
+    if(now.tv_sec != stampSec) {
+        struct tm t;
+        localtime_r(&now.tv_sec, &t);
+        snprintf(stamp, sizeof(stamp), "%d-%02d-%02d %02d:%02d:%02d",
+                 t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec);
+        stampSec = now.tv_sec;
+    }
+    const char* title = level >= 0 && level <= 3 ? TITLES[level] : TITLES[1];
+    int n = snprintf(line, LINE_LEN, "%s.%06ld %s", stamp, static_cast<long>(now.tv_usec), title);
+
+    va_list vaList;
+    va_start(vaList, format);
+    int m = vsnprintf(line + n, LINE_LEN - n - 1, format, vaList);     // 留一个位置给换行
+    va_end(vaList);
+    m = std::max(0, std::min(m, LINE_LEN - n - 2));
+    line[n + m] = '\n';
+    size_t len = n + m + 1;
+
+    if(isAsync_ && deque_) { // 异步方式：只进队列，WARN/ERROR满了就等，其余满了就丢，由写线程记一笔丢了多少
+        if(level >= options.blockLevel) {
+            deque_->push_back(std::string(line, len));
+        } else if(!deque_->try_push_back(std::string(line, len))) {
+            dropped_++;
+            droppedTotal_++;
+        }
+    } else {    // 同步方式（直接向文件中写入日志信息）
+        lock_guard<mutex> locker(mtx_);
+        RotateIfNeeded_();
+        buff_.Append(line, len);
+        WriteBlocks_(true);
+    }
 }
@@ -1,6 +1,7 @@
 #ifndef LOG_H
 #define LOG_H
 #include <mutex>
+#include <atomic>
 #include <string>
 #include <thread>
 #include <sys/time.h>
@@ -8,11 +9,27 @@
 #include <stdarg.h>           // vastart va_end
 #include <assert.h>
 #include <sys/stat.h>         // mkdir
+#include <memory>
 #include "blockqueue.h"
 #include "buffer.h"
 
+/*
+异步模式下工作线程只在自己线程的缓冲区里格式化一行，然后放进阻塞队列，不碰文件；
+队列满了时DEBUG/INFO丢掉并计数，不等，WARN/ERROR（options.blockLevel及以上）等写线程腾出位置，一行不丢
+文件只归写线程管：攒够整块再write，队列取空时把剩下的也写掉；换天或者超过大小上限时由写线程换下一段，
+新段用fallocate预留空间，换下来的段交给压缩线程在后台压成.gz
+同步模式（队列容量为0）下调用线程拿锁直接写文件，换段也在调用线程里做
+*/
 class Log {
 public:
+    struct Options {
+        size_t maxFileBytes = 64 * 1024 * 1024;  // 单个文件的大小上限，超过后换下一段 日期-N.log
+        bool preallocate = true;                 // 打开新段时用fallocate预留到上限，不改变文件长度
+        bool compress = true;                    // 换下来的段压成.gz，没编zlib时不起作用
+        int blockLevel = 2;                      // 异步队列满时这个等级及以上的行阻塞等待，低于它的直接丢；4表示全都丢
+    };
+    static Options options;     // 在init之前设置
+
     // 初始化日志实例（阻塞队列最大容量、日志保存路径、日志文件后缀）
     void init(int level, const char* path = "./log", 
                 const char* suffix =".log",
@@ -21,48 +38,67 @@ public:
     static Log* Instance();//全局访问指针。
     static void FlushLogThread();   // 异步写日志公有方法，调用私有方法asyncWrite
     
-    void write(int level, const char *format,...);  // 将输出内容按照标准格式整理
+    // 将输出内容按照标准格式整理；format按printf检查，参数类型不对编译时就报警告
+    void write(int level, const char *format,...) __attribute__((format(printf, 3, 4)));
     void flush();
 
-    int GetLevel();
-    void SetLevel(int level);
-    bool IsOpen() { return isOpen_; }
+    // 每条日志都要先查一次等级，不加锁，宽松读就够了，改了等级之后各线程稍晚一点看到也没关系
+    int GetLevel() const { return level_.load(std::memory_order_relaxed); }
+    void SetLevel(int level) { level_.store(level, std::memory_order_relaxed); }
+    bool IsOpen() const { return isOpen_.load(std::memory_order_relaxed); }
+    uint64_t Dropped() const { return droppedTotal_; }     // 队列满时丢掉的行数，只会有低于blockLevel的
     
 private:
     Log();
-    void AppendLogLevelTitle_(int level);
     virtual ~Log();//一般只有父类的析构函数才会写为虚函数，为了派生类能够重写虚构函数并且有虚函数表可以调用。
     void AsyncWrite_(); // 异步写日志方法
+    void CompressLoop_();
+    static bool Compress_(const std::string& fileName);
+
+    // 以下几个要拿着mtx_调用
+    void WriteBlocks_(bool all);    // 把buff_里攒下的写进文件，all为false时只写整块
+    void RotateIfNeeded_();
+    void OpenSegment_(time_t now);
+    void CloseSegment_(bool compress);
 
 private:
-    static const int LOG_PATH_LEN = 256;    // 日志文件最长文件名
-    static const int LOG_NAME_LEN = 256;    // 日志最长名字
-    static const int MAX_LINES = 50000;     // 日志文件内的最长日志条数
+    static const size_t BLOCK_SIZE = 64 * 1024;    // 写线程攒够这么多再写一次
+    static const int LINE_LEN = 4096;              // 一行日志的最大长度，更长的截断
 
     const char* path_;          //路径名
     const char* suffix_;        //后缀名
 
-    int MAX_LINES_;             // 最大日志行数
+    int fd_;                    // 当前段
+    std::string fileName_;
+    size_t fileBytes_;          // 当前段已经写了多少
+    int segment_;               // 当天的第几段，0是不带序号的那个
+    time_t nextDay_;            // 到这个时间换到新一天的文件
 
-    int lineCount_;             //日志行数记录
-    int toDay_;                 //按当天日期区分文件
-
-    bool isOpen_;               
+    std::atomic<bool> isOpen_;
  
-    Buffer buff_;       // 输出的内容，缓冲区
-    int level_;         // 日志等级
+    Buffer buff_;       // 等着写进文件的内容
+    std::atomic<int> level_;    // 日志等级
     bool isAsync_;      // 是否开启异步日志
+    std::atomic<uint64_t> dropped_;         // 写线程还没记进日志的丢弃行数
+    std::atomic<uint64_t> droppedTotal_;
 
-    FILE* fp_;                                          //打开log的文件指针
     std::unique_ptr<BlockQueue<std::string>> deque_;    //阻塞队列
     std::unique_ptr<std::thread> writeThread_;          //写线程的指针
-    std::mutex mtx_;                                    //同步日志必需的互斥量
+    std::unique_ptr<BlockQueue<std::string>> compressQueue_;    // 等着压缩的文件名
+    std::unique_ptr<std::thread> compressThread_;
+    std::mutex mtx_;                                    // 保护文件和buff_，异步模式下只有写线程和init会拿
 };
 
+// 编译期的最低等级，低于它的日志调用连同参数求值一起被编译器删掉，格式检查照做
+// 构建时用 -DLOG_MIN_LEVEL=1 去掉所有LOG_DEBUG
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
 #define LOG_BASE(level, format, ...) \
     do {\
         Log* log = Log::Instance();\
-        if (log->IsOpen() && log->GetLevel() <= level) {\
+        if ((level) >= LOG_MIN_LEVEL && log->IsOpen() && log->GetLevel() <= (level)) {\
             log->write(level, format, ##__VA_ARGS__); \
             log->flush();\
         }\
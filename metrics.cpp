@@ -0,0 +1,235 @@
+#include "metrics.h"
+#include "router.h"
+#include "httprequest.h"
+#include <stdio.h>
+
+static const int STATUS_CODES[] = { 200, 400, 403, 404, 413, 431, 500, 503 };
+
+Metrics* Metrics::Instance() {
+    static Metrics metrics;
+    return &metrics;
+}
+
+Metrics::COUNTER Metrics::StatusCounter(int code) {
+    for(size_t i = 0; i < sizeof(STATUS_CODES) / sizeof(STATUS_CODES[0]); i++) {
+        if(STATUS_CODES[i] == code) {
+            return static_cast<COUNTER>(REQ_200 + i);
+        }
+    }
+    return REQ_OTHER;
+}
+
+// 小于16的值一个值一个桶；之后每个2的幂区间按最高位后面的4位再分16个桶
+int Metrics::BucketOf(uint64_t value) {
+    if(value < (1u << SUB_BITS)) {
+        return static_cast<int>(value);
+    }
+    int msb = 63 - __builtin_clzll(value);
+    if(msb > MAX_BITS) {
+        return BUCKETS - 1;
+    }
+    int group = msb - SUB_BITS + 1;
+    int sub = static_cast<int>(value >> (msb - SUB_BITS)) & ((1 << SUB_BITS) - 1);
+    return (group << SUB_BITS) + sub;
+}
+
+uint64_t Metrics::BucketUpper(int bucket) {
+    int group = bucket >> SUB_BITS;
+    uint64_t sub = bucket & ((1 << SUB_BITS) - 1);
+    if(group == 0) {
+        return sub;
+    }
+    uint64_t lower = ((1ULL << SUB_BITS) + sub) << (group - 1);
+    return lower + (1ULL << (group - 1)) - 1;
+}
+
+void Metrics::Record(HISTOGRAM hist, int64_t ns) {
+    uint64_t value = ns > 0 ? static_cast<uint64_t>(ns) : 0;
+    Histogram_& h = Local_()->hists[hist];
+    std::atomic<uint64_t>& bucket = h.buckets[BucketOf(value)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    h.count.store(h.count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    h.sum.store(h.sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+// 每个线程第一次写指标时调用一次；优先复用已经退出的线程留下的分片
+Metrics::Shard_* Metrics::Acquire_() {
+    std::lock_guard<std::mutex> locker(mtx_);
+    for(Shard_* shard : shards_) {
+        bool idle = false;
+        if(shard->inUse.compare_exchange_strong(idle, true, std::memory_order_acquire)) {
+            return shard;
+        }
+    }
+    Shard_* shard = new Shard_();   // 值初始化全部清零；alignas(64)，C++17的new会按对齐分配
+    shard->inUse.store(true, std::memory_order_relaxed);
+    shards_.push_back(shard);
+    return shard;
+}
+
+void Metrics::AddGauge(const std::string& name, const std::string& help, std::function<double()> fn,
+                       const std::string& labels, const char* type) {
+    std::lock_guard<std::mutex> locker(mtx_);
+    for(Gauge_& gauge : gauges_) {
+        if(gauge.name == name && gauge.labels == labels) {    // 同名的替换掉，服务器重建时不会重复输出
+            gauge.help = help;
+            gauge.type = type;
+            gauge.fn = std::move(fn);
+            return;
+        }
+    }
+    // 按名字排好序，同名不同标签的挨在一起，只输出一次HELP/TYPE
+    auto pos = gauges_.begin();
+    while(pos != gauges_.end() && pos->name <= name) { ++pos; }
+    gauges_.insert(pos, { name, labels, help, type, std::move(fn) });
+}
+
+void Metrics::RemoveGauge(const std::string& name, const std::string& labels) {
+    std::lock_guard<std::mutex> locker(mtx_);
+    for(auto it = gauges_.begin(); it != gauges_.end(); ++it) {
+        if(it->name == name && it->labels == labels) {
+            gauges_.erase(it);
+            return;
+        }
+    }
+}
+
+uint64_t Metrics::Get(COUNTER counter) {
+    std::lock_guard<std::mutex> locker(mtx_);
+    uint64_t total = 0;
+    for(Shard_* shard : shards_) {
+        total += shard->counters[counter].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+// 调用方持有mtx_
+void Metrics::Merge_(HISTOGRAM hist, std::vector<uint64_t>* buckets, uint64_t* count, uint64_t* sum) {
+    buckets->assign(BUCKETS, 0);
+    *count = *sum = 0;
+    for(Shard_* shard : shards_) {
+        const Histogram_& h = shard->hists[hist];
+        for(int i = 0; i < BUCKETS; i++) {
+            (*buckets)[i] += h.buckets[i].load(std::memory_order_relaxed);
+        }
+        *count += h.count.load(std::memory_order_relaxed);
+        *sum += h.sum.load(std::memory_order_relaxed);
+    }
+}
+
+static uint64_t QuantileOf(const std::vector<uint64_t>& buckets, uint64_t count, double q) {
+    if(count == 0) { return 0; }
+    // 各分片的桶和总数不是同一时刻读的，以桶的合计为准
+    uint64_t total = 0;
+    for(uint64_t n : buckets) { total += n; }
+    uint64_t rank = static_cast<uint64_t>(q * total);
+    uint64_t seen = 0;
+    for(size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if(seen > rank) {
+            return Metrics::BucketUpper(static_cast<int>(i));
+        }
+    }
+    return Metrics::BucketUpper(static_cast<int>(buckets.size()) - 1);
+}
+
+uint64_t Metrics::Quantile(HISTOGRAM hist, double q) {
+    std::lock_guard<std::mutex> locker(mtx_);
+    std::vector<uint64_t> buckets;
+    uint64_t count, sum;
+    Merge_(hist, &buckets, &count, &sum);
+    return QuantileOf(buckets, count, q);
+}
+
+static void AppendMetric(std::string* out, const char* name, const char* type, const char* help) {
+    char line[256];
+    snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    *out += line;
+}
+
+static void AppendValue(std::string* out, const char* name, const char* labels, double value) {
+    char line[256];
+    snprintf(line, sizeof(line), "%s%s %.15g\n", name, labels, value);
+    *out += line;
+}
+
+std::string Metrics::Render() {
+    static const struct { COUNTER counter; const char* name; const char* help; } COUNTERS[] = {
+        { ACCEPTS, "tinyweb_accepts_total", "Accepted connections." },
+        { BYTES_IN, "tinyweb_bytes_in_total", "Bytes read from clients." },
+        { BYTES_OUT, "tinyweb_bytes_out_total", "Bytes written to clients." },
+        { TIMER_EXPIRED, "tinyweb_timer_expirations_total", "Connections closed because a phase deadline passed (first byte, header, body, write or keep-alive idle)." },
+        { CONN_REJECTED, "tinyweb_rejected_connections_total", "Connections refused with 503 at the connection limit." },
+        { REQ_SHED, "tinyweb_shed_requests_total", "Requests answered with 503 because the server was overloaded." },
+    };
+    static const struct { HISTOGRAM hist; const char* name; const char* help; } HISTOGRAMS[] = {
+        { PARSE_NS, "tinyweb_parse_seconds", "Time spent parsing requests per process() call." },
+        { TASK_WAIT_NS, "tinyweb_task_wait_seconds", "Time tasks wait in the thread pool queue." },
+        { SQL_WAIT_NS, "tinyweb_sql_wait_seconds", "Time waiting for a SQL connection from the pool." },
+    };
+    static const double QUANTILES[] = { 0.5, 0.9, 0.99, 0.999 };
+
+    std::lock_guard<std::mutex> locker(mtx_);
+    uint64_t totals[COUNTER_COUNT] = { 0 };
+    for(Shard_* shard : shards_) {
+        for(int i = 0; i < COUNTER_COUNT; i++) {
+            totals[i] += shard->counters[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    std::string out;
+    out.reserve(4096);
+    for(const auto& c : COUNTERS) {
+        AppendMetric(&out, c.name, "counter", c.help);
+        AppendValue(&out, c.name, "", totals[c.counter]);
+    }
+    // 各分片不是同一时刻读的，差值可能短暂为负
+    AppendMetric(&out, "tinyweb_connections_active", "gauge", "Open client connections.");
+    AppendValue(&out, "tinyweb_connections_active", "", static_cast<double>(static_cast<int64_t>(totals[CONN_OPENED] - totals[CONN_CLOSED])));
+    AppendMetric(&out, "tinyweb_task_queue_depth", "gauge", "Tasks waiting in the thread pool queue.");
+    AppendValue(&out, "tinyweb_task_queue_depth", "", static_cast<double>(static_cast<int64_t>(totals[TASKS_QUEUED] - totals[TASKS_STARTED])));
+
+    AppendMetric(&out, "tinyweb_requests_total", "counter", "Responses by status code.");
+    char labels[64];
+    for(size_t i = 0; i < sizeof(STATUS_CODES) / sizeof(STATUS_CODES[0]); i++) {
+        snprintf(labels, sizeof(labels), "{code=\"%d\"}", STATUS_CODES[i]);
+        AppendValue(&out, "tinyweb_requests_total", labels, totals[REQ_200 + i]);
+    }
+    AppendValue(&out, "tinyweb_requests_total", "{code=\"other\"}", totals[REQ_OTHER]);
+
+    std::vector<uint64_t> buckets;
+    for(const auto& h : HISTOGRAMS) {
+        uint64_t count, sum;
+        Merge_(h.hist, &buckets, &count, &sum);
+        AppendMetric(&out, h.name, "summary", h.help);
+        for(double q : QUANTILES) {
+            snprintf(labels, sizeof(labels), "{quantile=\"%g\"}", q);
+            AppendValue(&out, h.name, labels, QuantileOf(buckets, count, q) / 1e9);
+        }
+        std::string name = h.name;
+        AppendValue(&out, (name + "_sum").c_str(), "", sum / 1e9);
+        AppendValue(&out, (name + "_count").c_str(), "", count);
+    }
+
+    for(size_t i = 0; i < gauges_.size(); i++) {
+        const Gauge_& gauge = gauges_[i];
+        if(i == 0 || gauges_[i - 1].name != gauge.name) {
+            AppendMetric(&out, gauge.name.c_str(), gauge.type, gauge.help.c_str());
+        }
+        AppendValue(&out, gauge.name.c_str(), gauge.labels.c_str(), gauge.fn());
+    }
+    return out;
+}
+
+static void RouteMetrics(HttpRequest& req, const RouteMatch&) {
+    if(!req.IsPeerLocal()) {    // 不是本机来的请求当作没有这个路径，返回404
+        return;
+    }
+    std::string text = Metrics::Instance()->Render();
+    req.SetContent(req.arena()->Copy(text), "text/plain; version=0.0.4");
+}
+
+void Metrics::RegisterRoutes(Router* router) {
+    assert(router);
+    router->AddExact("/metrics", RouteMetrics);
+}
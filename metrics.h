@@ -0,0 +1,126 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <functional>
+#include <stdint.h>
+#include <time.h>
+#include <assert.h>
+
+class Router;
+
+/*
+服务器运行指标：计数器和延迟直方图按线程分片，每个线程只写自己的分片（缓存行对齐，没有锁也没有原子加），
+抓取/metrics时再把所有分片加起来，输出Prometheus文本格式
+直方图是HDR式的对数-线性分桶，相对误差约6%，覆盖1ns到约39小时
+*/
+class Metrics {
+public:
+    enum COUNTER {
+        ACCEPTS,            // accept成功的连接
+        CONN_OPENED,
+        CONN_CLOSED,        // 活跃连接数 = OPENED - CLOSED
+        BYTES_IN,
+        BYTES_OUT,
+        TASKS_QUEUED,       // 线程池队列深度 = QUEUED - STARTED
+        TASKS_STARTED,
+        TIMER_EXPIRED,      // 超时关闭的连接（各阶段合计，分阶段的见WebServer::timeouts）
+        CONN_REJECTED,      // 连接数到上限时回503拒掉的连接
+        REQ_SHED,           // 过载时回503丢掉的请求（排队太多、CoDel、数据库并发到上限）
+        REQ_200,            // 按状态码统计的请求数，顺序和STATUS_CODES一致
+        REQ_400,
+        REQ_403,
+        REQ_404,
+        REQ_413,
+        REQ_431,
+        REQ_500,
+        REQ_503,
+        REQ_OTHER,
+        COUNTER_COUNT,
+    };
+
+    enum HISTOGRAM {
+        PARSE_NS,           // 一次process里解析请求花的时间
+        TASK_WAIT_NS,       // 任务在线程池队列里等待的时间
+        SQL_WAIT_NS,        // 从连接池拿到连接的等待时间
+        HISTOGRAM_COUNT,
+    };
+
+    static Metrics* Instance();
+
+    void Add(COUNTER counter, uint64_t n = 1) {
+        std::atomic<uint64_t>& value = Local_()->counters[counter];
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    void Record(HISTOGRAM hist, int64_t ns);
+    void AddRequest(int code) { Add(StatusCounter(code)); }
+
+    // 抓取时才调用的仪表，例如连接池的空闲连接数；labels形如{pool="worker"}，type为gauge或counter
+    void AddGauge(const std::string& name, const std::string& help, std::function<double()> fn,
+                  const std::string& labels = "", const char* type = "gauge");
+    void RemoveGauge(const std::string& name, const std::string& labels = "");
+
+    uint64_t Get(COUNTER counter);                      // 所有线程的合计
+    uint64_t Quantile(HISTOGRAM hist, double q);        // 返回所在桶的上界
+    std::string Render();                               // Prometheus文本格式
+
+    static void RegisterRoutes(Router* router);         // 注册/metrics，只对本机回环地址开放
+    static COUNTER StatusCounter(int code);
+
+    static int64_t NowNs() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+    static const int SUB_BITS = 4;                      // 每个2的幂区间再分16个桶
+    static const int MAX_BITS = 47;                     // 更大的值落在最后一个桶
+    static const int BUCKETS = (MAX_BITS - SUB_BITS + 2) << SUB_BITS;
+
+    static int BucketOf(uint64_t value);
+    static uint64_t BucketUpper(int bucket);
+
+private:
+    struct Histogram_ {
+        std::atomic<uint64_t> buckets[BUCKETS];
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sum;
+    };
+
+    struct alignas(64) Shard_ {
+        std::atomic<uint64_t> counters[COUNTER_COUNT];
+        Histogram_ hists[HISTOGRAM_COUNT];
+        std::atomic<bool> inUse;
+    };
+
+    struct ShardHolder_ {       // 线程退出时把分片标记为空闲，数值保留，留给新线程接着累加
+        Shard_* shard = nullptr;
+        ~ShardHolder_() { if(shard) { shard->inUse.store(false, std::memory_order_release); } }
+    };
+
+    struct Gauge_ {
+        std::string name;
+        std::string labels;
+        std::string help;
+        const char* type;
+        std::function<double()> fn;
+    };
+
+    Metrics() = default;
+    Shard_* Local_() {
+        static thread_local ShardHolder_ holder;
+        if(!holder.shard) { holder.shard = Acquire_(); }
+        return holder.shard;
+    }
+    Shard_* Acquire_();
+    void Merge_(HISTOGRAM hist, std::vector<uint64_t>* buckets, uint64_t* count, uint64_t* sum);
+
+    std::mutex mtx_;                // 只保护分片列表和仪表列表，写指标的路径上不会拿
+    std::vector<Shard_*> shards_;
+    std::vector<Gauge_> gauges_;
+};
+
+#endif //METRICS_H
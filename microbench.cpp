@@ -0,0 +1,585 @@
+/*
+组件微基准：Buffer、HeapTimer、HttpRequest::parse、Log::write、AccessLog::Record、BlockQueue/MpmcQueue，
+每个用例先自动标定迭代次数，再重复若干轮取中位数，结果以JSON输出，可以和上一次构建的结果直接对比
+用法：microbench [--filter=buffer] [--cpus=0,1,2,3] [--min-time=0.2] [--repeat=5]
+                 [--corpus=dir] [--label=git-sha] [--out=result.json] [--baseline=old.json]
+--cpus：主线程绑定到第一个CPU，多线程用例的线程依次轮流绑定；为空则不绑定
+--corpus：目录下每个文件是一个原始请求（抓包得到的字节），不给则用内置的几条
+*/
+#include "buffer.h"
+#include "heaptimer.h"
+#include "httprequest.h"
+#include "log.h"
+#include "blockqueue.h"
+#include "mpmcqueue.h"
+#include "accesslog.h"
+#include <arpa/inet.h>
+#include <sched.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <memory>
+
+struct Options {
+    std::string filter;
+    std::vector<int> cpus = { 0 };
+    double minTime = 0.2;   // 每轮至少运行的秒数
+    int repeat = 5;
+    std::string corpus;
+    std::string label;
+    std::string out;
+    std::string baseline;
+};
+
+static Options g_opt;
+
+// 一个用例：执行iters次操作，返回实际完成的操作数（多线程用例可能按线程数取整）
+struct Case {
+    std::string name;
+    std::function<uint64_t(uint64_t iters)> run;
+};
+
+struct Result {
+    std::string name;
+    uint64_t iters;
+    double nsPerOp;     // 各轮的中位数
+    double minNsPerOp;
+};
+
+static int64_t NowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void PinThread(int index) {
+    if(g_opt.cpus.empty()) { return; }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(g_opt.cpus[index % g_opt.cpus.size()], &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+// 防止编译器把基准里的计算整个优化掉
+template<typename T>
+static inline void KeepAlive(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// 启动n个线程执行fn(i)，每个线程按顺序绑核，全部就绪后同时开始
+static void RunThreads(int n, const std::function<void(int)>& fn) {
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for(int i = 0; i < n; i++) {
+        threads.emplace_back([&, i]() {
+            PinThread(i + 1);
+            ready++;
+            while(!go.load(std::memory_order_acquire)) { std::this_thread::yield(); }
+            fn(i);
+        });
+    }
+    while(ready.load() < n) { std::this_thread::yield(); }
+    go.store(true, std::memory_order_release);
+    for(auto& th : threads) { th.join(); }
+}
+
+/*----------------------------- Buffer -----------------------------*/
+
+// 小块追加，攒到64K一次取走，对应写响应头和日志的用法
+static uint64_t BufferAppendSmall(uint64_t iters) {
+    Buffer buff;
+    char line[64];
+    memset(line, 'a', sizeof(line));
+    for(uint64_t i = 0; i < iters; i++) {
+        buff.Append(line, sizeof(line));
+        if(buff.ReadableBytes() >= 65536) { buff.RetrieveAll(); }
+    }
+    KeepAlive(buff.ReadableBytes());
+    return iters;
+}
+
+// 从默认大小一路追加到1M，每次都是新的Buffer，测扩容
+static uint64_t BufferAppendGrow(uint64_t iters) {
+    char block[1024];
+    memset(block, 'b', sizeof(block));
+    uint64_t ops = 0;
+    while(ops < iters) {
+        Buffer buff;
+        for(int i = 0; i < 1024; i++, ops++) {
+            buff.Append(block, sizeof(block));
+        }
+        KeepAlive(buff.ReadableBytes());
+    }
+    return ops;
+}
+
+// 读走一部分再追加，前面腾出的空间够用时MakeSpace_只做搬移不扩容
+static uint64_t BufferCompact(uint64_t iters) {
+    Buffer buff(4096);
+    char block[1000];
+    memset(block, 'c', sizeof(block));
+    for(uint64_t i = 0; i < iters; i++) {
+        buff.Append(block, sizeof(block));
+        if(buff.ReadableBytes() > 3000) { buff.Retrieve(2500); }
+    }
+    KeepAlive(buff.ReadableBytes());
+    return iters;
+}
+
+// 管道里写4K再用ReadFd读出，走readv+栈上额外缓冲的路径
+static uint64_t BufferReadFd(uint64_t iters) {
+    int fds[2];
+    int ret = pipe(fds);
+    assert(ret == 0);
+    char block[4096];
+    memset(block, 'd', sizeof(block));
+    Buffer buff;
+    int err = 0;
+    for(uint64_t i = 0; i < iters; i++) {
+        ssize_t n = write(fds[1], block, sizeof(block));
+        assert(n == (ssize_t)sizeof(block));
+        buff.ReadFd(fds[0], &err);
+        buff.RetrieveAll();
+        (void)n;
+    }
+    close(fds[0]);
+    close(fds[1]);
+    return iters;
+}
+
+/*----------------------------- HeapTimer -----------------------------*/
+
+// 一次加入n个随机超时的定时器，对应n个连接同时在线
+static uint64_t TimerAdd(uint64_t iters, int n) {
+    std::mt19937 rng(1);
+    uint64_t ops = 0;
+    while(ops < iters) {
+        HeapTimer timer;
+        for(int i = 0; i < n; i++, ops++) {
+            timer.add(i, 60000 + rng() % 60000, [](){});
+        }
+    }
+    return ops;
+}
+
+// n个定时器里随机挑一个延长超时，对应每次读写事件都调整一次；堆只建一次，不计入时间
+static uint64_t TimerAdjust(uint64_t iters, HeapTimer* timer, int n) {
+    std::mt19937 rng(2);
+    for(uint64_t i = 0; i < iters; i++) {
+        timer->adjust(rng() % n, 120000 + i % 1000);
+    }
+    return iters;
+}
+
+// n个已经到期的定时器，一次tick全部处理掉
+static uint64_t TimerTick(uint64_t iters, int n) {
+    uint64_t ops = 0;
+    uint64_t fired = 0;
+    while(ops < iters) {
+        HeapTimer timer;
+        for(int i = 0; i < n; i++) {
+            timer.add(i, 0, [&fired](){ fired++; });
+        }
+        timer.tick();
+        ops += n;
+    }
+    KeepAlive(fired);
+    return ops;
+}
+
+/*----------------------------- HttpRequest -----------------------------*/
+
+static const char* const BUILTIN_CORPUS[][2] = {
+    { "browser_get",
+      "GET /index.html HTTP/1.1\r\n"
+      "Host: 192.168.1.10:1316\r\n"
+      "Connection: keep-alive\r\n"
+      "Cache-Control: max-age=0\r\n"
+      "Upgrade-Insecure-Requests: 1\r\n"
+      "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+      "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+      "Referer: http://192.168.1.10:1316/\r\n"
+      "Accept-Encoding: gzip, deflate\r\n"
+      "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+      "Cookie: _ga=GA1.1.123456789.1700000000; session=9f8e7d6c5b4a\r\n"
+      "\r\n" },
+    { "curl_get",
+      "GET /picture HTTP/1.1\r\n"
+      "Host: localhost:1316\r\n"
+      "User-Agent: curl/7.88.1\r\n"
+      "Accept: */*\r\n"
+      "\r\n" },
+    { "query_get",
+      "GET /video?id=42&from=list&q=tiny%20web+server HTTP/1.1\r\n"
+      "Host: localhost:1316\r\n"
+      "User-Agent: Wget/1.21.3\r\n"
+      "Accept: */*\r\n"
+      "Connection: Keep-Alive\r\n"
+      "\r\n" },
+    { "form_post",
+      "POST /register HTTP/1.1\r\n"
+      "Host: 192.168.1.10:1316\r\n"
+      "Connection: keep-alive\r\n"
+      "Content-Length: 38\r\n"
+      "Origin: http://192.168.1.10:1316\r\n"
+      "Content-Type: application/x-www-form-urlencoded\r\n"
+      "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:121.0) Gecko/20100101 Firefox/121.0\r\n"
+      "Referer: http://192.168.1.10:1316/register.html\r\n"
+      "\r\n"
+      "username=%E5%BC%A0%E4%B8%89&password=1" },
+};
+
+static std::vector<std::pair<std::string, std::string>> LoadCorpus() {
+    std::vector<std::pair<std::string, std::string>> corpus;
+    if(g_opt.corpus.empty()) {
+        for(const auto& item : BUILTIN_CORPUS) {
+            corpus.push_back({ item[0], item[1] });
+        }
+        return corpus;
+    }
+    DIR* dir = opendir(g_opt.corpus.c_str());
+    if(!dir) {
+        fprintf(stderr, "cannot open corpus dir: %s\n", g_opt.corpus.c_str());
+        exit(1);
+    }
+    while(dirent* ent = readdir(dir)) {
+        if(ent->d_name[0] == '.') { continue; }
+        std::string path = g_opt.corpus + "/" + ent->d_name;
+        FILE* fp = fopen(path.c_str(), "rb");
+        if(!fp) { continue; }
+        std::string data;
+        char chunk[4096];
+        size_t n;
+        while((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) { data.append(chunk, n); }
+        fclose(fp);
+        std::string name = ent->d_name;
+        for(char& ch : name) {
+            if(!isalnum(static_cast<unsigned char>(ch))) { ch = '_'; }
+        }
+        corpus.push_back({ name, data });
+    }
+    closedir(dir);
+    std::sort(corpus.begin(), corpus.end());
+    return corpus;
+}
+
+// 和长连接一样复用同一个请求对象，每次Init后完整解析一遍
+static uint64_t ParseRequest(uint64_t iters, const std::string& raw) {
+    HttpRequest request;
+    Buffer buff(static_cast<int>(raw.size() + 64));
+    for(uint64_t i = 0; i < iters; i++) {
+        request.Init();
+        buff.Append(raw.data(), raw.size());
+        bool ok = request.parse(buff);
+        KeepAlive(ok);
+        buff.RetrieveAll();
+    }
+    return iters;
+}
+
+/*----------------------------- Log -----------------------------*/
+
+static std::string g_logDir;
+
+// n个线程同时写异步日志，操作数是总行数（队列满时丢掉的也算）；只在这里打开info级别，其他用例里的日志不计入
+static uint64_t LogWrite(uint64_t iters, int n) {
+    uint64_t perThread = std::max<uint64_t>(1, iters / n);
+    Log::Instance()->SetLevel(1);
+    RunThreads(n, [perThread](int t) {
+        for(uint64_t i = 0; i < perThread; i++) {
+            LOG_INFO("microbench thread %d line %llu status=%d path=%s", t, (unsigned long long)i, 200, "/index.html");
+        }
+    });
+    Log::Instance()->SetLevel(3);
+    return perThread * n;
+}
+
+// n个线程打被等级过滤掉的debug日志，量的是每条日志调用查等级的开销
+static uint64_t LogFiltered(uint64_t iters, int n) {
+    uint64_t perThread = std::max<uint64_t>(1, iters / n);
+    RunThreads(n, [perThread](int t) {
+        for(uint64_t i = 0; i < perThread; i++) {
+            LOG_DEBUG("microbench thread %d line %llu", t, (unsigned long long)i);
+        }
+    });
+    return perThread * n;
+}
+
+/*----------------------------- AccessLog -----------------------------*/
+
+// n个线程记访问日志，量的是工作线程这边的开销；刷盘线程照常在后台写
+static uint64_t AccessRecord(uint64_t iters, int n) {
+    uint64_t perThread = std::max<uint64_t>(1, iters / n);
+    RunThreads(n, [perThread](int t) {
+        AccessLog::Entry entry;
+        entry.ip = htonl(INADDR_LOOPBACK);
+        entry.method = "GET";
+        entry.path = "/index.html";
+        entry.version = "1.1";
+        entry.userAgent = "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0";
+        entry.code = 200;
+        entry.bytes = 3120;
+        for(uint64_t i = 0; i < perThread; i++) {
+            entry.durationNs = static_cast<int64_t>(i + t);
+            AccessLog::Instance()->Record(entry);
+        }
+    });
+    return perThread * n;
+}
+
+/*----------------------------- BlockQueue/MpmcQueue -----------------------------*/
+
+// n个生产者、n个消费者，操作数是经过队列的元素个数；生产者结束后每个消费者收到一个-1退出
+static uint64_t QueueContention(uint64_t iters, int n) {
+    BlockQueue<int> queue(1024);
+    uint64_t perThread = std::max<uint64_t>(1, iters / n);
+    std::atomic<int> producersLeft(n);
+    RunThreads(2 * n, [&](int t) {
+        if(t < n) {
+            for(uint64_t i = 0; i < perThread; i++) {
+                queue.push_back(static_cast<int>(i & 0x7fffffff));
+            }
+            if(--producersLeft == 0) {
+                for(int i = 0; i < n; i++) { queue.push_back(-1); }
+            }
+        } else {
+            int item;
+            uint64_t sum = 0;
+            while(queue.pop(item) && item >= 0) { sum += item; }
+            KeepAlive(sum);
+        }
+    });
+    return perThread * n;
+}
+
+// n个生产者、一个消费者，对应各线程写日志、写线程取；batch时消费者用pop_batch一次取一批
+template<typename Queue>
+static uint64_t QueueFanIn(uint64_t iters, int n, bool batch) {
+    Queue queue(1024);
+    uint64_t perThread = std::max<uint64_t>(1, iters / n);
+    std::atomic<int> producersLeft(n);
+    RunThreads(n + 1, [&](int t) {
+        if(t < n) {
+            for(uint64_t i = 0; i < perThread; i++) {
+                queue.push_back(static_cast<int>(i & 0x7fffffff));
+            }
+            if(--producersLeft == 0) {
+                queue.push_back(-1);
+            }
+            return;
+        }
+        uint64_t sum = 0;
+        if(batch) {
+            std::deque<int> items;
+            for(bool done = false; !done && queue.pop_batch(items, SIZE_MAX) > 0; items.clear()) {
+                for(int item : items) {
+                    if(item < 0) { done = true; break; }
+                    sum += item;
+                }
+            }
+        } else {
+            int item;
+            while(queue.pop(item) && item >= 0) { sum += item; }
+        }
+        KeepAlive(sum);
+    });
+    return perThread * n;
+}
+
+/*----------------------------- 驱动 -----------------------------*/
+
+static std::vector<Case> BuildCases() {
+    std::vector<Case> cases;
+    cases.push_back({ "buffer_append_small", BufferAppendSmall });
+    cases.push_back({ "buffer_append_grow", BufferAppendGrow });
+    cases.push_back({ "buffer_compact", BufferCompact });
+    cases.push_back({ "buffer_readfd_4k", BufferReadFd });
+    for(int n : { 1000, 100000 }) {
+        std::string suffix = "_" + std::to_string(n);
+        cases.push_back({ "timer_add" + suffix, [n](uint64_t it) { return TimerAdd(it, n); } });
+        std::shared_ptr<HeapTimer> timer = std::make_shared<HeapTimer>();
+        for(int i = 0; i < n; i++) {
+            timer->add(i, 60000 + i % 60000, [](){});
+        }
+        cases.push_back({ "timer_adjust" + suffix, [n, timer](uint64_t it) { return TimerAdjust(it, timer.get(), n); } });
+        cases.push_back({ "timer_tick" + suffix, [n](uint64_t it) { return TimerTick(it, n); } });
+    }
+    for(const auto& item : LoadCorpus()) {
+        std::string raw = item.second;
+        cases.push_back({ "parse_" + item.first, [raw](uint64_t it) { return ParseRequest(it, raw); } });
+    }
+    for(int n : { 1, 2, 4, 8, 16 }) {
+        cases.push_back({ "log_write_t" + std::to_string(n), [n](uint64_t it) { return LogWrite(it, n); } });
+    }
+    for(int n : { 1, 4, 16 }) {
+        cases.push_back({ "log_filtered_t" + std::to_string(n), [n](uint64_t it) { return LogFiltered(it, n); } });
+    }
+    for(int n : { 1, 4 }) {
+        cases.push_back({ "access_record_t" + std::to_string(n), [n](uint64_t it) { return AccessRecord(it, n); } });
+    }
+    for(int n : { 1, 2, 4, 8, 16 }) {
+        cases.push_back({ "queue_p" + std::to_string(n) + "c" + std::to_string(n),
+                          [n](uint64_t it) { return QueueContention(it, n); } });
+    }
+    for(int n : { 1, 2, 4, 8, 16, 32 }) {
+        std::string suffix = "_p" + std::to_string(n) + "c1";
+        cases.push_back({ "queue_fanin" + suffix, [n](uint64_t it) { return QueueFanIn<BlockQueue<int>>(it, n, false); } });
+        cases.push_back({ "queue_batch" + suffix, [n](uint64_t it) { return QueueFanIn<BlockQueue<int>>(it, n, true); } });
+        cases.push_back({ "mpmc_fanin" + suffix, [n](uint64_t it) { return QueueFanIn<MpmcQueue<int>>(it, n, false); } });
+    }
+    return cases;
+}
+
+// 迭代次数翻倍直到一轮超过minTime，然后按这个次数重复repeat轮
+static Result RunCase(const Case& c) {
+    uint64_t iters = 1;
+    int64_t minNs = static_cast<int64_t>(g_opt.minTime * 1e9);
+    for(;;) {
+        int64_t start = NowNs();
+        c.run(iters);
+        int64_t elapsed = NowNs() - start;
+        if(elapsed >= minNs || iters >= (1ULL << 40)) { break; }
+        // 按已测的速度估算，最多一次放大10倍，避免前几轮噪声太大
+        uint64_t guess = elapsed > 0 ? static_cast<uint64_t>(iters * 1.2 * minNs / elapsed) : iters * 10;
+        iters = std::max(iters + 1, std::min(guess, iters * 10));
+    }
+    std::vector<double> samples;
+    for(int r = 0; r < g_opt.repeat; r++) {
+        int64_t start = NowNs();
+        uint64_t ops = c.run(iters);
+        int64_t elapsed = NowNs() - start;
+        samples.push_back(static_cast<double>(elapsed) / std::max<uint64_t>(ops, 1));
+    }
+    std::sort(samples.begin(), samples.end());
+    return { c.name, iters, samples[samples.size() / 2], samples.front() };
+}
+
+// 在旧的结果里找同名用例的ns_per_op，找不到返回0
+static double BaselineOf(const std::string& json, const std::string& name) {
+    std::string key = "\"name\":\"" + name + "\"";
+    size_t pos = json.find(key);
+    if(pos == std::string::npos) { return 0; }
+    pos = json.find("\"ns_per_op\":", pos);
+    if(pos == std::string::npos) { return 0; }
+    return atof(json.c_str() + pos + 12);
+}
+
+static std::string ReadFile(const std::string& path) {
+    std::string data;
+    FILE* fp = fopen(path.c_str(), "rb");
+    if(!fp) { return data; }
+    char chunk[4096];
+    size_t n;
+    while((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) { data.append(chunk, n); }
+    fclose(fp);
+    return data;
+}
+
+static int RemoveEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
+
+static void ParseArgs(int argc, char** argv) {
+    for(int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* eq = strchr(arg, '=');
+        if(strncmp(arg, "--", 2) != 0 || !eq) {
+            fprintf(stderr, "bad argument: %s\n", arg);
+            exit(1);
+        }
+        std::string key(arg + 2, eq - arg - 2);
+        const char* val = eq + 1;
+        if(key == "filter") g_opt.filter = val;
+        else if(key == "cpus") {
+            g_opt.cpus.clear();
+            for(const char* p = val; *p; ) {
+                g_opt.cpus.push_back(atoi(p));
+                p = strchr(p, ',');
+                if(!p) { break; }
+                p++;
+            }
+        }
+        else if(key == "min-time") g_opt.minTime = std::max(0.01, atof(val));
+        else if(key == "repeat") g_opt.repeat = std::max(1, atoi(val));
+        else if(key == "corpus") g_opt.corpus = val;
+        else if(key == "label") g_opt.label = val;
+        else if(key == "out") g_opt.out = val;
+        else if(key == "baseline") g_opt.baseline = val;
+        else {
+            fprintf(stderr, "unknown option: %s\n", arg);
+            exit(1);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    ParseArgs(argc, argv);
+    PinThread(0);
+
+    // 日志写到临时目录，结束后删掉
+    char tmpl[] = "/tmp/microbench.XXXXXX";
+    g_logDir = mkdtemp(tmpl);
+    Log::Instance()->init(3, g_logDir.c_str(), ".log", 1024);
+    AccessLog::Options accessOptions;
+    accessOptions.path = g_logDir + "/access.log";
+    AccessLog::Instance()->Start(accessOptions);
+    HttpRequest::RegisterRoutes(Router::Instance());
+    Router::Instance()->Freeze();
+
+    std::string baseline = g_opt.baseline.empty() ? "" : ReadFile(g_opt.baseline);
+    std::string cpus;
+    for(size_t i = 0; i < g_opt.cpus.size(); i++) {
+        cpus += (i ? "," : "") + std::to_string(g_opt.cpus[i]);
+    }
+    std::string result = "{\"bench\":\"microbench\",\"label\":\"" + g_opt.label + "\",\"compiler\":\"" __VERSION__ "\","
+#ifdef NDEBUG
+        "\"assertions\":false,"
+#else
+        "\"assertions\":true,"
+#endif
+        "\"cpus\":\"" + cpus + "\",\"repeat\":" + std::to_string(g_opt.repeat) + ",\"cases\":[";
+    bool first = true;
+    for(const Case& c : BuildCases()) {
+        if(!g_opt.filter.empty() && c.name.find(g_opt.filter) == std::string::npos) { continue; }
+        Result r = RunCase(c);
+        char json[512];
+        snprintf(json, sizeof(json), "%s{\"name\":\"%s\",\"iters\":%llu,\"ns_per_op\":%.2f,\"min_ns_per_op\":%.2f,\"ops_per_s\":%.0f}",
+            first ? "" : ",", r.name.c_str(), (unsigned long long)r.iters, r.nsPerOp, r.minNsPerOp, 1e9 / r.nsPerOp);
+        result += json;
+        first = false;
+        // 进度和对比写到stderr，stdout只留JSON
+        double old = baseline.empty() ? 0 : BaselineOf(baseline, r.name);
+        if(old > 0) {
+            fprintf(stderr, "%-28s %12.2f ns/op  (baseline %.2f, %+.1f%%)\n", r.name.c_str(), r.nsPerOp, old,
+                (r.nsPerOp - old) / old * 100.0);
+        } else {
+            fprintf(stderr, "%-28s %12.2f ns/op\n", r.name.c_str(), r.nsPerOp);
+        }
+    }
+    result += "]}\n";
+
+    if(g_opt.out.empty()) {
+        fputs(result.c_str(), stdout);
+    } else {
+        FILE* fp = fopen(g_opt.out.c_str(), "w");
+        assert(fp);
+        fputs(result.c_str(), fp);
+        fclose(fp);
+    }
+    nftw(g_logDir.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+    fflush(nullptr);
+    // Log的写线程在析构时可能还阻塞在队列上，直接结束进程
+    _exit(0);
+}
@@ -0,0 +1,294 @@
+# ifndef MPMCQUEUE_H
+# define MPMCQUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <new>
+#include <thread>
+#include <utility>
+#include <assert.h>
+#include <stdint.h>
+
+/*
+有界的无锁多生产者多消费者队列（Dmitry Vyukov的做法），接口和BlockQueue一样，可以直接替换：
+每个槽位带一个序号，生产者和消费者各自用CAS抢下标，抢到之后只碰自己的槽位，互相不等锁
+队列空或满时先自旋一小会儿，还不行再在一个计数器上std::atomic::wait睡下；对面只有看到有人睡着时才改计数器、notify，
+平时入队出队只多一个栅栏和一次读，不写共享的缓存行，也不进内核
+容量取整到2的幂；没有push_front、front、back，这几个在无锁的环上做不出来
+Close()和BlockQueue一样不清空：之后入队的丢掉，出队的先把剩下的取完再返回false
+*/
+template<typename T>
+class MpmcQueue {
+public:
+    explicit MpmcQueue(size_t maxsize = 1024);
+    ~MpmcQueue();
+    MpmcQueue(const MpmcQueue&) = delete;
+    MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+    bool empty() { return size() == 0; }
+    bool full() { return size() >= capacity_; }
+    void push_back(const T& item) { emplace_back(item); }
+    void push_back(T&& item) { emplace_back(std::move(item)); }
+    template<typename... Args>
+    void emplace_back(Args&&... args);
+    bool try_push_back(T&& item);
+    bool pop(T& item);
+    bool pop(T& item, int timeout) { return pop(item, std::chrono::seconds(timeout)); }
+    template<typename Rep, typename Period>
+    bool pop(T& item, const std::chrono::duration<Rep, Period>& timeout);
+    size_t pop_batch(std::deque<T>& out, size_t maxItems);
+    template<typename Rep, typename Period>
+    size_t pop_batch(std::deque<T>& out, size_t maxItems, const std::chrono::duration<Rep, Period>& timeout);
+    bool try_pop(T& item);
+    void clear();
+    size_t capacity() { return capacity_; }
+    size_t size();
+
+    void flush();
+    void Close();
+
+private:
+    static const int SPIN = 64;     // 睡下之前先试这么多次
+
+    struct alignas(64) Cell_ {
+        std::atomic<size_t> seq;
+        alignas(T) unsigned char storage[sizeof(T)];
+        T* Item() { return std::launder(reinterpret_cast<T*>(storage)); }
+    };
+
+    template<typename... Args>
+    bool TryEmplace_(Args&&... args);
+    // 登记后再用retry试一次，还不行就睡到对面改计数器，返回retry是否成功
+    template<typename F>
+    bool Park_(std::atomic<uint32_t>& epoch, std::atomic<int>& waiters, F&& retry);
+    void Wake_(std::atomic<uint32_t>& epoch, std::atomic<int>& waiters);
+
+    Cell_* cells_;
+    size_t mask_;
+    size_t capacity_;
+    alignas(64) std::atomic<size_t> enqueuePos_;
+    alignas(64) std::atomic<size_t> dequeuePos_;
+    alignas(64) std::atomic<uint32_t> pushed_;      // 有消费者睡着时入队才加一，消费者睡在上面
+    std::atomic<int> popWaiters_;
+    alignas(64) std::atomic<uint32_t> popped_;      // 有生产者睡着时出队才加一，生产者睡在上面
+    std::atomic<int> pushWaiters_;
+    std::atomic<bool> isClose_;
+};
+
+template<typename T>
+MpmcQueue<T>::MpmcQueue(size_t maxsize)
+    : enqueuePos_(0), dequeuePos_(0), pushed_(0), popWaiters_(0), popped_(0), pushWaiters_(0), isClose_(false) {
+    assert(maxsize > 0);
+    size_t size = 2;
+    while(size < maxsize) { size <<= 1; }
+    capacity_ = size;
+    mask_ = size - 1;
+    cells_ = new Cell_[size];
+    for(size_t i = 0; i < size; i++) {
+        cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+}
+
+template<typename T>
+MpmcQueue<T>::~MpmcQueue() {
+    Close();
+    T item;
+    while(try_pop(item)) {}
+    delete[] cells_;
+}
+
+// 槽位的序号等于入队位置时可以写，写完置成位置+1交给消费者；消费者取完置成位置+容量，留给下一圈的生产者
+template<typename T>
+template<typename... Args>
+bool MpmcQueue<T>::TryEmplace_(Args&&... args) {
+    size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+    for(;;) {
+        Cell_& cell = cells_[pos & mask_];
+        size_t seq = cell.seq.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if(diff == 0) {
+            if(enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                new (cell.storage) T(std::forward<Args>(args)...);
+                cell.seq.store(pos + 1, std::memory_order_release);
+                Wake_(pushed_, popWaiters_);
+                return true;
+            }
+        } else if(diff < 0) {
+            return false;       // 满了：这一格上一圈的数据还没被取走
+        } else {
+            pos = enqueuePos_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template<typename T>
+bool MpmcQueue<T>::try_pop(T& item) {
+    size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+    for(;;) {
+        Cell_& cell = cells_[pos & mask_];
+        size_t seq = cell.seq.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+        if(diff == 0) {
+            if(dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                item = std::move(*cell.Item());
+                cell.Item()->~T();
+                cell.seq.store(pos + mask_ + 1, std::memory_order_release);
+                Wake_(popped_, pushWaiters_);
+                return true;
+            }
+        } else if(diff < 0) {
+            return false;       // 空了
+        } else {
+            pos = dequeuePos_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+// 放完数据（或者空出位置）之后看有没有人睡着；和Park_里的栅栏配对
+template<typename T>
+void MpmcQueue<T>::Wake_(std::atomic<uint32_t>& epoch, std::atomic<int>& waiters) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(waiters.load(std::memory_order_relaxed) > 0) {
+        epoch.fetch_add(1, std::memory_order_release);
+        epoch.notify_all();
+    }
+}
+
+// 两边都隔着seq_cst栅栏：要么对面看到了登记，改计数器叫醒我们；要么我们登记之后的这次重试看得到它放的数据
+template<typename T>
+template<typename F>
+bool MpmcQueue<T>::Park_(std::atomic<uint32_t>& epoch, std::atomic<int>& waiters, F&& retry) {
+    waiters.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint32_t seen = epoch.load(std::memory_order_acquire);
+    bool done = retry();
+    if(!done && !isClose_.load(std::memory_order_acquire)) {
+        epoch.wait(seen, std::memory_order_acquire);
+    }
+    waiters.fetch_sub(1, std::memory_order_relaxed);
+    return done;
+}
+
+template<typename T>
+template<typename... Args>
+void MpmcQueue<T>::emplace_back(Args&&... args) {
+    for(int spin = 0; ; spin++) {
+        if(isClose_.load(std::memory_order_acquire)) {
+            return;     // 关了之后入队的直接丢掉，和BlockQueue一样
+        }
+        if(TryEmplace_(std::forward<Args>(args)...)) {
+            return;
+        }
+        if(spin < SPIN) {
+            std::this_thread::yield();
+        } else if(Park_(popped_, pushWaiters_, [&]() { return TryEmplace_(std::forward<Args>(args)...); })) {
+            return;
+        }
+    }
+}
+
+template<typename T>
+bool MpmcQueue<T>::try_push_back(T&& item) {
+    return !isClose_.load(std::memory_order_acquire) && TryEmplace_(std::move(item));
+}
+
+template<typename T>
+bool MpmcQueue<T>::pop(T& item) {
+    for(int spin = 0; ; spin++) {
+        if(try_pop(item)) {
+            return true;
+        }
+        if(isClose_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        if(spin < SPIN) {
+            std::this_thread::yield();
+        } else if(Park_(pushed_, popWaiters_, [&]() { return try_pop(item); })) {
+            return true;
+        }
+    }
+}
+
+// std::atomic::wait不带超时，限时的等待只能自旋加短睡
+template<typename T>
+template<typename Rep, typename Period>
+bool MpmcQueue<T>::pop(T& item, const std::chrono::duration<Rep, Period>& timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    for(int spin = 0; ; spin++) {
+        if(try_pop(item)) {
+            return true;
+        }
+        if(isClose_.load(std::memory_order_acquire) || std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+        if(spin < SPIN) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+}
+
+template<typename T>
+size_t MpmcQueue<T>::pop_batch(std::deque<T>& out, size_t maxItems) {
+    T item;
+    if(maxItems == 0 || !pop(item)) {
+        return 0;
+    }
+    out.push_back(std::move(item));
+    size_t n = 1;
+    while(n < maxItems && try_pop(item)) {
+        out.push_back(std::move(item));
+        n++;
+    }
+    return n;
+}
+
+template<typename T>
+template<typename Rep, typename Period>
+size_t MpmcQueue<T>::pop_batch(std::deque<T>& out, size_t maxItems, const std::chrono::duration<Rep, Period>& timeout) {
+    T item;
+    if(maxItems == 0 || !pop(item, timeout)) {
+        return 0;
+    }
+    out.push_back(std::move(item));
+    size_t n = 1;
+    while(n < maxItems && try_pop(item)) {
+        out.push_back(std::move(item));
+        n++;
+    }
+    return n;
+}
+
+template<typename T>
+void MpmcQueue<T>::clear() {
+    T item;
+    while(try_pop(item)) {}
+}
+
+// 两个位置不是同时读的，并发时只是个近似值
+template<typename T>
+size_t MpmcQueue<T>::size() {
+    size_t head = dequeuePos_.load(std::memory_order_acquire);
+    size_t tail = enqueuePos_.load(std::memory_order_acquire);
+    return tail > head ? tail - head : 0;
+}
+
+template<typename T>
+void MpmcQueue<T>::flush() {
+    pushed_.fetch_add(1, std::memory_order_release);
+    pushed_.notify_all();
+}
+
+template<typename T>
+void MpmcQueue<T>::Close() {
+    isClose_.store(true, std::memory_order_release);
+    pushed_.fetch_add(1, std::memory_order_seq_cst);    // 睡着的两边都叫醒，醒来看到关了就返回
+    pushed_.notify_all();
+    popped_.fetch_add(1, std::memory_order_seq_cst);
+    popped_.notify_all();
+}
+
+# endif
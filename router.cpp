@@ -0,0 +1,350 @@
+#include "router.h"
+#include <string.h>
+#include <algorithm>
+
+std::string_view RouteMatch::Param(std::string_view name) const {
+    for(int i = 0; i < paramCount; i++) {
+        if(names[i] == name) {
+            return values[i];
+        }
+    }
+    return std::string_view();
+}
+
+Router* Router::Instance() {
+    static Router router;
+    return &router;
+}
+
+bool Router::AddExact(const std::string& path, RouteHandler handler, int tag) {
+    return Add_(EXACT, path, handler, tag, "");
+}
+
+bool Router::AddPrefix(const std::string& prefix, RouteHandler handler, int tag) {
+    return Add_(PREFIX, prefix, handler, tag, "");
+}
+
+bool Router::AddParam(const std::string& pattern, RouteHandler handler, int tag) {
+    return Add_(PARAM, pattern, handler, tag, "");
+}
+
+bool Router::AddStatic(const std::string& prefix, const std::string& dir) {
+    assert(!dir.empty());
+    // 目录末尾不带'/'，剩余路径总是以'/'开头
+    std::string root = dir;
+    while(root.size() > 1 && root.back() == '/') {
+        root.pop_back();
+    }
+    return Add_(STATIC, prefix, nullptr, -1, root);
+}
+
+// 冲突判断用的键：精确路由就是路径本身；其余按字典树里落的位置算，
+// 多余的'/'不算，参数名不算，前缀路由和静态挂载占同一个位置
+std::string Router::Key_(ROUTE_TYPE type, std::string_view pattern) {
+    if(type == EXACT) {
+        return "=" + std::string(pattern);
+    }
+    std::string key(type == PARAM ? "$" : "*");
+    size_t pos = 0;
+    for(std::string_view seg = NextSegment_(pattern, &pos); !seg.empty(); seg = NextSegment_(pattern, &pos)) {
+        key += '/';
+        if(type == PARAM && seg[0] == ':') {
+            key += ':';
+        } else {
+            key.append(seg.data(), seg.size());
+        }
+    }
+    return key;
+}
+
+// 两个参数路由从根往下走，在分开之前经过的参数位置上名字不一样就算冲突：
+// /user/:id/posts 和 /user/:name/files 共用":"那个结点，后注册的名字会被吞掉
+bool Router::ParamConflict_(std::string_view a, std::string_view b) {
+    size_t posA = 0, posB = 0;
+    std::string_view segA = NextSegment_(a, &posA), segB = NextSegment_(b, &posB);
+    for(; !segA.empty() && !segB.empty(); segA = NextSegment_(a, &posA), segB = NextSegment_(b, &posB)) {
+        if(segA[0] == ':' && segB[0] == ':') {
+            if(segA != segB) { return true; }
+        } else if(segA != segB) {
+            return false;   // 走到了不同的子结点
+        }
+    }
+    return false;
+}
+
+bool Router::Add_(ROUTE_TYPE type, const std::string& pattern, RouteHandler handler, int tag, const std::string& dir) {
+    assert(!frozen_);   // 冻结之后不允许再注册
+    assert(!pattern.empty() && pattern[0] == '/');
+    std::string key = Key_(type, pattern);
+    for(const Route_& route : routes_) {
+        if(Key_(route.type, route.pattern) == key) {
+            return false;   // 两个精确路由同一路径时任何种子都冲突，建表会停不下来
+        }
+        if(type == PARAM && route.type == PARAM && ParamConflict_(route.pattern, pattern)) {
+            return false;
+        }
+    }
+    routes_.push_back({type, pattern, handler, tag, dir});
+    return true;
+}
+
+void Router::Clear() {
+    frozen_ = false;
+    routes_.clear();
+    pool_.clear();
+    slots_.clear();
+    nodes_.clear();
+    edges_.clear();
+    seed_ = mask_ = 0;
+}
+
+// 启动时构建查找结构，之后的Match都是只读的
+bool Router::Freeze() {
+    if(frozen_) { return true; }
+    pool_.clear();
+    if(!BuildHash_()) {
+        return false;
+    }
+    BuildTrie_();
+    frozen_ = true;
+    return true;
+}
+
+uint32_t Router::Intern_(std::string_view str) {
+    uint32_t offset = pool_.size();
+    pool_.append(str.data(), str.size());
+    return offset;
+}
+
+// FNV-1a，种子参与初始值，换种子即可得到另一组哈希
+uint64_t Router::Hash_(std::string_view str, uint64_t seed) {
+    uint64_t h = 14695981039346656037ULL ^ (seed * 0x9E3779B97F4A7C15ULL);
+    for(unsigned char ch : str) {
+        h ^= ch;
+        h *= 1099511628211ULL;
+    }
+    return h ^ (h >> 32);
+}
+
+// 为精确路由寻找一个没有冲突的种子，查找时只需要探测一个槽位
+bool Router::BuildHash_() {
+    std::vector<int> exact;
+    for(size_t i = 0; i < routes_.size(); i++) {
+        if(routes_[i].type == EXACT) {
+            exact.push_back(i);
+        }
+    }
+    slots_.clear();
+    if(exact.empty()) { return true; }
+
+    size_t size = 8;
+    while(size < exact.size() * 2) { size <<= 1; }
+    std::vector<char> used;
+    for(; size <= MAX_HASH_SIZE; size <<= 1) {
+        for(uint64_t seed = 0; seed < 256; seed++) {
+            used.assign(size, 0);
+            bool ok = true;
+            for(int r : exact) {
+                size_t idx = Hash_(routes_[r].pattern, seed) & (size - 1);
+                if(used[idx]) { ok = false; break; }
+                used[idx] = 1;
+            }
+            if(!ok) { continue; }
+            seed_ = seed;
+            mask_ = size - 1;
+            slots_.assign(size, {0, 0, -1});
+            for(int r : exact) {
+                Slot_& slot = slots_[Hash_(routes_[r].pattern, seed_) & mask_];
+                slot.offset = Intern_(routes_[r].pattern);
+                slot.len = routes_[r].pattern.size();
+                slot.route = r;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// 取下一个路径段，跳过多余的'/'，pos停在段末尾
+std::string_view Router::NextSegment_(std::string_view path, size_t* pos) {
+    size_t i = *pos;
+    while(i < path.size() && path[i] == '/') { i++; }
+    size_t j = i;
+    while(j < path.size() && path[j] != '/') { j++; }
+    *pos = j;
+    return path.substr(i, j - i);
+}
+
+void Router::BuildTrie_() {
+    // 先用临时结构建树，再按层序展开成连续的数组，同一结点的边相邻存放
+    struct Tmp {
+        std::vector<std::pair<std::string, int>> kids;
+        int param = -1;
+        std::string paramName;
+        int endRoute = -1;
+        int prefixRoute = -1;
+    };
+    std::vector<Tmp> tmp(1);
+    nodes_.clear();
+    edges_.clear();
+
+    bool any = false;
+    for(size_t r = 0; r < routes_.size(); r++) {
+        if(routes_[r].type == EXACT) { continue; }
+        any = true;
+        std::string_view pattern = routes_[r].pattern;
+        int cur = 0;
+        size_t pos = 0;
+        for(std::string_view seg = NextSegment_(pattern, &pos); !seg.empty(); seg = NextSegment_(pattern, &pos)) {
+            if(routes_[r].type == PARAM && seg[0] == ':') {
+                if(tmp[cur].param < 0) {
+                    int next = tmp.size();
+                    tmp[cur].param = next;
+                    tmp[cur].paramName = std::string(seg.substr(1));
+                    tmp.emplace_back();
+                }
+                cur = tmp[cur].param;
+                continue;
+            }
+            int next = -1;
+            for(auto& kid : tmp[cur].kids) {
+                if(kid.first == seg) { next = kid.second; break; }
+            }
+            if(next < 0) {
+                next = tmp.size();
+                tmp[cur].kids.emplace_back(std::string(seg), next);
+                tmp.emplace_back();
+            }
+            cur = next;
+        }
+        if(routes_[r].type == PARAM) {
+            tmp[cur].endRoute = r;
+        } else {
+            tmp[cur].prefixRoute = r;
+        }
+    }
+    if(!any) { return; }
+
+    std::vector<int> order(1, 0);
+    for(size_t i = 0; i < order.size(); i++) {
+        Tmp& t = tmp[order[i]];
+        std::sort(t.kids.begin(), t.kids.end());
+        for(auto& kid : t.kids) { order.push_back(kid.second); }
+        if(t.param >= 0) { order.push_back(t.param); }
+    }
+    std::vector<int> index(tmp.size());
+    for(size_t i = 0; i < order.size(); i++) {
+        index[order[i]] = i;
+    }
+
+    nodes_.resize(order.size());
+    for(size_t i = 0; i < order.size(); i++) {
+        const Tmp& t = tmp[order[i]];
+        Node_& node = nodes_[i];
+        node.firstEdge = edges_.size();
+        node.edgeCount = t.kids.size();
+        for(auto& kid : t.kids) {
+            edges_.push_back({Intern_(kid.first), static_cast<uint32_t>(kid.first.size()), index[kid.second]});
+        }
+        node.paramChild = t.param >= 0 ? index[t.param] : -1;
+        node.paramOffset = Intern_(t.paramName);
+        node.paramLen = t.paramName.size();
+        node.endRoute = t.endRoute;
+        node.prefixRoute = t.prefixRoute;
+    }
+}
+
+void Router::Fill_(const Route_& route, RouteMatch* match) const {
+    match->handler = route.handler;
+    match->tag = route.tag;
+    if(route.type == STATIC) {
+        match->root = route.dir.c_str();
+    }
+}
+
+bool Router::HasDotDot(std::string_view path) {
+    size_t pos = 0;
+    for(std::string_view seg = NextSegment_(path, &pos); !seg.empty(); seg = NextSegment_(path, &pos)) {
+        if(seg == "..") {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 先查精确表，未命中再沿字典树走：静态段优先于参数段，不回溯，保留最长的前缀匹配
+bool Router::Match(std::string_view path, RouteMatch* match) const {
+    assert(frozen_ && match);
+    size_t query = path.find('?');
+    if(query != std::string_view::npos) {
+        path = path.substr(0, query);
+    }
+    match->handler = nullptr;
+    match->tag = -1;
+    match->root = nullptr;
+    match->rest = std::string_view();
+    match->paramCount = 0;
+
+    if(!slots_.empty()) {
+        const Slot_& slot = slots_[Hash_(path, seed_) & mask_];
+        if(slot.route >= 0 && slot.len == path.size() &&
+                memcmp(pool_.data() + slot.offset, path.data(), path.size()) == 0) {
+            Fill_(routes_[slot.route], match);
+            return true;
+        }
+    }
+    if(nodes_.empty()) { return false; }
+
+    int cur = 0;
+    int prefix = nodes_[0].prefixRoute;
+    size_t prefixPos = 0;
+    int params = 0;
+    bool complete = true;
+    size_t pos = 0;
+    for(std::string_view seg = NextSegment_(path, &pos); !seg.empty(); seg = NextSegment_(path, &pos)) {
+        const Node_& node = nodes_[cur];
+        int next = -1;
+        for(uint32_t e = node.firstEdge; e < node.firstEdge + node.edgeCount; e++) {
+            const Edge_& edge = edges_[e];
+            if(edge.len == seg.size() && memcmp(pool_.data() + edge.offset, seg.data(), seg.size()) == 0) {
+                next = edge.child;
+                break;
+            }
+        }
+        if(next < 0 && node.paramChild >= 0) {
+            if(params < RouteMatch::MAX_PARAMS) {
+                match->names[params] = std::string_view(pool_.data() + node.paramOffset, node.paramLen);
+                match->values[params] = seg;
+                params++;
+            }
+            next = node.paramChild;
+        }
+        if(next < 0) {
+            complete = false;
+            break;
+        }
+        cur = next;
+        if(nodes_[cur].prefixRoute >= 0) {
+            prefix = nodes_[cur].prefixRoute;
+            prefixPos = pos;
+        }
+    }
+
+    if(complete && nodes_[cur].endRoute >= 0) {
+        Fill_(routes_[nodes_[cur].endRoute], match);
+        match->paramCount = params;
+        return true;
+    }
+    if(prefix >= 0) {
+        std::string_view rest = prefixPos < path.size() ? path.substr(prefixPos) : std::string_view("/");
+        if(routes_[prefix].type == STATIC && HasDotDot(rest)) {
+            match->paramCount = 0;
+            return false;
+        }
+        Fill_(routes_[prefix], match);
+        match->rest = rest;
+        return true;
+    }
+    match->paramCount = 0;
+    return false;
+}
@@ -0,0 +1,120 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <stdint.h>
+#include <assert.h>
+
+class HttpRequest;
+struct RouteMatch;
+
+// 路由回调：在解析完请求行之后调用，可以改写请求的路径等信息
+typedef void (*RouteHandler)(HttpRequest& req, const RouteMatch& match);
+
+// 一次匹配的结果，全部是指向路由表或请求路径的视图，不做任何内存分配
+struct RouteMatch {
+    static const int MAX_PARAMS = 4;
+
+    RouteHandler handler;
+    int tag;                                // 注册时附带的标签，例如登录/注册
+    const char* root;                       // 静态挂载的目录，非静态路由为nullptr
+    std::string_view rest;                  // 前缀/静态路由匹配后剩余的路径
+    int paramCount;
+    std::string_view names[MAX_PARAMS];     // ":id"中的id
+    std::string_view values[MAX_PARAMS];    // 路径中对应的值
+
+    std::string_view Param(std::string_view name) const;
+};
+
+/*
+路由表：启动时注册，Freeze之后只读
+精确路由放在完美哈希表中，一次探测即可命中；
+前缀、参数路由和静态挂载放在按路径段组织的扁平字典树中
+*/
+class Router {
+public:
+    static Router* Instance();
+
+    // 和已注册的路由冲突（同一路径，或者落在字典树同一个位置）时返回false，不注册；
+    // 参数路由走到同一个参数位置时参数名也得一样，字典树的一个结点只记一个名字
+    bool AddExact(const std::string& path, RouteHandler handler, int tag = -1);
+    bool AddPrefix(const std::string& prefix, RouteHandler handler, int tag = -1);
+    bool AddParam(const std::string& pattern, RouteHandler handler, int tag = -1);  // 例如 /user/:id
+    bool AddStatic(const std::string& prefix, const std::string& dir);             // 例如 /static/ -> /var/www/
+
+    bool Freeze();      // 构建查找结构，失败返回false（精确路由在大小上限内找不到无冲突的哈希）
+    bool IsFrozen() const { return frozen_; }
+    void Clear();
+
+    // 静态挂载剩下的路径里有".."段时不算命中，免得跳出挂载目录
+    bool Match(std::string_view path, RouteMatch* match) const;
+
+    static bool HasDotDot(std::string_view path);   // 路径里有没有".."这一段
+
+private:
+    enum ROUTE_TYPE {
+        EXACT,
+        PREFIX,
+        PARAM,
+        STATIC,
+    };
+
+    struct Route_ {
+        ROUTE_TYPE type;
+        std::string pattern;
+        RouteHandler handler;
+        int tag;
+        std::string dir;
+    };
+
+    struct Slot_ {              // 完美哈希表的槽位
+        uint32_t offset;        // 键在pool_中的偏移
+        uint32_t len;
+        int32_t route;          // -1表示空槽
+    };
+
+    struct Edge_ {              // 字典树的静态边
+        uint32_t offset;
+        uint32_t len;
+        int32_t child;
+    };
+
+    struct Node_ {
+        uint32_t firstEdge;
+        uint32_t edgeCount;
+        int32_t paramChild;     // ":name"子结点
+        uint32_t paramOffset;   // 参数名在pool_中的位置
+        uint32_t paramLen;
+        int32_t endRoute;       // 在该结点结束的参数路由
+        int32_t prefixRoute;    // 以该结点为前缀的前缀路由/静态挂载
+    };
+
+    Router() : frozen_(false), seed_(0), mask_(0) {}
+
+    static const size_t MAX_HASH_SIZE = 1 << 20;    // 完美哈希表最多这么多槽
+
+    bool Add_(ROUTE_TYPE type, const std::string& pattern, RouteHandler handler, int tag, const std::string& dir);
+    static std::string Key_(ROUTE_TYPE type, std::string_view pattern);
+    static bool ParamConflict_(std::string_view a, std::string_view b);
+    bool BuildHash_();
+    void BuildTrie_();
+    uint32_t Intern_(std::string_view str);
+    void Fill_(const Route_& route, RouteMatch* match) const;
+
+    static uint64_t Hash_(std::string_view str, uint64_t seed);
+    static std::string_view NextSegment_(std::string_view path, size_t* pos);
+
+    bool frozen_;
+    std::vector<Route_> routes_;
+
+    std::string pool_;          // 所有键和路径段的字符池
+    uint64_t seed_;
+    uint64_t mask_;
+    std::vector<Slot_> slots_;
+    std::vector<Node_> nodes_;
+    std::vector<Edge_> edges_;
+};
+
+#endif //ROUTER_H
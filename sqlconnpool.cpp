@@ -17,14 +17,17 @@ void SqlConnPool::Init(const char* host, int port,
             LOG_ERROR("MySql init error!");
             assert(conn);
         }
+        MYSQL* handle = conn;
         conn = mysql_real_connect(conn, host, user, pwd, dbName, port, nullptr, 0);//这个函数的返回对象会是一个指向数据库的
         if (!conn) {
             LOG_ERROR("MySql Connect error!");
+            mysql_close(handle);    // 连不上的连接不放进池子，免得取出来一个空指针
+            continue;
         }
         connQue_.emplace(conn);//将建立起来的 这个连接扔到我们的连接池里面去
         //恰好这些指针都是一个Mysql*类型的数据。线程池里面也是存放的一些指针。感觉这些东西有点像一个黑盒
     }
-    MAX_CONN_ = connSize;
+    MAX_CONN_ = connQue_.size();
     sem_init(&semId_, 0, MAX_CONN_);
 }
 
@@ -34,8 +37,10 @@ MYSQL* SqlConnPool::GetConn() {//拿出一个连接来
         LOG_WARN("SqlConnPool busy!");//没有连接在这个connque里面了，就说明都在用
         return nullptr;
     }
+    int64_t start = Metrics::NowNs();
     sem_wait(&semId_);  // -1
     lock_guard<mutex> locker(mtx_);
+    Metrics::Instance()->Record(Metrics::SQL_WAIT_NS, Metrics::NowNs() - start);
     conn = connQue_.front();
     connQue_.pop();
     return conn;
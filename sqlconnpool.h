@@ -8,6 +8,7 @@
 #include <semaphore.h>
 #include <thread>
 #include "log.h"
+#include "metrics.h"
 
 
 //连接池，在项目开始的时候就要建立许多个和数据库的连接，以提高我们访问数据库的效率
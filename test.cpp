@@ -1,6 +1,26 @@
 #include "log.h"
 #include "threadpool.h"
+#include "httprequest.h"
+#include "httpresponse.h"
+#include "metrics.h"
+#include "coloop.h"
+#include "codel.h"
+#include "httpconn.h"
+#include "hpack.h"
+#include "http2.h"
+#include "tls.h"
+#include "accesslog.h"
+#include "mpmcqueue.h"
+#include "heaptimer.h"
 #include <features.h>
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <thread>
+#include <dirent.h>
 
 //cpp是具体的实现，而h才是供外界调用的接口
 
@@ -38,16 +58,866 @@ void ThreadLogTask(int i, int cnt) {
     }
 }
 
+// 统计堆分配次数，用来检查长连接的稳态请求是不是零分配
+static std::atomic<size_t> allocCount(0);
+
+void* operator new(size_t size) {
+    allocCount++;
+    void* ptr = malloc(size ? size : 1);
+    if(!ptr) { throw std::bad_alloc(); }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+
+void TestRequestAlloc() {
+    mkdir("./testresources", 0777);
+    FILE* fp = fopen("./testresources/index.html", "w");
+    assert(fp);
+    fputs("<html>index</html>", fp);
+    fclose(fp);
+
+    HttpRequest::RegisterRoutes(Router::Instance());
+    Router::Instance()->Freeze();
+
+    const char* reqs[] = {
+        "GET /index?from=home&lang=zh%2DCN HTTP/1.1\r\n"
+        "Host: 127.0.0.1:1316\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+        "Connection: keep-alive\r\n\r\n",
+        "POST /comment HTTP/1.1\r\n"
+        "host: 127.0.0.1:1316\r\n"
+        "content-type: application/x-www-form-urlencoded; charset=UTF-8\r\n"
+        "CONTENT-LENGTH: 52\r\n"
+        "Connection: Keep-Alive\r\n\r\n"
+        "username=tiny+web&password=p%40ss%21word&remember=on",
+    };
+    HttpRequest request;
+    HttpResponse response;
+    Buffer readBuff, writeBuff;
+    const char* srcDir = "./testresources";
+    size_t before = 0;
+    for(int i = 0; i < 20000; i++) {
+        if(i == 1000) { before = allocCount; }  // 前面的请求用来热身，让缓冲区和arena长到稳定大小
+        const char* raw = reqs[i % 2];
+        request.Init();
+        readBuff.Append(raw, strlen(raw));
+        assert(request.parse(readBuff) && request.IsFinish());
+        assert(request.path() == (i % 2 ? "/comment" : "/index.html"));
+        assert(i % 2 == 0 || request.GetPost("password") == "p@ss!word");
+        assert(i % 2 == 1 || request.GetQuery("lang") == "zh-CN");
+        assert(request.IsKeepAlive() && request.GetHeader(HttpRequest::HDR_HOST) == "127.0.0.1:1316");
+        assert(i % 2 == 1 || request.GetHeader("accept-language") == "zh-CN,zh;q=0.9,en;q=0.8");
+        response.Init(srcDir, request.path(), request.arena(), request.IsKeepAlive(), 200);
+        response.MakeResponse(writeBuff);
+        response.UnmapFile();
+        writeBuff.RetrieveAll();
+    }
+    size_t allocs = allocCount - before;
+    printf("TestRequestAlloc: %zu allocations in 19000 keep-alive requests\n", allocs);
+    assert(allocs == 0);
+}
+
+// 原地解码：%xx和'+'，截断的和不是十六进制的'%'原样保留，%00解出来的NUL留在值里面
+void TestUrlCodec() {
+    const struct { const char* in; size_t len; const char* out; size_t outLen; } decode[] = {
+        { "a%20b%2Fc", 9, "a b/c", 5 },
+        { "%E4%BD%A0", 9, "\xE4\xBD\xA0", 3 },
+        { "x+y++", 5, "x y  ", 5 },
+        { "100%", 4, "100%", 4 },
+        { "%4", 2, "%4", 2 },
+        { "%zz%4g", 6, "%zz%4g", 6 },
+        { "a%00b", 5, "a\0b", 3 },
+        { "%27%20OR%20%271%27=%271", 23, "' OR '1'='1", 11 },
+    };
+    for(const auto& c : decode) {
+        std::string buf(c.in, c.len);
+        size_t n = UrlCodec::Decode(&buf[0], buf.size());
+        assert(n == c.outLen && memcmp(buf.data(), c.out, n) == 0);
+    }
+
+    std::string body = "username=tiny+web&password=a%00b%27&&flag&eq=a=b%3D&pct=50%&long=0123456789abcdef0123456789%41";
+    FormMap form;
+    UrlCodec::ParseForm(&body[0], body.size(), &form);
+    assert(form.size() == 6 && form.Get("username") == "tiny web");
+    assert(form.Get("password") == std::string_view("a\0b'", 4));
+    assert(form.Has("flag") && form.Get("flag").empty());
+    assert(form.Get("eq") == "a=b=" && form.Get("pct") == "50%");
+    assert(form.Get("long") == "0123456789abcdef0123456789A");     // 跨过SSE2一次16字节的边界
+    printf("TestUrlCodec: %zu decode cases, %zu form fields\n", sizeof(decode) / sizeof(decode[0]), form.size());
+}
+
+// 请求体长度只认一个Content-Length：分块传输不支持，和Content-Length一起出现或者两个长度不一样都拒绝
+void TestRequestFraming() {
+    const struct { const char* raw; int code; } cases[] = {
+        { "POST /login HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n0\r\n\r\n", 501 },
+        { "POST /login HTTP/1.1\r\nContent-Length: 5\r\ntransfer-encoding: chunked\r\n\r\nhello", 400 },
+        { "POST /login HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 6\r\n\r\nhello!", 400 },
+    };
+    HttpRequest request;
+    HttpResponse response;
+    Buffer buff, out;
+    for(const auto& c : cases) {
+        request.Init();
+        buff.RetrieveAll();
+        buff.Append(c.raw, strlen(c.raw));
+        assert(!request.parse(buff) && request.ErrorCode() == c.code);
+        response.Init("./testresources", request.path(), request.arena(), false, request.ErrorCode());
+        out.RetrieveAll();
+        response.MakeResponse(out);
+        assert(out.RetrieveAllToStr().compare(0, 12, "HTTP/1.1 " + std::to_string(c.code)) == 0);
+    }
+    printf("TestRequestFraming: ok\n");
+}
+
+static void RouteMark(HttpRequest&, const RouteMatch&) {}
+
+// 精确表优先，字典树里静态段优先于参数段、取最长的前缀；重复注册被拒绝，静态挂载不能用".."跳出目录
+void TestRouter() {
+    Router* router = Router::Instance();
+    router->Clear();
+    assert(router->AddExact("/a/b", RouteMark, 1));
+    assert(!router->AddExact("/a/b", RouteMark, 2));
+    assert(router->AddPrefix("/a", RouteMark, 3));
+    assert(router->AddPrefix("/a/b/c/", RouteMark, 4));
+    assert(!router->AddStatic("//a/b/c", "/tmp"));     // 和上面的前缀落在同一个位置
+    assert(router->AddParam("/user/:id/posts/:post", RouteMark, 5));
+    assert(!router->AddParam("/user/:name/posts/:p", RouteMark, 6));
+    assert(router->AddParam("/user/me/posts/:post", RouteMark, 7));
+    assert(!router->AddParam("/user/:name/files", RouteMark, 8));   // 和:id共用一个参数结点
+    assert(router->AddParam("/user/:id/files/:file", RouteMark, 8));
+    assert(router->AddStatic("/static/", "/var/www/"));
+    assert(router->Freeze());
+
+    RouteMatch match;
+    assert(router->Match("/a/b?x=1", &match) && match.tag == 1 && match.rest.empty());
+    assert(router->Match("/a/b/", &match) && match.tag == 3 && match.rest == "/b/");    // 精确表不忽略结尾的'/'
+    assert(router->Match("/a/x/y", &match) && match.tag == 3 && match.rest == "/x/y");
+    assert(router->Match("/a/b/c/d", &match) && match.tag == 4 && match.rest == "/d");
+    assert(router->Match("/a/b/c", &match) && match.tag == 4 && match.rest == "/");
+    assert(router->Match("/user/42/posts/7", &match) && match.tag == 5 && match.paramCount == 2);
+    assert(match.Param("id") == "42" && match.Param("post") == "7" && match.Param("x").empty());
+    assert(router->Match("/user/me/posts/7", &match) && match.tag == 7 && match.Param("post") == "7");
+    assert(router->Match("/user/42/files/a", &match) && match.tag == 8 && match.Param("id") == "42" && match.Param("file") == "a");
+    assert(!router->Match("/user/42/posts", &match) && !router->Match("/b", &match));
+    assert(router->Match("/static/css/site.css", &match) && match.root == std::string("/var/www") && match.rest == "/css/site.css");
+    assert(router->Match("/static", &match) && match.rest == "/");
+    assert(!router->Match("/static/../etc/passwd", &match) && !router->Match("/static/css/../../x", &match));
+    assert(router->Match("/static/..css/a", &match) && Router::HasDotDot("/a/../b") && !Router::HasDotDot("/a/..b"));
+
+    router->Clear();
+    HttpRequest::RegisterRoutes(router);
+    assert(router->Freeze());
+    HttpRequest request;
+    Buffer buff;
+    buff.Append("GET /static/../../etc/passwd HTTP/1.1\r\n\r\n");
+    assert(!request.parse(buff) && request.ErrorCode() == 400);
+    // 路由改写path，target还是请求行里的原样，访问日志记的是它
+    request.Init();
+    Buffer next;
+    next.Append("GET /?lang=zh HTTP/1.1\r\n\r\n");
+    assert(request.parse(next) && request.path() == "/index.html" && request.target() == "/?lang=zh");
+    assert(request.GetQuery("lang") == "zh");
+    printf("TestRouter: ok\n");
+}
+
+void TestMetrics() {
+    Metrics* metrics = Metrics::Instance();
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; t++) {
+        threads.emplace_back([metrics]() {
+            for(int i = 1; i <= 1000; i++) {
+                metrics->Add(Metrics::ACCEPTS);
+                metrics->Record(Metrics::PARSE_NS, i * 1000);
+            }
+        });
+    }
+    for(auto& th : threads) { th.join(); }
+    assert(metrics->Get(Metrics::ACCEPTS) == 4000);
+    uint64_t p50 = metrics->Quantile(Metrics::PARSE_NS, 0.5);
+    assert(p50 >= 500000 && p50 <= 500000 * 107 / 100);     // 分桶的相对误差在1/16以内
+    std::string text = metrics->Render();
+    assert(text.find("tinyweb_accepts_total 4000\n") != std::string::npos);
+    assert(text.find("tinyweb_parse_seconds_count 4000\n") != std::string::npos);
+    printf("TestMetrics: p50=%lluns\n", (unsigned long long)p50);
+}
+
 void TestThreadPool() {
     Log::Instance()->init(0, "./testThreadpool", ".log", 5000);
     ThreadPool threadpool(6);//创建一个线程池并且里面开启了六个线程
     for(int i = 0; i < 18; i++) {
         threadpool.AddTask(std::bind(ThreadLogTask, i % 4, i * 10000));
     }
-    getchar();
+}   // 析构时等队列里的任务做完，join所有线程
+
+// 任务阻塞在“数据库”里时线程池应该加线程，空闲之后再减回下限
+void TestThreadPoolResize() {
+    ThreadPool::Options options;
+    options.minThreads = 1;
+    options.maxThreads = 4;
+    options.adjustMs = 10;
+    options.growDelayUs = 1000;
+    options.shrinkAfterMs = 50;
+    options.name = "test";
+    ThreadPool threadpool(options);
+    std::atomic<int> done(0);
+    for(int i = 0; i < 40; i++) {
+        threadpool.AddTask([&done] {
+            WatchCall call(Watchdog::SQL_QUERY);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            done++;
+        });
+    }
+    int peak = 0;
+    while(done < 40) {
+        peak = std::max(peak, threadpool.ThreadCount());
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    assert(peak > 1 && peak <= 4);
+    for(int i = 0; i < 100 && threadpool.ThreadCount() > 1; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    assert(threadpool.ThreadCount() == 1);
+    assert(Metrics::Instance()->Render().find("tinyweb_pool_threads{pool=\"test\"} 1\n") != std::string::npos);
+    printf("TestThreadPoolResize: peak=%d\n", peak);
+}
+
+// 一个线程被慢任务堵住时，后来的快任务不用等前面所有慢任务做完
+void TestThreadPoolClasses() {
+    ThreadPool::Options options;
+    options.minThreads = options.maxThreads = 1;
+    options.classes = { { "fast", 1, 0 }, { "slow", 1, 0 } };
+    options.name = "classes";
+    ThreadPool threadpool(options);
+    std::mutex mtx;
+    std::vector<int> order;
+    std::atomic<bool> gate(false);
+    threadpool.AddTask([&gate] { while(!gate) { std::this_thread::yield(); } }, 1);
+    for(int i = 0; i < 10; i++) {
+        threadpool.AddTask([&, i] { std::lock_guard<std::mutex> locker(mtx); order.push_back(i); }, 1);
+    }
+    threadpool.AddTask([&] { std::lock_guard<std::mutex> locker(mtx); order.push_back(-1); }, 0);
+    gate = true;
+    while(true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::lock_guard<std::mutex> locker(mtx);
+        if(order.size() == 11) { break; }
+    }
+    assert(order[0] == -1 || order[1] == -1);   // 两类权重相同，轮流取
+    printf("TestThreadPoolClasses: fast task ran %s\n", order[0] == -1 ? "first" : "second");
+}
+
+static CoTask CoCount(std::atomic<int>* count) {
+    (*count)++;
+    co_return;
+}
+
+// 等两次可读：第一次读到数据，第二次被取消
+static CoTask CoReadTwice(CoLoop* loop, int fd, std::atomic<int>* state) {
+    if(co_await loop->Wait(fd, EPOLLIN | EPOLLONESHOT)) {
+        char c;
+        if(read(fd, &c, 1) == 1 && c == 'x') { (*state)++; }
+    }
+    if(!co_await loop->Wait(fd, EPOLLIN | EPOLLONESHOT)) { (*state)++; }
+    (*state)++;
+}
+
+void TestCoroutine() {
+    // 帧用完放回本线程的池子，预热之后不再分配
+    std::atomic<int> count(0);
+    CoCount(&count).Start();
+    size_t before = allocCount;
+    for(int i = 0; i < 100; i++) { CoCount(&count).Start(); }
+    assert(allocCount - before == 0 && count == 101);
+
+    int fds[2];
+    int ret = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+    assert(ret == 0);
+    Epoller epoller;
+    ThreadPool threadpool(2);
+    CoLoop loop(&epoller, &threadpool);
+    epoller.AddFd(fds[0], EPOLLONESHOT);
+    std::atomic<int> state(0);
+    loop.Spawn(fds[0], CoReadTwice(&loop, fds[0], &state));
+    ret = write(fds[1], "x", 1);
+    assert(ret == 1);
+    while(state < 1) {  // 这里充当主线程的事件循环
+        for(int i = epoller.Wait(10) - 1; i >= 0; i--) { loop.Dispatch(epoller.GetEventFd(i)); }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));     // 让协程挂在第二次Wait上，也可能还没挂上，两种都要能取消
+    loop.Cancel(fds[0]);
+    while(state < 3) { std::this_thread::sleep_for(std::chrono::milliseconds(1)); }
+    close(fds[0]);
+    close(fds[1]);
+    printf("TestCoroutine: ok\n");
+}
+
+// 延迟短暂超标不丢；持续超过一个interval开始丢，丢的间隔越来越短；降下来就停
+void TestCoDel() {
+    const int64_t MS = 1000000;
+    CoDel codel(5 * MS, 100 * MS);
+    assert(!codel.ShouldDrop(1 * MS, 0));
+    assert(!codel.ShouldDrop(20 * MS, 10 * MS));
+    assert(!codel.ShouldDrop(20 * MS, 50 * MS));
+    assert(!codel.ShouldDrop(1 * MS, 60 * MS));     // 中间降下来过，重新计时
+    assert(!codel.ShouldDrop(20 * MS, 70 * MS));
+    assert(!codel.ShouldDrop(20 * MS, 160 * MS));
+    int drops = 0;
+    int64_t last = 0, gap = 0, firstGap = 0;
+    for(int64_t now = 170 * MS; now < 1170 * MS; now += MS) {
+        if(codel.ShouldDrop(20 * MS, now)) {
+            if(drops == 1) { firstGap = now - last; }
+            gap = now - last;
+            last = now;
+            drops++;
+        }
+    }
+    assert(drops > 10 && codel.Dropping() && gap < firstGap);
+    assert(!codel.ShouldDrop(1 * MS, 1200 * MS) && !codel.Dropping());
+    printf("TestCoDel: %d drops in 1s\n", drops);
+}
+
+// 空闲连接只留几十字节；一个请求处理完状态还回池里，下一个请求复用
+void TestConnCompact() {
+    int fds[2];
+    int ret = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+    assert(ret == 0);
+    HttpConn::srcDir = "./testresources/";
+    sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    HttpConn conn;
+    conn.init(fds[0], addr);
+    assert(conn.IsCompact());
+    int active = HttpConn::ActiveStates();
+    const char* req = "GET /index.html HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+    char out[4096];
+    int err = 0;
+    for(int i = 0; i < 3; i++) {
+        ret = write(fds[1], req, strlen(req));
+        assert(ret == (int)strlen(req));
+        assert(conn.read(&err) > 0 && HttpConn::ActiveStates() == active + 1);
+        assert(conn.process());
+        while(conn.ToWriteBytes() > 0) {
+            conn.write(&err);
+            while(read(fds[1], out, sizeof(out)) > 0) {}
+        }
+        conn.RequestEnd();
+        assert(conn.Compact() && conn.IsCompact());
+        assert(HttpConn::ActiveStates() == active && HttpConn::PooledStates() > 0);
+    }
+    int pooled = HttpConn::PooledStates();
+    // 请求只收到一半不能还
+    const char* half = "GET /index.html HTTP/1.1\r\nConnection: keep";
+    ret = write(fds[1], half, strlen(half));
+    assert(ret == (int)strlen(half));
+    assert(conn.read(&err) > 0 && HttpConn::PooledStates() == pooled - 1);
+    assert(!conn.process() && !conn.Compact());
+    conn.Close();
+    assert(HttpConn::ActiveStates() == active && HttpConn::PooledStates() == pooled);
+    close(fds[1]);
+    printf("TestConnCompact: idle connection %zu bytes\n", sizeof(HttpConn));
+    assert(sizeof(HttpConn) <= 64);
+}
+
+// UNIX套接字上的对端默认不算本机，/metrics当作没有这个路径；WebServer::unixListen.trustPeers打开时才算
+void TestPeerTrust() {
+    Router* router = Router::Instance();
+    router->Clear();
+    HttpRequest::RegisterRoutes(router);
+    Metrics::RegisterRoutes(router);
+    assert(router->Freeze());
+    HttpConn::srcDir = "./testresources/";
+    sockaddr_in none = { 0 };
+    const HttpConn::PEER kinds[] = { HttpConn::PEER_UNIX, HttpConn::PEER_UNIX_TRUSTED };
+    const char* const expect[] = { "HTTP/1.1 404", "HTTP/1.1 200" };
+    for(int i = 0; i < 2; i++) {
+        int fds[2];
+        int ret = socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+        assert(ret == 0);
+        HttpConn conn;
+        conn.init(fds[0], none, kinds[i]);
+        const char* req = "GET /metrics HTTP/1.1\r\n\r\n";
+        ret = write(fds[1], req, strlen(req));
+        assert(ret == (int)strlen(req));
+        int err = 0;
+        assert(conn.read(&err) > 0 && conn.process());
+        std::string response;
+        char out[4096];
+        while(conn.ToWriteBytes() > 0) {
+            conn.write(&err);
+            while((ret = read(fds[1], out, sizeof(out))) > 0) { response.append(out, ret); }
+        }
+        assert(response.compare(0, 12, expect[i]) == 0 && strcmp(conn.GetIP(), "unix") == 0);
+        conn.Close();
+        close(fds[1]);
+    }
+    printf("TestPeerTrust: unix peer 404 on /metrics, trusted unix peer 200\n");
+}
+
+// HPACK用RFC 7541附录C.4的例子；会话喂一个完整的请求，看回来的帧
+void TestHttp2() {
+    static const uint8_t c41[] = { 0x82, 0x86, 0x84, 0x41, 0x8c, 0xf1, 0xe3, 0xc2, 0xe5, 0xf2, 0x3a, 0x6b, 0xa0, 0xab, 0x90, 0xf4, 0xff };
+    HpackDecoder decoder;
+    std::vector<HpackDecoder::Header> headers;
+    bool truncated = false;
+    assert(decoder.Decode(c41, sizeof(c41), &headers, 4096, &truncated) && !truncated);
+    assert(headers.size() == 4 && headers[0].second == "GET" && headers[1].second == "http"
+           && headers[2].second == "/" && headers[3].first == ":authority" && headers[3].second == "www.example.com");
+
+    HpackEncoder encoder;
+    HpackDecoder roundTrip;
+    std::string block;
+    for(int i = 0; i < 2; i++) {    // 第二遍全部命中动态表
+        block.clear();
+        encoder.Encode(":method", "GET", &block);
+        encoder.Encode(":scheme", "http", &block);
+        encoder.Encode(":path", "/missing.html", &block);
+        encoder.Encode("user-agent", "tinyweb-test", &block);
+        headers.clear();
+        assert(roundTrip.Decode((const uint8_t*)block.data(), block.size(), &headers, 4096, &truncated));
+        assert(headers.size() == 4 && headers[2].second == "/missing.html" && headers[3].second == "tinyweb-test");
+    }
+    assert(block.size() == 4);
+
+    // 前缀整数后面跟一串0x80续字节：值不涨，移位超过28位就判解码失败
+    static const uint8_t overlong[] = { 0x3f, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x01 };
+    HpackDecoder overlongDecoder;
+    headers.clear();
+    assert(!overlongDecoder.Decode(overlong, sizeof(overlong), &headers, 4096, &truncated));
+
+    // 连接前言 + 空SETTINGS + 流1的HEADERS（END_STREAM|END_HEADERS）
+    Buffer in, out;
+    in.Append("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", 24);
+    assert(Http2Session::MatchPreface(in) == 1);
+    const char settings[9] = { 0, 0, 0, 4, 0, 0, 0, 0, 0 };
+    in.Append(settings, 9);
+    HpackEncoder clientEncoder;
+    block.clear();
+    clientEncoder.Encode(":method", "GET", &block);
+    clientEncoder.Encode(":scheme", "http", &block);
+    clientEncoder.Encode(":path", "/missing.html", &block);
+    clientEncoder.Encode(":authority", "localhost", &block);
+    char header[9] = { 0, 0, (char)block.size(), 1, 0x5, 0, 0, 0, 1 };
+    in.Append(header, 9);
+    in.Append(block);
+    sockaddr_in peer = {};
+    peer.sin_family = AF_INET;
+    peer.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    Http2Session session("./testresources/", -1, true, peer, false);
+    assert(session.OnRead(in, out) && in.ReadableBytes() == 0);
+    session.Produce(out);
+    HpackDecoder clientDecoder;
+    std::string status;
+    size_t body = 0;
+    bool ended = false;
+    int frames = 0;
+    while(out.ReadableBytes() >= 9) {
+        const uint8_t* p = (const uint8_t*)out.Peek();
+        uint32_t len = (p[0] << 16) | (p[1] << 8) | p[2];
+        uint8_t type = p[3], flags = p[4];
+        assert(out.ReadableBytes() >= 9 + len);
+        if(type == 1) {
+            headers.clear();
+            assert(clientDecoder.Decode(p + 9, len, &headers, 4096, &truncated));
+            assert(!headers.empty() && headers[0].first == ":status");
+            status = headers[0].second;
+        } else if(type == 0) {
+            body += len;
+        }
+        if((type == 0 || type == 1) && (flags & 0x1)) { ended = true; }
+        out.Retrieve(9 + len);
+        frames++;
+    }
+    assert(status == "404" && body > 0 && ended && session.Streams() == 0 && !session.Closing());
+
+    // 登录的流收齐后等查库，不在OnRead里查；数据库线程池满了时回503
+    auto frame = [&in](uint8_t type, uint8_t flags, uint8_t id, const std::string& payload) {
+        char head[9] = { 0, (char)(payload.size() >> 8), (char)payload.size(), (char)type, (char)flags, 0, 0, 0, (char)id };
+        in.Append(head, 9);
+        in.Append(payload);
+    };
+    auto request = [&clientEncoder](const char* method, const char* path) {
+        std::string block;
+        clientEncoder.Encode(":method", method, &block);
+        clientEncoder.Encode(":scheme", "http", &block);
+        clientEncoder.Encode(":path", path, &block);
+        clientEncoder.Encode("content-type", "application/x-www-form-urlencoded", &block);
+        return block;
+    };
+    int rstCode = -1;
+    auto drain = [&]() {
+        status.clear();
+        while(out.ReadableBytes() >= 9) {
+            const uint8_t* p = (const uint8_t*)out.Peek();
+            uint32_t len = (p[0] << 16) | (p[1] << 8) | p[2];
+            if(p[3] == 1) {
+                headers.clear();
+                assert(clientDecoder.Decode(p + 9, len, &headers, 4096, &truncated));
+                status = headers[0].second;
+            } else if(p[3] == 3) {
+                rstCode = p[12];
+            }
+            out.Retrieve(9 + len);
+        }
+    };
+    frame(1, 0x4, 3, request("POST", "/login"));
+    frame(0, 0x1, 3, "username=a&password=b");
+    assert(session.OnRead(in, out) && session.NeedsVerify());
+    drain();
+    assert(status.empty());
+    session.Verify(out, false);
+    session.Produce(out);
+    drain();
+    assert(status == "503" && !session.NeedsVerify() && session.Streams() == 0);
+
+    // 对端已经半关的流又来HEADERS：只重置这个流（STREAM_CLOSED），连接照常
+    frame(1, 0x5, 5, request("GET", "/missing.html"));
+    frame(1, 0x5, 5, request("GET", "/missing.html"));
+    assert(session.OnRead(in, out));
+    drain();
+    assert(rstCode == 5 && session.Streams() == 0 && !session.Closing());
+
+    // 头部名里夹着CRLF，拼进HTTP/1.1文本就多出一个content-length：按PROTOCOL_ERROR重置这个流
+    block = request("GET", "/missing.html");
+    clientEncoder.Encode("x\r\ncontent-length", "0", &block);
+    frame(1, 0x5, 7, block);
+    rstCode = -1;
+    assert(session.OnRead(in, out));
+    drain();
+    assert(rstCode == 1 && status.empty() && session.Streams() == 0 && !session.Closing());
+    printf("TestHttp2: %d frames, status %s, body %zu bytes\n", frames, status.c_str(), body);
+}
+
+#ifdef TINYWEB_TLS
+// 客户端：握手（有票据就带上），发一个请求，读到服务端关连接
+static bool TlsGet(int port, SSL_CTX* ctx, SSL_SESSION** session, std::string* response, bool* resumed) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return false;
+    }
+    SSL* ssl = SSL_new(ctx);
+    SSL_set_fd(ssl, fd);
+    if(*session) { SSL_set_session(ssl, *session); }
+    const char* req = "GET /index.html HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    bool ok = SSL_connect(ssl) == 1 && SSL_write(ssl, req, strlen(req)) == (int)strlen(req);
+    char buf[4096];
+    int n;
+    while(ok && (n = SSL_read(ssl, buf, sizeof(buf))) > 0) { response->append(buf, n); }
+    *resumed = SSL_session_reused(ssl);
+    if(*session) { SSL_SESSION_free(*session); }
+    *session = SSL_get1_session(ssl);   // TLS 1.3的票据在握手之后才到，读完响应再取
+    SSL_shutdown(ssl);
+    SSL_free(ssl);
+    close(fd);
+    return ok;
+}
+
+// 回环上用自签名证书握手两次，第二次用第一次拿到的票据恢复会话
+void TestTls() {
+    assert(TlsContext::MakeSelfSigned("./testtls-cert.pem", "./testtls-key.pem", "localhost"));
+    TlsContext context;
+    TlsContext::Options options;
+    options.certFile = "./testtls-cert.pem";
+    options.keyFile = "./testtls-key.pem";
+    assert(context.Init(options));
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    assert(bind(listenFd, (sockaddr*)&addr, len) == 0 && listen(listenFd, 4) == 0);
+    assert(getsockname(listenFd, (sockaddr*)&addr, &len) == 0);
+    int port = ntohs(addr.sin_port);
+
+    SSL_CTX* clientCtx = SSL_CTX_new(TLS_client_method());
+    SSL_SESSION* session = nullptr;
+    HttpConn::srcDir = "./testresources/";
+    HttpConn::tls = &context;
+    bool resumed[2] = { false, false };
+    for(int i = 0; i < 2; i++) {
+        std::string response;
+        std::thread client([&] { assert(TlsGet(port, clientCtx, &session, &response, &resumed[i])); });
+        sockaddr_in peer;
+        len = sizeof(peer);
+        int fd = accept4(listenFd, (sockaddr*)&peer, &len, SOCK_NONBLOCK);
+        assert(fd > 0);
+        HttpConn conn;
+        conn.init(fd, peer);
+        int err = 0;
+        while(true) {
+            pollfd pfd = { fd, static_cast<short>(conn.HandshakeWantsWrite() ? POLLOUT : POLLIN), 0 };
+            assert(poll(&pfd, 1, 2000) == 1);
+            ssize_t ret = conn.read(&err);
+            if(ret == 0 || (ret < 0 && err != EAGAIN)) { break; }
+            if(!conn.process()) { continue; }      // 握手还没完成，或者请求没收完
+            while(conn.ToWriteBytes() > 0) {
+                if(conn.write(&err) < 0 && err == EAGAIN) {
+                    pfd = { fd, POLLOUT, 0 };
+                    poll(&pfd, 1, 2000);
+                }
+            }
+            conn.RequestEnd();
+            if(!conn.IsKeepAlive()) { break; }
+        }
+        conn.Close();
+        client.join();
+        assert(response.compare(0, 9, "HTTP/1.1 ") == 0);
+    }
+    HttpConn::tls = nullptr;
+    assert(!resumed[0] && resumed[1]);
+    assert(context.Handshakes() == 2 && context.Resumed() == 1 && context.Failures() == 0);
+    SSL_SESSION_free(session);
+    SSL_CTX_free(clientCtx);
+    close(listenFd);
+    unlink("./testtls-cert.pem");
+    unlink("./testtls-key.pem");
+    // 内核没有tls ULP时kTLS开不起来，响应走的是SSL_write，这时不报kTLS的数
+    if(TlsContext::KernelTlsAvailable()) {
+        printf("TestTls: %llu handshakes, %llu resumed, %llu with kernel TLS send\n", (unsigned long long)context.Handshakes(),
+               (unsigned long long)context.Resumed(), (unsigned long long)context.KernelSend());
+    } else {
+        assert(context.KernelSend() == 0);
+        printf("TestTls: %llu handshakes, %llu resumed, no tls ULP in this kernel, user-space SSL_write\n",
+               (unsigned long long)context.Handshakes(), (unsigned long long)context.Resumed());
+    }
+}
+#endif
+
+// 文件超过上限后由写线程换段，换下来的段在后台压成.gz；目录不存在时由日志自己建
+void TestLogRotate() {
+    static const char DIR_NAME[] = "./testlogrotate";
+    auto listDir = [](int* gz, int* plain) {
+        *gz = *plain = 0;
+        if(DIR* dir = opendir(DIR_NAME)) {
+            while(dirent* ent = readdir(dir)) {
+                std::string name = ent->d_name;
+                if(name.size() > 7 && name.compare(name.size() - 7, 7, ".log.gz") == 0) { (*gz)++; }
+                else if(name.size() > 4 && name.compare(name.size() - 4, 4, ".log") == 0) { (*plain)++; }
+            }
+            closedir(dir);
+        }
+    };
+    if(DIR* dir = opendir(DIR_NAME)) {     // 清掉上次跑留下的
+        while(dirent* ent = readdir(dir)) {
+            if(ent->d_name[0] != '.') { unlink((std::string(DIR_NAME) + "/" + ent->d_name).c_str()); }
+        }
+        closedir(dir);
+        rmdir(DIR_NAME);
+    }
+    Log::Options saved = Log::options;
+    Log::options.maxFileBytes = 64 * 1024;
+    Log::Instance()->init(1, DIR_NAME, ".log", 5000);
+    uint64_t dropped = Log::Instance()->Dropped();     // 前面TestThreadPool丢的DEBUG/INFO不算这里的
+    for(int round = 0; round < 4; round++) {
+        for(int i = 0; i < 1000; i++) {
+            LOG_INFO("rotate round %d line %04d ==============================================", round, i);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    int gz = 0, plain = 0;
+    for(int waited = 0; waited < 3000; waited += 10) {
+        listDir(&gz, &plain);
+        if(gz >= 3 && plain == 1) { break; }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+#ifdef TINYWEB_ZLIB
+    assert(gz >= 3 && plain == 1);
+#else
+    assert(plain >= 4);
+#endif
+    dropped = Log::Instance()->Dropped() - dropped;
+    Log::options = saved;
+
+    // 一口气写满队列：ERROR等写线程腾位置，一行都不丢
+    uint64_t before = Log::Instance()->Dropped();
+    for(int i = 0; i < 20000; i++) {
+        LOG_ERROR("burst line %05d ==============================================", i);
+    }
+    assert(Log::Instance()->Dropped() == before);
+    printf("TestLogRotate: %d compressed segments, %d open, %llu info lines dropped, no errors dropped\n", gz, plain,
+           (unsigned long long)dropped);
+}
+
+// 两个线程各记一批，停下时要全部落盘；只记慢请求和错误时正常请求一条都不写
+void TestAccessLog() {
+    static const char* FILE_NAME = "./testaccess.log";
+    auto readLines = []() {
+        std::vector<std::string> lines;
+        FILE* fp = fopen(FILE_NAME, "r");
+        char line[1024];
+        while(fp && fgets(line, sizeof(line), fp)) { lines.push_back(line); }
+        if(fp) { fclose(fp); }
+        return lines;
+    };
+    AccessLog::Entry entry;
+    entry.ip = htonl(INADDR_LOOPBACK);
+    entry.method = "GET";
+    entry.path = "/index.html";
+    entry.version = "1.1";
+    entry.userAgent = "curl/8.0 \"quoted\"";
+    entry.code = 200;
+    entry.bytes = 3120;
+    entry.durationNs = 250000;
+
+    unlink(FILE_NAME);
+    AccessLog::Options options;
+    options.path = FILE_NAME;
+    options.flushMs = 5;
+    options.ringSize = 64;      // 比每个线程记的少，要靠过半时叫醒刷盘线程
+    assert(AccessLog::Instance()->Start(options));
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 2; t++) {
+        threads.emplace_back([&entry]() {
+            for(int i = 0; i < 500; i++) {
+                AccessLog::Instance()->Record(entry);
+                if(i % 16 == 0) { std::this_thread::sleep_for(std::chrono::milliseconds(1)); }
+            }
+        });
+    }
+    for(auto& thread : threads) { thread.join(); }
+    AccessLog::Instance()->Stop();
+    std::vector<std::string> lines = readLines();
+    uint64_t dropped = AccessLog::Instance()->Dropped();
+    assert(lines.size() + dropped == 1000 && AccessLog::Instance()->Written() == lines.size());
+    assert(lines[0].find("127.0.0.1 - - [") == 0);
+    assert(lines[0].find("] \"GET /index.html HTTP/1.1\" 200 3120 \"-\" \"curl/8.0 \\x22quoted\\x22\" 250\n") != std::string::npos);
+
+    unlink(FILE_NAME);
+    options.format = AccessLog::JSON;
+    options.slowOrErrorOnly = true;
+    options.slowMs = 100;
+    assert(AccessLog::Instance()->Start(options));
+    for(int i = 0; i < 50; i++) { AccessLog::Instance()->Record(entry); }
+    entry.code = 500;
+    entry.unixPeer = true;
+    AccessLog::Instance()->Record(entry);
+    entry.code = 200;
+    entry.unixPeer = false;
+    entry.durationNs = 150 * 1000000LL;
+    AccessLog::Instance()->Record(entry);
+    AccessLog::Instance()->Stop();
+    std::vector<std::string> slow = readLines();
+    assert(slow.size() == 2);
+    assert(slow[0].find("\"ip\":\"unix:\",") != std::string::npos);
+    assert(slow[0].find("\"status\":500,\"bytes\":3120,\"duration_us\":250,") != std::string::npos);
+    assert(slow[1].find("\"user_agent\":\"curl/8.0 \\\"quoted\\\"\"}") != std::string::npos);
+    printf("TestAccessLog: %zu lines, %llu dropped, %zu slow or error\n", lines.size(), (unsigned long long)dropped, slow.size());
+}
+
+// 两种队列接口一样：移动入队、批量取、满了try_push_back失败、带超时的pop被Close叫醒、多生产者不丢不重
+template<typename Queue>
+static uint64_t CheckQueue() {
+    Queue queue(8);
+    std::string moved(100, 'x');
+    queue.push_back(std::move(moved));
+    assert(moved.empty());      // 长字符串被移走，不是复制
+    queue.emplace_back(3, 'y');
+    std::deque<std::string> batch;
+    assert(queue.pop_batch(batch, 16) == 2 && batch[0].size() == 100 && batch[1] == "yyy");
+    while(queue.try_push_back(std::string("z"))) {}
+    assert(queue.full() && queue.pop_batch(batch, 3) == 3 && batch.size() == 5);
+    queue.clear();
+    std::string item;
+    assert(!queue.pop(item, std::chrono::milliseconds(5)));
+
+    std::thread closer([&queue]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        queue.Close();
+    });
+    auto start = std::chrono::steady_clock::now();
+    assert(!queue.pop(item, std::chrono::seconds(10)));
+    closer.join();
+    assert(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+
+    Queue closing(8);       // 关闭前入队的还能取出来，关闭后入队的丢掉
+    closing.push_back(std::string("a"));
+    closing.push_back(std::string("b"));
+    closing.Close();
+    closing.push_back(std::string("c"));
+    batch.clear();
+    assert(closing.pop_batch(batch, 16) == 2 && batch[1] == "b" && !closing.pop(item) && closing.pop_batch(batch, 16) == 0);
+
+    Queue ints(64);
+    std::atomic<int> producersLeft(4);
+    std::vector<std::thread> producers;
+    for(int t = 0; t < 4; t++) {
+        producers.emplace_back([&ints, &producersLeft]() {
+            for(int i = 1; i <= 20000; i++) { ints.push_back(std::to_string(i)); }
+            if(--producersLeft == 0) { ints.push_back(""); }
+        });
+    }
+    uint64_t sum = 0;
+    std::deque<std::string> got;
+    for(bool done = false; !done && ints.pop_batch(got, 32) > 0; got.clear()) {
+        for(const std::string& s : got) {
+            if(s.empty()) { done = true; break; }
+            sum += atoi(s.c_str());
+        }
+    }
+    for(auto& thread : producers) { thread.join(); }
+    assert(sum == 4ULL * 20000 * 20001 / 2);
+    return sum;
+}
+
+void TestQueue() {
+    uint64_t blocking = CheckQueue<BlockQueue<std::string>>();
+    uint64_t lockFree = CheckQueue<MpmcQueue<std::string>>();
+    printf("TestQueue: BlockQueue %llu, MpmcQueue %llu\n", (unsigned long long)blocking, (unsigned long long)lockFree);
+}
+
+// 回调里用同一个id重新挂回去（分阶段超时的懒续期），adjust也能把到期时间提前
+void TestTimer() {
+    HeapTimer timer;
+    std::vector<int> fired;
+    int rearmed = 0;
+    timer.add(1, 0, [&]() {
+        rearmed++;
+        timer.add(1, 5, [&]() { fired.push_back(1); });
+    });
+    timer.add(2, 60000, [&]() { fired.push_back(2); });
+    timer.add(3, 30000, [&]() { fired.push_back(3); });
+    timer.adjust(2, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    timer.tick();
+    assert(fired.size() == 1 && fired[0] == 2 && rearmed == 1);
+    assert(timer.contains(1) && !timer.contains(2) && timer.contains(3));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    timer.tick();
+    assert(fired.size() == 2 && fired[1] == 1 && !timer.contains(1));
+    assert(timer.GetNextTick() > 20000);
+    printf("TestTimer: %zu fired, %d re-armed from the callback\n", fired.size(), rearmed);
 }
 
 int main() {
     //TestLog();
+    TestRequestAlloc();
+    TestRouter();
+    TestRequestFraming();
+    TestUrlCodec();
+    TestMetrics();
     TestThreadPool();
+    TestThreadPoolResize();
+    TestThreadPoolClasses();
+    TestCoroutine();
+    TestCoDel();
+    TestConnCompact();
+    TestPeerTrust();
+    TestHttp2();
+#ifdef TINYWEB_TLS
+    TestTls();
+#endif
+    TestLogRotate();
+    TestAccessLog();
+    TestQueue();
+    TestTimer();
 }
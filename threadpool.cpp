@@ -0,0 +1,288 @@
+#include "threadpool.h"
+#include "log.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+
+thread_local int64_t ThreadPool::currentWait_ = 0;
+
+ThreadPool::ThreadPool(int threadCount) : ThreadPool([threadCount] {
+    Options options;
+    options.minThreads = options.maxThreads = threadCount;
+    return options;
+}()) {}
+
+ThreadPool::ThreadPool(const Options& options)
+    : opt_(options), isClosed_(false), hasDeadline_(false), queued_(0), alive_(0), retire_(0),
+      waitNs_(0), busyNs_(0), blockedNs_(0), done_(0),
+      threadCount_(0), utilization_(0), blockedRatio_(0), grows_(0), shrinks_(0), queuedCount_(0) {
+    assert(opt_.minThreads > 0);
+    opt_.maxThreads = std::max(opt_.maxThreads, opt_.minThreads);
+    opt_.adjustMs = std::max(opt_.adjustMs, 1);
+    if(opt_.classes.empty()) {
+        opt_.classes.emplace_back();
+    }
+    for(Class& cls : opt_.classes) {
+        cls.weight = std::max(cls.weight, 1);
+        hasDeadline_ = hasDeadline_ || cls.deadlineUs > 0;
+    }
+    queues_.resize(opt_.classes.size());
+    credit_.assign(opt_.classes.size(), 0);
+    if(opt_.cpus.empty() && opt_.numaNode >= 0) {
+        nodeCpus_ = NodeCpus(opt_.numaNode);
+        if(nodeCpus_.empty()) {
+            LOG_WARN("ThreadPool %s: no cpus for numa node %d, not pinning", opt_.name.c_str(), opt_.numaNode);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        for(int i = 0; i < opt_.minThreads; i++) {
+            Spawn_();
+        }
+    }
+    threadCount_.store(opt_.minThreads, std::memory_order_relaxed);
+    ExportMetrics_();
+    manager_ = std::thread(&ThreadPool::Manage_, this);
+}
+
+// 先摘掉指标回调，再让线程把剩下的任务做完后退出，逐个join
+ThreadPool::~ThreadPool() {
+    Metrics* metrics = Metrics::Instance();
+    std::string labels = "{pool=\"" + opt_.name + "\"}";
+    metrics->RemoveGauge("tinyweb_pool_threads", labels);
+    metrics->RemoveGauge("tinyweb_pool_utilization", labels);
+    metrics->RemoveGauge("tinyweb_pool_blocked_ratio", labels);
+    metrics->RemoveGauge("tinyweb_pool_grows_total", labels);
+    metrics->RemoveGauge("tinyweb_pool_shrinks_total", labels);
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        isClosed_ = true;
+    }
+    cond_.notify_all();
+    manageCond_.notify_all();
+    manager_.join();
+    for(std::thread& worker : workers_) {
+        if(worker.joinable()) { worker.join(); }
+    }
+}
+
+void ThreadPool::Spawn_() {
+    // 优先复用已经join过的空位，线程编号保持紧凑，绑核时按编号轮转
+    int index = 0;
+    while(index < static_cast<int>(workers_.size()) && workers_[index].joinable()) { index++; }
+    if(index == static_cast<int>(workers_.size())) {
+        workers_.emplace_back();
+    }
+    workers_[index] = std::thread(&ThreadPool::Worker_, this, index);
+    alive_++;
+}
+
+void ThreadPool::Pin_(int index) {
+    const std::vector<int>& cpus = opt_.cpus.empty() ? nodeCpus_ : opt_.cpus;
+    if(cpus.empty()) { return; }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(opt_.cpus.empty()) {
+        for(int cpu : cpus) { CPU_SET(cpu, &set); }     // NUMA节点：整个节点的CPU都可以用
+    } else {
+        CPU_SET(cpus[index % cpus.size()], &set);       // 指定CPU：每个线程一个，轮流分配
+    }
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if(ret != 0) {
+        LOG_WARN("ThreadPool %s: pin worker %d failed: %d", opt_.name.c_str(), index, ret);
+    }
+}
+
+void ThreadPool::Worker_(int index) {
+    Pin_(index);
+    Metrics* metrics = Metrics::Instance();
+    std::unique_lock<std::mutex> locker(mtx_);
+    while(true) {
+        if(queued_ > 0) {
+            Task task = Pop_();
+            locker.unlock();
+            int64_t start = Metrics::NowNs();
+            int64_t blocked = Watchdog::BlockedNs();
+            metrics->Add(Metrics::TASKS_STARTED);
+            metrics->Record(Metrics::TASK_WAIT_NS, start - task.queued);
+            currentWait_ = start - task.queued;
+            Watchdog::TaskBegin();
+            task.fn();
+            Watchdog::TaskEnd();
+            int64_t end = Metrics::NowNs();
+            blocked = Watchdog::BlockedNs() - blocked;
+            locker.lock();
+            waitNs_ += start - task.queued;
+            busyNs_ += end - start;
+            blockedNs_ += blocked;
+            done_++;
+        }
+        else if(isClosed_) break;
+        else if(retire_ > 0) {      // 队列空了才退出，不会丢任务
+            retire_--;
+            break;
+        }
+        else cond_.wait(locker);
+    }
+    alive_--;
+    finished_.push_back(index);
+    manageCond_.notify_one();
+}
+
+/*
+先看有没有超过deadline的队头，有就取超得最多的那个；
+否则按平滑加权轮询（和nginx的upstream一样）在非空的队列里选：每个非空队列加上自己的权重，
+取当前值最大的，被选中的减去这些队列的权重之和，这样各类交错执行，不会一类连续占满
+*/
+ThreadPool::Task ThreadPool::Pop_() {
+    int pick = -1;
+    if(hasDeadline_) {
+        int64_t now = Metrics::NowNs();
+        int64_t worst = 0;
+        for(size_t i = 0; i < queues_.size(); i++) {
+            if(queues_[i].empty() || opt_.classes[i].deadlineUs <= 0) { continue; }
+            int64_t late = now - queues_[i].front().queued - opt_.classes[i].deadlineUs * 1000LL;
+            if(late > worst) {
+                worst = late;
+                pick = static_cast<int>(i);
+            }
+        }
+    }
+    if(pick < 0) {
+        int weight = 0;     // 只算非空队列的权重，空队列不参与这一轮
+        for(size_t i = 0; i < queues_.size(); i++) {
+            if(queues_[i].empty()) { continue; }
+            credit_[i] += opt_.classes[i].weight;
+            weight += opt_.classes[i].weight;
+            if(pick < 0 || credit_[i] > credit_[pick]) { pick = static_cast<int>(i); }
+        }
+        credit_[pick] -= weight;
+    }
+    assert(pick >= 0);
+    Task task = std::move(queues_[pick].front());
+    queues_[pick].pop();
+    queued_--;
+    queuedCount_.store(queued_, std::memory_order_relaxed);
+    if(queues_[pick].empty()) {
+        credit_[pick] = 0;      // 空了就清零，免得空闲期间攒下的值让它回来后连续占线程
+    }
+    return task;
+}
+
+int64_t ThreadPool::OldestQueued_() const {
+    int64_t oldest = 0;
+    for(const std::queue<Task>& queue : queues_) {
+        if(!queue.empty() && (oldest == 0 || queue.front().queued < oldest)) {
+            oldest = queue.front().queued;
+        }
+    }
+    return oldest;
+}
+
+/*
+每个周期：
+排队延迟取本周期完成任务的平均等待时间和队头任务已经等了的时间中较大的那个，超过growDelayUs就加一个线程；
+但CPU密集的任务加线程没有用，所以只有扣掉阻塞时间后实际占用的CPU数还没到核数时才加
+忙碌比例持续shrinkAfterMs低于shrinkUtil就减一个线程
+*/
+void ThreadPool::Manage_() {
+    int cores = std::max(1u, std::thread::hardware_concurrency());
+    int64_t last = Metrics::NowNs();
+    int64_t lowSince = 0;
+    std::unique_lock<std::mutex> locker(mtx_);
+    while(!isClosed_) {
+        manageCond_.wait_for(locker, std::chrono::milliseconds(opt_.adjustMs));
+        if(!finished_.empty()) {
+            std::vector<std::thread> exited;
+            for(int index : finished_) { exited.push_back(std::move(workers_[index])); }
+            finished_.clear();
+            locker.unlock();
+            for(std::thread& worker : exited) { worker.join(); }
+            locker.lock();
+        }
+        int64_t now = Metrics::NowNs();
+        int64_t interval = now - last;
+        if(isClosed_ || interval < opt_.adjustMs * 1000000LL) {
+            continue;
+        }
+        int64_t delay = done_ ? waitNs_ / static_cast<int64_t>(done_) : 0;
+        if(queued_ > 0) {
+            delay = std::max(delay, now - OldestQueued_());
+        }
+        int active = alive_ - retire_;
+        double util = std::min(1.0, static_cast<double>(busyNs_) / (static_cast<double>(std::max(alive_, 1)) * interval));
+        double blockedRatio = busyNs_ ? std::min(1.0, static_cast<double>(blockedNs_) / busyNs_) : 0;
+        waitNs_ = busyNs_ = blockedNs_ = 0;
+        done_ = 0;
+        last = now;
+
+        if(delay > opt_.growDelayUs * 1000LL && active < opt_.maxThreads && active * (1 - blockedRatio) < cores) {
+            if(retire_ > 0) { retire_--; }     // 还有没退出的线程，撤销退出就行
+            else { Spawn_(); }
+            active++;
+            lowSince = 0;
+            grows_.fetch_add(1, std::memory_order_relaxed);
+            LOG_INFO("ThreadPool %s: grow to %d (delay %lldus, util %.2f, blocked %.2f)", opt_.name.c_str(),
+                     active, (long long)(delay / 1000), util, blockedRatio);
+        }
+        else if(util < opt_.shrinkUtil && queued_ == 0 && active > opt_.minThreads) {
+            if(lowSince == 0) {
+                lowSince = now;
+            }
+            else if(now - lowSince >= opt_.shrinkAfterMs * 1000000LL) {
+                retire_++;
+                active--;
+                lowSince = now;         // 每shrinkAfterMs最多减一个
+                cond_.notify_one();
+                shrinks_.fetch_add(1, std::memory_order_relaxed);
+                LOG_INFO("ThreadPool %s: shrink to %d (util %.2f)", opt_.name.c_str(), active, util);
+            }
+        }
+        else {
+            lowSince = 0;
+        }
+        threadCount_.store(active, std::memory_order_relaxed);
+        utilization_.store(util, std::memory_order_relaxed);
+        blockedRatio_.store(blockedRatio, std::memory_order_relaxed);
+    }
+}
+
+// 回调只读原子变量：抓取时Metrics持有自己的锁，不能再去拿工作线程写指标时可能持有的mtx_
+void ThreadPool::ExportMetrics_() {
+    Metrics* metrics = Metrics::Instance();
+    std::string labels = "{pool=\"" + opt_.name + "\"}";
+    metrics->AddGauge("tinyweb_pool_threads", "Worker threads in the pool.",
+        [this] { return static_cast<double>(threadCount_.load(std::memory_order_relaxed)); }, labels);
+    metrics->AddGauge("tinyweb_pool_utilization", "Share of worker time spent running tasks in the last interval.",
+        [this] { return utilization_.load(std::memory_order_relaxed); }, labels);
+    metrics->AddGauge("tinyweb_pool_blocked_ratio", "Share of task time spent in blocking calls in the last interval.",
+        [this] { return blockedRatio_.load(std::memory_order_relaxed); }, labels);
+    metrics->AddGauge("tinyweb_pool_grows_total", "Threads added by the pool manager.",
+        [this] { return static_cast<double>(grows_.load(std::memory_order_relaxed)); }, labels, "counter");
+    metrics->AddGauge("tinyweb_pool_shrinks_total", "Threads retired by the pool manager.",
+        [this] { return static_cast<double>(shrinks_.load(std::memory_order_relaxed)); }, labels, "counter");
+}
+
+// cpulist的格式形如"0-3,8-11"
+std::vector<int> ThreadPool::NodeCpus(int node) {
+    std::vector<int> cpus;
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE* fp = fopen(path, "r");
+    if(!fp) { return cpus; }
+    int first, last;
+    while(fscanf(fp, "%d", &first) == 1) {
+        last = first;
+        int c = fgetc(fp);
+        if(c == '-') {
+            if(fscanf(fp, "%d", &last) != 1) { break; }
+            c = fgetc(fp);
+        }
+        for(int cpu = first; cpu <= last; cpu++) { cpus.push_back(cpu); }
+        if(c != ',') { break; }
+    }
+    fclose(fp);
+    return cpus;
+}
@@ -6,63 +6,113 @@
 #include <condition_variable>
 #include <functional>
 #include <thread>
+#include <vector>
+#include <string>
+#include <atomic>
 #include <assert.h>
+#include "metrics.h"
+#include "watchdog.h"
 //定义了这个pool之后，就会立马开启线程开八个线程从任务队列中找任务来做。你只需要调用这个里面的addtask就可以往里面扔函数，然后他就能自己做了。
 //任务队列是封装了一个pool对象来实现的。
 
-
+/*
+线程数在[minThreads, maxThreads]之间自动调整：管理线程每隔adjustMs统计一次任务排队延迟、
+工作线程忙碌比例和阻塞调用（见Watchdog::BlockedNs）占的比例，排队变长就加线程，长时间空闲就减线程；
+所有线程都可以join，析构时先把队列里剩下的任务做完再退出
+任务可以分成几类，每类一个队列：平时按权重轮流取，某类队头等待超过它的deadlineUs时优先取
+*/
 class ThreadPool {
 public:
-    ThreadPool() = default;//声明默认的构造函数还是存在的
-    ThreadPool(ThreadPool&&) = default;//声明移动构造函数也是默认的
-    // 尽量用make_shared代替new，如果通过new再传递给shared_ptr，内存是不连续的，会造成内存碎片化
-    explicit ThreadPool(int threadCount = 8) : pool_(std::make_shared<Pool>()) { // make_shared:传递右值，功能是在动态内存中分配一个对象并初始化它，返回指向此对象的shared_ptr
-        assert(threadCount > 0);//返回一个pool类型？这个pool类型里面还有任务属性
-        for(int i = 0; i < threadCount; i++) {
-            std::thread([this]() {//用lambda函数作为工作函数，不断再task队列里去取任务来做
-                std::unique_lock<std::mutex> locker(pool_->mtx_);//对线程池加锁
-                while(true) {
-                    if(!pool_->tasks.empty()) {
-                        auto task = std::move(pool_->tasks.front());    // 左值变右值,资产转移
-                        pool_->tasks.pop();
-                        locker.unlock();    // 因为已经把任务取出来了，所以可以提前解锁了
-                        task();
-                        locker.lock();      // 马上又要取任务了，上锁
-                    } else if(pool_->isClosed) {
-                        break;
-                    } else {
-                        pool_->cond_.wait(locker);    // 等待,如果任务来了就notify的
-                    }
-                    
-                }
-            }).detach();//detach可以使得当前线程脱离父线程，自己来决定自己的生死
-        }
-    }
+    struct Class {
+        std::string name;
+        int weight = 1;                 // 各类都有任务时，按权重比例分配线程
+        int deadlineUs = 0;             // 队头等待超过这个时间就插到前面，0表示不设
+    };
 
-    ~ThreadPool() {
-        if(pool_) {
-            std::unique_lock<std::mutex> locker(pool_->mtx_);
-            pool_->isClosed = true;
-        }
-        pool_->cond_.notify_all();  // 唤醒所有的线程
-    }
+    struct Options {
+        int minThreads = 8;
+        int maxThreads = 8;             // 等于minThreads时就是固定大小
+        int adjustMs = 100;             // 调整周期
+        int growDelayUs = 2000;         // 平均排队延迟超过这个值就加线程
+        double shrinkUtil = 0.3;        // 忙碌比例低于这个值持续shrinkAfterMs就减线程
+        int shrinkAfterMs = 2000;
+        std::vector<int> cpus;          // 非空时工作线程依次绑定到这些CPU上
+        int numaNode = -1;              // >=0时工作线程绑定到这个NUMA节点的全部CPU（cpus为空时生效）
+        std::string name = "worker";    // 导出指标时的pool标签
+        std::vector<Class> classes;     // 为空时只有一类
+    };
+
+    explicit ThreadPool(int threadCount = 8);
+    explicit ThreadPool(const Options& options);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
 
     template<typename T>
-    void AddTask(T&& task) {//将函数指针传入到这个addtask里面
-        std::unique_lock<std::mutex> locker(pool_->mtx_);
-        pool_->tasks.emplace(std::forward<T>(task));
-        pool_->cond_.notify_one();
+    void AddTask(T&& task, int cls = 0) {//将函数指针传入到这个addtask里面，cls是Options::classes的下标
+        Metrics::Instance()->Add(Metrics::TASKS_QUEUED);
+        std::unique_lock<std::mutex> locker(mtx_);
+        assert(cls >= 0 && cls < static_cast<int>(queues_.size()));
+        queues_[cls].push(Task{ std::function<void()>(std::forward<T>(task)), Metrics::NowNs() });
+        queued_++;
+        queuedCount_.store(queued_, std::memory_order_relaxed);
+        cond_.notify_one();
     }
 
+    int ThreadCount() const { return threadCount_.load(std::memory_order_relaxed); }
+    size_t Queued() const { return queuedCount_.load(std::memory_order_relaxed); }     // 所有类别里排队的任务数
+    static int64_t CurrentWaitNs() { return currentWait_; }    // 在任务里调用：这个任务排队等了多久
+    double Utilization() const { return utilization_.load(std::memory_order_relaxed); }
+
+    static std::vector<int> NodeCpus(int node);     // 读/sys得到NUMA节点的CPU列表
+
 private:
-    // 用一个结构体封装起来，方便调用
-    struct Pool {//主要是来记录这个任务的。
-        std::mutex mtx_;//有这个池的锁
-        std::condition_variable cond_;//有使用这个池对应的条件变量
-        bool isClosed;
-        std::queue<std::function<void()>> tasks; // 任务队列，函数类型为void()
+    struct Task {
+        std::function<void()> fn;
+        int64_t queued;     // 入队时间，用来统计排队等待的时间
     };
-    std::shared_ptr<Pool> pool_;
+
+    void Spawn_();                  // 调用方持有mtx_
+    Task Pop_();                    // 调用方持有mtx_且队列不空
+    int64_t OldestQueued_() const;  // 调用方持有mtx_，所有队头里最早的入队时间，没有任务返回0
+    void Worker_(int index);
+    void Manage_();
+    void Pin_(int index);
+    void ExportMetrics_();
+
+    Options opt_;
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    std::condition_variable manageCond_;
+    bool isClosed_;
+    std::vector<std::queue<Task>> queues_;  // 每类一个
+    std::vector<int64_t> credit_;           // 平滑加权轮询的当前值
+    bool hasDeadline_;
+    size_t queued_;
+
+    std::vector<std::thread> workers_;  // 下标即线程编号，退出的线程由管理线程join后留空
+    std::vector<int> finished_;         // 已经退出、等待join的线程编号
+    int alive_;                         // 没有退出的工作线程数
+    int retire_;                        // 需要退出的线程数，空闲的线程看到后自行退出
+    std::vector<int> nodeCpus_;
+
+    // 本周期的统计，持有mtx_时更新
+    int64_t waitNs_;
+    int64_t busyNs_;
+    int64_t blockedNs_;
+    uint64_t done_;
+
+    // 导出的指标，抓取时不拿mtx_
+    std::atomic<int> threadCount_;
+    std::atomic<double> utilization_;
+    std::atomic<double> blockedRatio_;
+    std::atomic<uint64_t> grows_;
+    std::atomic<uint64_t> shrinks_;
+    std::atomic<size_t> queuedCount_;   // queued_的副本，不拿锁就能读
+
+    static thread_local int64_t currentWait_;
+
+    std::thread manager_;
 };
 
 #endif
@@ -0,0 +1,242 @@
+#include "tls.h"
+
+#ifdef TINYWEB_TLS
+
+#include <fcntl.h>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <algorithm>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+#include "log.h"
+#include "http2.h"
+
+TlsContext::TlsContext() : ctx_(nullptr), handshakes_(0), resumed_(0), ktlsSend_(0), failures_(0) {}
+
+TlsContext::~TlsContext() {
+    SSL_CTX_free(ctx_);
+}
+
+bool TlsContext::Init(const Options& options) {
+    assert(!ctx_);
+    ctx_ = SSL_CTX_new(TLS_server_method());
+    if(!ctx_) {
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(ctx_, TLS1_2_VERSION);
+    // 客户端不发close_notify直接断开很常见，当作正常关闭
+    uint64_t opts = SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_IGNORE_UNEXPECTED_EOF;
+    if(options.ktls) {
+        opts |= SSL_OP_ENABLE_KTLS;
+    }
+    SSL_CTX_set_options(ctx_, opts);
+    // 写缓冲区会随iov移动，允许部分写；空闲时释放OpenSSL的读写缓冲区
+    SSL_CTX_set_mode(ctx_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+    if(SSL_CTX_use_certificate_chain_file(ctx_, options.certFile.c_str()) != 1 ||
+       SSL_CTX_use_PrivateKey_file(ctx_, options.keyFile.c_str(), SSL_FILETYPE_PEM) != 1 ||
+       SSL_CTX_check_private_key(ctx_) != 1) {
+        LOG_ERROR("TLS: load %s / %s failed: %s", options.certFile.c_str(), options.keyFile.c_str(),
+                  ERR_error_string(ERR_get_error(), nullptr));
+        SSL_CTX_free(ctx_);
+        ctx_ = nullptr;
+        return false;
+    }
+    static const unsigned char SESSION_ID_CONTEXT[] = "tinyweb";
+    SSL_CTX_set_session_id_context(ctx_, SESSION_ID_CONTEXT, sizeof(SESSION_ID_CONTEXT) - 1);
+    SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx_, options.sessionCacheSize);
+    SSL_CTX_set_timeout(ctx_, options.sessionTimeoutS);
+    SSL_CTX_set_num_tickets(ctx_, options.tickets);
+    SSL_CTX_set_alpn_select_cb(ctx_, SelectAlpn_, nullptr);
+    LOG_INFO("TLS: cert %s, kTLS %s", options.certFile.c_str(), options.ktls ? "on" : "off");
+    if(options.ktls && !KernelTlsAvailable()) {
+        LOG_WARN("TLS: kernel has no tls ULP (modprobe tls), responses go through SSL_write in user space");
+    }
+    return true;
+}
+
+bool TlsContext::KernelTlsAvailable() {
+    FILE* fp = fopen("/proc/sys/net/ipv4/tcp_available_ulp", "r");
+    if(!fp) {
+        return false;
+    }
+    char line[256] = {};
+    bool found = false;
+    if(fgets(line, sizeof(line), fp)) {
+        for(char* token = strtok(line, " \n"); token && !found; token = strtok(nullptr, " \n")) {
+            found = strcmp(token, "tls") == 0;
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+SSL* TlsContext::NewSsl(int fd) {
+    assert(ctx_);
+    SSL* ssl = SSL_new(ctx_);
+    if(ssl) {
+        SSL_set_fd(ssl, fd);
+        SSL_set_accept_state(ssl);
+    }
+    return ssl;
+}
+
+// 按服务端的顺序选：开着HTTP/2时先h2；客户端两个都不支持时不回ALPN，照样按HTTP/1.1处理
+int TlsContext::SelectAlpn_(SSL* ssl, const unsigned char** out, unsigned char* outLen,
+                            const unsigned char* in, unsigned int inLen, void* arg) {
+    static const unsigned char PROTOS[] = "\x02h2\x08http/1.1";
+    const unsigned char* protos = Http2Session::enabled ? PROTOS : PROTOS + 3;
+    unsigned int protosLen = Http2Session::enabled ? sizeof(PROTOS) - 1 : sizeof(PROTOS) - 4;
+    unsigned char* selected = nullptr;
+    if(SSL_select_next_proto(&selected, outLen, protos, protosLen, in, inLen) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+bool TlsContext::MakeSelfSigned(const char* certFile, const char* keyFile, const char* commonName) {
+    EVP_PKEY* key = EVP_EC_gen("P-256");
+    X509* cert = X509_new();
+    bool ok = key && cert;
+    if(ok) {
+        X509_set_version(cert, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), static_cast<long>(time(nullptr)));
+        X509_gmtime_adj(X509_getm_notBefore(cert), -3600);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 365 * 24 * 3600L);
+        X509_set_pubkey(cert, key);
+        X509_NAME* name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>(commonName), -1, -1, 0);
+        X509_set_issuer_name(cert, name);
+        std::string san = std::string("DNS:") + commonName;
+        X509_EXTENSION* ext = X509V3_EXT_conf_nid(nullptr, nullptr, NID_subject_alt_name, san.c_str());
+        ok = ext && X509_add_ext(cert, ext, -1) == 1 && X509_sign(cert, key, EVP_sha256()) > 0;
+        X509_EXTENSION_free(ext);
+    }
+    if(ok) {
+        int fd = open(keyFile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);     // 私钥只给自己读
+        FILE* fp = fd >= 0 ? fdopen(fd, "w") : nullptr;
+        ok = fp && PEM_write_PrivateKey(fp, key, nullptr, nullptr, 0, nullptr, nullptr) == 1;
+        if(fp) { fclose(fp); }
+        else if(fd >= 0) { close(fd); }
+    }
+    if(ok) {
+        FILE* fp = fopen(certFile, "w");
+        ok = fp && PEM_write_X509(fp, cert) == 1;
+        if(fp) { fclose(fp); }
+    }
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    return ok;
+}
+
+TlsConn::TlsConn(TlsContext* context, int fd)
+    : context_(context), ssl_(context->NewSsl(fd)), fd_(fd), established_(false), wantWrite_(false), ktlsSend_(false),
+      fatal_(false) {}
+
+TlsConn::~TlsConn() {
+    if(!ssl_) {
+        return;
+    }
+    if(established_ && !fatal_) {
+        SSL_shutdown(ssl_);     // 非阻塞，只管把close_notify发出去，不等对端的
+    }
+    SSL_free(ssl_);
+}
+
+int TlsConn::Handshake() {
+    if(established_) {
+        return 1;
+    }
+    if(!ssl_ || fatal_) {
+        return -1;
+    }
+    ERR_clear_error();
+    int ret = SSL_do_handshake(ssl_);
+    if(ret != 1) {
+        int err = SSL_get_error(ssl_, ret);
+        // 服务端这一轮（证书链）偶尔写不进套接字缓冲区：和写响应一样交还给epoll等可写，不占着工作线程
+        if(err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+            wantWrite_ = err == SSL_ERROR_WANT_WRITE;
+            return 0;
+        }
+        fatal_ = true;
+        context_->failures_++;
+        LOG_DEBUG("TLS handshake failed on fd %d: %s", fd_, ERR_error_string(ERR_get_error(), nullptr));
+        return -1;
+    }
+    wantWrite_ = false;
+    established_ = true;
+    ktlsSend_ = BIO_get_ktls_send(SSL_get_wbio(ssl_)) > 0;
+    context_->handshakes_++;
+    if(SSL_session_reused(ssl_)) { context_->resumed_++; }
+    if(ktlsSend_) { context_->ktlsSend_++; }
+    LOG_DEBUG("TLS fd %d: %s %s, resumed %d, kTLS send %d", fd_, SSL_get_version(ssl_), SSL_get_cipher_name(ssl_),
+              SSL_session_reused(ssl_), ktlsSend_);
+    return 1;
+}
+
+// 一次读一整个记录；OpenSSL里还有解好的数据时接着读完，否则epoll不会再因为它触发
+ssize_t TlsConn::Read(Buffer& buff, int* saveErrno) {
+    ssize_t total = 0;
+    do {
+        buff.EnsureWriteable(MAX_RECORD);
+        ERR_clear_error();
+        int ret = SSL_read(ssl_, buff.BeginWrite(), static_cast<int>(std::min<size_t>(buff.WritableBytes(), INT_MAX)));
+        if(ret > 0) {
+            buff.HasWritten(ret);
+            total += ret;
+            continue;
+        }
+        int err = SSL_get_error(ssl_, ret);
+        if(err == SSL_ERROR_ZERO_RETURN) {      // 对端关了
+            return total;
+        }
+        if(err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+            *saveErrno = EAGAIN;
+        } else {
+            *saveErrno = err == SSL_ERROR_SYSCALL && errno ? errno : EPROTO;
+            fatal_ = true;
+        }
+        return total > 0 ? total : -1;
+    } while(SSL_pending(ssl_) > 0);
+    return total;
+}
+
+ssize_t TlsConn::Writev(const struct iovec* iov, int iovCnt) {
+    if(ktlsSend_) {
+        return writev(fd_, iov, iovCnt);    // 内核加密，和明文连接一样
+    }
+    // 重试时传进来的还是上次没写完的那段数据，满足SSL_write的重试要求
+    ssize_t total = 0;
+    for(int i = 0; i < iovCnt; i++) {
+        const char* base = static_cast<const char*>(iov[i].iov_base);
+        size_t left = iov[i].iov_len;
+        while(left > 0) {
+            ERR_clear_error();
+            int ret = SSL_write(ssl_, base, static_cast<int>(std::min<size_t>(left, INT_MAX)));
+            if(ret <= 0) {
+                int err = SSL_get_error(ssl_, ret);
+                if(err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {
+                    errno = EAGAIN;
+                } else {
+                    errno = err == SSL_ERROR_SYSCALL && errno ? errno : EPROTO;
+                    fatal_ = true;
+                }
+                return total > 0 ? total : -1;
+            }
+            total += ret;
+            base += ret;
+            left -= ret;
+        }
+    }
+    return total;
+}
+
+#endif // TINYWEB_TLS
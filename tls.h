@@ -0,0 +1,94 @@
+#ifndef TLS_H
+#define TLS_H
+
+#ifdef TINYWEB_TLS
+
+#include <atomic>
+#include <string>
+#include <sys/uio.h>
+#include <openssl/ssl.h>
+
+#include "buffer.h"
+
+/*
+TLS终结：握手在用户态用OpenSSL做，做完之后把记录层的加解密交给内核（kTLS，TCP_ULP "tls"）
+发送方向进了内核以后套接字上直接writev明文，内核负责加密，响应头+mmap文件的writev路径不用改；
+内核没加载tls模块（tcp_available_ulp里没有tls）、OpenSSL编译时没开ktls或者加密套件不支持时退回SSL_write：
+mmap的文件也要经过SSL_write在用户态按16KB一个记录加密再拷进套接字，大文件比明文连接慢得多，
+这时KernelSend()计数为0，启动时会打一条日志
+会话恢复：TLS 1.3发无状态票据（加密票据的密钥在SSL_CTX里，重启后失效），TLS 1.2用服务端会话缓存
+*/
+class TlsContext {
+public:
+    struct Options {
+        std::string certFile;           // PEM，可以带中间证书链
+        std::string keyFile;
+        bool ktls = true;               // 握手后尝试内核TLS
+        int sessionTimeoutS = 7200;     // 票据和缓存会话的有效期
+        long sessionCacheSize = 20480;  // TLS 1.2服务端会话缓存的条数
+        int tickets = 1;                // TLS 1.3握手后发几张票据，默认2张，客户端一般只用一张
+    };
+
+    TlsContext();
+    ~TlsContext();
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+
+    bool Init(const Options& options);  // 证书或私钥加载失败返回false
+    SSL* NewSsl(int fd);
+
+    static bool KernelTlsAvailable();   // 内核能不能挂tls ULP，不能时kTLS一定开不起来
+
+    // 生成EC P-256自签名证书，测试和本机调试用
+    static bool MakeSelfSigned(const char* certFile, const char* keyFile, const char* commonName);
+
+    uint64_t Handshakes() const { return handshakes_; }
+    uint64_t Resumed() const { return resumed_; }         // 其中用票据或会话缓存恢复的
+    uint64_t KernelSend() const { return ktlsSend_; }     // 其中发送方向进了内核的
+    uint64_t Failures() const { return failures_; }
+
+private:
+    friend class TlsConn;
+    static int SelectAlpn_(SSL* ssl, const unsigned char** out, unsigned char* outLen,
+                           const unsigned char* in, unsigned int inLen, void* arg);
+
+    SSL_CTX* ctx_;
+    std::atomic<uint64_t> handshakes_;
+    std::atomic<uint64_t> resumed_;
+    std::atomic<uint64_t> ktlsSend_;
+    std::atomic<uint64_t> failures_;
+};
+
+// 一条TLS连接，只在持有这个连接的线程里用
+class TlsConn {
+public:
+    TlsConn(TlsContext* context, int fd);
+    ~TlsConn();     // 发close_notify，要在close(fd)之前
+    TlsConn(const TlsConn&) = delete;
+    TlsConn& operator=(const TlsConn&) = delete;
+
+    // 1握手完成，0还要等，-1失败；返回0时WantsWrite()说明等的是套接字可写还是对端的数据
+    int Handshake();
+    bool WantsWrite() const { return wantWrite_; }
+    bool Established() const { return established_; }
+    bool KernelSend() const { return ktlsSend_; }
+
+    // 和readv/writev一样返回字节数，出错返回-1并设置errno，读写不了时是EAGAIN
+    ssize_t Read(Buffer& buff, int* saveErrno);
+    ssize_t Writev(const struct iovec* iov, int iovCnt);
+
+private:
+    static const size_t MAX_RECORD = 16 * 1024;
+
+    TlsContext* context_;
+    SSL* ssl_;
+    int fd_;
+    bool established_;
+    bool wantWrite_;
+    bool ktlsSend_;
+    bool fatal_;        // 出过致命错误之后不能再调SSL_shutdown
+};
+
+#endif // TINYWEB_TLS
+
+#endif //TLS_H
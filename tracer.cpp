@@ -0,0 +1,113 @@
+#include "tracer.h"
+#include "router.h"
+#include "httprequest.h"
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <stdio.h>
+
+double Tracer::sampleRate = 0;
+size_t Tracer::ringSize = 1 << 16;
+thread_local uint64_t Tracer::current_ = 0;
+
+static const char* const PHASE_NAMES[] = {
+    "queue_read", "read", "parse", "verify", "response", "queue_write", "write",
+};
+
+Tracer* Tracer::Instance() {
+    static Tracer tracer;
+    return &tracer;
+}
+
+Tracer::Tracer() : head_(0), nextId_(1), rng_(0x9e3779b97f4a7c15ULL) {
+    size_t size = 1;
+    while(size < ringSize) { size <<= 1; }
+    ring_.reset(new Event_[size]());
+    mask_ = size - 1;
+}
+
+uint64_t Tracer::Sample() {
+    if(sampleRate <= 0) {
+        return 0;
+    }
+    // xorshift64，只在主线程调用，不需要同步
+    rng_ ^= rng_ << 13;
+    rng_ ^= rng_ >> 7;
+    rng_ ^= rng_ << 17;
+    if(static_cast<double>(rng_ >> 11) * (1.0 / 9007199254740992.0) >= sampleRate) {
+        return 0;
+    }
+    return nextId_++;
+}
+
+static int32_t ThreadId() {
+    static thread_local int32_t tid = static_cast<int32_t>(syscall(SYS_gettid));
+    return tid;
+}
+
+void Tracer::Record(uint64_t id, PHASE phase, int64_t begin, int64_t end, int fd, int64_t arg) {
+    uint64_t pos = head_.fetch_add(1, std::memory_order_relaxed);
+    Event_& e = ring_[pos & mask_];
+    e.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    e.id.store(id, std::memory_order_relaxed);
+    e.begin.store(begin, std::memory_order_relaxed);
+    e.end.store(end, std::memory_order_relaxed);
+    e.arg.store(arg, std::memory_order_relaxed);
+    e.tid.store(ThreadId(), std::memory_order_relaxed);
+    e.fd.store(fd, std::memory_order_relaxed);
+    e.phase.store(phase, std::memory_order_relaxed);
+    e.seq.store(pos + 1, std::memory_order_release);
+}
+
+// 读一遍环形缓冲区；被并发覆盖的槽位前后两次seq对不上，直接跳过
+std::string Tracer::DumpJson() {
+    std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    uint64_t head = head_.load(std::memory_order_acquire);
+    uint64_t first = head > mask_ + 1 ? head - mask_ - 1 : 0;
+    bool comma = false;
+    char line[256];
+    for(uint64_t pos = first; pos < head; pos++) {
+        Event_& e = ring_[pos & mask_];
+        uint64_t seq = e.seq.load(std::memory_order_acquire);
+        if(seq != pos + 1) { continue; }
+        uint64_t id = e.id.load(std::memory_order_relaxed);
+        int64_t begin = e.begin.load(std::memory_order_relaxed);
+        int64_t end = e.end.load(std::memory_order_relaxed);
+        int64_t arg = e.arg.load(std::memory_order_relaxed);
+        int32_t tid = e.tid.load(std::memory_order_relaxed);
+        int32_t fd = e.fd.load(std::memory_order_relaxed);
+        int32_t phase = e.phase.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(e.seq.load(std::memory_order_relaxed) != seq || phase < 0 || phase >= PHASE_COUNT) { continue; }
+        int n = snprintf(line, sizeof(line),
+            "%s{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+            "\"args\":{\"trace\":%llu,\"fd\":%d,\"arg\":%lld}}",
+            comma ? ",\n" : "\n", PHASE_NAMES[phase], tid, begin / 1000.0, (end - begin) / 1000.0,
+            (unsigned long long)id, fd, (long long)arg);
+        out.append(line, n);
+        comma = true;
+    }
+    out += "\n]}\n";
+    return out;
+}
+
+bool Tracer::Dump(const char* path) {
+    std::string json = DumpJson();
+    FILE* fp = fopen(path, "w");
+    if(!fp) { return false; }
+    bool ok = fwrite(json.data(), 1, json.size(), fp) == json.size();
+    return fclose(fp) == 0 && ok;
+}
+
+static void RouteTrace(HttpRequest& req, const RouteMatch&) {
+    if(!req.IsPeerLocal()) {    // 和/metrics一样，外部来的请求返回404
+        return;
+    }
+    std::string json = Tracer::Instance()->DumpJson();
+    req.SetContent(req.arena()->Copy(json), "application/json");
+}
+
+void Tracer::RegisterRoutes(Router* router) {
+    assert(router);
+    router->AddExact("/trace", RouteTrace);
+}
@@ -0,0 +1,86 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <stdint.h>
+#include "metrics.h"
+
+class Router;
+
+/*
+按请求采样的阶段跟踪：采样命中的请求在每个阶段边界记下CLOCK_MONOTONIC时间戳，
+写进固定大小的无锁环形缓冲区（写满后覆盖最旧的），需要时导出为Chrome trace / Perfetto能打开的JSON
+没有命中采样的请求只多一次判断，sampleRate为0时完全关闭
+*/
+class Tracer {
+public:
+    enum PHASE {
+        QUEUE_READ,     // DealRead_入队到OnRead_开始执行
+        READ,           // 读套接字
+        PARSE,          // HttpRequest::parse
+        VERIFY,         // UserVerify查数据库，嵌套在PARSE里
+        RESPONSE,       // MakeResponse，包括stat和mmap
+        QUEUE_WRITE,    // DealWrite_入队到OnWrite_开始执行
+        WRITE,          // 一次OnWrite_里的writev，参数是写出的字节数
+        PHASE_COUNT,
+    };
+
+    static Tracer* Instance();
+
+    uint64_t Sample();      // 返回新的跟踪id，没命中采样返回0；只在主线程调用
+    void Record(uint64_t id, PHASE phase, int64_t begin, int64_t end, int fd, int64_t arg = 0);
+
+    std::string DumpJson();         // Chrome trace格式
+    bool Dump(const char* path);
+
+    // 当前线程正在处理的请求的跟踪id，给连接对象以外的代码（例如UserVerify）用
+    static uint64_t Current() { return current_; }
+    static void SetCurrent(uint64_t id) { current_ = id; }
+
+    static void RegisterRoutes(Router* router);     // 注册/trace，只对本机回环地址开放
+
+    static double sampleRate;       // 采样比例，0.01即1%
+    static size_t ringSize;         // 环形缓冲区的事件数，取整到2的幂，在第一次使用之前设置
+
+private:
+    struct Event_ {                 // 字段用relaxed原子变量，读者靠seq判断有没有读到写了一半的事件
+        std::atomic<uint64_t> seq;  // 0表示正在写，否则是写入序号+1
+        std::atomic<uint64_t> id;
+        std::atomic<int64_t> begin;
+        std::atomic<int64_t> end;
+        std::atomic<int64_t> arg;
+        std::atomic<int32_t> tid;
+        std::atomic<int32_t> fd;
+        std::atomic<int32_t> phase;
+    };
+
+    Tracer();
+
+    std::unique_ptr<Event_[]> ring_;
+    size_t mask_;
+    std::atomic<uint64_t> head_;
+    uint64_t nextId_;
+    uint64_t rng_;
+
+    static thread_local uint64_t current_;
+};
+
+// 在作用域结束时记录一个阶段，跟踪id取当前线程的Current()
+class TraceScope {
+public:
+    TraceScope(Tracer::PHASE phase, int fd = -1)
+        : id_(Tracer::Current()), phase_(phase), fd_(fd), begin_(id_ ? Metrics::NowNs() : 0) {}
+    ~TraceScope() {
+        if(id_) { Tracer::Instance()->Record(id_, phase_, begin_, Metrics::NowNs(), fd_); }
+    }
+
+private:
+    uint64_t id_;
+    Tracer::PHASE phase_;
+    int fd_;
+    int64_t begin_;
+};
+
+#endif //TRACER_H
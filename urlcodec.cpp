@@ -0,0 +1,135 @@
+#include "urlcodec.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+std::string_view FormMap::Get(std::string_view key) const {
+    for(const Field& field : fields_) {
+        if(field.first == key) {
+            return field.second;
+        }
+    }
+    return std::string_view();
+}
+
+bool FormMap::Has(std::string_view key) const {
+    for(const Field& field : fields_) {
+        if(field.first == key) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int UrlCodec::Hex_(char ch) {
+    if(ch >= '0' && ch <= '9') return ch - '0';
+    if(ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    if(ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    return -1;
+}
+
+// 跳过（并搬移）不需要处理的普通字符，返回第一个特殊字符'=' '&' '+' '%'的位置
+const char* UrlCodec::Skip_(const char* r, const char* end, char** w) {
+    char* out = *w;
+#ifdef __SSE2__
+    const __m128i eq = _mm_set1_epi8('=');
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i plus = _mm_set1_epi8('+');
+    const __m128i pct = _mm_set1_epi8('%');
+    while(end - r >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r));
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, eq), _mm_cmpeq_epi8(v, amp)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v, plus), _mm_cmpeq_epi8(v, pct)));
+        int mask = _mm_movemask_epi8(m);
+        if(mask == 0) {
+            if(out != r) { _mm_storeu_si128(reinterpret_cast<__m128i*>(out), v); }
+            out += 16;
+            r += 16;
+            continue;
+        }
+        int n = __builtin_ctz(mask);
+        if(out != r) { memmove(out, r, n); }
+        *w = out + n;
+        return r + n;
+    }
+#endif
+    while(r < end && *r != '=' && *r != '&' && *r != '+' && *r != '%') {
+        *out++ = *r++;
+    }
+    *w = out;
+    return r;
+}
+
+void UrlCodec::Emit_(char* keyBegin, char* keyEnd, char* end, FormMap* out) {
+    if(keyEnd == nullptr) {     // 没有'='，整段都是键
+        keyEnd = end;
+    }
+    if(keyBegin == end) { return; }     // 空字段，例如"a=1&&b=2"
+    out->Add(std::string_view(keyBegin, keyEnd - keyBegin), std::string_view(keyEnd, end - keyEnd));
+}
+
+// 单趟解析：读指针r在前，写指针w在后，边扫描边解码
+void UrlCodec::ParseForm(char* data, size_t len, FormMap* out) {
+    const char* r = data;
+    const char* end = data + len;
+    char* w = data;
+    char* keyBegin = w;
+    char* keyEnd = nullptr;
+    while(r < end) {
+        r = Skip_(r, end, &w);
+        if(r >= end) { break; }
+        switch(*r) {
+        case '=':
+            if(keyEnd == nullptr) {
+                keyEnd = w;     // 值从这里开始，'='本身不写入
+            } else {
+                *w++ = '=';     // 值里面的'='照原样保留
+            }
+            r++;
+            break;
+        case '&':   // 键值对连接符
+            Emit_(keyBegin, keyEnd, w, out);
+            keyBegin = w;
+            keyEnd = nullptr;
+            r++;
+            break;
+        case '+':   // 键值对中的空格换为+或者%20
+            *w++ = ' ';
+            r++;
+            break;
+        case '%':
+            if(end - r >= 3 && Hex_(r[1]) >= 0 && Hex_(r[2]) >= 0) {
+                *w++ = static_cast<char>(Hex_(r[1]) * 16 + Hex_(r[2]));
+                r += 3;
+            } else {    // 不合法的转义按原样保留
+                *w++ = '%';
+                r++;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    Emit_(keyBegin, keyEnd, w, out);
+}
+
+size_t UrlCodec::Decode(char* data, size_t len) {
+    const char* r = data;
+    const char* end = data + len;
+    char* w = data;
+    while(r < end) {
+        char ch = *r;
+        if(ch == '+') {
+            *w++ = ' ';
+            r++;
+        } else if(ch == '%' && end - r >= 3 && Hex_(r[1]) >= 0 && Hex_(r[2]) >= 0) {
+            *w++ = static_cast<char>(Hex_(r[1]) * 16 + Hex_(r[2]));
+            r += 3;
+        } else {
+            *w++ = ch;
+            r++;
+        }
+    }
+    return w - data;
+}
@@ -0,0 +1,44 @@
+#ifndef URL_CODEC_H
+#define URL_CODEC_H
+
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <stddef.h>
+
+// 键值对的小型扁平表：表单字段很少，线性查找比哈希表快，clear之后容量保留，不再分配内存
+class FormMap {
+public:
+    typedef std::pair<std::string_view, std::string_view> Field;
+
+    FormMap() { fields_.reserve(16); }
+
+    void Add(std::string_view key, std::string_view value) { fields_.emplace_back(key, value); }
+    std::string_view Get(std::string_view key) const;   // 找不到返回空串
+    bool Has(std::string_view key) const;
+    void clear() { fields_.clear(); }
+    size_t size() const { return fields_.size(); }
+    bool empty() const { return fields_.empty(); }
+    const Field& operator[](size_t i) const { return fields_[i]; }
+
+private:
+    std::vector<Field> fields_;
+};
+
+/*
+application/x-www-form-urlencoded 和查询串的解码
+原地解码（解码后的长度不会变长），结果都是指向原缓冲区的视图；
+普通字符用SSE2一次扫描16个字节
+*/
+class UrlCodec {
+public:
+    static void ParseForm(char* data, size_t len, FormMap* out);
+    static size_t Decode(char* data, size_t len);   // 解码单个值，返回解码后的长度
+
+private:
+    static const char* Skip_(const char* r, const char* end, char** w);
+    static void Emit_(char* keyBegin, char* keyEnd, char* end, FormMap* out);
+    static int Hex_(char ch);
+};
+
+#endif //URL_CODEC_H
@@ -0,0 +1,234 @@
+#include "watchdog.h"
+#include "log.h"
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <chrono>
+
+int Watchdog::stallMs = 2000;
+size_t Watchdog::recorderSize = 1024;
+const char* Watchdog::dumpDir = "./log";
+std::atomic<bool> Watchdog::dumpRequested_(false);
+
+static const char* const CALL_NAMES[] = { "none", "mysql_query", "mmap", "writev" };
+
+Watchdog* Watchdog::Instance() {
+    static Watchdog watchdog;
+    return &watchdog;
+}
+
+Watchdog::~Watchdog() {
+    Stop();
+}
+
+Watchdog::Slot_* Watchdog::Local_() {
+    static thread_local SlotHolder_ holder;
+    if(!holder.slot) { holder.slot = Instance()->Acquire_(); }
+    return holder.slot;
+}
+
+// 和Metrics的分片一样，线程退出后槽位留给新线程复用
+Watchdog::Slot_* Watchdog::Acquire_() {
+    std::lock_guard<std::mutex> locker(slotMtx_);
+    Slot_* slot = nullptr;
+    for(Slot_* s : slots_) {
+        bool idle = false;
+        if(s->inUse.compare_exchange_strong(idle, true, std::memory_order_acquire)) {
+            slot = s;
+            break;
+        }
+    }
+    if(!slot) {
+        slot = new Slot_();
+        slot->inUse.store(true, std::memory_order_relaxed);
+        slots_.push_back(slot);
+    }
+    slot->taskStart.store(0, std::memory_order_relaxed);
+    slot->callStart.store(0, std::memory_order_relaxed);
+    slot->tid.store(static_cast<int32_t>(syscall(SYS_gettid)), std::memory_order_relaxed);
+    return slot;
+}
+
+void Watchdog::TaskBegin() {
+    Slot_* slot = Local_();
+    slot->fd.store(-1, std::memory_order_relaxed);
+    slot->phase.store(nullptr, std::memory_order_relaxed);
+    slot->path[0].store(0, std::memory_order_relaxed);
+    slot->taskStart.store(Metrics::NowNs(), std::memory_order_release);
+}
+
+void Watchdog::SetConn(int fd) {
+    Local_()->fd.store(fd, std::memory_order_relaxed);
+}
+
+void Watchdog::TaskEnd() {
+    Local_()->taskStart.store(0, std::memory_order_release);
+}
+
+void Watchdog::SetPhase(const char* phase) {
+    Local_()->phase.store(phase, std::memory_order_relaxed);
+}
+
+void Watchdog::SetPath(std::string_view path) {
+    Slot_* slot = Local_();
+    uint64_t words[PATH_WORDS] = { 0 };
+    memcpy(words, path.data(), std::min(path.size(), sizeof(words) - 1));
+    for(int i = 0; i < PATH_WORDS; i++) {
+        slot->path[i].store(words[i], std::memory_order_relaxed);
+    }
+}
+
+void Watchdog::CallBegin(CALL call) {
+    Slot_* slot = Local_();
+    slot->call.store(call, std::memory_order_relaxed);
+    slot->callStart.store(Metrics::NowNs(), std::memory_order_release);
+}
+
+static thread_local int64_t blockedNs = 0;
+
+void Watchdog::CallEnd() {
+    Slot_* slot = Local_();
+    blockedNs += Metrics::NowNs() - slot->callStart.load(std::memory_order_relaxed);
+    slot->callStart.store(0, std::memory_order_release);
+}
+
+int64_t Watchdog::BlockedNs() {
+    return blockedNs;
+}
+
+std::string Watchdog::PathOf_(const Slot_* slot) {
+    uint64_t words[PATH_WORDS];
+    for(int i = 0; i < PATH_WORDS; i++) {
+        words[i] = slot->path[i].load(std::memory_order_relaxed);
+    }
+    const char* str = reinterpret_cast<const char*>(words);
+    return std::string(str, strnlen(str, sizeof(words)));
+}
+
+void Watchdog::RecordRequest(int fd, std::string_view method, std::string_view path, int code,
+                             size_t bytes, int64_t startNs, int64_t endNs) {
+    Request_ req;
+    req.start = startNs;
+    req.end = endNs;
+    req.fd = fd;
+    req.code = code;
+    req.bytes = bytes;
+    snprintf(req.method, sizeof(req.method), "%.*s", (int)method.size(), method.data());
+    snprintf(req.path, sizeof(req.path), "%.*s", (int)path.size(), path.data());
+    std::lock_guard<std::mutex> locker(recMtx_);
+    if(requests_.empty()) {
+        requests_.resize(std::max<size_t>(recorderSize, 1));
+    }
+    requests_[next_] = req;
+    next_ = (next_ + 1) % requests_.size();
+    count_ = std::min(count_ + 1, requests_.size());
+}
+
+// 先写正在执行的任务，再按时间顺序写最近完成的请求
+bool Watchdog::Dump(const char* reason) {
+    mkdir(dumpDir, 0777);
+    static std::atomic<int> seq(0);
+    char path[256];
+    snprintf(path, sizeof(path), "%s/flight-%lld-%d-%d.log", dumpDir, (long long)time(nullptr), (int)getpid(), seq++);
+    FILE* fp = fopen(path, "w");
+    if(!fp) {
+        LOG_ERROR("Watchdog: cannot open %s", path);
+        return false;
+    }
+    int64_t now = Metrics::NowNs();
+    fprintf(fp, "reason: %s\n\n[running tasks]\n", reason);
+    {
+        std::lock_guard<std::mutex> locker(slotMtx_);
+        for(Slot_* slot : slots_) {
+            int64_t start = slot->taskStart.load(std::memory_order_acquire);
+            if(!slot->inUse.load(std::memory_order_relaxed) || start == 0) { continue; }
+            int64_t callStart = slot->callStart.load(std::memory_order_acquire);
+            const char* phase = slot->phase.load(std::memory_order_relaxed);
+            fprintf(fp, "tid=%d fd=%d phase=%s path=%s elapsed=%.3fms", slot->tid.load(std::memory_order_relaxed),
+                slot->fd.load(std::memory_order_relaxed), phase ? phase : "-", PathOf_(slot).c_str(), (now - start) / 1e6);
+            if(callStart) {
+                fprintf(fp, " in %s for %.3fms", CALL_NAMES[slot->call.load(std::memory_order_relaxed)], (now - callStart) / 1e6);
+            }
+            fputc('\n', fp);
+        }
+    }
+    fprintf(fp, "\n[recent requests, oldest first; start is ms before dump]\n");
+    {
+        std::lock_guard<std::mutex> locker(recMtx_);
+        size_t size = requests_.size();
+        for(size_t i = 0; i < count_; i++) {
+            const Request_& req = requests_[(next_ + size - count_ + i) % size];
+            fprintf(fp, "start=-%.3fms dur=%.3fms fd=%d %s %s code=%d bytes=%zu\n", (now - req.start) / 1e6,
+                (req.end - req.start) / 1e6, req.fd, req.method, req.path, req.code, req.bytes);
+        }
+    }
+    fclose(fp);
+    LOG_WARN("Watchdog: flight recorder written to %s (%s)", path, reason);
+    return true;
+}
+
+void Watchdog::OnSignal_(int) {
+    dumpRequested_.store(true, std::memory_order_relaxed);   // 信号处理函数里只置标志，落盘由看门狗线程做
+}
+
+void Watchdog::Check_(int64_t now) {
+    int64_t threshold = static_cast<int64_t>(stallMs) * 1000000;
+    bool stalled = false;
+    {
+        std::lock_guard<std::mutex> locker(slotMtx_);
+        for(Slot_* slot : slots_) {
+            int64_t start = slot->taskStart.load(std::memory_order_acquire);
+            if(start == 0 || now - start < threshold || slot->reported == start) { continue; }
+            slot->reported = start;     // 同一个任务只报一次
+            stalled = true;
+            int64_t callStart = slot->callStart.load(std::memory_order_acquire);
+            const char* phase = slot->phase.load(std::memory_order_relaxed);
+            LOG_WARN("Watchdog: task on tid %d stalled %lldms, fd=%d phase=%s path=%s call=%s(%lldms)",
+                slot->tid.load(std::memory_order_relaxed), (long long)((now - start) / 1000000),
+                slot->fd.load(std::memory_order_relaxed), phase ? phase : "-", PathOf_(slot).c_str(),
+                callStart ? CALL_NAMES[slot->call.load(std::memory_order_relaxed)] : "none",
+                (long long)(callStart ? (now - callStart) / 1000000 : 0));
+        }
+    }
+    // 持续卡顿时每个任务都会报一次日志，但落盘最多10秒一次
+    if(stalled && (lastDump_ == 0 || now - lastDump_ >= 10 * 1000000000LL)) {
+        lastDump_ = now;
+        Dump("stall");
+    }
+}
+
+void Watchdog::Loop_() {
+    // 检查间隔取阈值的四分之一，最多100ms，保证SIGUSR1能及时响应
+    int interval = std::max(1, std::min(stallMs / 4, 100));
+    while(running_.load(std::memory_order_relaxed)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+        if(dumpRequested_.exchange(false)) {
+            Dump("SIGUSR1");
+        }
+        Check_(Metrics::NowNs());
+    }
+}
+
+void Watchdog::Start() {
+    if(stallMs <= 0 || running_.exchange(true)) {
+        return;
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = OnSignal_;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, nullptr);
+    thread_ = std::thread(&Watchdog::Loop_, this);
+}
+
+void Watchdog::Stop() {
+    if(running_.exchange(false) && thread_.joinable()) {
+        thread_.join();
+    }
+}
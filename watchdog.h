@@ -0,0 +1,115 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <stdint.h>
+#include "metrics.h"
+
+/*
+卡顿检测和飞行记录仪：
+线程池的每个工作线程有一个槽位，任务开始、阻塞调用（mysql_query、mmap、writev）开始时在槽位里记下时间，
+看门狗线程定期扫描，超过阈值的任务连同连接fd、路径、当前阶段一起写日志，并把飞行记录仪落盘；
+飞行记录仪保存最近N个完成的请求，收到SIGUSR1时也会落盘
+*/
+class Watchdog {
+public:
+    enum CALL {
+        NONE,
+        SQL_QUERY,
+        MMAP,
+        WRITEV,
+        CALL_COUNT,
+    };
+
+    static Watchdog* Instance();
+
+    void Start();       // 启动看门狗线程并接管SIGUSR1，重复调用无效果
+    void Stop();
+
+    // 下面这些只修改当前线程自己的槽位
+    static void TaskBegin();
+    static void TaskEnd();
+    static void SetConn(int fd);
+    static void SetPhase(const char* phase);
+    static void SetPath(std::string_view path);
+    static void CallBegin(CALL call);
+    static void CallEnd();
+    static int64_t BlockedNs();         // 当前线程在阻塞调用里累计花掉的时间，线程池用来估计阻塞比例
+
+    // 一个请求的响应写完后记一笔
+    void RecordRequest(int fd, std::string_view method, std::string_view path, int code,
+                       size_t bytes, int64_t startNs, int64_t endNs);
+
+    bool Dump(const char* reason);      // 写到dumpDir下的flight-<时间>-<pid>-<序号>.log
+
+    static int stallMs;                 // 任务超过这个时间算卡顿，0表示不启动看门狗
+    static size_t recorderSize;         // 飞行记录仪保存的请求数，在第一次使用之前设置
+    static const char* dumpDir;
+
+private:
+    static const int PATH_WORDS = 8;    // 路径最多记64字节
+
+    struct alignas(64) Slot_ {
+        std::atomic<int64_t> taskStart;     // 0表示空闲
+        std::atomic<int64_t> callStart;     // 0表示不在阻塞调用里
+        std::atomic<int> call;
+        std::atomic<int> fd;
+        std::atomic<const char*> phase;     // 只放字符串常量
+        std::atomic<uint64_t> path[PATH_WORDS];
+        std::atomic<int32_t> tid;
+        std::atomic<bool> inUse;
+        int64_t reported;                   // 看门狗线程自己用：已经报告过的任务开始时间
+    };
+
+    struct SlotHolder_ {
+        Slot_* slot = nullptr;
+        ~SlotHolder_() { if(slot) { slot->inUse.store(false, std::memory_order_release); } }
+    };
+
+    struct Request_ {
+        int64_t start;      // CLOCK_MONOTONIC
+        int64_t end;
+        int fd;
+        int code;
+        size_t bytes;
+        char method[8];
+        char path[64];
+    };
+
+    Watchdog() = default;
+    ~Watchdog();
+    static Slot_* Local_();
+    Slot_* Acquire_();
+    void Loop_();
+    void Check_(int64_t now);
+    static void OnSignal_(int sig);
+    static std::string PathOf_(const Slot_* slot);
+
+    std::mutex slotMtx_;
+    std::vector<Slot_*> slots_;
+
+    std::mutex recMtx_;
+    std::vector<Request_> requests_;
+    size_t next_ = 0;
+    size_t count_ = 0;
+
+    int64_t lastDump_ = 0;              // 看门狗线程自己用：上一次因卡顿落盘的时间
+    std::thread thread_;
+    std::atomic<bool> running_{false};
+
+    static std::atomic<bool> dumpRequested_;
+};
+
+// 阻塞调用的作用域
+class WatchCall {
+public:
+    explicit WatchCall(Watchdog::CALL call) { Watchdog::CallBegin(call); }
+    ~WatchCall() { Watchdog::CallEnd(); }
+};
+
+#endif //WATCHDOG_H
@@ -1,6 +1,46 @@
 #include "webserver.h"
 
 using namespace std;
+
+bool WebServer::useCoroutines = false;
+WebServer::OverloadOptions WebServer::overload;
+WebServer::LifecycleOptions WebServer::lifecycle;
+AccessLog::Options WebServer::accessLog;
+WebServer::UnixListenOptions WebServer::unixListen;
+WebServer::SocketOptions WebServer::socketOptions;
+WebServer::TimeoutOptions WebServer::timeouts;
+#ifdef TINYWEB_TLS
+TlsContext::Options WebServer::tls;
+#endif
+
+ThreadPool::Options WebServer::poolOptions = [] {
+    ThreadPool::Options options;
+    options.maxThreads = 0;
+    return options;
+}();
+
+// 读请求便宜，先照顾；写给慢客户端的任务权重低，但等太久也会被提到前面
+static ThreadPool::Options PoolOptions(int threadNum) {
+    ThreadPool::Options options = WebServer::poolOptions;
+    options.minThreads = threadNum;
+    options.maxThreads = max(options.maxThreads, threadNum);
+    if(options.classes.empty()) {
+        options.classes.resize(WebServer::TASK_CLASS_COUNT);
+        options.classes[WebServer::TASK_READ] = { "read", 2, 0 };
+        options.classes[WebServer::TASK_WRITE] = { "write", 1, 10000 };
+    }
+    assert(options.classes.size() == WebServer::TASK_CLASS_COUNT);
+    return options;
+}
+
+// 查库的任务单独一个线程池，卡在数据库上时不占用处理静态请求的线程；超过连接数的线程只会在连接池上排队
+static ThreadPool::Options DbPoolOptions(int connPoolNum) {
+    ThreadPool::Options options;
+    options.name = "db";
+    options.minThreads = 1;
+    options.maxThreads = max(connPoolNum, 1);
+    return options;
+}
 //在初始化的时候就要注意一下的初始化：
 //工作目录srcDir，方便之后去处理请求的资源
 //连接池也要提前准备好SqlConnPool::Instance()->Init（）；
@@ -10,43 +50,136 @@ WebServer::WebServer(
             int sqlPort, const char* sqlUser, const  char* sqlPwd,
             const char* dbName, int connPoolNum, int threadNum,
             bool openLog, int logLevel, int logQueSize):
-            port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), isClose_(false),
-            timer_(new HeapTimer()), threadpool_(new ThreadPool(threadNum)), epoller_(new Epoller())
+            port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), isClose_(false), listenFd_(-1), unixFd_(-1), signalFd_(InitSignalFd_()),
+            timer_(new HeapTimer()), threadpool_(new ThreadPool(PoolOptions(threadNum))),
+            dbpool_(new ThreadPool(DbPoolOptions(connPoolNum))), epoller_(new Epoller()),
+            dbInFlight_(0), acceptPaused_(false), draining_(false), drainDeadline_(0)
     {
     srcDir_ = getcwd(nullptr, 256);//获得目前的工作目录？
     assert(srcDir_);
     strcat(srcDir_, "/resources/");
     HttpConn::userCount = 0;
     HttpConn::srcDir = srcDir_;
+    HttpConn::cork = socketOptions.cork;
+    if(useCoroutines) {
+        coLoop_.reset(new CoLoop(epoller_.get(), threadpool_.get(), MAX_FD));
+    }
+    InitDeadlines_();
+    if(overload.codelTargetUs > 0) {
+        codel_.reset(new CoDel(overload.codelTargetUs * 1000LL, max(overload.codelIntervalMs, 1) * 1000000LL));
+    }
+    busyResponse_ = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: " + to_string(overload.retryAfterS) +
+                    "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+    // 注册路由，启动之后路由表只读
+    HttpRequest::RegisterRoutes(Router::Instance());
+    Metrics::RegisterRoutes(Router::Instance());
+    Tracer::RegisterRoutes(Router::Instance());
+    if(!Router::Instance()->Freeze()) { isClose_ = true; }
+
+    Watchdog::Instance()->Start();
+    signal(SIGPIPE, SIG_IGN);   // 对端先关了连接时写会收到SIGPIPE，默认处理会杀掉进程，改成让write返回EPIPE
+    Metrics::Instance()->AddGauge("tinyweb_sql_free_connections", "Idle connections in the SQL pool.",
+        []() { return static_cast<double>(SqlConnPool::Instance()->GetFreeConnCount()); });
+    Metrics::Instance()->AddGauge("tinyweb_conn_states", "Per-connection request state objects, in use by active connections or pooled.",
+        []() { return static_cast<double>(HttpConn::ActiveStates()); }, "{state=\"active\"}");
+    Metrics::Instance()->AddGauge("tinyweb_conn_states", "Per-connection request state objects, in use by active connections or pooled.",
+        []() { return static_cast<double>(HttpConn::PooledStates()); }, "{state=\"pooled\"}");
 
     // 初始化操作
     SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);  // 连接池单例的初始化
+    // 日志先打开，建监听套接字时出的错和套接字参数设不上的警告才记得下来
+    if(openLog) {
+        Log::Instance()->init(logLevel, "./log", ".log", logQueSize);
+    }
     // 初始化事件和初始化socket(监听)
     InitEventMode_(trigMode);//事件类型一般要设置为ET模式
     if(!InitSocket_()) { isClose_ = true;}
+    if(signalFd_ >= 0) { epoller_->AddFd(signalFd_, EPOLLIN); }
 
     // 是否打开日志标志
     if(openLog) {//开启日志
-        Log::Instance()->init(logLevel, "./log", ".log", logQueSize);
         if(isClose_) { LOG_ERROR("========== Server init error!=========="); }
         else {
             LOG_INFO("========== Server init ==========");
             LOG_INFO("Port:%d, OpenLinger: %s", port_, OptLinger? "true":"false");
+            if(unixFd_ >= 0) { LOG_INFO("Unix socket: %s%s", unixListen.path.c_str(), listenFd_ < 0 ? " (no TCP)" : ""); }
             LOG_INFO("Listen Mode: %s, OpenConn Mode: %s",
                             (listenEvent_ & EPOLLET ? "ET": "LT"),
                             (connEvent_ & EPOLLET ? "ET": "LT"));
             LOG_INFO("LogSys level: %d", logLevel);
             LOG_INFO("srcDir: %s", HttpConn::srcDir);
-            LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
+            LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d-%d", connPoolNum, threadNum, max(poolOptions.maxThreads, threadNum));
         }
     }
+    if(!accessLog.path.empty()) {
+        if(AccessLog::Instance()->Start(accessLog)) {
+            Metrics::Instance()->AddGauge("tinyweb_access_log_records_total", "Requests written to the access log.",
+                []() { return static_cast<double>(AccessLog::Instance()->Written()); }, "", "counter");
+            Metrics::Instance()->AddGauge("tinyweb_access_log_dropped_total", "Access log records dropped because a thread's ring was full.",
+                []() { return static_cast<double>(AccessLog::Instance()->Dropped()); }, "", "counter");
+        } else {
+            isClose_ = true;
+        }
+    }
+#ifdef TINYWEB_TLS
+    // 证书在日志打开之后加载，加载失败的原因能记下来
+    if(!tls.certFile.empty()) {
+        tls_.reset(new TlsContext());
+        if(tls_->Init(tls)) {
+            HttpConn::tls = tls_.get();
+            TlsContext* context = tls_.get();
+            Metrics::Instance()->AddGauge("tinyweb_tls_handshakes_total", "Completed TLS handshakes.",
+                [context]() { return static_cast<double>(context->Handshakes()); }, "", "counter");
+            Metrics::Instance()->AddGauge("tinyweb_tls_resumed_total", "TLS handshakes resumed from a ticket or the session cache.",
+                [context]() { return static_cast<double>(context->Resumed()); }, "", "counter");
+            Metrics::Instance()->AddGauge("tinyweb_tls_ktls_send_total", "TLS connections whose record encryption moved to the kernel.",
+                [context]() { return static_cast<double>(context->KernelSend()); }, "", "counter");
+            Metrics::Instance()->AddGauge("tinyweb_tls_handshake_failures_total", "Failed TLS handshakes.",
+                [context]() { return static_cast<double>(context->Failures()); }, "", "counter");
+        } else {
+            isClose_ = true;
+        }
+    }
+#endif
 }
 
 WebServer::~WebServer() {
-    close(listenFd_);//关闭监听的fd
+    if(listenFd_ >= 0) { close(listenFd_); }    //关闭监听的fd，退出时已经关过了
+    if(unixFd_ >= 0) { close(unixFd_); }
+    if(!unixPath_.empty()) { unlink(unixPath_.c_str()); }
+    if(signalFd_ >= 0) { close(signalFd_); }
     isClose_ = true;
+    // 协程模式下先取消所有连接，挂起的协程被恢复后自己关连接、释放帧。协程查库时换到dbpool_，查完再换回threadpool_，
+    // 两个池子先停哪个，另一个里的协程都可能往停掉的池里投；所以两个都开着，等协程全部关掉连接退出了再停。
+    // 查库卡住时要等它返回，这和回调模式下dbpool_析构时等它是一样的
+    if(coLoop_) {
+        for(auto& user : users_) { coLoop_->Cancel(user.first); }
+        while(HttpConn::userCount > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    // 回调模式下读写任务会往dbpool_里加任务，而数据库任务只交还连接、不再往threadpool_里投，
+    // 所以先等threadpool_做完手上的任务再停dbpool_；任务里还要用到连接和epoller，这两个最后才析构
+    threadpool_.reset();
+    dbpool_.reset();
     free(srcDir_);//释放掉
+    if(AccessLog::Instance()->Enabled()) {     // 线程池停了，不会再有新记录
+        AccessLog::Instance()->Stop();
+        Metrics::Instance()->RemoveGauge("tinyweb_access_log_records_total");
+        Metrics::Instance()->RemoveGauge("tinyweb_access_log_dropped_total");
+    }
+#ifdef TINYWEB_TLS
+    if(HttpConn::tls) {
+        HttpConn::tls = nullptr;    // 剩下的连接析构时还会用到SSL_CTX，SSL对象自己持有它的引用
+        Metrics::Instance()->RemoveGauge("tinyweb_tls_handshakes_total");
+        Metrics::Instance()->RemoveGauge("tinyweb_tls_resumed_total");
+        Metrics::Instance()->RemoveGauge("tinyweb_tls_ktls_send_total");
+        Metrics::Instance()->RemoveGauge("tinyweb_tls_handshake_failures_total");
+    }
+#endif
     SqlConnPool::Instance()->ClosePool();//关闭连接池
+    Watchdog::Instance()->Stop();
 }
 
 //线程池是在哪里开的呢？
@@ -81,16 +214,41 @@ void WebServer::Start() {
     int timeMS = -1;  /* epoll wait timeout == -1 无事件将阻塞 */
     if(!isClose_) { LOG_INFO("========== Server start =========="); }
     while(!isClose_) {//持续打开webserver
-        if(timeoutMS_ > 0) {
+        if(deadlines_) {
             timeMS = timer_->GetNextTick();     // 获取下一次的超时等待事件(至少这个时间才会有用户过期，每次关闭超时连接则需要有新的请求进来)
         }//每次循环开始的时候先处理最快到期的定时器事件，然后wait的事件小于这个即将到期的时间。
+        if(acceptPaused_) {
+            // 连接是在工作线程里关的，主线程收不到通知，暂停期间每10ms看一次能不能恢复accept
+            if(!Saturated_(true)) { PauseAccept_(false); }
+            else if(timeMS < 0 || timeMS > 10) { timeMS = 10; }
+        }
+        if(draining_) {
+            // 同样每10ms看一次连接关完了没有
+            if(HttpConn::userCount == 0) { break; }
+            if(Metrics::NowNs() >= drainDeadline_) {
+                LOG_WARN("Drain timeout, %d connections left", (int)HttpConn::userCount);
+                // 只shutdown不close，正在处理的工作线程读写失败后自己关，剩下的随users_析构关掉
+                for(auto& user : users_) {
+                    if(!user.second.IsClosed()) { shutdown(user.first, SHUT_RDWR); }
+                }
+                break;
+            }
+            if(timeMS < 0 || timeMS > 10) { timeMS = 10; }
+        }
         int eventCnt = epoller_->Wait(timeMS);//等待对应长度的时间
         for(int i = 0; i < eventCnt; i++) {
             /* 处理事件 */
             int fd = epoller_->GetEventFd(i);
             uint32_t events = epoller_->GetEvents(i);
-            if(fd == listenFd_) {
-                DealListen_();
+            if(fd == listenFd_ || fd == unixFd_) {
+                DealListen_(fd);
+            }
+            else if(fd == signalFd_) {
+                DealSignal_();
+            }
+            else if(coLoop_) {
+                assert(users_.count(fd) > 0);
+                DealCoEvent_(&users_[fd], events);
             }
             //如果是对应的读、写事件那么就交给对应的线程去做（这个线程在deal函数里面）
             else if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
@@ -109,123 +267,694 @@ void WebServer::Start() {
             }
         }
     }
+    isClose_ = true;
+    LOG_INFO("========== Server stop ==========");
 }
 
-void WebServer::SendError_(int fd, const char*info) {
+// 预先生成好的503，过载时直接发，不走解析和响应生成；发不出去也不管，反正要关连接
+void WebServer::SendBusy_(int fd) {
     assert(fd > 0);
-    int ret = send(fd, info, strlen(info), 0);
-    if(ret < 0) {
-        LOG_WARN("send error to client[%d] error!", fd);
+#ifdef TINYWEB_TLS
+    if(HttpConn::tls) { return; }   // 还没握手，明文的503对方也看不懂，直接关
+#endif
+    send(fd, busyResponse_.data(), busyResponse_.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    Metrics::Instance()->AddRequest(503);
+}
+
+// 在工作线程里、刚读到新数据时调用：排队的任务太多，或者CoDel认为排队延迟已经持续过高，就丢掉这个请求
+bool WebServer::Shed_(HttpConn* client) {
+    bool shed = overload.maxQueued > 0 && threadpool_->Queued() >= static_cast<size_t>(overload.maxQueued);
+    if(!shed && codel_) {
+        shed = codel_->ShouldDrop(ThreadPool::CurrentWaitNs(), Metrics::NowNs());
+    }
+    if(shed) {
+        Reject_(client);
+    }
+    return shed;
+}
+
+void WebServer::Reject_(HttpConn* client) {
+    if(client->SendNow(busyResponse_)) {
+        Metrics::Instance()->AddRequest(503);
+    }
+    Metrics::Instance()->Add(Metrics::REQ_SHED);
+    CloseConn_(client);
+}
+
+// 查库的请求要先占一个名额，到上限就不再往数据库线程池里排
+bool WebServer::AcquireDb_() {
+    int inFlight = dbInFlight_.fetch_add(1, std::memory_order_relaxed);
+    if(overload.maxDbInFlight > 0 && inFlight >= overload.maxDbInFlight) {
+        dbInFlight_.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void WebServer::ReleaseDb_() {
+    dbInFlight_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// 连接数或者排队的任务数到了上限；恢复时要空出10%（至少一个）连接、排队降到一半，避免在临界点上反复开关
+bool WebServer::Saturated_(bool resuming) const {
+    int conns = HttpConn::userCount;
+    size_t queued = threadpool_->Queued();
+    if(resuming) {
+        return conns > overload.maxConns - max(1, overload.maxConns / 10) ||
+               (overload.maxQueued > 0 && queued > static_cast<size_t>(overload.maxQueued / 2));
+    }
+    return conns >= overload.maxConns ||
+           (overload.maxQueued > 0 && queued >= static_cast<size_t>(overload.maxQueued));
+}
+
+// 暂停时把监听套接字从epoll里拿掉，新连接留在内核的积压队列里，满了客户端会重传SYN
+void WebServer::PauseAccept_(bool pause) {
+    if(pause == acceptPaused_) { return; }
+    acceptPaused_ = pause;
+    for(int fd : { listenFd_, unixFd_ }) {
+        if(fd < 0) { continue; }
+        if(pause) { epoller_->DelFd(fd); } else { epoller_->AddFd(fd, ListenEvents_()); }
+    }
+    if(pause) {
+        LOG_WARN("Saturated (%d conns, %zu queued), pause accept", (int)HttpConn::userCount, threadpool_->Queued());
+    } else {
+        LOG_INFO("Resume accept");
+    }
+}
+
+// EPOLLEXCLUSIVE只能和EPOLLIN、EPOLLET之类一起用，不能带EPOLLRDHUP，也不能EPOLL_CTL_MOD，所以暂停用的是删了再加
+uint32_t WebServer::ListenEvents_() const {
+    if(overload.exclusiveAccept) {
+        return (listenEvent_ & EPOLLET) | EPOLLIN | EPOLLEXCLUSIVE;
     }
-    close(fd);
+    return listenEvent_ | EPOLLIN;
 }
 
 void WebServer::CloseConn_(HttpConn* client) {//关闭一个连接，那么就是要从红黑树上删除。
     assert(client);
-    LOG_INFO("Client[%d] quit!", client->GetFd());
+    LOG_DEBUG("Client[%d] quit!", client->GetFd());
     epoller_->DelFd(client->GetFd());
     client->Close();
 }
 
-void WebServer::AddClient_(int fd, sockaddr_in addr) {//增加一个客人，被addfd函数调用，用于添加定时器
+// 工作线程里调用：定时器判了超时的连接（见OnDeadline_）不再打开事件，由手上有它的线程关
+void WebServer::HandBack_(HttpConn* client, uint32_t events) {
+    if(client->TimedOut()) {
+        CloseConn_(client);
+        return;
+    }
+    epoller_->ModFd(client->GetFd(), connEvent_ | events);
+}
+
+// UNIX套接字的对端没有IP和端口，只记下是从它进来的，按unixListen.trustPeers决定算不算本机
+void WebServer::AddClient_(int fd, const sockaddr_storage& addr) {//增加一个客人，被addfd函数调用，用于添加定时器
     assert(fd > 0);
-    users_[fd].init(fd, addr);
-    if(timeoutMS_ > 0) {//这里主要是给新增的客人贴上一个定时检验的定时器，避免长时间不联系（kindof长连接）
-        timer_->add(fd, timeoutMS_, std::bind(&WebServer::CloseConn_, this, &users_[fd]));
+    sockaddr_in peer = {};
+    HttpConn::PEER kind = HttpConn::PEER_INET;
+    if(addr.ss_family == AF_INET) {
+        memcpy(&peer, &addr, sizeof(peer));
+    } else {
+        kind = unixListen.trustPeers ? HttpConn::PEER_UNIX_TRUSTED : HttpConn::PEER_UNIX;
+    }
+    users_[fd].init(fd, peer, kind);
+    if(coLoop_) {
+        // 超时只是取消，由协程自己关连接；先只注册不打开读事件，协程第一次Wait时才打开
+        StartDeadline_(fd);
+        epoller_->AddFd(fd, connEvent_);
+        if(!socketOptions.accept4) { SetFdNonblock(fd); }
+        coLoop_->Spawn(fd, ServeConn_(&users_[fd]), TASK_READ);
+        LOG_DEBUG("Client[%d] in!", fd);
+        return;
     }
+    StartDeadline_(fd);     //这里主要是给新增的客人贴上一个定时检验的定时器，避免长时间不联系（kindof长连接）
     epoller_->AddFd(fd, EPOLLIN | connEvent_);
-    SetFdNonblock(fd);//设置非阻塞
-    LOG_INFO("Client[%d] in!", users_[fd].GetFd());
+    if(!socketOptions.accept4) { SetFdNonblock(fd); }  //设置非阻塞，accept4拿到的已经是了
+    LOG_DEBUG("Client[%d] in!", users_[fd].GetFd());
 }
 
 // 处理监听套接字，主要逻辑是accept新的套接字，并加入timer和epoller中
-void WebServer::DealListen_() {
-    struct sockaddr_in addr;
-    socklen_t len = sizeof(addr);
+void WebServer::DealListen_(int listenFd) {
+    struct sockaddr_storage addr;
+    socklen_t len;
     do {
-        int fd = accept(listenFd_, (struct sockaddr *)&addr, &len);
+        len = sizeof(addr);
+        int fd = socketOptions.accept4 ? accept4(listenFd, (struct sockaddr *)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC)
+                                       : accept(listenFd, (struct sockaddr *)&addr, &len);
         if(fd <= 0) { return;}
-        else if(HttpConn::userCount >= MAX_FD) {
-            SendError_(fd, "Server busy!");
+        else if(HttpConn::userCount >= min(overload.maxConns, MAX_FD)) {
+            SendBusy_(fd);
+            close(fd);
+            Metrics::Instance()->Add(Metrics::CONN_REJECTED);
             LOG_WARN("Clients is full!");
+            PauseAccept_(true);
             return;
         }
+        Metrics::Instance()->Add(Metrics::ACCEPTS);
         AddClient_(fd, addr);//添加定时器定时检查这个连接状态
+        if(Saturated_(false)) {
+            PauseAccept_(true);
+            return;
+        }
     } while(listenEvent_ & EPOLLET);
 }
 
 // 处理读事件，主要逻辑是将OnRead加入线程池的任务队列中
 void WebServer::DealRead_(HttpConn* client) {
     assert(client);
-    ExtentTime_(client);//收到了这个客户的消息，要重新给这个客户计时
-    //使用bind将function类型绑定了一些参数成为了一个仿函数然后传递到线程池中去
-    threadpool_->AddTask(std::bind(&WebServer::OnRead_, this, client)); // 这是一个右值，bind将参数和函数绑定
+    ExtentTime_(client, false);//收到了这个客户的消息，按请求读到哪一步重新算截止时间
+    client->RequestBegin();
+    if(client->TraceId()) { client->SetQueuedAt(Metrics::NowNs()); }
+    // 投出去之后连接归工作线程，Unhold是任务对它的最后一次访问
+    client->Hold();
+    threadpool_->AddTask([this, client] { OnRead_(client); client->Unhold(); }, TASK_READ);
     //threadpool是一个比较独立的过程，他自己开了很多线程，你要让他做事就直接将任务放在这个类的task参数里面就可以了。
 }
 
 // 处理写事件，主要逻辑是将OnWrite加入线程池的任务队列中
 void WebServer::DealWrite_(HttpConn* client) {
     assert(client);
-    ExtentTime_(client);
-    threadpool_->AddTask(std::bind(&WebServer::OnWrite_, this, client));
+    if(client->HandshakeWantsWrite()) {     // TLS握手的数据写得出去了，握手还是走读的路径
+        DealRead_(client);
+        return;
+    }
+    ExtentTime_(client, true);
+    if(client->TraceId()) { client->SetQueuedAt(Metrics::NowNs()); }
+    client->Hold();
+    threadpool_->AddTask([this, client] { OnWrite_(client); client->Unhold(); }, TASK_WRITE);
 }
 
-void WebServer::ExtentTime_(HttpConn* client) {
+void WebServer::InitDeadlines_() {
+    const int ms[PHASE_COUNT] = { timeouts.firstByteMs, timeouts.headerMs, timeouts.bodyMs, timeouts.writeMs, timeouts.keepAliveMs, timeouts.processMs };
+    static const char* const NAMES[PHASE_COUNT] = { "first_byte", "header", "body", "write", "keepalive", "process" };
+    armCapNs_ = 0;
+    for(int i = 0; i < PHASE_COUNT; i++) {
+        int phaseMs = ms[i] > 0 ? ms[i] : max(timeoutMS_, 0);
+        phaseNs_[i] = phaseMs * 1000000LL;
+        if(phaseNs_[i] > 0 && (armCapNs_ == 0 || phaseNs_[i] < armCapNs_)) {
+            armCapNs_ = phaseNs_[i];
+        }
+        timedOut_[i] = 0;
+    }
+    if(armCapNs_ == 0) {
+        return;
+    }
+    deadlines_.reset(new Deadline_[MAX_FD]);
+    for(int i = 0; i < PHASE_COUNT; i++) {
+        Metrics::Instance()->AddGauge("tinyweb_conn_timeouts_total", "Connections closed because a phase deadline passed.",
+            [this, i]() { return static_cast<double>(timedOut_[i].load(std::memory_order_relaxed)); },
+            std::string("{phase=\"") + NAMES[i] + "\"}", "counter");
+    }
+}
+
+// 这个阶段从from开始，到什么时候为止；不限时的阶段返回INT64_MAX
+int64_t WebServer::PhaseEnd_(PHASE phase, int64_t from) const {
+    return phaseNs_[phase] > 0 ? from + phaseNs_[phase] : INT64_MAX;
+}
+
+void WebServer::StartDeadline_(int fd) {
+    if(!deadlines_) { return; }
+    int64_t now = Metrics::NowNs();
+    Deadline_& deadline = deadlines_[fd];
+    deadline.phase.store(PHASE_FIRST_BYTE, std::memory_order_relaxed);
+    deadline.at.store(PhaseEnd_(PHASE_FIRST_BYTE, now), std::memory_order_relaxed);
+    Arm_(fd, now);
+}
+
+// 堆里的结点挂在min(截止时间, 现在+最短的阶段)：工作线程之后再改的截止时间不会早于它，所以工作线程只管写deadlines_，
+// 从来不用碰堆；主线程把截止时间提前（比如进入请求头阶段）时才调整一次堆
+void WebServer::Arm_(int fd, int64_t now) {
+    Deadline_& deadline = deadlines_[fd];
+    int64_t at = std::min(deadline.at.load(std::memory_order_relaxed), now + armCapNs_);
+    deadline.armed = at;
+    int ms = static_cast<int>((max<int64_t>(at - now, 0) + 999999) / 1000000);
+    if(timer_->contains(fd)) {
+        timer_->adjust(fd, ms);
+    } else {
+        timer_->add(fd, ms, [this, fd] { OnDeadline_(fd); });
+    }
+}
+
+void WebServer::SetDeadline_(int fd, PHASE phase, int64_t at) {
+    Deadline_& deadline = deadlines_[fd];
+    deadline.phase.store(phase, std::memory_order_relaxed);
+    deadline.at.store(at, std::memory_order_relaxed);
+    if(at < deadline.armed) {
+        Arm_(fd, Metrics::NowNs());
+    }
+}
+
+// 读事件：请求头阶段的截止时间从第一个字节算起，之后的读事件不续期；请求体按已经收到的字节数续
+// 写事件：套接字重新可写说明客户端读走了一些，从现在起再给writeMs
+void WebServer::ExtentTime_(HttpConn* client, bool writing) {
     assert(client);
-    if(timeoutMS_ > 0) { timer_->adjust(client->GetFd(), timeoutMS_); }
+    if(!deadlines_) { return; }
+    int fd = client->GetFd();
+    Deadline_& deadline = deadlines_[fd];
+    int64_t now = Metrics::NowNs();
+    int current = deadline.phase.load(std::memory_order_relaxed);
+    if(writing) {
+        SetDeadline_(fd, PHASE_WRITE, PhaseEnd_(PHASE_WRITE, now));
+        return;
+    }
+    switch(client->ReadPhase()) {
+    case HttpConn::READ_IDLE:       // 新请求的第一个字节
+        SetDeadline_(fd, PHASE_HEADER, PhaseEnd_(PHASE_HEADER, now));
+        break;
+    case HttpConn::READ_HEADER:     // 流水线上的下一个请求写响应期间已经收了一半
+        if(current != PHASE_HEADER) {
+            SetDeadline_(fd, PHASE_HEADER, PhaseEnd_(PHASE_HEADER, now));
+        }
+        break;
+    case HttpConn::READ_BODY: {
+        if(current != PHASE_BODY) {
+            deadline.bodyStart = now;
+        }
+        int64_t at = PhaseEnd_(PHASE_BODY, deadline.bodyStart);
+        if(at != INT64_MAX && timeouts.bodyMinRate > 0) {
+            at += static_cast<int64_t>(client->BodyReceived() * 1000000000.0 / timeouts.bodyMinRate);
+        }
+        SetDeadline_(fd, PHASE_BODY, at);
+        break;
+    }
+    case HttpConn::READ_H2:
+        SetDeadline_(fd, PHASE_IDLE, PhaseEnd_(PHASE_IDLE, now));
+        break;
+    }
+}
+
+// 只写deadlines_，工作线程里也能调：从现在起算的阶段不会早于堆里的结点（见Arm_），不用碰堆
+void WebServer::Enter_(HttpConn* client, PHASE phase) {
+    if(!deadlines_) { return; }
+    Deadline_& deadline = deadlines_[client->GetFd()];
+    deadline.phase.store(phase, std::memory_order_relaxed);
+    deadline.at.store(PhaseEnd_(phase, Metrics::NowNs()), std::memory_order_release);
+}
+
+// 定时器到期（结点已经出堆）：截止时间被推后了就重新挂回去，这是平时唯一一次动堆；差不到1ms的算到期
+void WebServer::OnDeadline_(int fd) {
+    HttpConn* client = &users_[fd];
+    if(client->IsClosed()) {    // 连接已经被别的地方关了，结点是剩下的
+        return;
+    }
+    Deadline_& deadline = deadlines_[fd];
+    int64_t now = Metrics::NowNs();
+    if(deadline.at.load(std::memory_order_acquire) > now + 1000000) {
+        Arm_(fd, now);
+        return;
+    }
+    int phase = deadline.phase.load(std::memory_order_relaxed);
+    timedOut_[phase]++;
+    Metrics::Instance()->Add(Metrics::TIMER_EXPIRED);
+    LOG_DEBUG("Client[%d] timed out in phase %d", fd, phase);
+    if(coLoop_) {
+        coLoop_->Cancel(fd);
+    } else if(client->Held()) {
+        // 工作线程还在用它的State_和Ext_，这里关了会把正在用的状态还回池里；只shutdown，
+        // 它的读写会失败，交还时看到标记自己关（见HandBack_）；已经交还了的，epoll会报HUP，由主线程关
+        client->MarkTimedOut();
+        shutdown(fd, SHUT_RDWR);
+    } else {
+        CloseConn_(client);
+    }
 }
 
 void WebServer::OnRead_(HttpConn* client) {//实际上对于读缓冲区里的操作。应该是先读到自己的buffer中，再解析
     assert(client);
-    int ret = -1;
-    int readErrno = 0;
-    ret = client->read(&readErrno);         // 读取客户端套接字的数据，读到httpconn的读缓存区
-    if(ret <= 0 && readErrno != EAGAIN) {   // 读异常就关闭客户端
+    if(!Read_(client)) {   // 读异常就关闭客户端
         CloseConn_(client);
         return;
     }
+    if(Shed_(client)) { return; }
     // 业务逻辑的处理（先读后处理）
     OnProcess(client);
 }
 
+// 读一次套接字，顺带记看门狗和跟踪；返回false表示连接要关掉
+bool WebServer::Read_(HttpConn* client) {
+    int ret = -1;
+    int readErrno = 0;
+    Watchdog::SetConn(client->GetFd());
+    Watchdog::SetPhase("read");
+    uint64_t traceId = client->TraceId();
+    int64_t start = traceId ? Metrics::NowNs() : 0;
+    size_t pending = client->PendingBytes();
+    ret = client->read(&readErrno);         // 读取客户端套接字的数据，读到httpconn的读缓存区
+    if(traceId) {
+        Tracer::Instance()->Record(traceId, Tracer::QUEUE_READ, client->QueuedAt(), start, client->GetFd());
+        Tracer::Instance()->Record(traceId, Tracer::READ, start, Metrics::NowNs(), client->GetFd(),
+                                   client->PendingBytes() - pending);
+    }
+    return ret > 0 || readErrno == EAGAIN;
+}
+
 /* 处理读（请求）数据的函数 */
 void WebServer::OnProcess(HttpConn* client) {
     // 首先调用process()进行逻辑处理，解析，生成响应都在这个函数里面执行
     if(client->process()) { // 根据返回的信息重新将fd置为EPOLLOUT（写）或EPOLLIN（读）
     //读完事件就跟内核说可以写了
     //读完如果有东西被放到缓冲区了，那么说明什么呢？说明有东西要还给客户，所以要把监测的事件改为写
-        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);    // 响应成功，修改监听事件为写,等待OnWrite_()发送
+        Enter_(client, PHASE_WRITE);
+        HandBack_(client, EPOLLOUT);    // 响应成功，修改监听事件为写,等待OnWrite_()发送
+    } else if(client->NeedsVerify()) {
+        // 登录/注册要查库，交给数据库线程池；EPOLLONESHOT还没重新打开，这期间不会有这个连接的事件
+        if(!AcquireDb_()) {
+            if(client->RefuseVerify()) {    // HTTP/2只给这几个流回503，连接上别的流照常
+                Metrics::Instance()->Add(Metrics::REQ_SHED);
+                Enter_(client, PHASE_WRITE);
+                HandBack_(client, EPOLLOUT);
+            } else {
+                Reject_(client);
+            }
+            return;
+        }
+        Enter_(client, PHASE_PROCESS);  // 排队、查库的时间不算在请求头阶段里，查库另有自己的时限
+        client->Hold();     // 转给数据库线程池，当前任务的Unhold在它之后，计数不会中途归零
+        dbpool_->AddTask([this, client] { OnVerify_(client); client->Unhold(); });
     } else {
     //写完事件就跟内核说可以读了
-        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
+        client->Compact();      // 读到的只是半个请求时什么也不做
+        HandBack_(client, client->HandshakeWantsWrite() ? EPOLLOUT : EPOLLIN);
     }
 }
 
+void WebServer::OnVerify_(HttpConn* client) {
+    assert(client);
+    Watchdog::SetConn(client->GetFd());
+    client->Verify();
+    ReleaseDb_();
+    Enter_(client, PHASE_WRITE);
+    HandBack_(client, EPOLLOUT);
+}
+
 void WebServer::OnWrite_(HttpConn* client) {//将我们自己缓冲区的东西读给fd。这是再下一次循环的时候检测到写缓存区可以写才调用的
     assert(client);
-    int ret = -1;
     int writeErrno = 0;
-    ret = client->write(&writeErrno);//写的时候主要是一个响应头部和一个响应数据，是两个指针方便操作
+    int ret = Write_(client, &writeErrno);
     if(client->ToWriteBytes() == 0) {
         /* 传输完成 */
-        if(client->IsKeepAlive()) {
-            // OnProcess(client);
-            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN); // 回归换成监测读事件
+        client->RequestEnd();
+        if(client->IsKeepAlive() && !draining_) {   // 退出时写完这个响应就关
+            if(client->PendingBytes() > 0) {
+                // 流水线：后面的请求已经在读缓冲区里了，不会再有读事件，直接接着处理
+                OnProcess(client);
+                return;
+            }
+            client->Compact();      // 重新打开读事件之前还掉状态，之后连接可能就归别的线程了
+            Enter_(client, PHASE_IDLE);
+            HandBack_(client, EPOLLIN);     // 回归换成监测读事件
             return;
         }
     }
-    else if(ret < 0) {
-        if(writeErrno == EAGAIN) {  // 缓冲区满了 
-            /* 继续传输 */
-            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
-            return;
+    else if(ret > 0 || writeErrno == EAGAIN) {  // 缓冲区满了，或者水平触发下写了一批（HTTP/2一批接一批地生成帧）
+        /* 继续传输 */
+        HandBack_(client, EPOLLOUT);
+        return;
+    }
+    CloseConn_(client);
+}
+
+// 写一次响应，顺带记看门狗和跟踪
+int WebServer::Write_(HttpConn* client, int* writeErrno) {
+    Watchdog::SetConn(client->GetFd());
+    Watchdog::SetPhase("write");
+    Watchdog::SetPath(client->Path());
+    uint64_t traceId = client->TraceId();
+    int64_t start = traceId ? Metrics::NowNs() : 0;
+    int toWrite = client->ToWriteBytes();
+    int ret = client->write(writeErrno);//写的时候主要是一个响应头部和一个响应数据，是两个指针方便操作
+    if(traceId) {
+        Tracer::Instance()->Record(traceId, Tracer::QUEUE_WRITE, client->QueuedAt(), start, client->GetFd());
+        Tracer::Instance()->Record(traceId, Tracer::WRITE, start, Metrics::NowNs(), client->GetFd(),
+                                   toWrite - client->ToWriteBytes());
+    }
+    return ret;
+}
+
+/*
+协程模式下一个连接的全部流程：读 → 解析 → （换到数据库线程池查库）→ 写 → 回到读
+等待fd时挂起，不占线程；超时或对端关闭时Wait返回false，协程自己关连接退出
+*/
+CoTask WebServer::ServeConn_(HttpConn* client) {
+    int fd = client->GetFd();
+    bool alive = true;
+    // co_await不要写进&&/||里：GCC不会按短路求值跳过它
+    while(alive) {
+        uint32_t wait = client->HandshakeWantsWrite() ? EPOLLOUT : EPOLLIN;
+        if(!co_await coLoop_->Wait(fd, connEvent_ | wait)) { break; }
+        if(!Read_(client)) { break; }
+        if(Shed_(client)) { co_return; }
+        while(alive) {      // 读缓冲区里可能有好几个请求（流水线）
+            if(!client->process()) {
+                if(!client->NeedsVerify()) { break; }   // 请求还没收完，接着读
+                if(AcquireDb_()) {
+                    Enter_(client, PHASE_PROCESS);
+                    co_await CoSwitch(dbpool_.get());
+                    Watchdog::SetConn(fd);
+                    client->Verify();
+                    ReleaseDb_();
+                    Enter_(client, PHASE_WRITE);
+                    co_await CoSwitch(threadpool_.get(), TASK_WRITE);
+                } else if(client->RefuseVerify()) {
+                    Metrics::Instance()->Add(Metrics::REQ_SHED);
+                } else {
+                    Reject_(client);
+                    co_return;
+                }
+            }
+            while(alive) {
+                int writeErrno = 0;
+                int ret = Write_(client, &writeErrno);
+                if(client->ToWriteBytes() == 0) { break; }
+                if(ret < 0) {
+                    // 缓冲区满了就等可写，其他错误关连接
+                    alive = writeErrno == EAGAIN;
+                    if(alive) { alive = co_await coLoop_->Wait(fd, connEvent_ | EPOLLOUT); }
+                }
+            }
+            if(!alive) { break; }
+            client->RequestEnd();
+            alive = client->IsKeepAlive() && !draining_;
+            if(client->PendingBytes() == 0) { break; }
+        }
+        if(client->Compact()) {     // 等下一个请求期间不占缓冲区；请求只收到一半时还不算空闲，截止时间不变
+            Enter_(client, PHASE_IDLE);
         }
     }
     CloseConn_(client);
 }
 
+// 协程模式下主线程只负责续期定时器，然后恢复等在这个fd上的协程
+void WebServer::DealCoEvent_(HttpConn* client, uint32_t events) {
+    int fd = client->GetFd();
+    if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        coLoop_->Cancel(fd);
+        return;
+    }
+    bool reading = (events & EPOLLIN) || client->HandshakeWantsWrite();
+    ExtentTime_(client, !reading);
+    if(reading) {
+        client->RequestBegin();
+    }
+    if(client->TraceId()) { client->SetQueuedAt(Metrics::NowNs()); }
+    coLoop_->Dispatch(fd, reading ? TASK_READ : TASK_WRITE);
+}
+
+// 信号要在所有线程里都屏蔽掉才只会从signalfd读到，所以在建线程池之前调用
+int WebServer::InitSignalFd_() {
+    if(!lifecycle.handleSignals) {
+        return -1;
+    }
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+    return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+void WebServer::DealSignal_() {
+    struct signalfd_siginfo info;
+    while(read(signalFd_, &info, sizeof(info)) == sizeof(info)) {
+        LOG_INFO("Signal %d from pid %d", (int)info.ssi_signo, (int)info.ssi_pid);
+        if(info.ssi_signo == SIGUSR2) {
+            HandOff();
+        } else {
+            Shutdown();
+        }
+    }
+}
+
+void WebServer::Shutdown() {
+    if(draining_) { return; }
+    draining_ = true;
+    drainDeadline_ = Metrics::NowNs() + lifecycle.drainTimeoutMs * 1000000LL;
+    for(int* fd : { &listenFd_, &unixFd_ }) {
+        if(*fd < 0) { continue; }
+        if(!acceptPaused_) { epoller_->DelFd(*fd); }
+        close(*fd);     // 交接过的话新进程还拿着，积压队列里的连接由它接着accept
+        *fd = -1;
+    }
+    acceptPaused_ = false;
+    if(!unixPath_.empty()) {    // 不再有人accept，先删掉路径，代理连不上会马上换别的上游，不会卡在积压队列里
+        unlink(unixPath_.c_str());
+        unixPath_.clear();
+    }
+    CloseIdle_();
+    LOG_INFO("Shutting down, draining %d connections", (int)HttpConn::userCount);
+}
+
+// 状态已经还回池里的连接没有处理到一半的请求，直接关；正在处理的等写完响应再关（见OnWrite_/ServeConn_）
+void WebServer::CloseIdle_() {
+    for(auto& user : users_) {
+        HttpConn& conn = user.second;
+        if(conn.IsClosed() || !conn.IsCompact()) { continue; }
+        if(coLoop_) {
+            coLoop_->Cancel(user.first);
+        } else {
+            // 连接可能正在某个工作线程手里，不能在这里Close；shutdown之后它的读写会失败，或者收到RDHUP再关
+            shutdown(user.first, SHUT_RDWR);
+        }
+    }
+}
+
+// 连上新进程在handoffPath上等着的UNIX套接字，用SCM_RIGHTS把监听套接字（TCP的和UNIX的，有几个发几个）一次发过去
+static bool SendListenFds(const std::string& path, const int* fds, int count) {
+    struct sockaddr_un addr = { 0 };
+    addr.sun_family = AF_UNIX;
+    if(path.empty() || path.size() >= sizeof(addr.sun_path) || count < 1 || count > 2) { return false; }
+    memcpy(addr.sun_path, path.data(), path.size());
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(sock < 0) { return false; }
+    if(connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return false;
+    }
+    char byte = 'L';
+    struct iovec iov = { &byte, 1 };
+    char control[CMSG_SPACE(sizeof(int) * 2)] = { 0 };
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+    ssize_t len = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    close(sock);
+    return len == 1;
+}
+
+// 新进程这边：在path上监听，等老进程连上来把监听套接字发过来；按地址族分到tcpFd和unixFd里，没收到的是-1
+static void RecvListenFds(const std::string& path, int timeoutMs, int* tcpFd, int* unixFd) {
+    *tcpFd = *unixFd = -1;
+    struct sockaddr_un addr = { 0 };
+    addr.sun_family = AF_UNIX;
+    if(path.empty() || path.size() >= sizeof(addr.sun_path)) { return; }
+    memcpy(addr.sun_path, path.data(), path.size());
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(sock < 0) { return; }
+    unlink(path.c_str());
+    int fds[2] = { -1, -1 };
+    int count = 0;
+    if(bind(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(sock, 1) == 0) {
+        struct pollfd pfd = { sock, POLLIN, 0 };
+        int conn = poll(&pfd, 1, timeoutMs) == 1 ? accept4(sock, nullptr, nullptr, SOCK_CLOEXEC) : -1;
+        if(conn >= 0) {
+            struct timeval tv = { timeoutMs / 1000, (timeoutMs % 1000) * 1000 };
+            setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            char byte;
+            struct iovec iov = { &byte, 1 };
+            char control[CMSG_SPACE(sizeof(int) * 2)] = { 0 };
+            struct msghdr msg = { 0 };
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if(recvmsg(conn, &msg, MSG_CMSG_CLOEXEC) == 1) {
+                struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+                if(cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                    count = std::min<int>(2, (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+                    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * count);
+                }
+            }
+            close(conn);
+        }
+    }
+    close(sock);
+    unlink(path.c_str());
+    for(int i = 0; i < count; i++) {
+        // 确认拿到的是正在监听的套接字
+        int listening = 0;
+        socklen_t len = sizeof(listening);
+        struct sockaddr_storage local;
+        socklen_t localLen = sizeof(local);
+        int* slot = nullptr;
+        if(getsockopt(fds[i], SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) == 0 && listening &&
+           getsockname(fds[i], (struct sockaddr*)&local, &localLen) == 0) {
+            slot = local.ss_family == AF_UNIX ? unixFd : tcpFd;
+        }
+        if(slot && *slot < 0) {
+            *slot = fds[i];
+        } else {
+            close(fds[i]);
+        }
+    }
+}
+
+bool WebServer::HandOff() {
+    int fds[2];
+    int count = 0;
+    for(int fd : { listenFd_, unixFd_ }) {
+        if(fd >= 0) { fds[count++] = fd; }
+    }
+    if(lifecycle.handoffPath.empty() || count == 0) {
+        LOG_WARN("Hot restart requested but no handoff path configured");
+        return false;
+    }
+    if(!SendListenFds(lifecycle.handoffPath, fds, count)) {
+        LOG_ERROR("Hand off listen socket to %s error: %s", lifecycle.handoffPath.c_str(), strerror(errno));
+        return false;
+    }
+    LOG_INFO("Listen socket handed off to %s", lifecycle.handoffPath.c_str());
+    unixPath_.clear();      // 套接字文件现在归新进程了
+    Shutdown();
+    return true;
+}
+
 /* Create listenFd */
 bool WebServer::InitSocket_() {
+    if(lifecycle.takeover) {    // 热重启：监听套接字由老进程交过来，已经bind和listen过了
+        RecvListenFds(lifecycle.handoffPath, lifecycle.takeoverTimeoutMs, &listenFd_, &unixFd_);
+        if(unixListen.tcp && listenFd_ < 0) {
+            LOG_ERROR("Take over listen socket from %s error!", lifecycle.handoffPath.c_str());
+            return false;
+        }
+        if(!unixListen.tcp && listenFd_ >= 0) {
+            close(listenFd_);
+            listenFd_ = -1;
+        }
+        if(unixFd_ >= 0) {
+            if(unixListen.path.empty()) {
+                close(unixFd_);
+                unixFd_ = -1;
+            } else {
+                unixPath_ = unixListen.path;
+            }
+        }
+        // 老进程没开UNIX套接字时自己建
+        return (listenFd_ < 0 || ListenOn_(listenFd_)) &&
+               (unixListen.path.empty() || (unixFd_ >= 0 ? ListenOn_(unixFd_) : InitUnixSocket_()));
+    }
+    if(!unixListen.path.empty() && !InitUnixSocket_()) {
+        return false;
+    }
+    if(!unixListen.tcp) {
+        return unixFd_ >= 0;
+    }
     int ret;
     struct sockaddr_in addr;
     if(port_ > 65535 || port_ < 1024) {
@@ -247,14 +976,14 @@ bool WebServer::InitSocket_() {
 
     listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
     if(listenFd_ < 0) {
-        LOG_ERROR("Create socket error!", port_);
+        LOG_ERROR("Create socket error on port %d: %s", port_, strerror(errno));
         return false;
     }
 
     ret = setsockopt(listenFd_, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
     if(ret < 0) {
         close(listenFd_);
-        LOG_ERROR("Init linger error!", port_);
+        LOG_ERROR("Init linger error on port %d!", port_);
         return false;
     }
     }
@@ -278,25 +1007,99 @@ bool WebServer::InitSocket_() {
     }
 
     // 监听
-    ret = listen(listenFd_, 6);
+    ret = listen(listenFd_, SOMAXCONN);    // 积压队列太小时短连接压测下SYN会被丢弃，客户端要等1秒重传
     if(ret < 0) {
         LOG_ERROR("Listen port:%d error!", port_);
         close(listenFd_);
         return false;
     }
-    ret = epoller_->AddFd(listenFd_,  listenEvent_ | EPOLLIN);  // 将监听套接字加入epoller
+    return ListenOn_(listenFd_);
+}
+
+// 残留的套接字文件（上次没正常退出）先删掉再bind；路径上是别的文件时不删，直接失败
+bool WebServer::InitUnixSocket_() {
+    struct sockaddr_un addr = { 0 };
+    addr.sun_family = AF_UNIX;
+    const std::string& path = unixListen.path;
+    if(path.size() >= sizeof(addr.sun_path)) {
+        LOG_ERROR("Unix socket path too long: %s", path.c_str());
+        return false;
+    }
+    memcpy(addr.sun_path, path.data(), path.size());
+    struct stat st;
+    if(lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path.c_str());
+    }
+    unixFd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(unixFd_ < 0) {
+        LOG_ERROR("Create unix socket error: %s", strerror(errno));
+        return false;
+    }
+    if(bind(unixFd_, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        LOG_ERROR("Bind unix socket %s error: %s", path.c_str(), strerror(errno));
+        close(unixFd_);
+        unixFd_ = -1;
+        return false;
+    }
+    unixPath_ = path;
+    chmod(path.c_str(), unixListen.mode);   // 按配置设权限，不受umask影响
+    if(listen(unixFd_, SOMAXCONN) < 0) {
+        LOG_ERROR("Listen unix socket %s error: %s", path.c_str(), strerror(errno));
+        close(unixFd_);
+        unixFd_ = -1;
+        return false;
+    }
+    return ListenOn_(unixFd_);
+}
+
+// 热重启接过来的监听套接字也按这边的配置重新设一遍；设不上只记一笔，不影响启动
+void WebServer::TuneListen_(int fd, bool tcp) {
+    const SocketOptions& opt = socketOptions;
+    int one = 1;
+    if(opt.sndBuf > 0 && setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &opt.sndBuf, sizeof(opt.sndBuf)) < 0) {
+        LOG_WARN("SO_SNDBUF %d: %s", opt.sndBuf, strerror(errno));
+    }
+    if(opt.rcvBuf > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &opt.rcvBuf, sizeof(opt.rcvBuf)) < 0) {
+        LOG_WARN("SO_RCVBUF %d: %s", opt.rcvBuf, strerror(errno));
+    }
+    if(!tcp) {
+        return;
+    }
+    if(opt.noDelay && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0) {
+        LOG_WARN("TCP_NODELAY: %s", strerror(errno));
+    }
+    if(opt.deferAcceptS > 0 && setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &opt.deferAcceptS, sizeof(opt.deferAcceptS)) < 0) {
+        LOG_WARN("TCP_DEFER_ACCEPT %d: %s", opt.deferAcceptS, strerror(errno));
+    }
+    if(opt.fastOpenQueue > 0) {
+        if(setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &opt.fastOpenQueue, sizeof(opt.fastOpenQueue)) < 0) {
+            LOG_WARN("TCP_FASTOPEN %d: %s", opt.fastOpenQueue, strerror(errno));
+        }
+        FILE* fp = fopen("/proc/sys/net/ipv4/tcp_fastopen", "r");
+        int sysctl = 0;
+        if(fp && fscanf(fp, "%d", &sysctl) == 1 && !(sysctl & 2)) {
+            LOG_WARN("net.ipv4.tcp_fastopen is %d, server side TFO stays off", sysctl);
+        }
+        if(fp) { fclose(fp); }
+    }
+}
+
+bool WebServer::ListenOn_(int fd) {
+    TuneListen_(fd, fd == listenFd_);
+    int ret = epoller_->AddFd(fd, ListenEvents_());  // 将监听套接字加入epoller
     if(ret == 0) {
         LOG_ERROR("Add listen error!");
-        close(listenFd_);
+        close(fd);
+        if(fd == listenFd_) { listenFd_ = -1; } else { unixFd_ = -1; }
         return false;
     }
-    SetFdNonblock(listenFd_);   
-    LOG_INFO("Server port:%d", port_);
+    SetFdNonblock(fd);
+    if(fd == listenFd_) { LOG_INFO("Server port:%d", port_); }
     return true;
 }
 
 // 设置非阻塞
 int WebServer::SetFdNonblock(int fd) {
     assert(fd > 0);
-    return fcntl(fd, F_SETFL, fcntl(fd, F_GETFD, 0) | O_NONBLOCK);
+    return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
 }
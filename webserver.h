@@ -6,8 +6,14 @@
 #include <unistd.h>      // close()
 #include <assert.h>
 #include <errno.h>
+#include <signal.h>
 #include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <string.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>    // TCP_NODELAY、TCP_CORK……
 #include <arpa/inet.h>
 #include "epoller.h"
 #include "heaptimer.h"
@@ -15,6 +21,8 @@
 #include "sqlconnpool.h"
 #include "threadpool.h"
 #include "httpconn.h"
+#include "coloop.h"
+#include "codel.h"
 
 class WebServer {
 public:
@@ -27,24 +35,145 @@ public:
     ~WebServer();
     void Start();
 
+    enum TASK_CLASS {   // 线程池里的任务类别，对应poolOptions.classes的下标
+        TASK_READ,
+        TASK_WRITE,
+        TASK_CLASS_COUNT,
+    };
+
+    // 线程池的伸缩、绑核、任务类别参数，classes为空时用默认权重；线程数下限取构造时的threadNum，maxThreads不大于threadNum时线程数固定
+    static ThreadPool::Options poolOptions;
+    static bool useCoroutines;      // 每个连接一个协程（见ServeConn_），代替OnRead_/OnWrite_的回调链
+
+    // 过载保护，超过上限的连接和请求直接回预先生成好的503
+    struct OverloadOptions {
+        int maxConns = MAX_FD;          // 并发连接数上限，到了就暂停accept
+        int maxQueued = 0;              // 线程池排队的任务数上限，超过时新读到的请求回503，0表示不限
+        int maxDbInFlight = 0;          // 排队和正在查库的登录/注册请求数上限，0表示不限
+        int codelTargetUs = 0;          // 排队延迟的目标值，持续超过就按CoDel丢请求，0表示关闭
+        int codelIntervalMs = 100;
+        int retryAfterS = 1;            // 503里的Retry-After
+        bool exclusiveAccept = false;   // 监听套接字加EPOLLEXCLUSIVE，多个进程共用一个监听套接字时只唤醒一个
+    };
+    static OverloadOptions overload;
+
+    // 退出和热重启：SIGTERM/SIGINT停止accept，等在途请求做完后Start()返回；
+    // SIGUSR2把监听套接字通过handoffPath交给新进程（新进程takeover=true启动，在这个路径上等着），然后自己按SIGTERM退出
+    struct LifecycleOptions {
+        bool handleSignals = true;      // 用signalfd接管上面几个信号，嵌在别的程序里时可以关掉
+        int drainTimeoutMs = 30000;     // 等在途请求的最长时间，到了强制关掉剩下的连接
+        std::string handoffPath;        // 交接监听套接字用的UNIX套接字路径，空表示不支持热重启
+        bool takeover = false;          // 不自己bind，从handoffPath接老进程的监听套接字
+        int takeoverTimeoutMs = 30000;  // 新进程等老进程交接的最长时间
+    };
+    static LifecycleOptions lifecycle;
+
+    static AccessLog::Options accessLog;    // path不为空时记访问日志
+
+    // 同机的反向代理可以走UNIX套接字，不过回环TCP的协议栈，也不占临时端口；path为空时不开
+    struct UnixListenOptions {
+        std::string path;       // 启动时路径上残留的套接字文件先删掉，退出时删掉自己建的
+        int mode = 0660;        // 套接字文件的权限，决定哪些用户的进程能连进来；代理换了用户时把它加进同一个组
+        bool tcp = true;        // false时只听UNIX套接字，不再监听TCP端口
+        // 连进来的进程当作本机，能看/metrics、/trace；前面是反向代理时不要开，代理转进来的是外面的请求
+        bool trustPeers = false;
+    };
+    static UnixListenOptions unixListen;
+
+    // 套接字参数，除了accept4都默认不动内核的设置；缓冲区大小和TCP_NODELAY设在监听套接字上，
+    // Linux上accept出来的连接会继承，不用每个连接再调一次setsockopt
+    struct SocketOptions {
+        bool accept4 = true;        // accept4直接拿到非阻塞、CLOEXEC的fd，省掉每个连接两次fcntl
+        bool noDelay = false;       // TCP_NODELAY，关掉Nagle
+        bool cork = false;          // 写响应时加TCP_CORK，写完再拔掉，让响应头、文件内容、TLS的多条记录凑成整段发
+        int deferAcceptS = 0;       // TCP_DEFER_ACCEPT：第一段请求数据到了才唤醒accept，最多等这么多秒，0表示不开
+        int fastOpenQueue = 0;      // TCP_FASTOPEN的队列长度，0表示不开；还要net.ipv4.tcp_fastopen带上2
+        int sndBuf = 0;             // SO_SNDBUF/SO_RCVBUF，0表示交给内核自动调节，设了之后就不再自动调节
+        int rcvBuf = 0;
+    };
+    static SocketOptions socketOptions;
+
+    // 分阶段的超时，毫秒，0表示用构造时的timeoutMS；timeoutMS也为0时这个阶段不限时
+    struct TimeoutOptions {
+        int firstByteMs = 0;        // 连上之后到第一个字节（TLS握手也算）
+        int headerMs = 0;           // 从第一个字节到请求头收完；中途收到数据不续期，一次发一个字节也拖不过去
+        int bodyMs = 0;             // 请求头收完之后读请求体的时间
+        int bodyMinRate = 0;        // 请求体每收到这么多字节多给一秒，0表示不按速率续
+        int writeMs = 0;            // 写响应时，每次客户端读走一些、套接字重新可写之后最多再等这么久
+        int keepAliveMs = 0;        // 响应写完之后等下一个请求；HTTP/2连接每个事件都按这个续
+        int processMs = 0;          // 登录/注册交给数据库线程池之后等查库的时间，这期间请求头、请求体的截止时间不算
+    };
+    static TimeoutOptions timeouts;
+
+#ifdef TINYWEB_TLS
+    static TlsContext::Options tls;     // certFile不为空时监听端口只接受TLS连接
+#endif
+
+    void Shutdown();        // 和收到SIGTERM一样，只能在Start()所在的线程里调用
+    bool HandOff();         // 和收到SIGUSR2一样，交接成功后开始退出
+
 private:
     bool InitSocket_(); //初始化套接字 
+    bool InitUnixSocket_();
+    bool ListenOn_(int fd);     // 把监听套接字加进epoller
+    void TuneListen_(int fd, bool tcp);
+    static int InitSignalFd_();
+    void DealSignal_();
+    void CloseIdle_();      // 退出时关掉空闲的长连接
     void InitEventMode_(int trigMode);
-    void AddClient_(int fd, sockaddr_in addr);
+    void AddClient_(int fd, const sockaddr_storage& addr);
   
-    void DealListen_();//主线程来负责监听和转移
+    void DealListen_(int listenFd);//主线程来负责监听和转移
     void DealWrite_(HttpConn* client);//传入参数是什么意思
     void DealRead_(HttpConn* client);
 
-    void SendError_(int fd, const char*info);
-    void ExtentTime_(HttpConn* client);
+    void SendBusy_(int fd);                 // 发送预先生成的503，不关连接
+    bool Shed_(HttpConn* client);           // 过载时丢掉请求，返回true表示已经丢掉
+    void Reject_(HttpConn* client);         // 回503并关掉连接
+    bool AcquireDb_();
+    void ReleaseDb_();
+    bool Saturated_(bool resuming) const;
+    void PauseAccept_(bool pause);
+    uint32_t ListenEvents_() const;
+    // 超时分阶段：每个连接的截止时间记在deadlines_里，读写事件只改它，不动定时器的堆；
+    // 堆里的结点到期时截止时间还没到，再按它重新挂回去（见OnDeadline_）
+    enum PHASE {
+        PHASE_FIRST_BYTE,
+        PHASE_HEADER,
+        PHASE_BODY,
+        PHASE_WRITE,
+        PHASE_IDLE,
+        PHASE_PROCESS,
+        PHASE_COUNT,
+    };
+    struct Deadline_ {
+        std::atomic<int64_t> at{0};     // Metrics::NowNs()的时间，工作线程在响应写完时也会改
+        std::atomic<int> phase{0};
+        int64_t armed = 0;              // 以下两个只有主线程碰：堆里结点的到期时间
+        int64_t bodyStart = 0;
+    };
+    void InitDeadlines_();
+    void StartDeadline_(int fd);                        // 新连接
+    void ExtentTime_(HttpConn* client, bool writing);   // 主线程收到读/写事件时，按请求读到哪一步换阶段
+    void SetDeadline_(int fd, PHASE phase, int64_t at);
+    void Arm_(int fd, int64_t now);
+    void Enter_(HttpConn* client, PHASE phase);         // 工作线程换阶段：查库、写响应、等下一个请求
+    void OnDeadline_(int fd);
+    int64_t PhaseEnd_(PHASE phase, int64_t from) const;
     void CloseConn_(HttpConn* client);
+    void HandBack_(HttpConn* client, uint32_t events);  // 工作线程把连接交还给epoll，期间超时了就关掉
 
     void OnRead_(HttpConn* client);
     void OnWrite_(HttpConn* client);
+    void OnVerify_(HttpConn* client);   // 在数据库线程池里执行
+    bool Read_(HttpConn* client);
+    int Write_(HttpConn* client, int* writeErrno);
+
+    CoTask ServeConn_(HttpConn* client);
+    void DealCoEvent_(HttpConn* client, uint32_t events);
     void OnProcess(HttpConn* client);
 
-    static const int MAX_FD = 65536;
+    static constexpr int MAX_FD = 65536;
 
     static int SetFdNonblock(int fd);
 
@@ -53,14 +182,33 @@ private:
     int timeoutMS_;  /* 毫秒MS */
     bool isClose_;
     int listenFd_;
+    int unixFd_;
+    std::string unixPath_;  // 自己bind出来的套接字文件，退出时删掉；交给新进程之后就不归这里删了
     char* srcDir_;
+    int signalFd_;      // 要在线程池之前建好，线程创建时继承屏蔽这几个信号的掩码
     
     uint32_t listenEvent_;  // 监听事件
     uint32_t connEvent_;    // 连接事件
    
     std::unique_ptr<HeapTimer> timer_;
     std::unique_ptr<ThreadPool> threadpool_;
+    std::unique_ptr<ThreadPool> dbpool_;
     std::unique_ptr<Epoller> epoller_;
+    std::unique_ptr<CoLoop> coLoop_;    // 只在协程模式下有
+    std::unique_ptr<CoDel> codel_;      // codelTargetUs为0时没有
+#ifdef TINYWEB_TLS
+    std::unique_ptr<TlsContext> tls_;   // 没配证书时没有
+#endif
+
+    std::string busyResponse_;
+    std::atomic<int> dbInFlight_;
+    bool acceptPaused_;
+    std::atomic<bool> draining_;    // 正在退出：不再accept，请求做完就关连接
+    int64_t drainDeadline_;
+    std::unique_ptr<Deadline_[]> deadlines_;    // 下标是fd，所有阶段都不限时时为空
+    int64_t phaseNs_[PHASE_COUNT];              // 0表示不限时
+    int64_t armCapNs_;                          // 堆里的结点最多挂这么远，取各阶段里最短的
+    std::atomic<uint64_t> timedOut_[PHASE_COUNT];
     std::unordered_map<int, HttpConn> users_;
 };
 